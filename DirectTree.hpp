@@ -0,0 +1,49 @@
+/*
+*    ZeroTrace: Oblivious Memory Primitives from Intel SGX
+*    Copyright (C) 2018  Sajin (sshsshy)
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU General Public License as published by
+*    the Free Software Foundation, version 3 of the License.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU General Public License for more details.
+*
+*    You should have received a copy of the GNU General Public License
+*    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+DirectTree.hpp
+
+Description of an in-memory tree of the App (INLINE_HASH_LAYOUT, see LocalStorage::setupLayout), handed to the enclave
+once so that DIRECT_TREES can read and write its paths in place instead of through OCALLs.
+Bucket label b (root = 1) at depth d lies in layer l = d / subtree_height, and its record is at
+layer_base[l] + subtree_no * layer_stride[l] + header_size + (local_no-1) * record_stride, as in LocalStorage::recordOffset.
+A heap ordered tree is the single layer case, with layer_base[0] = 0.
+*/
+
+#pragma once
+
+#include <stdint.h>
+
+#define DIRECT_TREE_MAX_LAYERS 32
+
+struct direct_tree {
+	unsigned char *base;
+	uint64_t tree_size;
+	uint32_t depth;
+	//<L hash | bucket | R hash>
+	uint32_t record_size;
+	uint32_t record_stride;
+	uint32_t header_size;
+	uint32_t subtree_height;
+	uint32_t no_of_layers;
+	uint64_t layer_base[DIRECT_TREE_MAX_LAYERS];
+	uint64_t layer_stride[DIRECT_TREE_MAX_LAYERS];
+	//One dirty bit per bucket label for the snapshots (DIRTY_TRACKING), NULL if the storage doesn't keep them
+	uint8_t *dirty_bitmap;
+	uint64_t dirty_bitmap_size;
+};
@@ -0,0 +1,81 @@
+/*
+*    ZeroTrace: Oblivious Memory Primitives from Intel SGX
+*    Copyright (C) 2018  Sajin (sshsshy)
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU General Public License as published by
+*    the Free Software Foundation, version 3 of the License.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU General Public License for more details.
+*
+*    You should have received a copy of the GNU General Public License
+*    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+ExitlessRing.hpp
+
+Layout of the ring the enclave posts its path requests to in EXITLESS_MODE, shared by the enclave and the App.
+The ring and its buffers live in untrusted memory (see ZT_Untrusted/ExitlessIO.hpp).
+
+A slot goes FREE -> CLAIMED (enclave, by compare-and-swap) -> POSTED (enclave, request and upload in place)
+-> TAKEN (a worker, by compare-and-swap) -> DONE (worker, fetched path in place) -> FREE (enclave, once it copied it in).
+Slots are claimed in ticket order, so requests are taken up in about the order they were posted.
+
+A request no worker took up within EXITLESS_WAIT_SPINS is pulled back (POSTED -> CLAIMED -> FREE, enclave) and made
+with an OCALL instead. Once taken, the enclave calls exitlessWake every EXITLESS_WAIT_SPINS, which also gives the CPU
+up to the worker when the App has fewer cores than threads.
+*/
+
+#pragma once
+
+#include <stdint.h>
+
+#define EXITLESS_RING_SLOTS 8
+//Rounds the enclave waits on a slot before it falls back to an OCALL
+#define EXITLESS_WAIT_SPINS 20000
+
+#define EXITLESS_SLOT_FREE 0
+#define EXITLESS_SLOT_CLAIMED 1
+#define EXITLESS_SLOT_POSTED 2
+#define EXITLESS_SLOT_TAKEN 3
+#define EXITLESS_SLOT_DONE 4
+
+//Buffers of a slot
+#define EXITLESS_PATH 0
+#define EXITLESS_PATH_HASH 1
+#define EXITLESS_UP_PATH 2
+#define EXITLESS_UP_PATH_HASH 3
+#define EXITLESS_BUFFERS 4
+
+//A request uploads the up_ path (if up_path_size is not 0), then fetches the path (if path_size is not 0)
+struct exitless_slot {
+	volatile uint32_t state;
+	uint32_t storage_id;
+	uint32_t label;
+	uint32_t level;
+	uint32_t D_level;
+	uint32_t path_size;
+	uint32_t path_hash_size;
+	uint32_t up_label;
+	uint32_t up_level;
+	uint32_t up_D_level;
+	uint32_t up_path_size;
+	uint32_t up_path_hash_size;
+	unsigned char *buffers[EXITLESS_BUFFERS];
+};
+
+struct exitless_ring {
+	//Next ticket, slot tickets % EXITLESS_RING_SLOTS is the next one to claim
+	volatile uint64_t tickets;
+	//Workers spinning on the ring, when none is the enclave wakes them up with the exitlessWake OCALL
+	volatile uint32_t awake;
+	volatile uint32_t stop;
+	//Size of the path buffers and of the hash buffers of a slot
+	uint32_t path_buffer_size;
+	uint32_t hash_buffer_size;
+	struct exitless_slot slots[EXITLESS_RING_SLOTS];
+};
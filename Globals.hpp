@@ -23,5 +23,28 @@
 #define ID_SIZE_IN_BYTES 4
 #define KEY_LENGTH 16
 #define TAG_SIZE 16
+
+//Backend storage types for the untrusted ORAM trees
+#define BACKEND_MEMORY 0
+#define BACKEND_HDD 1
+#define BACKEND_MMAP 2
+//Trees held by a separate storage server process (see ZT_Untrusted/RemoteStorage.hpp)
+#define BACKEND_REMOTE 3
+//Trees packed subtree by subtree into objects of an object store (see ZT_Untrusted/ObjectStorage.hpp)
+#define BACKEND_OBJECT 4
+
+//Placement of the recursion levels of an instance (ZT_New)
+//PLACEMENT_UNIFORM : every level on the backend of the instance
+//PLACEMENT_AUTO : hdd/mmap instances keep their smallest posmap levels in RAM, as far as the memory budget goes (see ZT_Untrusted/TieredStorage.hpp)
+#define PLACEMENT_UNIFORM 0
+#define PLACEMENT_AUTO 1
+
+//Errors returned by ZT_Checkpoint and ZT_Snapshot
+//ZT_ERROR_IO : the enclave state couldn't be sealed, or a file couldn't be written
+//ZT_ERROR_NO_INSTANCE : there is no such instance
+//ZT_ERROR_NOT_PERSISTENT : the instance keeps trees that don't outlive the process (memory/remote/object backends, levels in RAM with PLACEMENT_AUTO)
+#define ZT_ERROR_IO -1
+#define ZT_ERROR_NO_INSTANCE -2
+#define ZT_ERROR_NOT_PERSISTENT -3
 const char SHARED_AES_KEY[KEY_LENGTH] = {"AAAAAAAAAAAAAAA"};
 const char HARDCODED_IV[IV_LENGTH] = {"AAAAAAAAAAA"};
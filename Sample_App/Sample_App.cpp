@@ -23,7 +23,7 @@ uint32_t no_of_accesses;
 uint32_t *element;
 uint32_t min_expected_no_of_parameters = 10;
 bool resume_experiment;
-bool inmem_flag;
+uint8_t backend_type = BACKEND_HDD;
 uint32_t data_size;
 uint32_t max_blocks;
 int requestlength;
@@ -38,6 +38,10 @@ uint32_t request_size, response_size;
 unsigned char *data_in;
 unsigned char *data_out;
 uint32_t bulk_batch_size=0;
+//Bytes of RAM for the top levels of the hdd/mmap trees
+uint64_t cache_budget=0;
+//PLACEMENT_AUTO keeps the small posmap levels of hdd/mmap instances in RAM, out of cache_budget
+uint8_t placement = PLACEMENT_UNIFORM;
 
 clock_t generate_request_start, generate_request_stop, extract_response_start, extract_response_stop, process_request_start, process_request_stop, generate_request_time, extract_response_time,  process_request_time;
 uint8_t Z;
@@ -286,7 +290,7 @@ void getParams(int argc, char* argv[])
 {
 	if(argc<min_expected_no_of_parameters) {
 		printf("Command line parameters error, expected :\n");
-		printf(" <N> <No_of_requests> <Stash_size> <Data_block_size> <\"resume\"/\"new\"> <\"memory\"/\"hdd\"> <0/1 = Non-oblivious/Oblivious> <Recursion_block_size> <\"auto\"/\"path\"/\"circuit\"> <Z>\n\n");
+		printf(" <N> <No_of_requests> <Stash_size> <Data_block_size> <\"resume\"/\"new\"> <\"memory\"/\"hdd\"/\"mmap\"/\"remote\"/\"object\"> <0/1 = Non-oblivious/Oblivious> <Recursion_block_size> <\"auto\"/\"path\"/\"circuit\"> <Z> <Bulk_batch_size> [<Cache_budget_MB>]\n\n");
 	}
 
 	std::string str = argv[1];
@@ -302,7 +306,13 @@ void getParams(int argc, char* argv[])
 		resume_experiment = true;
 	str = argv[6];
 	if(str=="memory")
-		inmem_flag = true;
+		backend_type = BACKEND_MEMORY;
+	if(str=="mmap")
+		backend_type = BACKEND_MMAP;
+	if(str=="remote")
+		backend_type = BACKEND_REMOTE;
+	if(str=="object")
+		backend_type = BACKEND_OBJECT;
 	str = argv[7];
 	if(str=="1")
 		oblivious = 1;
@@ -317,6 +327,15 @@ void getParams(int argc, char* argv[])
 		Z = std::stoi(str);
 	str=argv[11];
 		bulk_batch_size = std::stoi(str);
+	if(argc>12) {
+		str=argv[12];
+		cache_budget = (uint64_t) std::stoi(str) * 1024 * 1024;
+	}
+	if(argc>13) {
+		str=argv[13];
+		if(str=="auto")
+			placement = PLACEMENT_AUTO;
+	}
 
 	std::string qfile_name = "ZT_"+std::to_string(max_blocks)+"_"+std::to_string(data_size);
 	iquery_file = fopen(qfile_name.c_str(),"w");
@@ -333,7 +352,19 @@ int main(int argc, char *argv[]) {
 	getParams(argc, argv);
 
 	ZT_Initialize();
-	uint32_t zt_id = ZT_New(max_blocks, data_size, stash_size, oblivious, recursion_data_size, oram_type, Z);
+	//"resume" takes up the instance checkpointed by the last run (hdd/mmap), and falls back to a new one without a usable checkpoint
+	std::string checkpoint_file = "ZT_"+std::to_string(max_blocks)+"_"+std::to_string(data_size)+".ckpt";
+	uint32_t zt_id = -1;
+	if(resume_experiment) {
+		zt_id = ZT_Resume(checkpoint_file.c_str());
+		//Check the whole of the resumed trees before taking requests on them
+		if(zt_id != (uint32_t) -1 && ZT_Audit(zt_id, oram_type) < 0) {
+			ZT_Close();
+			return -1;
+		}
+	}
+	if(zt_id == (uint32_t) -1)
+		zt_id = ZT_New(max_blocks, data_size, stash_size, oblivious, recursion_data_size, oram_type, Z, backend_type, cache_budget, placement);
 	//Store returned zt_id, to make use of different ORAM instances!
 	printf("Obtained zt_id = %d\n", zt_id);
 
@@ -488,6 +519,14 @@ int main(int argc, char *argv[]) {
 	end = clock();
 	tclock = end - start;
 
+	if((backend_type == BACKEND_HDD || backend_type == BACKEND_MMAP) && placement == PLACEMENT_UNIFORM) {
+		int8_t checkpoint_rt = ZT_Checkpoint(zt_id, oram_type, checkpoint_file.c_str());
+		if(checkpoint_rt == 0)
+			printf("Checkpointed to %s\n", checkpoint_file.c_str());
+		else
+			printf("Checkpoint to %s failed (%d)\n", checkpoint_file.c_str(), checkpoint_rt);
+	}
+
 	//Time in CLOCKS :
 	printf("%ld\n",tclock);
 	if(bulk_batch_size==0)
@@ -18,8 +18,12 @@
 
 int8_t ZT_Initialize();
 void ZT_Close();
-uint32_t ZT_New( uint32_t max_blocks, uint32_t data_size, uint32_t stash_size, uint32_t oblivious_flag, uint32_t recursion_data_size, uint32_t oram_type, uint8_t pZ);
+uint32_t ZT_New( uint32_t max_blocks, uint32_t data_size, uint32_t stash_size, uint32_t oblivious_flag, uint32_t recursion_data_size, uint32_t oram_type, uint8_t pZ, uint8_t backend_type, uint64_t cache_budget, uint8_t placement);
 
 void ZT_Access(uint32_t instance_id, uint8_t oram_type, unsigned char *encrypted_request, unsigned char *encrypted_response, unsigned char *tag_in, unsigned char* tag_out, uint32_t request_size, uint32_t response_size, uint32_t tag_size);
 void ZT_Bulk_Read(uint32_t instance_id, uint8_t oram_type, uint32_t bulk_batch_size, unsigned char *encrypted_request, unsigned char *encrypted_response, unsigned char *tag_in, unsigned char* tag_out, uint32_t request_size, uint32_t response_size, uint32_t tag_size);
+int64_t ZT_Snapshot(const char *snapshot_directory);
+int8_t ZT_Checkpoint(uint32_t instance_id, uint8_t oram_type, const char *checkpoint_file);
+uint32_t ZT_Resume(const char *checkpoint_file);
+int64_t ZT_Audit(uint32_t instance_id, uint8_t oram_type);
 
@@ -0,0 +1,324 @@
+/*
+*    ZeroTrace: Oblivious Memory Primitives from Intel SGX
+*    Copyright (C) 2018  Sajin (sshsshy)
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU General Public License as published by
+*    the Free Software Foundation, version 3 of the License.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU General Public License for more details.
+*
+*    You should have received a copy of the GNU General Public License
+*    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+LocalStorageTest.cpp
+
+Round trips of buckets, paths and hashes through LocalStorage, for every backend,
+with a recursive instance (posmap tree at level 1, data tree at level 2) and a non-recursive one, also read in place
+the way DIRECT_TREES does for the trees held in memory,
+and instances of the disk backend taken up after a crash, whose trees have to be back at their last checkpoint.
+*/
+
+#include "StorageTest.hpp"
+#include "../Globals.hpp"
+#include "LocalStorage.hpp"
+#include "TieredStorage.hpp"
+#include <sys/wait.h>
+
+#define MAX_BLOCKS 2000
+#define DATA_SIZE 152
+#define RECURSION_BLOCK_SIZE 88
+#define STASH_SIZE 50
+#define TEST_Z 4
+#define NO_OF_PATHS 200
+#define CACHE_BUDGET (64*1024)
+
+extern std::string storage_directory;
+extern std::vector<std::string> stripe_directories;
+
+//Depths of the trees LocalStorage sizes for MAX_BLOCKS : the data tree, and the level 1 posmap tree of the recursive instance
+#define DATA_TREE_D 9
+#define POSMAP_TREE_D 5
+
+/*
+checkAuditRange() - Reads the whole tree row by row in chunks, as ZT_Audit does (LocalStorage::auditRange),
+and checks every bucket, its hash and the hashes of its children against the shadow tree.
+*/
+void checkAuditRange(LocalStorage *ls, struct shadow_tree *tree) {
+	uint32_t chunk = 24;
+	std::vector<unsigned char> buckets(chunk * tree->bucket_bytes), hashes(chunk * HASH_LENGTH), child_hashes(2 * chunk * HASH_LENGTH);
+	for(uint32_t depth = 0;depth <= tree->D;depth++) {
+		uint32_t first = (uint32_t)1 << depth;
+		for(uint32_t label = first;label < 2*first;label+= chunk) {
+			uint32_t count = (2*first - label < chunk) ? (2*first - label) : chunk;
+			bool leaves = (depth == tree->D);
+			check(ls->auditRange(tree->level, label, count, buckets.data(), hashes.data(), leaves ? NULL : child_hashes.data(), tree->size_for_level), "audit range refused", tree->level, label);
+			for(uint32_t i = 0;i < count;i++) {
+				uint32_t node = label + i;
+				if(tree->written[node])
+					check(memcmp(&(buckets[(uint64_t)i * tree->bucket_bytes]), &(tree->buckets[(uint64_t)node * tree->bucket_bytes]), tree->bucket_bytes)==0, "audited bucket differs", tree->level, node);
+				checkHash(tree, node, &(hashes[i * HASH_LENGTH]));
+				if(!leaves) {
+					checkHash(tree, 2*node, &(child_hashes[2 * i * HASH_LENGTH]));
+					checkHash(tree, 2*node+1, &(child_hashes[(2 * i + 1) * HASH_LENGTH]));
+				}
+			}
+		}
+	}
+}
+
+//Offset of the record of node (root = 1) in a direct tree, as ORAMTree::directRecordOffset computes it
+uint64_t directOffset(struct direct_tree *direct, uint32_t node) {
+	uint32_t depth = 31 - __builtin_clz(node);
+	uint32_t layer = depth / direct->subtree_height;
+	uint32_t depth_in_subtree = depth - layer * direct->subtree_height;
+	uint32_t subtree_root = node >> depth_in_subtree;
+	uint32_t local_no = node - (subtree_root << depth_in_subtree) + (1 << depth_in_subtree);
+	uint64_t subtree_no = subtree_root - ((uint64_t)1 << (layer * direct->subtree_height));
+	return direct->layer_base[layer] + subtree_no * direct->layer_stride[layer] + direct->header_size + (uint64_t)(local_no-1) * direct->record_stride;
+}
+
+/*
+checkDirectTree() - Reads every written bucket and its hash where the description handed to the enclave for DIRECT_TREES
+places them, and checks them against the shadow tree. Trees the storage doesn't describe are skipped.
+*/
+void checkDirectTree(LocalStorage *ls, struct shadow_tree *tree) {
+	struct direct_tree direct;
+	if(!ls->directTree(tree->level, &direct))
+		return;
+	check(direct.record_size == tree->bucket_bytes + 2*HASH_LENGTH && direct.depth == tree->D, "direct tree mismatched", tree->level, 0);
+	for(uint32_t node = 1;node < ((uint32_t)2 << tree->D);node++) {
+		uint64_t offset = directOffset(&direct, node);
+		check(offset + direct.record_stride <= direct.tree_size, "direct record beyond the tree", tree->level, node);
+		if(tree->written[node])
+			check(memcmp(direct.base + offset + HASH_LENGTH, &(tree->buckets[(uint64_t)node * tree->bucket_bytes]), tree->bucket_bytes)==0, "direct bucket differs", tree->level, node);
+		//The hash of a bucket is in the L/R slot of its parent's record, the root hash in front of the tree
+		if(node == 1)
+			checkHash(tree, node, direct.base);
+		else
+			checkHash(tree, node, direct.base + directOffset(&direct, node>>1) + ((node%2==0) ? 0 : (direct.record_size - HASH_LENGTH)));
+	}
+}
+
+void testRecursive(uint32_t storage_id, uint8_t backend, uint64_t cache_budget) {
+	LocalStorage ls(storage_id);
+	ls.setParams(MAX_BLOCKS, DATA_TREE_D, TEST_Z, STASH_SIZE, DATA_SIZE, backend, RECURSION_BLOCK_SIZE, 2, cache_budget);
+	struct shadow_tree posmap_tree, data_tree;
+	shadowInit(&posmap_tree, 1, POSMAP_TREE_D, TEST_Z, RECURSION_BLOCK_SIZE);
+	shadowInit(&data_tree, 2, DATA_TREE_D, TEST_Z, DATA_SIZE);
+	exerciseTree(&ls, &posmap_tree, NO_OF_PATHS);
+	exerciseTree(&ls, &data_tree, NO_OF_PATHS);
+	ls.syncStorage();
+	//Past a recovery point, the writes of the disk backend go through its undo log (WAL_MODE) and are held till groups commit
+	for(uint32_t i = 0;i < NO_OF_PATHS;i++) {
+		writePath(&ls, &posmap_tree, randomLeaf(&posmap_tree));
+		writePath(&ls, &data_tree, randomLeaf(&data_tree));
+		ls.endAccess();
+	}
+	for(uint32_t i = 0;i < NO_OF_PATHS;i++) {
+		checkPath(&ls, &posmap_tree, randomLeaf(&posmap_tree));
+		checkPath(&ls, &data_tree, randomLeaf(&data_tree));
+	}
+	ls.syncStorage();
+	checkAuditRange(&ls, &posmap_tree);
+	checkAuditRange(&ls, &data_tree);
+	checkDirectTree(&ls, &posmap_tree);
+	checkDirectTree(&ls, &data_tree);
+	ls.closeStorage();
+}
+
+void testNonRecursive(uint32_t storage_id, uint8_t backend) {
+	LocalStorage ls(storage_id);
+	ls.setParams(MAX_BLOCKS, DATA_TREE_D, TEST_Z, STASH_SIZE, DATA_SIZE, backend, RECURSION_BLOCK_SIZE, -1, 0);
+	struct shadow_tree data_tree;
+	shadowInit(&data_tree, -1, DATA_TREE_D, TEST_Z, DATA_SIZE);
+	exerciseTree(&ls, &data_tree, NO_OF_PATHS);
+	ls.syncStorage();
+	checkAuditRange(&ls, &data_tree);
+	checkDirectTree(&ls, &data_tree);
+	ls.closeStorage();
+}
+
+//PLACEMENT_AUTO : a budget that fits the posmap tree, which goes to RAM while the data tree stays on backend
+void testTiered(uint32_t storage_id, uint8_t backend) {
+	TieredStorage ts(storage_id);
+	ts.setParams(MAX_BLOCKS, DATA_TREE_D, TEST_Z, STASH_SIZE, DATA_SIZE, backend, RECURSION_BLOCK_SIZE, 2, CACHE_BUDGET);
+	struct shadow_tree posmap_tree, data_tree;
+	shadowInit(&posmap_tree, 1, POSMAP_TREE_D, TEST_Z, RECURSION_BLOCK_SIZE);
+	shadowInit(&data_tree, 2, DATA_TREE_D, TEST_Z, DATA_SIZE);
+	exerciseTree(&ts, &posmap_tree, NO_OF_PATHS);
+	exerciseTree(&ts, &data_tree, NO_OF_PATHS);
+	ts.syncStorage();
+	for(uint32_t i = 0;i < NO_OF_PATHS;i++) {
+		writePath(&ts, &posmap_tree, randomLeaf(&posmap_tree));
+		writePath(&ts, &data_tree, randomLeaf(&data_tree));
+		ts.endAccess();
+	}
+	for(uint32_t i = 0;i < NO_OF_PATHS;i++) {
+		checkPath(&ts, &posmap_tree, randomLeaf(&posmap_tree));
+		checkPath(&ts, &data_tree, randomLeaf(&data_tree));
+	}
+	ts.closeStorage();
+}
+
+//Two live instances of the same shape must not share any tree file or state
+void testTwoInstances(uint8_t backend) {
+	LocalStorage ls_a(10), ls_b(11);
+	ls_a.setParams(MAX_BLOCKS, DATA_TREE_D, TEST_Z, STASH_SIZE, DATA_SIZE, backend, RECURSION_BLOCK_SIZE, -1, 0);
+	ls_b.setParams(MAX_BLOCKS, DATA_TREE_D, TEST_Z, STASH_SIZE, DATA_SIZE, backend, RECURSION_BLOCK_SIZE, -1, 0);
+	struct shadow_tree tree_a, tree_b;
+	shadowInit(&tree_a, -1, DATA_TREE_D, TEST_Z, DATA_SIZE);
+	shadowInit(&tree_b, -1, DATA_TREE_D, TEST_Z, DATA_SIZE);
+	for(uint32_t i = 0;i < NO_OF_PATHS;i++) {
+		writePath(&ls_a, &tree_a, randomLeaf(&tree_a));
+		writePath(&ls_b, &tree_b, randomLeaf(&tree_b));
+	}
+	for(uint32_t i = 0;i < NO_OF_PATHS;i++) {
+		checkPath(&ls_a, &tree_a, randomLeaf(&tree_a));
+		checkPath(&ls_b, &tree_b, randomLeaf(&tree_b));
+	}
+	ls_a.closeStorage();
+	ls_b.closeStorage();
+}
+
+/*
+testSnapshots() - Two incremental snapshots of an instance, applied in order to a fresh instance of the same shape,
+have to reproduce its trees, and a snapshot applied out of order has to be refused.
+*/
+void testSnapshots(uint8_t backend, int8_t recursion_levels) {
+	std::string snapshot_directory = storage_directory + "snapshots_" + std::to_string(backend) + "_" + std::to_string(recursion_levels) + "/";
+	LocalStorage ls(20), copy(21), stale(22);
+	ls.setParams(MAX_BLOCKS, DATA_TREE_D, TEST_Z, STASH_SIZE, DATA_SIZE, backend, RECURSION_BLOCK_SIZE, recursion_levels, 0);
+	copy.setParams(MAX_BLOCKS, DATA_TREE_D, TEST_Z, STASH_SIZE, DATA_SIZE, backend, RECURSION_BLOCK_SIZE, recursion_levels, 0);
+	stale.setParams(MAX_BLOCKS, DATA_TREE_D, TEST_Z, STASH_SIZE, DATA_SIZE, backend, RECURSION_BLOCK_SIZE, recursion_levels, 0);
+	int32_t level = (recursion_levels==-1) ? -1 : recursion_levels;
+	struct shadow_tree data_tree;
+	shadowInit(&data_tree, level, DATA_TREE_D, TEST_Z, DATA_SIZE);
+
+	for(uint32_t i = 0;i < NO_OF_PATHS;i++)
+		writePath(&ls, &data_tree, randomLeaf(&data_tree));
+	check(ls.writeSnapshot(snapshot_directory) > 0, "first snapshot failed", level, 0);
+	for(uint32_t i = 0;i < 8;i++)
+		writeObject(&ls, &data_tree, 1 + rand() % (((uint32_t)2 << DATA_TREE_D) - 1));
+	for(uint32_t i = 0;i < NO_OF_PATHS/4;i++)
+		writePath(&ls, &data_tree, randomLeaf(&data_tree));
+	int64_t second = ls.writeSnapshot(snapshot_directory);
+	//Only the buckets written since the first snapshot
+	check(second > 0 && second < ((int64_t)2 << DATA_TREE_D) - 1, "second snapshot is not incremental", level, 0);
+
+	check(copy.applySnapshot(snapshot_directory + "20_1.zts"), "first snapshot refused", level, 0);
+	check(copy.applySnapshot(snapshot_directory + "20_2.zts"), "second snapshot refused", level, 0);
+	for(uint32_t i = 0;i < NO_OF_PATHS;i++)
+		checkPath(&copy, &data_tree, randomLeaf(&data_tree));
+	check(!stale.applySnapshot(snapshot_directory + "20_2.zts"), "snapshot applied out of order", level, 0);
+	ls.closeStorage();
+	copy.closeStorage();
+	stale.closeStorage();
+}
+
+//Takes uploads without keeping them, to replay the writes of a crashed process into the shadow trees
+struct NullStorage {
+	void uploadPath(unsigned char *path, uint32_t leaf, unsigned char *path_hash, uint32_t level, uint32_t D) {}
+};
+
+/*
+testCrashResume() - A child process checkpoints an instance of the disk backend (syncStorage, then checkpointed(1) once
+the enclave state would be sealed), writes more paths and dies without closing it. With sealed_second, it dies once the
+trees of a second checkpoint are synced and its state sealed, but before checkpointed(2). Resumed from the last checkpoint
+it sealed, every bucket has to be what it was at that checkpoint (WAL_MODE rolls the trees back to it).
+*/
+void testCrashResume(int8_t recursion_levels, bool sealed_second) {
+	int32_t data_level = (recursion_levels==-1) ? -1 : recursion_levels;
+	struct shadow_tree posmap_tree, data_tree;
+	shadowInit(&posmap_tree, 1, POSMAP_TREE_D, TEST_Z, RECURSION_BLOCK_SIZE);
+	shadowInit(&data_tree, data_level, DATA_TREE_D, TEST_Z, DATA_SIZE);
+
+	//The child draws the same random paths the parent replays
+	uint32_t seed = rand();
+	fflush(stdout);
+	pid_t pid = fork();
+	if(pid == 0) {
+		srand(seed);
+		LocalStorage ls(30);
+		ls.setParams(MAX_BLOCKS, DATA_TREE_D, TEST_Z, STASH_SIZE, DATA_SIZE, BACKEND_HDD, RECURSION_BLOCK_SIZE, recursion_levels, CACHE_BUDGET);
+		for(uint32_t i = 0;i < NO_OF_PATHS;i++) {
+			if(recursion_levels != -1)
+				writePath(&ls, &posmap_tree, randomLeaf(&posmap_tree));
+			writePath(&ls, &data_tree, randomLeaf(&data_tree));
+		}
+		ls.syncStorage();
+		ls.checkpointed(1);
+		for(uint32_t i = 0;i < NO_OF_PATHS;i++) {
+			if(recursion_levels != -1)
+				writePath(&ls, &posmap_tree, randomLeaf(&posmap_tree));
+			writePath(&ls, &data_tree, randomLeaf(&data_tree));
+			ls.endAccess();
+		}
+		if(sealed_second)
+			ls.syncStorage();
+		_exit(0);
+	}
+	int status;
+	waitpid(pid, &status, 0);
+	check(WIFEXITED(status) && WEXITSTATUS(status) == 0, "the crashing process failed", data_level, 0);
+
+	NullStorage null_storage;
+	srand(seed);
+	for(uint32_t phase = 0;phase < (sealed_second ? 2 : 1);phase++) {
+		for(uint32_t i = 0;i < NO_OF_PATHS;i++) {
+			if(recursion_levels != -1)
+				writePath(&null_storage, &posmap_tree, randomLeaf(&posmap_tree));
+			writePath(&null_storage, &data_tree, randomLeaf(&data_tree));
+		}
+	}
+
+	LocalStorage ls(31);
+	ls.resumeFrom(30, sealed_second ? 2 : 1);
+	ls.setParams(MAX_BLOCKS, DATA_TREE_D, TEST_Z, STASH_SIZE, DATA_SIZE, BACKEND_HDD, RECURSION_BLOCK_SIZE, recursion_levels, CACHE_BUDGET);
+	for(uint32_t leaf = (uint32_t)1 << DATA_TREE_D;leaf < (uint32_t)2 << DATA_TREE_D;leaf++)
+		checkPath(&ls, &data_tree, leaf);
+	if(recursion_levels != -1) {
+		for(uint32_t leaf = (uint32_t)1 << POSMAP_TREE_D;leaf < (uint32_t)2 << POSMAP_TREE_D;leaf++)
+			checkPath(&ls, &posmap_tree, leaf);
+	}
+	ls.closeStorage();
+}
+
+int main(int argc, char **argv) {
+	srand(1);
+	storage_directory = testDirectory("LocalStorageTest");
+	uint8_t backends[] = {BACKEND_MEMORY, BACKEND_HDD, BACKEND_MMAP};
+	for(uint32_t i = 0;i < sizeof(backends);i++) {
+		testRecursive(3*i, backends[i], 0);
+		testNonRecursive(3*i+1, backends[i]);
+		//A budget that caches the posmap tree and the top levels of the data tree
+		testRecursive(3*i+2, backends[i], CACHE_BUDGET);
+	}
+	testTwoInstances(BACKEND_HDD);
+	testTiered(15, BACKEND_HDD);
+	testTiered(16, BACKEND_MMAP);
+
+	//The disk backend striped across three directories, which puts the levels of a path in different files
+	for(uint32_t k = 0;k < 3;k++)
+		stripe_directories.push_back(storage_directory + "stripe" + std::to_string(k) + "/");
+	testRecursive(12, BACKEND_HDD, 0);
+	testNonRecursive(13, BACKEND_HDD);
+	testRecursive(14, BACKEND_HDD, CACHE_BUDGET);
+	stripe_directories.clear();
+
+	for(uint32_t i = 0;i < sizeof(backends);i++) {
+		testSnapshots(backends[i], -1);
+		testSnapshots(backends[i], 2);
+	}
+
+	for(uint32_t k = 0;k < 2;k++) {
+		testCrashResume(-1, k==1);
+		testCrashResume(2, k==1);
+	}
+	return testResult("LocalStorageTest");
+}
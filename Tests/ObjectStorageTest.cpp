@@ -0,0 +1,133 @@
+/*
+*    ZeroTrace: Oblivious Memory Primitives from Intel SGX
+*    Copyright (C) 2018  Sajin (sshsshy)
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU General Public License as published by
+*    the Free Software Foundation, version 3 of the License.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU General Public License for more details.
+*
+*    You should have received a copy of the GNU General Public License
+*    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+ObjectStorageTest.cpp
+
+Round trips of buckets, paths and hashes through ObjectStorage over a DirectoryObjectStore,
+with trees that are a whole number of objects deep and trees whose last layer is cut short,
+paths fetched in batches before they are written back (BATCH_PATHS),
+and a new instance, which has to start out empty without touching anything but its own objects.
+*/
+
+#include "StorageTest.hpp"
+#include "../Globals.hpp"
+#include "ObjectStorage.hpp"
+#include <fcntl.h>
+
+#define MAX_BLOCKS 2000
+#define DATA_SIZE 152
+#define RECURSION_BLOCK_SIZE 88
+#define STASH_SIZE 50
+#define TEST_Z 4
+#define NO_OF_PATHS 200
+//A data tree of 8 levels (two whole layers of objects)
+#define SMALL_MAX_BLOCKS 512
+#define SMALL_TREE_D 7
+#define DATA_TREE_D 9
+#define POSMAP_TREE_D 5
+
+void testRecursive(uint32_t storage_id) {
+	ObjectStorage os(storage_id);
+	os.setParams(MAX_BLOCKS, DATA_TREE_D, TEST_Z, STASH_SIZE, DATA_SIZE, BACKEND_OBJECT, RECURSION_BLOCK_SIZE, 2, 0);
+	struct shadow_tree posmap_tree, data_tree;
+	shadowInit(&posmap_tree, 1, POSMAP_TREE_D, TEST_Z, RECURSION_BLOCK_SIZE);
+	shadowInit(&data_tree, 2, DATA_TREE_D, TEST_Z, DATA_SIZE);
+	exerciseTree(&os, &posmap_tree, NO_OF_PATHS);
+	exerciseTree(&os, &data_tree, NO_OF_PATHS);
+	os.syncStorage();
+	for(uint32_t i = 0;i < NO_OF_PATHS;i++) {
+		checkPath(&os, &posmap_tree, randomLeaf(&posmap_tree));
+		checkPath(&os, &data_tree, randomLeaf(&data_tree));
+	}
+	os.closeStorage();
+}
+
+void testNonRecursive(uint32_t storage_id, uint32_t max_blocks, uint32_t D) {
+	ObjectStorage os(storage_id);
+	os.setParams(max_blocks, D, TEST_Z, STASH_SIZE, DATA_SIZE, BACKEND_OBJECT, RECURSION_BLOCK_SIZE, -1, 0);
+	struct shadow_tree data_tree;
+	shadowInit(&data_tree, -1, D, TEST_Z, DATA_SIZE);
+	exerciseTree(&os, &data_tree, NO_OF_PATHS);
+	os.closeStorage();
+}
+
+/*
+testHeldPaths() - Three paths downloaded and then written back in order, as BATCH_PATHS does. The objects of the
+instance are deleted in between, so a write-back that fetched its objects again would lose the buckets and hashes
+it doesn't write itself, and one that PUT a stale copy of an object shared with an earlier path would undo that path.
+*/
+void testHeldPaths(std::string directory, uint32_t storage_id) {
+	std::string instance_directory = directory + std::to_string(storage_id) + "_" + std::to_string(MAX_BLOCKS) + "_" + std::to_string(DATA_SIZE) + "_" + std::to_string(STASH_SIZE) + "/";
+	DirectoryObjectStore instance_store(instance_directory);
+	for(uint32_t round = 0;round < 10;round++) {
+		ObjectStorage os(storage_id);
+		os.setParams(MAX_BLOCKS, DATA_TREE_D, TEST_Z, STASH_SIZE, DATA_SIZE, BACKEND_OBJECT, RECURSION_BLOCK_SIZE, -1, 0);
+		struct shadow_tree data_tree;
+		shadowInit(&data_tree, -1, DATA_TREE_D, TEST_Z, DATA_SIZE);
+		exerciseTree(&os, &data_tree, NO_OF_PATHS);
+		uint32_t leaves[3];
+		for(uint32_t i = 0;i < 3;i++) {
+			leaves[i] = randomLeaf(&data_tree);
+			checkPath(&os, &data_tree, leaves[i]);
+		}
+		instance_store.clear();
+		for(uint32_t i = 0;i < 3;i++)
+			writePath(&os, &data_tree, leaves[i]);
+		for(uint32_t i = 0;i < 3;i++)
+			checkPath(&os, &data_tree, leaves[i]);
+		os.closeStorage();
+	}
+}
+
+//A new instance over the objects of an old one reads zeros, and leaves files that aren't objects alone
+void testNewInstance(std::string directory, uint32_t storage_id) {
+	std::string instance_directory = directory + std::to_string(storage_id) + "_" + std::to_string(MAX_BLOCKS) + "_" + std::to_string(DATA_SIZE) + "_" + std::to_string(STASH_SIZE) + "/";
+	std::string other_file = instance_directory + "not_an_object";
+
+	ObjectStorage old_os(storage_id);
+	old_os.setParams(MAX_BLOCKS, DATA_TREE_D, TEST_Z, STASH_SIZE, DATA_SIZE, BACKEND_OBJECT, RECURSION_BLOCK_SIZE, -1, 0);
+	struct shadow_tree data_tree;
+	shadowInit(&data_tree, -1, DATA_TREE_D, TEST_Z, DATA_SIZE);
+	for(uint32_t i = 0;i < NO_OF_PATHS;i++)
+		writePath(&old_os, &data_tree, randomLeaf(&data_tree));
+	old_os.closeStorage();
+	close(open(other_file.c_str(), O_WRONLY|O_CREAT, 0644));
+
+	ObjectStorage os(storage_id);
+	os.setParams(MAX_BLOCKS, DATA_TREE_D, TEST_Z, STASH_SIZE, DATA_SIZE, BACKEND_OBJECT, RECURSION_BLOCK_SIZE, -1, 0);
+	shadowInit(&data_tree, -1, DATA_TREE_D, TEST_Z, DATA_SIZE);
+	std::vector<unsigned char> bucket(data_tree.bucket_bytes), hash(HASH_LENGTH), zeros(data_tree.bucket_bytes, 0);
+	for(uint32_t label = 1;label < ((uint32_t)2 << DATA_TREE_D);label++) {
+		os.downloadObject(bucket.data(), label, hash.data(), HASH_LENGTH, DATA_SIZE, -1);
+		check(memcmp(bucket.data(), zeros.data(), bucket.size())==0 && memcmp(hash.data(), zeros.data(), HASH_LENGTH)==0, "bucket of the old instance survived", -1, label);
+	}
+	os.closeStorage();
+	check(access(other_file.c_str(), F_OK)==0, "file that is not an object was removed", -1, 0);
+}
+
+int main(int argc, char **argv) {
+	srand(1);
+	std::string directory = testDirectory("ObjectStorageTest");
+	setenv("ZT_OBJECT_STORE", ("dir:" + directory).c_str(), 1);
+	testRecursive(0);
+	testNonRecursive(1, MAX_BLOCKS, DATA_TREE_D);
+	testNonRecursive(2, SMALL_MAX_BLOCKS, SMALL_TREE_D);
+	testNewInstance(directory, 3);
+	testHeldPaths(directory, 4);
+	return testResult("ObjectStorageTest");
+}
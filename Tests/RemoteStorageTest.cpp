@@ -0,0 +1,202 @@
+/*
+*    ZeroTrace: Oblivious Memory Primitives from Intel SGX
+*    Copyright (C) 2018  Sajin (sshsshy)
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU General Public License as published by
+*    the Free Software Foundation, version 3 of the License.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU General Public License for more details.
+*
+*    You should have received a copy of the GNU General Public License
+*    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+RemoteStorageTest.cpp
+
+Round trips of buckets, paths and hashes through RemoteStorage, against a zt_storage_server started by the test
+for every backend it serves, and requests that don't match the parameters of their instance,
+which the server has to answer by closing the connection.
+*/
+
+#include "StorageTest.hpp"
+#include "../Globals.hpp"
+#include "RemoteStorage.hpp"
+#include <signal.h>
+#include <sys/wait.h>
+
+#define MAX_BLOCKS 2000
+#define DATA_SIZE 152
+#define RECURSION_BLOCK_SIZE 88
+#define STASH_SIZE 50
+#define TEST_Z 4
+#define NO_OF_PATHS 200
+#define DATA_TREE_D 9
+#define POSMAP_TREE_D 5
+
+pid_t startServer(std::string address, const char *backend, std::string directory) {
+	pid_t pid = fork();
+	if(pid == 0) {
+		execl("./zt_storage_server", "zt_storage_server", address.c_str(), backend, directory.c_str(), (char*) NULL);
+		printf("Unable to run zt_storage_server\n");
+		_exit(1);
+	}
+	//The server is up once it takes connections
+	for(uint32_t i = 0;i < 500;i++) {
+		int fd = remoteConnect(address);
+		if(fd != -1) {
+			close(fd);
+			return pid;
+		}
+		usleep(10000);
+	}
+	printf("zt_storage_server did not come up on %s\n", address.c_str());
+	exit(1);
+}
+
+void stopServer(pid_t pid) {
+	kill(pid, SIGTERM);
+	waitpid(pid, NULL, 0);
+}
+
+void testRecursive() {
+	RemoteStorage rs(0);
+	rs.setParams(MAX_BLOCKS, DATA_TREE_D, TEST_Z, STASH_SIZE, DATA_SIZE, BACKEND_REMOTE, RECURSION_BLOCK_SIZE, 2, 0);
+	struct shadow_tree posmap_tree, data_tree;
+	shadowInit(&posmap_tree, 1, POSMAP_TREE_D, TEST_Z, RECURSION_BLOCK_SIZE);
+	shadowInit(&data_tree, 2, DATA_TREE_D, TEST_Z, DATA_SIZE);
+	exerciseTree(&rs, &posmap_tree, NO_OF_PATHS);
+	exerciseTree(&rs, &data_tree, NO_OF_PATHS);
+	rs.syncStorage();
+	for(uint32_t i = 0;i < NO_OF_PATHS;i++) {
+		checkPath(&rs, &posmap_tree, randomLeaf(&posmap_tree));
+		checkPath(&rs, &data_tree, randomLeaf(&data_tree));
+	}
+	rs.closeStorage();
+}
+
+void testNonRecursive() {
+	RemoteStorage rs(1);
+	rs.setParams(MAX_BLOCKS, DATA_TREE_D, TEST_Z, STASH_SIZE, DATA_SIZE, BACKEND_REMOTE, RECURSION_BLOCK_SIZE, -1, 0);
+	struct shadow_tree data_tree;
+	shadowInit(&data_tree, -1, DATA_TREE_D, TEST_Z, DATA_SIZE);
+	exerciseTree(&rs, &data_tree, NO_OF_PATHS);
+	rs.closeStorage();
+}
+
+/*
+sendInvalid() - Sends req (with a payload of the size it claims, for uploads) on a fresh connection of a
+recursive instance, followed by a sync for uploads since they have no response of their own.
+The server has to close the connection rather than answer.
+*/
+void sendInvalid(std::string address, struct remote_request req, const char *what) {
+	int fd = remoteConnect(address);
+	struct remote_params params;
+	memset(&params, 0, sizeof(params));
+	params.maxBlocks = MAX_BLOCKS;
+	params.D = DATA_TREE_D;
+	params.Z = TEST_Z;
+	params.stashSize = STASH_SIZE;
+	params.dataSize = DATA_SIZE;
+	params.recursion_block_size = RECURSION_BLOCK_SIZE;
+	params.recursion_levels = 2;
+	struct remote_request set;
+	memset(&set, 0, sizeof(set));
+	set.op = REMOTE_OP_SET_PARAMS;
+	set.size = sizeof(params);
+	uint8_t ack;
+	remoteSend(fd, &set, (unsigned char*) &params, sizeof(params), NULL, 0);
+	check(remoteRead(fd, &ack, 1), "no acknowledgement of the parameters", req.level, req.key);
+
+	std::vector<unsigned char> payload;
+	if(req.op == REMOTE_OP_UPLOAD_OBJECT || req.op == REMOTE_OP_UPLOAD_PATH)
+		payload.assign((uint64_t) req.size + req.hash_size, 0);
+	remoteSend(fd, &req, payload.data(), payload.size(), NULL, 0);
+	if(!payload.empty()) {
+		struct remote_request sync;
+		memset(&sync, 0, sizeof(sync));
+		sync.op = REMOTE_OP_SYNC;
+		remoteSend(fd, &sync, NULL, 0, NULL, 0);
+	}
+	unsigned char response;
+	check(!remoteRead(fd, &response, 1), what, req.level, req.key);
+	close(fd);
+}
+
+void testInvalidRequests(std::string address) {
+	uint32_t data_path_size = (DATA_TREE_D+1) * TEST_Z * DATA_SIZE;
+	struct remote_request req;
+
+	memset(&req, 0, sizeof(req));
+	req.op = REMOTE_OP_DOWNLOAD_PATH;
+	req.key = 1 << DATA_TREE_D;
+	req.level = 2;
+	req.d_level = DATA_TREE_D;
+	req.size = data_path_size;
+	req.hash_size = (2*DATA_TREE_D+1) * HASH_LENGTH;
+
+	struct remote_request bad = req;
+	bad.level = 3;
+	sendInvalid(address, bad, "level beyond recursion_levels served");
+	bad = req;
+	bad.level = -1;
+	sendInvalid(address, bad, "level -1 of a recursive instance served");
+	bad = req;
+	bad.size = data_path_size + 1;
+	sendInvalid(address, bad, "oversized path served");
+	bad = req;
+	bad.hash_size = req.hash_size + HASH_LENGTH;
+	sendInvalid(address, bad, "oversized path hash served");
+	bad = req;
+	bad.d_level = DATA_TREE_D + 1;
+	sendInvalid(address, bad, "path deeper than the tree served");
+	bad = req;
+	bad.key = 1;
+	sendInvalid(address, bad, "path of a non-leaf served");
+
+	bad = req;
+	bad.op = REMOTE_OP_UPLOAD_PATH;
+	bad.hash_size = (DATA_TREE_D+1) * HASH_LENGTH;
+	bad.size = data_path_size * 2;
+	sendInvalid(address, bad, "oversized path upload accepted");
+
+	memset(&bad, 0, sizeof(bad));
+	bad.op = REMOTE_OP_UPLOAD_OBJECT;
+	bad.key = 1;
+	bad.level = 1;
+	bad.d_level = DATA_SIZE;
+	bad.size = TEST_Z * DATA_SIZE;
+	bad.hash_size = HASH_LENGTH;
+	sendInvalid(address, bad, "data sized bucket uploaded to the posmap tree");
+
+	memset(&bad, 0, sizeof(bad));
+	bad.op = REMOTE_OP_FETCH_HASH;
+	bad.key = 2 << POSMAP_TREE_D;
+	bad.level = 1;
+	bad.hash_size = HASH_LENGTH;
+	sendInvalid(address, bad, "hash of a bucket beyond the tree served");
+	bad.key = 1;
+	bad.hash_size = 1024 * 1024;
+	sendInvalid(address, bad, "oversized hash served");
+}
+
+int main(int argc, char **argv) {
+	srand(1);
+	std::string directory = testDirectory("RemoteStorageTest");
+	std::string address = "unix:" + directory + "zt_storage.sock";
+	setenv("ZT_STORAGE_SERVER", address.c_str(), 1);
+	const char *backends[] = {"memory", "hdd", "mmap"};
+	for(uint32_t i = 0;i < 3;i++) {
+		pid_t server = startServer(address, backends[i], directory);
+		testRecursive();
+		testNonRecursive();
+		if(i == 0)
+			testInvalidRequests(address);
+		stopServer(server);
+	}
+	return testResult("RemoteStorageTest");
+}
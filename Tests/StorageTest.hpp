@@ -0,0 +1,175 @@
+/*
+*    ZeroTrace: Oblivious Memory Primitives from Intel SGX
+*    Copyright (C) 2018  Sajin (sshsshy)
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU General Public License as published by
+*    the Free Software Foundation, version 3 of the License.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU General Public License for more details.
+*
+*    You should have received a copy of the GNU General Public License
+*    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+StorageTest.hpp
+
+Helpers shared by the storage tests, which drive the untrusted storage the way the enclave does (uploadPath/downloadPath,
+uploadObject/downloadObject) and need neither SGX nor the enclave. Every write is mirrored in a shadow_tree, and every
+download is checked against it : the bucket of each node on the path, and the <L-hash, R-hash> pair of each node
+(the root hash alone for the root), for the nodes that were written so far.
+*/
+
+#pragma once
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+
+#define HASH_LENGTH 32
+
+uint32_t test_failures = 0;
+
+struct shadow_tree {
+	int32_t level;
+	uint32_t D;
+	uint32_t Z;
+	uint32_t size_for_level;
+	uint32_t bucket_bytes;
+	//Indexed by bucket label (1 is the root)
+	std::vector<unsigned char> buckets;
+	std::vector<unsigned char> hashes;
+	std::vector<bool> written;
+};
+
+void check(bool ok, const char *what, int32_t level, uint32_t label) {
+	if(!ok) {
+		printf("FAIL : %s, level %d, label %d\n", what, level, label);
+		test_failures++;
+	}
+}
+
+void shadowInit(struct shadow_tree *tree, int32_t level, uint32_t D, uint32_t Z, uint32_t size_for_level) {
+	uint64_t no_of_buckets = (uint64_t)1 << (D+1);
+	tree->level = level;
+	tree->D = D;
+	tree->Z = Z;
+	tree->size_for_level = size_for_level;
+	tree->bucket_bytes = Z * size_for_level;
+	tree->buckets.assign(no_of_buckets * tree->bucket_bytes, 0);
+	tree->hashes.assign(no_of_buckets * HASH_LENGTH, 0);
+	tree->written.assign(no_of_buckets, false);
+}
+
+void randomBytes(unsigned char *buffer, uint64_t size) {
+	for(uint64_t i = 0;i < size;i++)
+		buffer[i] = rand();
+}
+
+uint32_t randomLeaf(struct shadow_tree *tree) {
+	return ((uint32_t)1 << tree->D) + (rand() % ((uint32_t)1 << tree->D));
+}
+
+//Writes random buckets and hashes along the path to leaf, leaf to root as the enclave lays them out
+template<class S> void writePath(S *storage, struct shadow_tree *tree, uint32_t leaf) {
+	std::vector<unsigned char> path((tree->D+1) * tree->bucket_bytes), path_hash((tree->D+1) * HASH_LENGTH);
+	randomBytes(path.data(), path.size());
+	randomBytes(path_hash.data(), path_hash.size());
+	storage->uploadPath(path.data(), leaf, path_hash.data(), tree->level, tree->D);
+	uint32_t node = leaf;
+	for(uint32_t i = 0;i <= tree->D;i++) {
+		memcpy(&(tree->buckets[(uint64_t)node * tree->bucket_bytes]), &(path[(uint64_t)i * tree->bucket_bytes]), tree->bucket_bytes);
+		memcpy(&(tree->hashes[(uint64_t)node * HASH_LENGTH]), &(path_hash[i * HASH_LENGTH]), HASH_LENGTH);
+		tree->written[node] = true;
+		node = node>>1;
+	}
+}
+
+void checkHash(struct shadow_tree *tree, uint32_t node, unsigned char *hash) {
+	if(tree->written[node])
+		check(memcmp(hash, &(tree->hashes[(uint64_t)node * HASH_LENGTH]), HASH_LENGTH)==0, "hash differs", tree->level, node);
+}
+
+template<class S> void checkPath(S *storage, struct shadow_tree *tree, uint32_t leaf) {
+	std::vector<unsigned char> path((tree->D+1) * tree->bucket_bytes), path_hash((2*tree->D+1) * HASH_LENGTH);
+	storage->downloadPath(path.data(), leaf, path_hash.data(), path_hash.size(), tree->level, tree->D);
+	uint32_t node = leaf;
+	unsigned char *hash_iter = path_hash.data();
+	for(uint32_t i = 0;i <= tree->D;i++) {
+		if(tree->written[node])
+			check(memcmp(&(path[(uint64_t)i * tree->bucket_bytes]), &(tree->buckets[(uint64_t)node * tree->bucket_bytes]), tree->bucket_bytes)==0, "bucket differs", tree->level, node);
+		if(node==1) {
+			checkHash(tree, 1, hash_iter);
+		}
+		else {
+			uint32_t left = node & ~1;
+			checkHash(tree, left, hash_iter);
+			checkHash(tree, left+1, hash_iter + HASH_LENGTH);
+			hash_iter+= 2*HASH_LENGTH;
+		}
+		node = node>>1;
+	}
+}
+
+template<class S> void writeObject(S *storage, struct shadow_tree *tree, uint32_t label) {
+	std::vector<unsigned char> bucket(tree->bucket_bytes), hash(HASH_LENGTH);
+	randomBytes(bucket.data(), bucket.size());
+	randomBytes(hash.data(), hash.size());
+	storage->uploadObject(bucket.data(), label, hash.data(), HASH_LENGTH, tree->size_for_level, tree->level);
+	memcpy(&(tree->buckets[(uint64_t)label * tree->bucket_bytes]), bucket.data(), tree->bucket_bytes);
+	memcpy(&(tree->hashes[(uint64_t)label * HASH_LENGTH]), hash.data(), HASH_LENGTH);
+	tree->written[label] = true;
+}
+
+template<class S> void checkObject(S *storage, struct shadow_tree *tree, uint32_t label) {
+	std::vector<unsigned char> bucket(tree->bucket_bytes), hash(HASH_LENGTH);
+	storage->downloadObject(bucket.data(), label, hash.data(), HASH_LENGTH, tree->size_for_level, tree->level);
+	if(!tree->written[label])
+		return;
+	check(memcmp(bucket.data(), &(tree->buckets[(uint64_t)label * tree->bucket_bytes]), tree->bucket_bytes)==0, "object differs", tree->level, label);
+	checkHash(tree, label, hash.data());
+}
+
+/*
+exerciseTree() - The access pattern of a build followed by accesses : a few buckets uploaded on their own,
+then paths written and read back at random leaves, every one of which is checked against the shadow tree.
+*/
+template<class S> void exerciseTree(S *storage, struct shadow_tree *tree, uint32_t no_of_paths) {
+	for(uint32_t i = 0;i < 8;i++)
+		writeObject(storage, tree, 1 + rand() % (((uint32_t)2 << tree->D) - 1));
+	for(uint32_t i = 0;i < 8;i++)
+		checkObject(storage, tree, 1 + rand() % (((uint32_t)2 << tree->D) - 1));
+	for(uint32_t i = 0;i < no_of_paths;i++) {
+		uint32_t leaf = randomLeaf(tree);
+		checkPath(storage, tree, leaf);
+		writePath(storage, tree, leaf);
+		checkPath(storage, tree, randomLeaf(tree));
+	}
+}
+
+//Scratch directory for the tree files of a test, under TMPDIR
+std::string testDirectory(const char *name) {
+	const char *tmp = getenv("TMPDIR");
+	std::string directory = std::string(tmp ? tmp : "/tmp") + "/" + name + "_XXXXXX";
+	if(mkdtemp(&directory[0]) == NULL) {
+		printf("Unable to create a directory for %s\n", name);
+		exit(1);
+	}
+	return directory + "/";
+}
+
+int testResult(const char *name) {
+	if(test_failures)
+		printf("%s : %d checks FAILED\n", name, test_failures);
+	else
+		printf("%s : passed\n", name);
+	return test_failures ? 1 : 0;
+}
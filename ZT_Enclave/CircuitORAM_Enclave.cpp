@@ -25,15 +25,29 @@ void oarray_search2(uint32_t *array, uint32_t loc, uint32_t *leaf, uint32_t newL
     return;
 }
 
-void CircuitORAM::Initialize(uint8_t pZ, uint32_t pmax_blocks, uint32_t pdata_size, uint32_t pstash_size, uint32_t poblivious_flag, uint32_t precursion_data_size, int8_t precursion_levels, uint64_t onchip_posmap_mem_limit){
+void CircuitORAM::Initialize(uint8_t pZ, uint32_t pmax_blocks, uint32_t pdata_size, uint32_t pstash_size, uint32_t poblivious_flag, uint32_t precursion_data_size, int8_t precursion_levels, uint64_t onchip_posmap_mem_limit, uint32_t pstorage_id){
 	#ifdef BUILDTREE_DEBUG
 		printf("In CircuitORAM::Initialize, Started Initialize\n");
 	#endif
 
 	ORAMTree::SampleKey();	
-	ORAMTree::SetParams(pZ, pmax_blocks, pdata_size, pstash_size, poblivious_flag, precursion_data_size, precursion_levels, onchip_posmap_mem_limit);
+	ORAMTree::SetParams(pZ, pmax_blocks, pdata_size, pstash_size, poblivious_flag, precursion_data_size, precursion_levels, onchip_posmap_mem_limit, pstorage_id);
 	ORAMTree::Initialize();
+	AllocateEvictionBuffers();
 
+	#ifdef BUILDTREE_DEBUG
+		printf("Finished Initialize\n");
+	#endif
+}
+
+bool CircuitORAM::Restore(unsigned char *state, uint64_t state_size, uint32_t pstorage_id){
+	if(!ORAMTree::RestoreState(state, state_size, pstorage_id))
+		return false;
+	AllocateEvictionBuffers();
+	return true;
+}
+
+void CircuitORAM::AllocateEvictionBuffers(){
 	uint32_t d_largest;
 	if(recursion_levels==-1)
 		d_largest = D;
@@ -46,10 +60,6 @@ void CircuitORAM::Initialize(uint8_t pZ, uint32_t pmax_blocks, uint32_t pdata_si
 	target_position = (int32_t*) malloc ((d_largest+2) * sizeof(uint32_t) );
 	serialized_block_hold = (unsigned char*) malloc (data_size + ADDITIONAL_METADATA_SIZE);
 	serialized_block_write = (unsigned char*) malloc (data_size + ADDITIONAL_METADATA_SIZE);	
-
-	#ifdef BUILDTREE_DEBUG
-		printf("Finished Initialize\n");
-	#endif
 }
 
 uint32_t* CircuitORAM::prepare_target(uint32_t N, uint32_t D, uint32_t leaf, unsigned char *serialized_path, uint32_t block_size, uint32_t level, uint32_t * deepest, int32_t *target_position){	
@@ -332,11 +342,6 @@ void CircuitORAM::CircuitORAM_FetchBlock(unsigned char* decrypted_path, unsigned
 	//FetchBlock over Path
 	unsigned char *decrypted_path_ptr = decrypted_path;
 	unsigned char *path_ptr;
-	unsigned char *new_path_hash_iter = new_path_hash;
-	unsigned char *new_path_hash_trail = new_path_hash;
-	unsigned char *old_path_hash_iter = path_hash;		
-	unsigned char *new_path_hash_ptr = new_path_hash;
-	uint32_t leaf_temp_prev = (leaf+nlevel)<<1;
 	uint32_t i,k; 
 	uint8_t rt;
 
@@ -409,34 +414,27 @@ void CircuitORAM::CircuitORAM_FetchBlock(unsigned char* decrypted_path, unsigned
 		displaySerializedBlock(serialized_result_block, level, recursion_levels, x);
 	#endif
 
-	//Encrypt Path Module
-	#ifdef ENCRYPTION_ON
-		encryptPath(decrypted_path, encrypted_path, (Z*(dlevel+1)), data_size);
-	#endif			
-
-	//Path Integrity Module
-	#ifndef PASSIVE_ADVERSARY
-		new_path_hash_iter = new_path_hash;
-		new_path_hash_trail = new_path_hash;
-		old_path_hash_iter = path_hash;		
-		new_path_hash_ptr = new_path_hash;
-		leaf_temp_prev = (leaf+nlevel)<<1;
+	#ifdef ENCLAVE_TREES
+		bool enclave_tree = isEnclaveTree(level);
+	#else
+		bool enclave_tree = false;
+	#endif
 
-		#ifdef ENCRYPTION_ON
-			path_ptr = encrypted_path;
+	//Encrypt Path and Path Integrity Modules, an enclave tree is written back as it is
+	if(!enclave_tree) {
+		#ifdef PASSIVE_ADVERSARY
+			#ifdef ENCRYPTION_ON
+				encryptPath(decrypted_path, encrypted_path, (Z*(dlevel+1)), data_size);
+			#endif
 		#else
-			path_ptr = decrypted_path;
+			//Every bucket is encrypted right before CreateNewPathHash() hashes it
+			#ifdef ENCRYPTION_ON
+				CreateNewPathHash(encrypted_path, path_hash, new_path_hash, leaf + nlevel, block_size, dlevel, level, decrypted_path);
+			#else
+				CreateNewPathHash(decrypted_path, path_hash, new_path_hash, leaf + nlevel, block_size, dlevel, level, NULL);
+			#endif
 		#endif
-
-		for(i=0;i < ( Z * (dlevel+1) ); i++) {
-			if(i%Z==0) {
-				uint32_t p = i/Z;
-				addToNewPathHash(path_ptr, old_path_hash_iter, new_path_hash_trail, new_path_hash_iter,(dlevel+1)-p, leaf_temp_prev, block_size, dlevel, level);
-				leaf_temp_prev>>1;
-				path_ptr+=(Z*block_size);
-			}
-		}
-	#endif
+	}
 
 	// Time taken signal !
 	if(level==recursion_levels){
@@ -446,11 +444,16 @@ void CircuitORAM::CircuitORAM_FetchBlock(unsigned char* decrypted_path, unsigned
 	}	
 
 	// WriteBack the path, arr_blocks
-	#ifdef ENCRYPTION_ON
-		uploadPath(&rt, encrypted_path, path_size, leaf + nlevel, new_path_hash, new_path_hash_size, level, dlevel);			
-	#else
-		uploadPath(&rt, decrypted_path, path_size, leaf + nlevel, new_path_hash, new_path_hash_size, level, dlevel);
-	#endif	
+	if(enclave_tree) {
+		WriteEnclavePath(decrypted_path, leaf + nlevel, dlevel, level);
+	}
+	else {
+		#ifdef ENCRYPTION_ON
+			WriteBackPath(encrypted_path, path_size, leaf + nlevel, new_path_hash, new_path_hash_size, level, dlevel);
+		#else
+			WriteBackPath(decrypted_path, path_size, leaf + nlevel, new_path_hash, new_path_hash_size, level, dlevel);
+		#endif
+	}
 
 	//Set newleaf for fetched_block
 	setTreeLabel(serialized_result_block, newleaf);
@@ -478,14 +481,30 @@ void CircuitORAM::CircuitORAM_FetchBlock(unsigned char* decrypted_path, unsigned
 }
 
 
+/*
+ReadAccessPaths() - Samples the eviction leaves of the access, and reads its access path. With BATCH_PATHS the access path and both
+eviction paths are fetched in one OCALL, and the three write-backs go out together with the fetch that follows.
+*/
+unsigned char* CircuitORAM::ReadAccessPaths(uint32_t leaf, uint32_t level, uint32_t nlevel) {
+	uint64_t temp_n = 0;
+
+	//Sample the leaves for eviction
+	sgx_read_rand((unsigned char*) &temp_n, 4);
+	eviction_leaf_left = (temp_n % (nlevel/2) );
+	eviction_leaf_right = eviction_leaf_left + (nlevel/2);
+
+	#ifdef BATCH_PATHS
+		uint32_t labels[3] = {leaf + nlevel, eviction_leaf_left + nlevel, eviction_leaf_right + nlevel};
+		BeginPathBatch(3, labels, level);
+	#endif
+	return ReadBucketsFromPath(leaf + nlevel, path_hash, level);
+}
+
 uint32_t CircuitORAM::access_oram_level(char opType, uint32_t leaf, uint32_t id, uint32_t position_in_id, uint32_t level, uint32_t newleaf,uint32_t newleaf_nextleaf, unsigned char *data_in,  unsigned char *data_out)
 {
 	uint32_t return_value=-1;
-	#ifdef EXITLESS_MODE			
-		path_hash = resp_struct->path_hash;
-	#endif
 
-	decrypted_path = ReadBucketsFromPath(leaf + N_level[level], path_hash, level);
+	decrypted_path = ReadAccessPaths(leaf, level, N_level[level]);
 
 	return_value = CircuitORAM_Access(opType, id, position_in_id,leaf, newleaf, newleaf_nextleaf,decrypted_path, 
 					path_hash,level,D_level[level],N_level[level], data_in, data_out); 
@@ -496,25 +515,23 @@ void CircuitORAM::EvictionRoutine(unsigned char *decrypted_path, unsigned char *
 				uint32_t data_size, uint32_t block_size, uint32_t path_size, uint32_t new_path_hash_size, uint32_t leaf, uint32_t level, 
 				uint32_t dlevel, uint32_t nlevel) {
 	uint8_t rt;			
-	uint32_t i;
-	uint64_t leaf_right, leaf_left, temp_n;
+	uint64_t leaf_right, leaf_left;
 	unsigned char *eviction_path_left, *eviction_path_right;
 	unsigned char *decrypted_path_ptr = decrypted_path;
 	unsigned char *path_ptr;
-	unsigned char *new_path_hash_iter = new_path_hash;
-	unsigned char *new_path_hash_trail = new_path_hash;
-	unsigned char *old_path_hash_iter = path_hash;		
-	unsigned char *new_path_hash_ptr = new_path_hash;
-	uint32_t leaf_temp_prev = (leaf+nlevel)<<1;
+	#ifdef ENCLAVE_TREES
+		bool enclave_tree = isEnclaveTree(level);
+	#else
+		bool enclave_tree = false;
+	#endif
 	
 	#ifdef SHOW_STASH_COUNT_DEBUG
 		print_stash_count(level, nlevel);	
 	#endif
 		
-	//Sample the leaves for eviction
-	sgx_read_rand((unsigned char*) &temp_n, 4);
-	leaf_left = (temp_n % (nlevel/2) );
-	leaf_right = leaf_left + (nlevel/2);
+	//Sampled by ReadAccessPaths()
+	leaf_left = eviction_leaf_left;
+	leaf_right = eviction_leaf_right;
 
 	eviction_path_left = ReadBucketsFromPath(leaf_left + nlevel, path_hash, level);
 	for(uint32_t e = 0; e <dlevel+2; e++){
@@ -563,40 +580,30 @@ void CircuitORAM::EvictionRoutine(unsigned char *decrypted_path, unsigned char *
 		print_stash_count(level,nlevel);
 	#endif	
 
-	#ifdef ENCRYPTION_ON
-		encryptPath(eviction_path_left, encrypted_path, (Z*(dlevel+1)), data_size);
-	#endif
-
-	//time_report(5);			
+	if(enclave_tree) {
+		WriteEnclavePath(eviction_path_left, leaf_left + nlevel, dlevel, level);
+	}
+	else {
+		//time_report(5);			
 
-	#ifdef ENCRYPTION_ON
-		uploadPath(&rt, encrypted_path, path_size, leaf_left + nlevel, new_path_hash, new_path_hash_size, level, dlevel);		
-	#else
-		uploadPath(&rt, eviction_path_left, path_size, leaf_left + nlevel, new_path_hash, new_path_hash_size, level, dlevel);
-	#endif		
+		#ifdef PASSIVE_ADVERSARY
+			#ifdef ENCRYPTION_ON
+				encryptPath(eviction_path_left, encrypted_path, (Z*(dlevel+1)), data_size);
+			#endif
+		#else
+			#ifdef ENCRYPTION_ON
+				CreateNewPathHash(encrypted_path, path_hash, new_path_hash, leaf_left + nlevel, block_size, dlevel, level, eviction_path_left);
+			#else
+				CreateNewPathHash(eviction_path_left, path_hash, new_path_hash, leaf_left + nlevel, block_size, dlevel, level, NULL);
+			#endif
+		#endif
 
-	#ifndef PASSIVE_ADVERSARY
-		new_path_hash_iter = new_path_hash;
-		new_path_hash_trail = new_path_hash;
-		old_path_hash_iter = path_hash;		
-		new_path_hash_ptr = new_path_hash;
-		leaf_temp_prev = (leaf_left+nlevel)<<1;
 		#ifdef ENCRYPTION_ON
-			path_ptr = encrypted_path;
+			WriteBackPath(encrypted_path, path_size, leaf_left + nlevel, new_path_hash, new_path_hash_size, level, dlevel);
 		#else
-			path_ptr = eviction_path_left;
+			WriteBackPath(eviction_path_left, path_size, leaf_left + nlevel, new_path_hash, new_path_hash_size, level, dlevel);
 		#endif
-	
-		for(i=0;i < ( Z * (dlevel+1) ); i++) {
-			if(i%Z==0) {
-				uint32_t p = i/Z;
-				addToNewPathHash(path_ptr, old_path_hash_iter, new_path_hash_trail, new_path_hash_iter,(dlevel+1)-p, leaf_temp_prev, block_size, dlevel, level);
-				leaf_temp_prev>>1;
-				path_ptr+=(Z*block_size);
-			}
-				
-		}
-	#endif
+	}
 		
 	eviction_path_right = ReadBucketsFromPath(leaf_right + nlevel, path_hash, level);
 
@@ -637,39 +644,29 @@ void CircuitORAM::EvictionRoutine(unsigned char *decrypted_path, unsigned char *
 	#endif	
 
 
-	#ifdef ENCRYPTION_ON
-		encryptPath(eviction_path_right, encrypted_path, (Z*(dlevel+1)), data_size);
-	#endif
-
-	#ifndef PASSIVE_ADVERSARY
-		new_path_hash_iter = new_path_hash;
-		new_path_hash_trail = new_path_hash;
-		old_path_hash_iter = path_hash;		
-		new_path_hash_ptr = new_path_hash;
-		leaf_temp_prev = (leaf+nlevel)<<1;
-		#ifdef ENCRYPTION_ON
-			path_ptr = encrypted_path;
+	if(enclave_tree) {
+		WriteEnclavePath(eviction_path_right, leaf_right + nlevel, dlevel, level);
+	}
+	else {
+		#ifdef PASSIVE_ADVERSARY
+			#ifdef ENCRYPTION_ON
+				encryptPath(eviction_path_right, encrypted_path, (Z*(dlevel+1)), data_size);
+			#endif
 		#else
-			path_ptr = eviction_path_right;
+			#ifdef ENCRYPTION_ON
+				CreateNewPathHash(encrypted_path, path_hash, new_path_hash, leaf_right + nlevel, block_size, dlevel, level, eviction_path_right);
+			#else
+				CreateNewPathHash(eviction_path_right, path_hash, new_path_hash, leaf_right + nlevel, block_size, dlevel, level, NULL);
+			#endif
 		#endif
 
-		for(i=0;i < ( Z * (dlevel+1) ); i++) {
-			if(i%Z==0) {
-				uint32_t p = i/Z;
-				addToNewPathHash(path_ptr, old_path_hash_iter, new_path_hash_trail, new_path_hash_iter,(dlevel+1)-p, leaf_temp_prev, block_size, dlevel, level);
-				leaf_temp_prev>>1;
-				path_ptr+=(Z*block_size);
-			}
-			
-		}
-	#endif
-
 
-	#ifdef ENCRYPTION_ON
-		uploadPath(&rt, encrypted_path, path_size, leaf_right + nlevel, path_hash, new_path_hash_size, level, dlevel);
-	#else
-		uploadPath(&rt, eviction_path_right, path_size, leaf_right + nlevel, path_hash, new_path_hash_size, level, dlevel);
-	#endif			
+		#ifdef ENCRYPTION_ON
+			WriteBackPath(encrypted_path, path_size, leaf_right + nlevel, new_path_hash, new_path_hash_size, level, dlevel);
+		#else
+			WriteBackPath(eviction_path_right, path_size, leaf_right + nlevel, new_path_hash, new_path_hash_size, level, dlevel);
+		#endif
+	}
 	
 	#ifdef SHOW_STASH_COUNT_DEBUG
 		print_stash_count(level, nlevel);
@@ -711,11 +708,6 @@ uint32_t CircuitORAM::CircuitORAM_Access(char opType, uint32_t id, uint32_t posi
 		new_path_hash_size = 0;
 	#endif
 
-	#ifdef EXITLESS_MODE
-		serialized_path = resp_struct->new_path;
-		new_path_hash = resp_struct->new_path_hash;
-	#endif	
-
 	unsigned char *path_ptr;
 	unsigned char *new_path_hash_iter = new_path_hash;
 	unsigned char *new_path_hash_trail = new_path_hash;
@@ -765,7 +757,7 @@ uint32_t CircuitORAM::access(uint32_t id, uint32_t position_in_id, char opType,
 		}	
 		time_report(1);	
 	
-		decrypted_path = ReadBucketsFromPath(leaf+N, path_hash,-1);			
+		decrypted_path = ReadAccessPaths(leaf, -1, N);
 		CircuitORAM_Access(opType, id, -1, leaf, newleaf, -1, decrypted_path, path_hash, -1, D, N, data_in, data_out);
 	}
 
@@ -34,15 +34,21 @@
 		int32_t *target_position;
 		unsigned char *serialized_block_hold;
 		unsigned char *serialized_block_write;
+		//Eviction paths of the access in progress, sampled before its access path is read
+		uint32_t eviction_leaf_left;
+		uint32_t eviction_leaf_right;
 
 		CircuitORAM(uint32_t s_max_blocks, uint32_t s_data_size, uint32_t s_stash_size, uint32_t oblivious, uint32_t s_recursion_data_size, int8_t recursion_levels, uint64_t onchip_posmap_mem_limit);
 		void CircuitORAM_RebuildPath(unsigned char* decrypted_path_ptr, uint32_t data_size, uint32_t block_size, uint32_t leaf, uint32_t level, uint32_t D_level, uint32_t nlevel);
-		void Initialize(uint8_t pZ, uint32_t pmax_blocks, uint32_t pdata_size, uint32_t pstash_size, uint32_t poblivious_flag, uint32_t precursion_data_size, int8_t precursion_levels, uint64_t onchip_posmap_mem_limit);
+		void Initialize(uint8_t pZ, uint32_t pmax_blocks, uint32_t pdata_size, uint32_t pstash_size, uint32_t poblivious_flag, uint32_t precursion_data_size, int8_t precursion_levels, uint64_t onchip_posmap_mem_limit, uint32_t pstorage_id);
+		bool Restore(unsigned char *state, uint64_t state_size, uint32_t pstorage_id);
+		void AllocateEvictionBuffers();
 
 		uint32_t CircuitORAM_Access(char opType, uint32_t id, uint32_t position_in_id, uint32_t leaf, uint32_t newleaf, uint32_t newleaf_nextlevel, unsigned char* decrypted_path, 
 						unsigned char* path_hash, uint32_t level, uint32_t D_level, uint32_t nlevel, unsigned char* data_in, unsigned char *data_out);
 		void Access_temp(uint32_t id, char opType, unsigned char* data_in, unsigned char* data_out);	
 		uint32_t access(uint32_t id, uint32_t position_in_id, char opType, uint8_t level, unsigned char* data_in, unsigned char* data_out, uint32_t *prev_sampled_leaf);			
+		unsigned char* ReadAccessPaths(uint32_t leaf, uint32_t level, uint32_t nlevel);
 		uint32_t access_oram_level(char opType, uint32_t leaf, uint32_t id, uint32_t position_in_id, uint32_t level, uint32_t newleaf,uint32_t newleaf_nextleaf, unsigned char *data_in,  unsigned char *data_out);
 
 		void EvictionRoutine(unsigned char *decrypted_path, unsigned char *encrypted_path, unsigned char *path_hash, unsigned char *new_path_hash, 
@@ -91,3 +91,100 @@ void aes_enc_serialized(unsigned char* decrypted_block, uint32_t data_size, unsi
 
 
 
+
+#ifdef EXITLESS_MODE
+	/*
+	EXITLESS_MODE : path requests are posted to the ring the App set up in untrusted memory (see ExitlessRing.hpp),
+	and served there by its ExitlessIO workers while we spin, instead of going out with OCALLs.
+	The slot buffers are taken once, at exitlessSetup(), and checked to lie outside the enclave : the pointers in the
+	ring itself are never followed again, and whatever comes back is copied in before it is verified.
+	*/
+	static struct exitless_ring *exitless_ring = NULL;
+	static unsigned char *exitless_buffers[EXITLESS_RING_SLOTS][EXITLESS_BUFFERS];
+	static uint32_t exitless_path_buffer_size = 0;
+	static uint32_t exitless_hash_buffer_size = 0;
+
+	bool exitlessSetup(void *ring) {
+		struct exitless_ring *new_ring = (struct exitless_ring*) ring;
+		if(new_ring == NULL || sgx_is_outside_enclave(new_ring, sizeof(struct exitless_ring)) != 1)
+			return false;
+		uint32_t path_buffer_size = new_ring->path_buffer_size;
+		uint32_t hash_buffer_size = new_ring->hash_buffer_size;
+		for(uint32_t i = 0; i < EXITLESS_RING_SLOTS; i++) {
+			for(uint32_t j = 0; j < EXITLESS_BUFFERS; j++) {
+				unsigned char *buffer = new_ring->slots[i].buffers[j];
+				uint32_t size = (j == EXITLESS_PATH || j == EXITLESS_UP_PATH) ? path_buffer_size : hash_buffer_size;
+				if(buffer == NULL || sgx_is_outside_enclave(buffer, size) != 1)
+					return false;
+				exitless_buffers[i][j] = buffer;
+			}
+		}
+		exitless_path_buffer_size = path_buffer_size;
+		exitless_hash_buffer_size = hash_buffer_size;
+		exitless_ring = new_ring;
+		return true;
+	}
+
+	/*
+	exitlessPathIO() - Uploads up_path (up_path_size 0 for none), then fetches path (path_size 0 for none), through the ring.
+	Returns false, having done nothing, if there is no ring, the paths don't fit its buffers or no worker took the request up
+	in time : the caller makes the OCALL then.
+	*/
+	bool exitlessPathIO(uint32_t storage_id, unsigned char *up_path, uint32_t up_path_size, uint32_t up_label, unsigned char *up_path_hash, uint32_t up_path_hash_size,
+			uint32_t up_level, uint32_t up_D_level, unsigned char *path, uint32_t path_size, uint32_t label, unsigned char *path_hash, uint32_t path_hash_size,
+			uint32_t level, uint32_t D_level) {
+		if(exitless_ring == NULL || up_path_size > exitless_path_buffer_size || path_size > exitless_path_buffer_size
+				|| up_path_hash_size > exitless_hash_buffer_size || path_hash_size > exitless_hash_buffer_size)
+			return false;
+
+		uint32_t s = (uint32_t) (__sync_fetch_and_add(&(exitless_ring->tickets), 1) % EXITLESS_RING_SLOTS);
+		struct exitless_slot *slot = &(exitless_ring->slots[s]);
+		while(!__sync_bool_compare_and_swap(&(slot->state), EXITLESS_SLOT_FREE, EXITLESS_SLOT_CLAIMED))
+			__builtin_ia32_pause();
+
+		slot->storage_id = storage_id;
+		slot->up_path_size = up_path_size;
+		if(up_path_size != 0) {
+			slot->up_label = up_label;
+			slot->up_level = up_level;
+			slot->up_D_level = up_D_level;
+			slot->up_path_hash_size = up_path_hash_size;
+			memcpy(exitless_buffers[s][EXITLESS_UP_PATH], up_path, up_path_size);
+			memcpy(exitless_buffers[s][EXITLESS_UP_PATH_HASH], up_path_hash, up_path_hash_size);
+		}
+		slot->path_size = path_size;
+		slot->label = label;
+		slot->level = level;
+		slot->D_level = D_level;
+		slot->path_hash_size = path_hash_size;
+		__sync_synchronize();
+		slot->state = EXITLESS_SLOT_POSTED;
+		__sync_synchronize();
+
+		//Every worker is parked
+		if(exitless_ring->awake == 0)
+			exitlessWake();
+
+		uint32_t spins = 0;
+		while(slot->state != EXITLESS_SLOT_DONE) {
+			if(++spins < EXITLESS_WAIT_SPINS) {
+				__builtin_ia32_pause();
+				continue;
+			}
+			spins = 0;
+			if(__sync_bool_compare_and_swap(&(slot->state), EXITLESS_SLOT_POSTED, EXITLESS_SLOT_CLAIMED)) {
+				slot->state = EXITLESS_SLOT_FREE;
+				return false;
+			}
+			exitlessWake();
+		}
+		__sync_synchronize();
+		if(path_size != 0) {
+			memcpy(path, exitless_buffers[s][EXITLESS_PATH], path_size);
+			memcpy(path_hash, exitless_buffers[s][EXITLESS_PATH_HASH], path_hash_size);
+		}
+		__sync_synchronize();
+		slot->state = EXITLESS_SLOT_FREE;
+		return true;
+	}
+#endif
@@ -30,11 +30,35 @@
 	#include "Block.hpp"
 	#include "oasm_lib.h"
 	#include "../Globals.hpp"
+	#include "../ExitlessRing.hpp"
+	#include "../DirectTree.hpp"
 	#include <assert.h>
 
 	// define FLAGS :
 	#define ENCRYPTION_ON 1
 	#define PATH_GRANULAR_IO 1
+	//SPARSE_TREES : trees start out unwritten, untouched buckets (all zeros in storage) stand for their initial contents,
+	//see ORAMTree::fillInitialBuckets()
+	#define SPARSE_TREES 1
+	//Bytes of buckets a dense build (SPARSE_TREES off) uploads per OCALL, see ORAMTree::StreamBuildTree()
+	#define BUILD_CHUNK_SIZE (4 * 1024 * 1024)
+	//ENCLAVE_TREES : posmap levels whose whole tree fits in ENCLAVE_TREE_BUDGET bytes (per instance, smallest levels first,
+	//never the data level) are kept in enclave memory in plaintext, their paths move without OCALLs, encryption or Merkle hashing.
+	//See ORAMTree::SetupEnclaveTrees()
+	#define ENCLAVE_TREES 1
+	#define ENCLAVE_TREE_BUDGET (8 * 1024 * 1024)
+	//Buckets fetched per OCALL by the Merkle audit of a tree (ORAMTree::AuditTrees), per enclave thread
+	#define AUDIT_CHUNK_SIZE (1024 * 1024)
+	//EXCHANGE_PATHS : the write-back of a path is held until the next path fetch of the instance, and both go in
+	//one OCALL (exchangePath), see ORAMTree::WriteBackPath()
+	#define EXCHANGE_PATHS 1
+	//BATCH_PATHS : CircuitORAM fetches the access path and both eviction paths of a level in one OCALL, and writes them
+	//back in one (exchangePaths), see ORAMTree::BeginPathBatch()
+	#define BATCH_PATHS 1
+	#define MAX_BATCH_PATHS 3
+	//DIRECT_TREES : trees the App holds in memory are read and written in place, through pointers into untrusted memory
+	//checked once with sgx_is_outside_enclave, instead of through the path OCALLs. See ORAMTree::AttachDirectTree()
+	#define DIRECT_TREES 1
 	#define TIME_PERFORMANCE 1
 	#define DEBUG_ZT_ENCLAVE 1
 	#define SET_PARAMETERS_DEBUG 1
@@ -56,6 +80,8 @@
 	//#define ACCESS_CORAM_DEBUG3 1
 	//#define ACCCES_DEBUG_EXITLESS 1
 	//#define ACCESS_DEBUG_REBUILD 1 
+	//EXITLESS_MODE : path fetches and write-backs go through a ring in untrusted memory, served by the ExitlessIO workers
+	//of the App (EXITLESS_MODE in App.cpp as well), instead of OCALLs. See exitlessPathIO()
 	//#define EXITLESS_MODE 1
 	//#define PASSIVE_ADVERSARY 1
 	//#define DEBUG_EFO 1
@@ -164,6 +190,13 @@
 	}
 
 
+	#ifdef EXITLESS_MODE
+		bool exitlessSetup(void *ring);
+		bool exitlessPathIO(uint32_t storage_id, unsigned char *up_path, uint32_t up_path_size, uint32_t up_label, unsigned char *up_path_hash, uint32_t up_path_hash_size,
+			uint32_t up_level, uint32_t up_D_level, unsigned char *path, uint32_t path_size, uint32_t label, unsigned char *path_hash, uint32_t path_hash_size,
+			uint32_t level, uint32_t D_level);
+	#endif
+
 	void aes_dec_serialized(unsigned char* encrypted_block, uint32_t data_size, unsigned char *decrypted_block, unsigned char* aes_key);
 	void aes_enc_serialized(unsigned char* decrypted_block, uint32_t data_size, unsigned char *encrypted_block, unsigned char* aes_key);
 #endif
@@ -52,9 +52,14 @@ void ORAMTree::print_pmap0(){
     printf("\n");
 }
 
-void ORAMTree::verifyPath(unsigned char *path_array, unsigned char *path_hash, uint32_t leaf, uint32_t D, uint32_t block_size, uint32_t level) {
+/*
+verifyPath() - Checks a fetched path against the Merkle root of level. If decrypted_path_array is not NULL, every bucket
+is also decrypted into it, right before it is hashed, so the path streams through the cache once instead of twice.
+*/
+void ORAMTree::verifyPath(unsigned char *path_array, unsigned char *path_hash, uint32_t leaf, uint32_t D, uint32_t block_size, uint32_t level, unsigned char *decrypted_path_array) {
 	unsigned char *path_array_iter = path_array;
 	unsigned char *path_hash_iter = path_hash;
+	unsigned char *decrypted_path_iter = decrypted_path_array;
 	sgx_sha256_hash_t parent_hash;
 	sgx_sha256_hash_t child;
 	sgx_sha256_hash_t lchild;
@@ -67,6 +72,11 @@ void ORAMTree::verifyPath(unsigned char *path_array, unsigned char *path_hash, u
 	//uint32_t D = (uint32_t) ceil(log((double)max_blocks)/log((double)2));
 	
 	for(i=D+1;i>0;i--) {
+		if(decrypted_path_iter!=NULL) {
+			decryptPath(path_array_iter, decrypted_path_iter, Z, block_size - ADDITIONAL_METADATA_SIZE);
+			decrypted_path_iter+=(block_size*Z);
+		}
+
 		if(i==(D+1)) {
 			//No child hashes to compute			
 			sgx_sha256_msg(path_array_iter, (block_size*Z), (sgx_sha256_hash_t*)child);
@@ -234,6 +244,319 @@ void ORAMTree::encryptPath(unsigned char* path_array, unsigned char *encrypted_p
 	}
 }
 
+/*
+Sparse trees (SPARSE_TREES) :
+
+The build no longer uploads the tree, storage starts out as all zeros (holes in the tree files, untouched
+anonymous pages in memory) and a bucket is only materialized by the first path write that covers it.
+Until then, a bucket that reads back as all zeros stands for its initial contents: dummy blocks for
+internal buckets, and the blocks the build would have placed in it sequentially for leaf buckets.
+Likewise a zero hash slot stands for the hash of an untouched subtree, which only depends on the
+depth of its root, so the Merkle root of the fresh tree is computed in O(D) instead of over every bucket.
+*/
+
+/*
+computeInitialHashes() - initial_hash[d] = hash of an untouched subtree rooted at depth d,
+leaves are at depth D. initial_hash[0] is the Merkle root of the freshly built tree.
+*/
+void ORAMTree::computeInitialHashes(unsigned char *initial_hash, uint32_t D, uint32_t block_size) {
+	unsigned char *zero_bucket = (unsigned char*) calloc(Z, block_size);
+	sgx_sha256_msg(zero_bucket, block_size * Z, (sgx_sha256_hash_t*) (initial_hash + D * HASH_LENGTH));
+
+	for(int32_t d = D-1; d >= 0; d--) {
+		unsigned char *child_hash = initial_hash + (d+1) * HASH_LENGTH;
+		sgx_sha_state_handle_t sha_handle;
+		sgx_sha256_init(&sha_handle);
+		sgx_sha256_update(zero_bucket, block_size * Z, sha_handle);
+		sgx_sha256_update(child_hash, HASH_LENGTH, sha_handle);
+		sgx_sha256_update(child_hash, HASH_LENGTH, sha_handle);
+		sgx_sha256_get_hash(sha_handle, (sgx_sha256_hash_t*) (initial_hash + d * HASH_LENGTH));
+		sgx_sha256_close(sha_handle);
+	}
+	free(zero_bucket);
+}
+
+/*
+fillInitialHashes() - Replaces the zero slots of a fetched path_hash with the initial hash of their depth.
+
+path_hash holds the <L,R> pair of each non-root level from the leaf up, followed by the root hash.
+Done before verifyPath(), so that verification and CreateNewPathHash() only ever see real hashes.
+*/
+void ORAMTree::fillInitialHashes(unsigned char *path_hash, uint32_t D, uint32_t level) {
+	unsigned char *hashes = ((int32_t) level==-1) ? initial_hash : initial_hash_level[level];
+	unsigned char *slot = path_hash;
+
+	for(uint32_t i = 0; i < 2*D+1; i++) {
+		uint32_t depth = D - (i/2);
+		bool untouched = true;
+		for(uint32_t b = 0; b < HASH_LENGTH; b++) {
+			if(slot[b]!=0) {
+				untouched = false;
+				break;
+			}
+		}
+		if(untouched)
+			memcpy(slot, hashes + depth * HASH_LENGTH, HASH_LENGTH);
+		slot+=HASH_LENGTH;
+	}
+}
+
+/*
+initialLeaf() - Leaf the build places block id in : the first c leaves get bpb+1 blocks, the rest bpb,
+and ids are handed out in order of leaves.
+*/
+uint32_t ORAMTree::initialLeaf(uint64_t id, uint64_t real_blocks, uint64_t pN) {
+	uint64_t bpb = real_blocks / pN;
+	uint64_t c = real_blocks - (bpb * pN);
+
+	if(id < c * (bpb+1))
+		return (uint32_t) (id / (bpb+1));
+	return (uint32_t) (c + (id - c * (bpb+1)) / bpb);
+}
+
+/*
+fillInitialBuckets() - Writes the initial plaintext of every untouched block of a fetched path into decrypted_path.
+A block is untouched if it is all zeros in fetched_path, a real encrypted block never is (it starts with a random nonce).
+fetched_path and decrypted_path can be the same buffer (ENCRYPTION_ON off).
+*/
+void ORAMTree::fillInitialBuckets(unsigned char *fetched_path, unsigned char *decrypted_path, uint32_t leaf, uint32_t D, uint32_t tdata_size, uint32_t level) {
+	uint32_t block_size = tdata_size + ADDITIONAL_METADATA_SIZE;
+	uint64_t real_blocks, pN;
+	if((int32_t) level==-1) {
+		real_blocks = max_blocks;
+		pN = N;
+	}
+	else {
+		real_blocks = real_max_blocks_level[level];
+		pN = N_level[level];
+	}
+	uint64_t bpb = real_blocks / pN;
+	uint64_t c = real_blocks - (bpb * pN);
+
+	unsigned char *fetched_iter = fetched_path;
+	unsigned char *decrypted_iter = decrypted_path;
+	for(uint32_t i = 0; i < (D+1)*Z; i++) {
+		bool untouched = true;
+		for(uint32_t b = 0; b < block_size; b++) {
+			if(fetched_iter[b]!=0) {
+				untouched = false;
+				break;
+			}
+		}
+
+		if(untouched) {
+			uint32_t id = gN, treeLabel = 0;
+			//Blocks of the leaf bucket are the first Z of the path
+			uint32_t q = i % Z;
+			if(i < Z) {
+				uint64_t leaf_label = leaf - pN;
+				uint64_t blocks_in_this_bucket = bpb + ((leaf_label < c) ? 1 : 0);
+				if(q < blocks_in_this_bucket) {
+					id = (uint32_t) (leaf_label * bpb + ((leaf_label < c) ? leaf_label : c) + q);
+					treeLabel = (uint32_t) leaf_label;
+				}
+			}
+
+			unsigned char *data = decrypted_iter + ADDITIONAL_METADATA_SIZE;
+			memcpy(decrypted_iter + NONCE_LENGTH, &id, ID_SIZE_IN_BYTES);
+			memcpy(decrypted_iter + NONCE_LENGTH + ID_SIZE_IN_BYTES, &treeLabel, ID_SIZE_IN_BYTES);
+
+			if(id!=gN && (int32_t) level!=-1 && (int32_t) level!=recursion_levels) {
+				//Recursion data : the initial position map entries of the next level, as fill_recursion_data() does in the build
+				uint32_t *pmap_entries = (uint32_t*) data;
+				for(uint32_t p = 0; p < x; p++) {
+					uint64_t next_id = (uint64_t) id * x + p;
+					if(next_id < real_max_blocks_level[level+1])
+						pmap_entries[p] = initialLeaf(next_id, real_max_blocks_level[level+1], N_level[level+1]);
+					else
+						pmap_entries[p] = 0;
+				}
+			}
+			else {
+				for(uint32_t b = 0; b < tdata_size; b++)
+					data[b] = (b % 26) + 65;
+			}
+		}
+
+		fetched_iter+=block_size;
+		decrypted_iter+=block_size;
+	}
+}
+
+
+/*
+SetupEnclaveTrees() - Picks the levels kept in the enclave (ENCLAVE_TREES) : going up from level 1, as long as the trees so far
+fit in ENCLAVE_TREE_BUDGET, and allocates them. The data level is never one of them. Only depends on the parameters,
+so a restored instance picks the same levels its checkpoint was taken with.
+*/
+void ORAMTree::SetupEnclaveTrees() {
+	enclave_levels = 0;
+	enclave_tree_level = NULL;
+	if(recursion_levels==-1)
+		return;
+	enclave_tree_level = (unsigned char**) calloc(recursion_levels+1, sizeof(unsigned char*));
+
+	#ifdef ENCLAVE_TREES
+		uint64_t budget_used = 0;
+		for(int32_t level = 1; level < recursion_levels; level++) {
+			uint32_t pD_temp = ceil((double)max_blocks_level[level]/(double)Z);
+			uint32_t pD = (uint32_t) ceil(log((double)pD_temp)/log((double)2));
+			uint64_t pN = (uint64_t) 1 << pD;
+			uint64_t tree_size = (2*pN-1) * Z * (recursion_data_size + ADDITIONAL_METADATA_SIZE);
+			if(budget_used + tree_size > ENCLAVE_TREE_BUDGET)
+				break;
+			enclave_tree_level[level] = (unsigned char*) malloc(tree_size);
+			if(enclave_tree_level[level]==NULL)
+				break;
+			budget_used+= tree_size;
+			enclave_levels = level;
+		}
+		printf("ENCLAVE_TREES : Levels 1-%d kept in the enclave, %f MB\n", enclave_levels, float(budget_used)/float(1024*1024));
+	#endif
+}
+
+bool ORAMTree::isEnclaveTree(uint32_t level) {
+	return ((int32_t) level!=-1 && level>=1 && level<=enclave_levels);
+}
+
+/*
+StreamBuildTree() - Builds the tree of level (-1 for the non-recursive tree) in storage, with the contents fillInitialBuckets()
+gives an untouched one. Buckets are generated in post-order, each one as soon as its children are, so the hashes of the
+subtrees still waiting for their sibling fit on a stack of pD+1 hashes, and none is fetched back from storage.
+Encrypted buckets are gathered in a buffer of BUILD_CHUNK_SIZE bytes, uploaded with their hashes in one OCALL (uploadBuckets)
+whenever it fills up. Sets root_hash to the Merkle root of the tree.
+*/
+void ORAMTree::StreamBuildTree(uint32_t level, uint32_t pD, uint64_t pN, uint32_t tdata_size, unsigned char *root_hash) {
+	uint8_t ret;
+	uint32_t block_size = tdata_size + ADDITIONAL_METADATA_SIZE;
+	uint32_t bucket_size = Z * block_size;
+	uint32_t chunk_buckets = BUILD_CHUNK_SIZE / bucket_size;
+	if(chunk_buckets == 0)
+		chunk_buckets = 1;
+
+	unsigned char *chunk = (unsigned char*) malloc(chunk_buckets * bucket_size);
+	unsigned char *chunk_hashes = (unsigned char*) malloc(chunk_buckets * HASH_LENGTH);
+	uint32_t *chunk_labels = (uint32_t*) malloc(chunk_buckets * sizeof(uint32_t));
+	uint32_t in_chunk = 0;
+	unsigned char *hash_stack = (unsigned char*) malloc((pD+1) * HASH_LENGTH);
+	uint32_t stack_top = 0;
+
+	//Every bucket above the leaves starts out as the same dummies, the second bucket of any initial path
+	unsigned char *plain = (unsigned char*) calloc(2, bucket_size);
+	unsigned char *dummy_bucket = (unsigned char*) malloc(bucket_size);
+	fillInitialBuckets(plain, plain, pN, 1, tdata_size, level);
+	memcpy(dummy_bucket, plain + bucket_size, bucket_size);
+
+	for(uint64_t leaf = pN; leaf < 2*pN; leaf++) {
+		uint64_t node = leaf;
+		bool parent_done;
+		do {
+			unsigned char *bucket = chunk + in_chunk * bucket_size;
+			unsigned char *hash = chunk_hashes + in_chunk * HASH_LENGTH;
+			unsigned char *source = dummy_bucket;
+			if(node == leaf) {
+				memset(plain, 0, bucket_size);
+				fillInitialBuckets(plain, plain, node, 0, tdata_size, level);
+				source = plain;
+			}
+			#ifdef ENCRYPTION_ON
+				encryptPath(source, bucket, Z, tdata_size);
+			#else
+				memcpy(bucket, source, bucket_size);
+			#endif
+
+			if(node == leaf) {
+				sgx_sha256_msg(bucket, bucket_size, (sgx_sha256_hash_t*) hash);
+			}
+			else {
+				//Both children are on top of the stack, the left one below
+				stack_top-=2;
+				sgx_sha_state_handle_t sha_handle;
+				sgx_sha256_init(&sha_handle);
+				sgx_sha256_update(bucket, bucket_size, sha_handle);
+				sgx_sha256_update(hash_stack + stack_top * HASH_LENGTH, HASH_LENGTH, sha_handle);
+				sgx_sha256_update(hash_stack + (stack_top+1) * HASH_LENGTH, HASH_LENGTH, sha_handle);
+				sgx_sha256_get_hash(sha_handle, (sgx_sha256_hash_t*) hash);
+				sgx_sha256_close(sha_handle);
+			}
+			memcpy(hash_stack + stack_top * HASH_LENGTH, hash, HASH_LENGTH);
+			stack_top++;
+
+			chunk_labels[in_chunk] = (uint32_t) node;
+			in_chunk++;
+			if(in_chunk == chunk_buckets) {
+				uploadBuckets(&ret, storage_id, chunk, in_chunk * bucket_size, chunk_labels, chunk_hashes, in_chunk * HASH_LENGTH, in_chunk, block_size, level);
+				in_chunk = 0;
+			}
+
+			//A right child completes its parent
+			parent_done = (node%2==1 && node>1);
+			node = node>>1;
+		} while(parent_done);
+	}
+	if(in_chunk != 0)
+		uploadBuckets(&ret, storage_id, chunk, in_chunk * bucket_size, chunk_labels, chunk_hashes, in_chunk * HASH_LENGTH, in_chunk, block_size, level);
+
+	memcpy(root_hash, hash_stack, HASH_LENGTH);
+	free(chunk);
+	free(chunk_hashes);
+	free(chunk_labels);
+	free(hash_stack);
+	free(plain);
+	free(dummy_bucket);
+}
+
+uint64_t ORAMTree::enclaveTreeSize(uint32_t level) {
+	return (2*N_level[level]-1) * Z * (recursion_data_size + ADDITIONAL_METADATA_SIZE);
+}
+
+/*
+BuildEnclaveTree() - Fills the enclave tree of level with the contents the build gives an untrusted tree :
+the blocks of every leaf as placed by initialLeaf(), dummies everywhere else (see fillInitialBuckets()).
+*/
+void ORAMTree::BuildEnclaveTree(uint32_t level) {
+	uint32_t pD = D_level[level];
+	uint64_t pN = N_level[level];
+	uint32_t bucket_size = Z * (recursion_data_size + ADDITIONAL_METADATA_SIZE);
+	unsigned char *tree = enclave_tree_level[level];
+	unsigned char *path = (unsigned char*) malloc((pD+1) * bucket_size);
+
+	for(uint64_t leaf = pN; leaf < 2*pN; leaf++) {
+		memset(path, 0, (pD+1) * bucket_size);
+		fillInitialBuckets(path, path, leaf, pD, recursion_data_size, level);
+		memcpy(tree + (leaf-1) * bucket_size, path, bucket_size);
+		//Buckets above the leaves all start out as the same dummies
+		if(leaf==pN && pD > 0) {
+			for(uint64_t i = 1; i < pN; i++)
+				memcpy(tree + (i-1) * bucket_size, path + bucket_size, bucket_size);
+		}
+	}
+	free(path);
+	memset(merkle_root_hash_level[level], 0, HASH_LENGTH);
+}
+
+/*
+ReadEnclavePath()/WriteEnclavePath() - Path of leaf (a node label, leaf + N_level) between the enclave tree of level
+and a path buffer laid out as the untrusted paths are : the leaf bucket first, the root last.
+Like an untrusted path, every access touches one whole path of the tree.
+*/
+void ORAMTree::ReadEnclavePath(unsigned char *path, uint32_t leaf, uint32_t D_level, uint32_t level) {
+	uint32_t bucket_size = Z * (recursion_data_size + ADDITIONAL_METADATA_SIZE);
+	unsigned char *tree = enclave_tree_level[level];
+	for(uint32_t i = 0; i <= D_level; i++) {
+		memcpy(path, tree + (uint64_t)((leaf>>i)-1) * bucket_size, bucket_size);
+		path+= bucket_size;
+	}
+}
+
+void ORAMTree::WriteEnclavePath(unsigned char *path, uint32_t leaf, uint32_t D_level, uint32_t level) {
+	uint32_t bucket_size = Z * (recursion_data_size + ADDITIONAL_METADATA_SIZE);
+	unsigned char *tree = enclave_tree_level[level];
+	for(uint32_t i = 0; i <= D_level; i++) {
+		memcpy(tree + (uint64_t)((leaf>>i)-1) * bucket_size, path, bucket_size);
+		path+= bucket_size;
+	}
+}
 
 void ORAMTree::BuildTreeRecursive(int32_t level, uint32_t *prev_pmap){	
 	if(level == 0) {
@@ -250,7 +573,9 @@ void ORAMTree::BuildTreeRecursive(int32_t level, uint32_t *prev_pmap){
 		#endif			
 
 		if(recursion_levels!=-1) {
-			memcpy(posmap_l, prev_pmap, real_max_blocks_level[level] * sizeof(uint32_t));
+			//The position map of level 1 is the sequential placement of the build
+			for(uint32_t i = 0; i < real_max_blocks_level[level]; i++)
+				posmap_l[i] = initialLeaf(i, real_max_blocks_level[1], N_level[1]);
 			D_level[level] = 0;
 			N_level[level] = max_blocks_level[level];		
 		}		
@@ -271,161 +596,48 @@ void ORAMTree::BuildTreeRecursive(int32_t level, uint32_t *prev_pmap){
 	}
 	else {
 		uint32_t tdata_size;
-		uint32_t block_size;
 
 		uint32_t util_divisor = Z;
 		uint32_t pD_temp = ceil((double)max_blocks_level[level]/(double)util_divisor);
 		uint32_t pD = (uint32_t) ceil(log((double)pD_temp)/log((double)2));
 		uint32_t pN = (int) pow((double)2, (double) pD);
-		uint32_t ptreeSize = 2*pN-1;	
 		D_level[level] = pD;
 		N_level[level] = pN;
 
 		#ifdef BUILDTREE_DEBUG				
-			printf("\n\nBuildTreeRecursive,\nLevel : %d, Params - D = %d, N = %d, treeSize = %d, x = %d\n",level,pD,pN,ptreeSize,x);
+			printf("\n\nBuildTreeRecursive,\nLevel : %d, Params - D = %d, N = %d, treeSize = %d, x = %d\n",level,pD,pN,2*pN-1,x);
 		#endif
 
-		if(level==recursion_levels) {
-			tdata_size = data_size;	
-			block_size = (data_size+ADDITIONAL_METADATA_SIZE);		
-		}
-		else {	
+		if(level==recursion_levels)
+			tdata_size = data_size;
+		else
 			tdata_size = recursion_data_size;
-			block_size = recursion_data_size + ADDITIONAL_METADATA_SIZE;
-		}						
-
-		uint32_t *posmap_l = (uint32_t *) malloc(max_blocks_level[level] * sizeof(uint32_t));
-		if(posmap_l==NULL) {
-			printf("Failed to allocate\n");
-		}
 
-		uint32_t hashsize = HASH_LENGTH;
-		unsigned char* hash_lchild = (unsigned char*) malloc(HASH_LENGTH);	
-		unsigned char* hash_rchild = (unsigned char*) malloc(HASH_LENGTH);
-		uint32_t blocks_per_bucket_in_ll = real_max_blocks_level[level]/pN;
-
-		#ifdef BUILDTREE_DEBUG
-			printf("Posmap Size = %f MB\n",float(max_blocks_level[level]*sizeof(uint32_t))/(float(1024*1024)));
-			for(uint8_t jk = 0;jk <=recursion_levels; jk++) {
-				printf("real_max_blocks_level[%d] = %d \n",jk,real_max_blocks_level[jk]);
+		#ifdef ENCLAVE_TREES
+			if(isEnclaveTree(level)) {
+				BuildEnclaveTree(level);
+				BuildTreeRecursive(level-1, NULL);
+				return;
 			}
-			printf("\n");	
-			printf("pN = %d, level = %d, real_max_blocks_level[level] = %d, blocks_per_bucket_in_ll = %d\n",pN, level, real_max_blocks_level[level], blocks_per_bucket_in_ll);
 		#endif
 
-		uint32_t c = real_max_blocks_level[level] - (blocks_per_bucket_in_ll * pN);
-		uint32_t cnt = 0;
-
-		Bucket temp(Z);
-		temp.initialize(tdata_size, gN);
-		temp.displayBlocks();
-
-		//Build Last Level of Tree
-		uint32_t label = 0;
-		for(uint32_t i = pN; i <= ptreeSize; i++) {
-
-			temp.reset_values(gN);
-
-			uint32_t blocks_in_this_bucket = blocks_per_bucket_in_ll;
-			if(cnt < c) {
-				blocks_in_this_bucket+=1;
-				cnt+=1;
-			}
-
-			#ifdef BUILDTREE_DEBUG
-				printf("Bucket : %d\n", i);
-			#endif
-
-			for(uint8_t q=0;q<blocks_in_this_bucket;q++) {	
-				temp.blocks[q].id = label;
-				temp.blocks[q].treeLabel = i - pN;
-
-				if(level!=recursion_levels) { 	
-					#ifdef BUILDTREE_DEBUG										
-						printf("Block %d: ",temp.blocks[q].id);
-						for(uint8_t p=0;p<x;p++) {
-							printf("%d,",(prev_pmap[(label*x)+p]));
-						}
-						printf("\n");
-					#endif
-					temp.blocks[q].fill_recursion_data(&(prev_pmap[(label)*x]), recursion_data_size);
-				}
-				else{
-					#ifdef BUILDTREE_DEBUG
-						printf("(%d,%d)",temp.blocks[q].id, temp.blocks[q].treeLabel);
-					#endif
-				}
-
-				posmap_l[temp.blocks[q].id] = temp.blocks[q].treeLabel;
-				label++;	
-			}
-
-			#ifdef BUILDTREE_DEBUG
-				printf("\n");
-			#endif
-
-			#ifdef ENCRYPTION_ON
-				temp.aes_encryptBlocks(tdata_size, aes_key);
-			#endif			
-	
-			unsigned char *serialized_bucket = temp.serialize(tdata_size);
-			uint8_t ret;
-
-			//Hash / Integrity Tree
-			sgx_sha256_msg(serialized_bucket, block_size * Z, (sgx_sha256_hash_t*) &(merkle_root_hash_level[level]));
-
-			//Upload Bucket
-			uploadObject(&ret, serialized_bucket, Z*block_size ,i, (unsigned char*) &(merkle_root_hash_level[level]), HASH_LENGTH, block_size, level);
-
-			#ifdef BUILDTREE_VERIFICATION_DEBUG
-			printf("Level = %d, Bucket no = %d, Hash = ",level, i);
-			for(uint8_t l = 0;l<HASH_LENGTH;l++)
-			  printf("%c",(merkle_root_hash_level[level][l]%26)+'A');
-			printf("\n");
-			#endif
-
-			free(serialized_bucket);
-		}
-
-		//Build Upper Levels of Tree
-		for(uint32_t i = pN - 1; i>=1; i--){
-			temp.reset_values(gN);		
-
-			#ifdef ENCRYPTION_ON
-				temp.aes_encryptBlocks(tdata_size, aes_key);
-			#endif
-
-			unsigned char *serialized_bucket = temp.serialize(tdata_size);
-			uint8_t ret;
-
-			//Hash 	
-			build_fetchChildHash(i*2, i*2 +1, hash_lchild, hash_rchild, HASH_LENGTH, level);		
-			sgx_sha_state_handle_t p_sha_handle;
-			sgx_sha256_init(&p_sha_handle);
-			sgx_sha256_update(serialized_bucket, block_size * Z, p_sha_handle);					
-			sgx_sha256_update(hash_lchild, SGX_SHA256_HASH_SIZE, p_sha_handle);
-			sgx_sha256_update(hash_rchild, SGX_SHA256_HASH_SIZE, p_sha_handle);
-			sgx_sha256_get_hash(p_sha_handle, (sgx_sha256_hash_t*) merkle_root_hash_level[level]);
-			sgx_sha256_close(p_sha_handle);	
-
-			//Upload Bucket 
-			uploadObject(&ret, serialized_bucket, Z*block_size ,i, (unsigned char*) &(merkle_root_hash_level[level]), HASH_LENGTH, block_size, level);
+		#ifdef SPARSE_TREES
+			//Nothing is uploaded, only the Merkle root of the untouched tree is needed
+			initial_hash_level[level] = (unsigned char*) malloc((pD+1) * HASH_LENGTH);
+			computeInitialHashes(initial_hash_level[level], pD, tdata_size + ADDITIONAL_METADATA_SIZE);
+			memcpy(merkle_root_hash_level[level], initial_hash_level[level], HASH_LENGTH);
+		#else
+			StreamBuildTree(level, pD, pN, tdata_size, merkle_root_hash_level[level]);
+		#endif
 
-			#ifdef BUILDTREE_VERIFICATION_DEBUG
-			printf("Level = %d, Bucket no = %d, Hash = ",level, i);
+		#ifdef BUILDTREE_VERIFICATION_DEBUG
+			printf("Level = %d, Root hash = ",level);
 			for(uint8_t l = 0;l<HASH_LENGTH;l++)
-			  printf("%c",(merkle_root_hash_level[level][l]%26)+'A');
+				printf("%c",(merkle_root_hash_level[level][l]%26)+'A');
 			printf("\n");
-			#endif
-
-			free(serialized_bucket);	
-	        }
+		#endif
 
-		free(hash_lchild);
-		free(hash_rchild);
-		BuildTreeRecursive(level-1, posmap_l);
-		if(level!=0)
-			free(posmap_l);			
+		BuildTreeRecursive(level-1, NULL);
 	}
 	return;
 }
@@ -435,7 +647,7 @@ void ORAMTree::BuildTreeRecursive(int32_t level, uint32_t *prev_pmap){
         unsigned char *bucket_array = (unsigned char*) malloc(Z*block_size);
         unsigned char *hash = (unsigned char*) malloc(HASH_LENGTH);
         uint8_t rt;
-        downloadObject(&rt, bucket_array, Z*block_size, i, hash, HASH_LENGTH,level,D_level[level]);
+        downloadObject(&rt, storage_id, bucket_array, Z*block_size, i, hash, HASH_LENGTH,level,D_level[level]);
         Bucket temp2(bucket_array,data_size);
         //Bucket temp3(serialized_bucket, data_size);
         //printf("(%d,%d) \t",temp2.blocks[0].id,temp2.blocks[0].treeLabel);
@@ -460,9 +672,20 @@ void ORAMTree::Initialize() {
 	printf("In ORAMTree::Initialize(), After BuildTreeRecursive\n");
     }
     else {
+        SetupRecursiveStashes();
+        SetupEnclaveTrees();
+	printf("In ORAMTree::Initialize(), Before BuildTreeRecursive\n");
+        BuildTreeRecursive(recursion_levels, NULL);
+	printf("In ORAMTree::Initialize(), After BuildTreeRecursive\n");			
+    }
+
+	PerformMemoryAllocations();
+}
+
+void ORAMTree::SetupRecursiveStashes() {
         N_level = (uint64_t*) malloc ((recursion_levels +1) * sizeof(uint64_t));
         D_level = (uint32_t*) malloc ((recursion_levels +1) * sizeof(uint64_t));
-        recursive_stash = (Stash *) malloc(sizeof(Stash) * (recursion_levels+1));
+        recursive_stash = (Stash *) calloc(recursion_levels+1, sizeof(Stash));
         //Fix stash_size for each level
         // 2.19498 log2(N) + 1.56669 * lambda - 10.98615
         printf("RECURSION_LEVELS = %d\n", recursion_levels);
@@ -483,11 +706,9 @@ void ORAMTree::Initialize() {
 
 		}        
 	}
-	printf("In ORAMTree::Initialize(), Before BuildTreeRecursive\n");
-        BuildTreeRecursive(recursion_levels, NULL);
-	printf("In ORAMTree::Initialize(), After BuildTreeRecursive\n");			
-    }
+}
 
+void ORAMTree::PerformMemoryAllocations() {
 	uint32_t d_largest;
 	if(recursion_levels==-1)
 		d_largest = D;
@@ -498,7 +719,6 @@ void ORAMTree::Initialize() {
 	//So that we dont have to have costly malloc and free within access()
 	//Since ZT is currently single threaded, these are shared across all ORAM instances
 	//Will have to redesign these to be comoponents of the ORAM_Instance class in a multi-threaded setting.
-	//PerformMemoryAllocations()
 
 	uint64_t largest_path_size = Z*(data_size+ADDITIONAL_METADATA_SIZE)*(d_largest+1);
 	printf("Z=%d, data_size=%d, d_largest=%d, Largest_path_size = %ld\n", Z, data_size, d_largest, largest_path_size);
@@ -508,51 +728,483 @@ void ORAMTree::Initialize() {
 	path_hash = (unsigned char*) malloc (HASH_LENGTH*2*(d_largest+1));
 	new_path_hash = (unsigned char*) malloc (HASH_LENGTH*2*(d_largest+1));
 	serialized_result_block = (unsigned char*) malloc (data_size+ADDITIONAL_METADATA_SIZE);
+
+	#ifdef BATCH_PATHS
+		batch_fetched = (unsigned char*) malloc (MAX_BATCH_PATHS * largest_path_size);
+		batch_written_paths = (unsigned char*) malloc (MAX_BATCH_PATHS * largest_path_size);
+		batch_path_hash = (unsigned char*) malloc (MAX_BATCH_PATHS * HASH_LENGTH*2*(d_largest+1));
+		batch_new_hash = (unsigned char*) malloc (MAX_BATCH_PATHS * HASH_LENGTH*2*(d_largest+1));
+	#endif
 }
 
 /*
-uint32_t ORAMTree::savePosmap(unsigned char *posmap_serialized, uint32_t posmap_size) {
-    uint32_t real_pmap_size;			
-    if(recursive_posmap){
-        real_pmap_size = max_blocks_level[0]*16;
-        //printf("savePosmap : NO_OF_ENTRIES : %d\n",real_pmap_size);
-    }		
-    else{
-        real_pmap_size = max_blocks;
-    }
-    memcpy(posmap_serialized, posmap, real_pmap_size*4);
-    return (real_pmap_size*4);
+Checkpoint of an instance (sealed/unsealed by sealORAMInstance/restoreORAMInstance in ZT_Enclave.cpp) :
+<oram_state_header> <aes_key> <Merkle root of every tree> <posmap>
+then for every tree <uint32 no_of_blocks> <blocks of its stash, serialized>,
+then the enclave trees of levels 1..enclave_levels (ENCLAVE_TREES), whose roots are left out of the root check.
+Trees are the non-recursive tree, or recursion levels 1..recursion_levels, the posmap is the enclave-resident one (level 0).
+Everything else is recomputed from the parameters, so restoring costs no OCALLs besides one root check per tree.
+*/
+uint32_t ORAMTree::posmapEntries() {
+	if(recursion_levels==-1)
+		return max_blocks;
+	return real_max_blocks_level[0];
+}
+
+Stash* ORAMTree::stashOfTree(uint32_t tree, uint32_t *block_size) {
+	if(recursion_levels==-1) {
+		*block_size = data_size + ADDITIONAL_METADATA_SIZE;
+		return &stash;
+	}
+	int32_t level = tree + 1;
+	*block_size = ((level==recursion_levels) ? data_size : recursion_data_size) + ADDITIONAL_METADATA_SIZE;
+	return &(recursive_stash[level]);
+}
+
+unsigned char* ORAMTree::rootOfTree(uint32_t tree) {
+	if(recursion_levels==-1)
+		return (unsigned char*) merkle_root_hash;
+	return (unsigned char*) merkle_root_hash_level[tree + 1];
+}
+
+uint64_t ORAMTree::StateSize() {
+	uint32_t no_of_trees = (recursion_levels==-1) ? 1 : recursion_levels;
+	uint64_t size = sizeof(struct oram_state_header) + KEY_LENGTH + (uint64_t) no_of_trees * HASH_LENGTH;
+	size+= (uint64_t) posmapEntries() * sizeof(uint32_t);
+	for(uint32_t i = 0; i < no_of_trees; i++) {
+		uint32_t block_size;
+		Stash *tree_stash = stashOfTree(i, &block_size);
+		size+= sizeof(uint32_t) + (uint64_t) tree_stash->saveStash(NULL) * block_size;
+	}
+	for(uint32_t level = 1; level <= enclave_levels; level++)
+		size+= enclaveTreeSize(level);
+	return size;
 }
+
+void ORAMTree::SaveState(unsigned char *state, uint32_t poram_type) {
+	struct oram_state_header *header = (struct oram_state_header*) state;
+	uint32_t no_of_trees = (recursion_levels==-1) ? 1 : recursion_levels;
+	memcpy(header->magic, ORAM_STATE_MAGIC, 8);
+	header->oram_type = poram_type;
+	header->Z = Z;
+	header->max_blocks = max_blocks;
+	header->data_size = data_size;
+	header->stash_size = stash_size;
+	header->oblivious_flag = oblivious_flag;
+	header->recursion_data_size = recursion_data_size;
+	header->recursion_levels = recursion_levels;
+	header->mem_posmap_limit = mem_posmap_limit;
+	header->posmap_entries = posmapEntries();
+	header->no_of_trees = no_of_trees;
+	header->enclave_levels = enclave_levels;
+	header->reserved = 0;
+
+	unsigned char *state_ptr = state + sizeof(struct oram_state_header);
+	memcpy(state_ptr, aes_key, KEY_LENGTH);
+	state_ptr+= KEY_LENGTH;
+	for(uint32_t i = 0; i < no_of_trees; i++) {
+		memcpy(state_ptr, rootOfTree(i), HASH_LENGTH);
+		state_ptr+= HASH_LENGTH;
+	}
+	memcpy(state_ptr, posmap, (uint64_t) header->posmap_entries * sizeof(uint32_t));
+	state_ptr+= (uint64_t) header->posmap_entries * sizeof(uint32_t);
+	for(uint32_t i = 0; i < no_of_trees; i++) {
+		uint32_t block_size;
+		Stash *tree_stash = stashOfTree(i, &block_size);
+		uint32_t no_of_blocks = tree_stash->saveStash(state_ptr + sizeof(uint32_t));
+		memcpy(state_ptr, &no_of_blocks, sizeof(uint32_t));
+		state_ptr+= sizeof(uint32_t) + (uint64_t) no_of_blocks * block_size;
+	}
+	for(uint32_t level = 1; level <= enclave_levels; level++) {
+		memcpy(state_ptr, enclave_tree_level[level], enclaveTreeSize(level));
+		state_ptr+= enclaveTreeSize(level);
+	}
+}
+
+/*
+RestoreState() - Sets this (malloc'ed, uninitialized) instance up from a checkpoint written by SaveState,
+on top of the trees already held by storage pstorage_id. Returns false if the checkpoint is malformed,
+or if the root of a tree in storage is not the one the checkpoint authenticates (the trees moved on since).
 */
+bool ORAMTree::RestoreState(unsigned char *state, uint64_t state_size, uint32_t pstorage_id) {
+	struct oram_state_header *header = (struct oram_state_header*) state;
+	if(state_size < sizeof(struct oram_state_header) || memcmp(header->magic, ORAM_STATE_MAGIC, 8)!=0)
+		return false;
+
+	aes_key = (unsigned char*) malloc (KEY_LENGTH);
+	SetParams(header->Z, header->max_blocks, header->data_size, header->stash_size, header->oblivious_flag, header->recursion_data_size, header->recursion_levels, header->mem_posmap_limit, pstorage_id);
+	uint32_t no_of_trees = (recursion_levels==-1) ? 1 : recursion_levels;
+	if(header->no_of_trees != no_of_trees || header->posmap_entries != posmapEntries())
+		return false;
+	uint64_t fixed_size = sizeof(struct oram_state_header) + KEY_LENGTH + (uint64_t) no_of_trees * HASH_LENGTH + (uint64_t) header->posmap_entries * sizeof(uint32_t);
+	if(state_size < fixed_size)
+		return false;
+
+	//Tree geometry and stashes, as BuildTree/BuildTreeRecursive leave them
+	uint32_t util_divisor = Z;
+	if(recursion_levels==-1) {
+		uint32_t pD_temp = ceil((double)max_blocks/(double)util_divisor);
+		D = (uint32_t) ceil(log((double)pD_temp)/log((double)2));
+		N = (int) pow((double)2, (double) D);
+		treeSize = 2*N-1;
+		gN = max_blocks;
+		if(oblivious_flag)
+			stash.setup(stash_size, data_size, gN);
+		else
+			stash.setup_nonoblivious(data_size, gN);
+		#ifdef SPARSE_TREES
+			initial_hash = (unsigned char*) malloc((D+1) * HASH_LENGTH);
+			computeInitialHashes(initial_hash, D, data_size + ADDITIONAL_METADATA_SIZE);
+		#endif
+	}
+	else {
+		SetupRecursiveStashes();
+		for(int32_t level = 1; level <= recursion_levels; level++) {
+			uint32_t pD_temp = ceil((double)max_blocks_level[level]/(double)util_divisor);
+			D_level[level] = (uint32_t) ceil(log((double)pD_temp)/log((double)2));
+			N_level[level] = (int) pow((double)2, (double) D_level[level]);
+			#ifdef SPARSE_TREES
+				uint32_t block_size = ((level==recursion_levels) ? data_size : recursion_data_size) + ADDITIONAL_METADATA_SIZE;
+				initial_hash_level[level] = (unsigned char*) malloc((D_level[level]+1) * HASH_LENGTH);
+				computeInitialHashes(initial_hash_level[level], D_level[level], block_size);
+			#endif
+		}
+		D_level[0] = 0;
+		N_level[0] = max_blocks_level[0];
+		SetupEnclaveTrees();
+	}
+	if(header->enclave_levels != enclave_levels)
+		return false;
+
+	unsigned char *state_ptr = state + sizeof(struct oram_state_header);
+	memcpy(aes_key, state_ptr, KEY_LENGTH);
+	state_ptr+= KEY_LENGTH;
+	for(uint32_t i = 0; i < no_of_trees; i++) {
+		memcpy(rootOfTree(i), state_ptr, HASH_LENGTH);
+		state_ptr+= HASH_LENGTH;
+	}
+	posmap = (uint32_t*) malloc((uint64_t) header->posmap_entries * sizeof(uint32_t));
+	memcpy(posmap, state_ptr, (uint64_t) header->posmap_entries * sizeof(uint32_t));
+	state_ptr+= (uint64_t) header->posmap_entries * sizeof(uint32_t);
+	for(uint32_t i = 0; i < no_of_trees; i++) {
+		uint32_t block_size, no_of_blocks;
+		Stash *tree_stash = stashOfTree(i, &block_size);
+		if((uint64_t) (state_ptr - state) + sizeof(uint32_t) > state_size)
+			return false;
+		memcpy(&no_of_blocks, state_ptr, sizeof(uint32_t));
+		state_ptr+= sizeof(uint32_t);
+		if((uint64_t) (state_ptr - state) + (uint64_t) no_of_blocks * block_size > state_size)
+			return false;
+		tree_stash->restoreStash(state_ptr, no_of_blocks, oblivious_flag);
+		state_ptr+= (uint64_t) no_of_blocks * block_size;
+	}
+	for(uint32_t level = 1; level <= enclave_levels; level++) {
+		if((uint64_t) (state_ptr - state) + enclaveTreeSize(level) > state_size)
+			return false;
+		memcpy(enclave_tree_level[level], state_ptr, enclaveTreeSize(level));
+		state_ptr+= enclaveTreeSize(level);
+	}
+	PerformMemoryAllocations();
+
+	//Root of every tree in storage, an untouched (sparse) tree has none stored yet, enclave trees have none at all
+	unsigned char *stored_root = (unsigned char*) malloc(HASH_LENGTH);
+	unsigned char *stored_root2 = (unsigned char*) malloc(HASH_LENGTH);
+	unsigned char *zero_hash = (unsigned char*) calloc(1, HASH_LENGTH);
+	bool match = true;
+	for(uint32_t i = 0; i < no_of_trees && match; i++) {
+		int32_t level = (recursion_levels==-1) ? -1 : (i + 1);
+		if(isEnclaveTree(level))
+			continue;
+		build_fetchChildHash(storage_id, 1, 1, stored_root, stored_root2, HASH_LENGTH, level);
+		#ifdef SPARSE_TREES
+			if(memcmp(stored_root, zero_hash, HASH_LENGTH)==0)
+				memcpy(stored_root, (recursion_levels==-1) ? initial_hash : initial_hash_level[level], HASH_LENGTH);
+		#endif
+		match = (memcmp(stored_root, rootOfTree(i), HASH_LENGTH)==0);
+	}
+	free(stored_root);
+	free(stored_root2);
+	free(zero_hash);
+	return match;
+}
+
+static void freeStashBlocks(Stash *stash) {
+	struct nodev2 *node = stash->getStart();
+	while(node != NULL) {
+		struct nodev2 *next = node->next;
+		free(node->serialized_block);
+		free(node);
+		node = next;
+	}
+	stash->setStart(NULL);
+}
+
 /*
-uint32_t saveState(unsigned char *posmap_serialized, uint32_t posmap_size, unsigned char* stash_serialized, uint32_t stash_size) {
-        //ASIDE : Test if SGX will fail if posmap_serialized returned a pointer to the posmap in PRM
-        memcpy(posmap_serialized, posmap, posmap_size);
-        uint32_t stash_size_returned = stash.saveStash(stash_serialized, -1);
-        return stash_size_returned;
+ReleaseState() - Frees what a failed RestoreState allocated, for an instance that was calloc'ed before it (restoreORAMInstance),
+so whatever RestoreState didn't get to is still NULL. The instance itself is left to the caller.
+*/
+void ORAMTree::ReleaseState() {
+	if(aes_key != NULL) {
+		memset_s(aes_key, KEY_LENGTH, 0, KEY_LENGTH);
+		free(aes_key);
+	}
+	free(posmap);
+	freeStashBlocks(&stash);
+	free(initial_hash);
+	if(recursion_levels != -1) {
+		for(int32_t level = 1; recursive_stash != NULL && level <= recursion_levels; level++)
+			freeStashBlocks(&(recursive_stash[level]));
+		for(int32_t level = 0; initial_hash_level != NULL && level <= recursion_levels; level++)
+			free(initial_hash_level[level]);
+		for(int32_t level = 0; enclave_tree_level != NULL && level <= recursion_levels; level++)
+			free(enclave_tree_level[level]);
+	}
+	free(recursive_stash);
+	free(initial_hash_level);
+	free(enclave_tree_level);
+	free(direct_tree_level);
+	free(max_blocks_level);
+	free(real_max_blocks_level);
+	free(N_level);
+	free(D_level);
+	free(merkle_root_hash_level);
+	free(encrypted_path);
+	free(decrypted_path);
+	free(fetched_path_array);
+	free(path_hash);
+	free(new_path_hash);
+	free(serialized_result_block);
+	#ifdef BATCH_PATHS
+		free(batch_fetched);
+		free(batch_written_paths);
+		free(batch_path_hash);
+		free(batch_new_hash);
+	#endif
+}
+
+/*
+Audit of the trees in storage (after ZT_Resume, or after applying snapshots) :
+
+A tree matches the root held by the enclave if the stored hash of its root is that root, and every node satisfies
+hash = H(bucket) at the leaves and H(bucket | hash(left) | hash(right)) above, with the hashes as stored.
+So every node can be checked on its own : the tree is walked bottom-up in chunks of consecutive buckets of a depth,
+each fetched with one OCALL (auditFetch) together with their hashes and those of their children, and the chunks are
+dealt round-robin to the threads of the audit. Zero hash slots stand for untouched subtrees (SPARSE_TREES),
+enclave trees (ENCLAVE_TREES) have nothing in storage to check.
+*/
+
+/*
+auditBucket() - Checks one fetched bucket at depth against its stored hash and the stored hashes of its children.
+*/
+bool ORAMTree::auditBucket(unsigned char *bucket, uint32_t bucket_size, unsigned char *hash, unsigned char *child_hashes, uint32_t depth, uint32_t tree_depth, int32_t level) {
+	sgx_sha256_hash_t computed;
+	unsigned char *expected = hash;
+	unsigned char *children = child_hashes;
+
+	#ifdef SPARSE_TREES
+		unsigned char *initial = (level==-1) ? initial_hash : initial_hash_level[level];
+		unsigned char filled[3 * HASH_LENGTH];
+		unsigned char zero_hash[HASH_LENGTH] = {0};
+		if(memcmp(hash, zero_hash, HASH_LENGTH)==0)
+			expected = initial + depth * HASH_LENGTH;
+		if(depth != tree_depth) {
+			for(uint32_t c = 0; c < 2; c++) {
+				bool untouched = (memcmp(child_hashes + c * HASH_LENGTH, zero_hash, HASH_LENGTH)==0);
+				memcpy(filled + c * HASH_LENGTH, untouched ? initial + (depth+1) * HASH_LENGTH : child_hashes + c * HASH_LENGTH, HASH_LENGTH);
+			}
+			children = filled;
+		}
+	#endif
+
+	if(depth == tree_depth) {
+		sgx_sha256_msg(bucket, bucket_size, &computed);
+	}
+	else {
+		sgx_sha_state_handle_t sha_handle;
+		sgx_sha256_init(&sha_handle);
+		sgx_sha256_update(bucket, bucket_size, sha_handle);
+		sgx_sha256_update(children, 2 * HASH_LENGTH, sha_handle);
+		sgx_sha256_get_hash(sha_handle, &computed);
+		sgx_sha256_close(sha_handle);
+	}
+	return (memcmp(computed, expected, HASH_LENGTH)==0);
+}
+
+/*
+AuditTrees() - Share thread_no (of no_of_threads) of the audit of every tree of this instance in storage.
+Only reads the instance, so the shares run concurrently, one ECALL per thread (see ZT_Audit).
+Returns the number of buckets verified, -1 as soon as one of them (or the root) doesn't match.
+*/
+int64_t ORAMTree::AuditTrees(uint32_t thread_no, uint32_t no_of_threads) {
+	uint32_t no_of_trees = (recursion_levels==-1) ? 1 : recursion_levels;
+	uint64_t chunk_no = 0;
+	int64_t verified = 0;
+	bool match = true;
+	uint8_t rt;
+
+	for(uint32_t i = 0; i < no_of_trees && match; i++) {
+		int32_t level = (recursion_levels==-1) ? -1 : (i + 1);
+		if(isEnclaveTree(level))
+			continue;
+		uint32_t tree_depth = (level==-1) ? D : D_level[level];
+		uint32_t block_size = ((level==-1 || level==recursion_levels) ? data_size : recursion_data_size) + ADDITIONAL_METADATA_SIZE;
+		uint32_t bucket_size = Z * block_size;
+		uint32_t chunk_buckets = (AUDIT_CHUNK_SIZE < bucket_size) ? 1 : (AUDIT_CHUNK_SIZE / bucket_size);
+		unsigned char *buckets = (unsigned char*) malloc((uint64_t) chunk_buckets * bucket_size);
+		unsigned char *hashes = (unsigned char*) malloc((uint64_t) chunk_buckets * HASH_LENGTH);
+		unsigned char *child_hashes = (unsigned char*) malloc((uint64_t) chunk_buckets * 2 * HASH_LENGTH);
+
+		for(int32_t depth = tree_depth; depth >= 0 && match; depth--) {
+			uint64_t first = (uint64_t) 1 << depth;
+			for(uint64_t label = first; label < 2 * first && match; label+= chunk_buckets, chunk_no++) {
+				if(chunk_no % no_of_threads != thread_no)
+					continue;
+				uint32_t count = ((2 * first - label) < chunk_buckets) ? (uint32_t) (2 * first - label) : chunk_buckets;
+				uint32_t child_hashes_size = ((uint32_t) depth == tree_depth) ? 0 : (count * 2 * HASH_LENGTH);
+				auditFetch(&rt, storage_id, buckets, count * bucket_size, (uint32_t) label, count, hashes, count * HASH_LENGTH, child_hashes, child_hashes_size, block_size, level);
+
+				for(uint32_t b = 0; b < count && match; b++)
+					match = auditBucket(buckets + (uint64_t) b * bucket_size, bucket_size, hashes + b * HASH_LENGTH, child_hashes + b * 2 * HASH_LENGTH, depth, tree_depth, level);
+				if(match && label == 1) {
+					//The stored root, which the check above tied to the rest of the tree, has to be the one of the enclave
+					unsigned char *stored_root = hashes;
+					#ifdef SPARSE_TREES
+						unsigned char zero_hash[HASH_LENGTH] = {0};
+						if(memcmp(stored_root, zero_hash, HASH_LENGTH)==0)
+							stored_root = (level==-1) ? initial_hash : initial_hash_level[level];
+					#endif
+					match = (memcmp(stored_root, rootOfTree(i), HASH_LENGTH)==0);
+				}
+				if(!match)
+					printf("AUDIT : Tree %d doesn't match its root, buckets %d-%d at depth %d\n", level, (uint32_t) label, (uint32_t) label + count - 1, depth);
+				verified+= count;
+			}
+		}
+		free(buckets);
+		free(hashes);
+		free(child_hashes);
+	}
+	return match ? verified : -1;
+}
+
+/*
+AttachDirectTree() - Takes up the App's in-memory tree of level (DIRECT_TREES, see DirectTree.hpp), whose paths are
+read and written in place from then on. The description comes from the App, so it is checked against the parameters
+of the tree, and every record it can place has to lie within the untrusted range [base, base+tree_size).
+*/
+bool ORAMTree::AttachDirectTree(uint32_t level, struct direct_tree *tree) {
+	uint32_t D_temp, tdata_size;
+	if((int32_t) level==-1) {
+		if(recursion_levels != -1)
+			return false;
+		D_temp = D;
+		tdata_size = data_size;
+	}
+	else {
+		if(recursion_levels == -1 || level < 1 || (int32_t) level > recursion_levels || isEnclaveTree(level))
+			return false;
+		D_temp = D_level[level];
+		tdata_size = ((int32_t) level==recursion_levels) ? data_size : recursion_data_size;
+	}
+
+	if(tree->depth != D_temp || tree->record_size != Z*(tdata_size+ADDITIONAL_METADATA_SIZE) + 2*HASH_LENGTH
+			|| tree->record_stride < tree->record_size || tree->header_size < HASH_LENGTH || tree->subtree_height == 0
+			|| tree->no_of_layers > DIRECT_TREE_MAX_LAYERS || tree->no_of_layers != (D_temp + tree->subtree_height) / tree->subtree_height)
+		return false;
+	if(tree->base == NULL || sgx_is_outside_enclave(tree->base, tree->tree_size) != 1)
+		return false;
+	//Bounding the layers by the tree keeps the offsets from wrapping around, and the last bucket of every depth
+	//is the one placed furthest into its layer
+	for(uint32_t l = 0; l < tree->no_of_layers; l++) {
+		uint64_t subtrees = (uint64_t) 1 << (l * tree->subtree_height);
+		if(tree->layer_base[l] > tree->tree_size || tree->layer_stride[l] > tree->tree_size / subtrees)
+			return false;
+	}
+	for(uint32_t depth = 0; depth <= D_temp; depth++) {
+		uint32_t last = (uint32_t) (((uint64_t) 2 << depth) - 1);
+		if(directRecordOffset(tree, last) + tree->record_stride > tree->tree_size)
+			return false;
+	}
+	if(tree->dirty_bitmap != NULL) {
+		if(tree->dirty_bitmap_size < (((uint64_t) 2 << D_temp) + 7) / 8 || sgx_is_outside_enclave(tree->dirty_bitmap, tree->dirty_bitmap_size) != 1)
+			return false;
+	}
+
+	if(direct_tree_level == NULL)
+		direct_tree_level = (struct direct_tree*) calloc((recursion_levels==-1) ? 1 : (recursion_levels+1), sizeof(struct direct_tree));
+	memcpy(&(direct_tree_level[((int32_t) level==-1) ? 0 : level]), tree, sizeof(struct direct_tree));
+	return true;
+}
+
+struct direct_tree* ORAMTree::directTreeOf(uint32_t level) {
+	if(direct_tree_level == NULL)
+		return NULL;
+	struct direct_tree *tree = &(direct_tree_level[((int32_t) level==-1) ? 0 : level]);
+	return (tree->base == NULL) ? NULL : tree;
+}
+
+//Offset of the record of bucket_no (root = 1), as LocalStorage::recordOffset places it
+uint64_t ORAMTree::directRecordOffset(struct direct_tree *tree, uint32_t bucket_no) {
+	uint32_t depth = 31 - __builtin_clz(bucket_no);
+	uint32_t layer = depth / tree->subtree_height;
+	uint32_t depth_in_subtree = depth - layer * tree->subtree_height;
+	uint32_t subtree_root = bucket_no >> depth_in_subtree;
+	uint32_t local_no = bucket_no - (subtree_root << depth_in_subtree) + (1 << depth_in_subtree);
+	uint64_t subtree_no = subtree_root - ((uint64_t) 1 << (layer * tree->subtree_height));
+	return tree->layer_base[layer] + subtree_no * tree->layer_stride[layer] + tree->header_size + (uint64_t) (local_no-1) * tree->record_stride;
 }
-uint32_t restoreState(uint32_t* posmap_stored, uint32_t posmap_size, uint32_t *stash_serialized, uint32_t stash_size)
-{
-    posmap = (uint32_t*) malloc(posmap_size);
-    memcpy(posmap, posmap_stored, posmap_size);
-    stash.restoreStash(stash_serialized, stash_size/8);
-
-    node *iter = stash.start;
-    while(iter) {
-        if(iter->occupied==true&&iter->block->id!=gN){
-            printf("%d\n",iter->block->id);
-        }				
-        iter= iter->next;
-    }
 
-    return 1;
+/*
+ReadDirectPath() - Copies the path of leaf out of a direct tree, in the layout downloadPath returns it in : buckets leaf to root,
+and the <L,R> hash pair under every node above the leaf, followed by the root hash.
+The path is copied in once and verified and decrypted from the copy, the App can't change what was verified.
+*/
+void ORAMTree::ReadDirectPath(unsigned char *path, unsigned char *path_hash, uint32_t leaf, uint32_t D_level, struct direct_tree *tree) {
+	uint32_t bucket_size = tree->record_size - 2*HASH_LENGTH;
+	uint32_t temp = leaf;
+	unsigned char *path_iter = path;
+	unsigned char *pair_iter = path_hash;
+	for(uint32_t i = 0; i < D_level+1; i++) {
+		unsigned char *record = tree->base + directRecordOffset(tree, temp);
+		memcpy(path_iter, record+HASH_LENGTH, bucket_size);
+		if(i!=0) {
+			memcpy(pair_iter, record, HASH_LENGTH);
+			memcpy(pair_iter+HASH_LENGTH, record+HASH_LENGTH+bucket_size, HASH_LENGTH);
+			pair_iter+=(2*HASH_LENGTH);
+		}
+		if(temp==1)
+			memcpy(pair_iter, tree->base, HASH_LENGTH);
+		path_iter+=bucket_size;
+		temp = temp>>1;
+	}
 }
+
+/*
+WriteDirectPath() - Writes an encrypted path and its new hashes (one per node, leaf to root) into a direct tree :
+the bucket of every node into its record and its hash into the L/R slot of its parent's record, or in front of the tree for the root.
 */
+void ORAMTree::WriteDirectPath(unsigned char *path, unsigned char *path_hash, uint32_t leaf, uint32_t D_level, struct direct_tree *tree) {
+	uint32_t bucket_size = tree->record_size - 2*HASH_LENGTH;
+	uint32_t temp = leaf;
+	unsigned char *path_iter = path;
+	unsigned char *path_hash_iter = path_hash;
+	for(uint32_t i = 0; i < D_level+1; i++) {
+		memcpy(tree->base + directRecordOffset(tree, temp) + HASH_LENGTH, path_iter, bucket_size);
+		uint64_t hash_offset = 0;
+		if(temp!=1)
+			hash_offset = directRecordOffset(tree, temp>>1) + ((temp%2==0) ? 0 : (tree->record_size-HASH_LENGTH));
+		memcpy(tree->base + hash_offset, path_hash_iter, HASH_LENGTH);
+		if(tree->dirty_bitmap != NULL)
+			tree->dirty_bitmap[temp>>3] |= (1<<(temp&7));
+		path_iter+=bucket_size;
+		path_hash_iter+=HASH_LENGTH;
+		temp = temp>>1;
+	}
+}
 
 //For non-recursive level = -1
 unsigned char* ORAMTree::ReadBucketsFromPath(uint32_t leaf, unsigned char *path_hash, uint32_t level) {
 	uint32_t temp = leaf;
-	uint8_t rt;
 	uint32_t tdata_size;
 	uint32_t path_size, path_hash_size;
 	uint32_t D_temp; 
@@ -575,37 +1227,73 @@ unsigned char* ORAMTree::ReadBucketsFromPath(uint32_t leaf, unsigned char *path_
 		D_temp = D_level[level];
 	}		
 
-	#ifdef EXITLESS_MODE
-		//while( !(*(req_struct->block)) ) {}
-		*(req_struct->id) = leaf;
-		*(req_struct->level) = level;
-		*(req_struct->d_lev) = D_level[level];
-		*(req_struct->recursion) = true;
-		*(req_struct->block) = false;			
-
-		while( !(*(req_struct->block)) ) {} // Wait til spinlock is set to true by RequestHandler thread
-
-		fetched_path_array = resp_struct->path;
-		// NOTE DO NOT FREE THESE IN EXITLESS MODE
-		//Set path_array from resp_struct					
-	#else
-		downloadPath(&rt, fetched_path_array, path_size, leaf, path_hash, path_hash_size, level, D_temp);
+	#ifdef ENCLAVE_TREES
+		if(isEnclaveTree(level)) {
+			ReadEnclavePath(decrypted_path, leaf, D_temp, level);
+			return decrypted_path;
+		}
 	#endif
 
-	#ifndef PASSIVE_ADVERSARY
-		verifyPath(fetched_path_array,path_hash,leaf,D_temp,tdata_size + ADDITIONAL_METADATA_SIZE, level);
+	bool fetched = false;
+	//Paths of a batch were verified as they came in
+	bool verified = false;
+	#ifdef BATCH_PATHS
+		if(batch_active) {
+			if(level == batch_level && batch_next < batch_paths && leaf == batch_leaf[batch_next]) {
+				TakeBatchPath(fetched_path_array, path_hash);
+				fetched = true;
+				verified = true;
+			}
+			else
+				EndPathBatch();
+		}
+	#endif
+	#ifdef DIRECT_TREES
+		struct direct_tree *direct = directTreeOf(level);
+		if(direct != NULL) {
+			//A write-back held for another tree goes out first
+			FlushPath();
+			ReadDirectPath(fetched_path_array, path_hash, leaf, D_temp, direct);
+			fetched = true;
+		}
+	#endif
+	if(!fetched)
+		FetchPaths(1, &leaf, fetched_path_array, path_hash, path_size, path_hash_size, level, D_temp);
+
+	#ifdef ENCRYPTION_ON
+		//Decrypted along with the verification, unless the path was verified before
+		bool decrypted = false;
 	#endif
+	if(!verified) {
+		#ifdef SPARSE_TREES
+			fillInitialHashes(path_hash, D_temp, level);
+		#endif
+
+		#ifndef PASSIVE_ADVERSARY
+			#ifdef ENCRYPTION_ON
+				verifyPath(fetched_path_array,path_hash,leaf,D_temp,tdata_size + ADDITIONAL_METADATA_SIZE, level, decrypted_path);
+				decrypted = true;
+			#else
+				verifyPath(fetched_path_array,path_hash,leaf,D_temp,tdata_size + ADDITIONAL_METADATA_SIZE, level, NULL);
+			#endif
+		#endif
+	}
 
 	#ifdef ACCESS_DEBUG
 		printf("Verified path \n");
 	#endif
 
 	#ifdef ENCRYPTION_ON
-		decryptPath(fetched_path_array,decrypted_path,(Z*(D_temp+1)),tdata_size);
+		if(!decrypted)
+			decryptPath(fetched_path_array,decrypted_path,(Z*(D_temp+1)),tdata_size);
 	#else
 		decrypted_path = fetched_path_array;			
 	#endif
 
+	#ifdef SPARSE_TREES
+		fillInitialBuckets(fetched_path_array, decrypted_path, leaf, D_temp, tdata_size, level);
+	#endif
+
 	#ifdef ACCESS_DEBUG
 		printf("Decrypted path \n");
 	#endif
@@ -617,12 +1305,259 @@ unsigned char* ORAMTree::ReadBucketsFromPath(uint32_t leaf, unsigned char *path_
 	#endif
 }
 
-void ORAMTree::CreateNewPathHash(unsigned char *path_ptr, unsigned char *old_path_hash, unsigned char *new_path_hash, uint32_t leaf, uint32_t block_size, uint32_t D_level, uint32_t level){
+/*
+WriteBackPath() - Uploads a rewritten path and its hashes. With EXCHANGE_PATHS, a path encrypted into encrypted_path
+with its hashes in new_path_hash (which nothing else writes before the next fetch) is only noted here, and goes out
+ahead of the next ReadBucketsFromPath, in the same OCALL as the path it fetches. Uploading first keeps the next fetch
+right even on the same tree (the eviction paths of CircuitORAM). The access ECALLs end with FlushPath(), so the trees
+are up to date whenever the enclave is left, and that last upload is an OCALL of its own : a recursive access over
+the L+1 trees costs L+2 path OCALLs instead of 2(L+1).
+*/
+void ORAMTree::WriteBackPath(unsigned char *path, uint32_t path_size, uint32_t leaf, unsigned char *path_hash, uint32_t path_hash_size, uint32_t level, uint32_t D_level) {
+	uint8_t rt;
+	#ifdef DIRECT_TREES
+		struct direct_tree *direct = directTreeOf(level);
+		if(direct != NULL) {
+			WriteDirectPath(path, path_hash, leaf, D_level, direct);
+			return;
+		}
+	#endif
+	#ifdef BATCH_PATHS
+		if(batch_active && level == batch_level && batch_written < batch_paths && path_size == batch_path_size) {
+			memcpy(batch_written_paths + batch_written * batch_path_size, path, path_size);
+			memcpy(batch_new_hash + batch_written * path_hash_size, path_hash, path_hash_size);
+			batch_written_leaf[batch_written] = leaf;
+			batch_new_hash_size = path_hash_size;
+			batch_written++;
+			if(batch_written == batch_paths)
+				EndPathBatch();
+			return;
+		}
+	#endif
+	#ifdef EXCHANGE_PATHS
+		FlushPath();
+		if(path == encrypted_path && path_hash == new_path_hash) {
+			pending_paths = 1;
+			pending_leaf[0] = leaf;
+			pending_path_data = encrypted_path;
+			pending_hash_data = new_path_hash;
+			pending_level = level;
+			pending_D_level = D_level;
+			pending_path_size = path_size;
+			pending_hash_size = path_hash_size;
+			upload_pending = true;
+			return;
+		}
+	#endif
+	#ifdef EXITLESS_MODE
+		if(exitlessPathIO(storage_id, path, path_size, leaf, path_hash, path_hash_size, level, D_level, NULL, 0, 0, NULL, 0, 0, 0))
+			return;
+	#endif
+	uploadPath(&rt, storage_id, path, path_size, leaf, path_hash, path_hash_size, level, D_level);
+}
+
+/*
+FlushPath() - Uploads the paths WriteBackPath() or a batch is holding, if any.
+*/
+void ORAMTree::FlushPath() {
+	uint8_t rt;
+	#ifdef BATCH_PATHS
+		if(batch_active)
+			EndPathBatch();
+	#endif
+	if(upload_pending) {
+		uint32_t sent = 0;
+		#ifdef EXITLESS_MODE
+			while(sent < pending_paths && exitlessPathIO(storage_id, pending_path_data + sent * pending_path_size, pending_path_size, pending_leaf[sent],
+				pending_hash_data + sent * pending_hash_size, pending_hash_size, pending_level, pending_D_level, NULL, 0, 0, NULL, 0, 0, 0))
+				sent++;
+		#endif
+		if(pending_paths - sent == 1)
+			uploadPath(&rt, storage_id, pending_path_data + sent * pending_path_size, pending_path_size, pending_leaf[sent], pending_hash_data + sent * pending_hash_size,
+				pending_hash_size, pending_level, pending_D_level);
+		else if(sent < pending_paths)
+			exchangePaths(&rt, storage_id, pending_path_data + sent * pending_path_size, (pending_paths - sent) * pending_path_size, pending_leaf + sent,
+				pending_hash_data + sent * pending_hash_size, (pending_paths - sent) * pending_hash_size, pending_paths - sent, pending_level, pending_D_level,
+				NULL, 0, NULL, NULL, 0, 0, 0, 0);
+		upload_pending = false;
+	}
+}
+
+/*
+FetchPaths() - Fetches no_of_paths paths of level to labels (path_size bytes and path_hash_size bytes of hashes each,
+back to back in paths and hashes), after uploading the paths being held : in one downloadPath, exchangePath or
+exchangePaths OCALL, whichever fits.
+*/
+void ORAMTree::FetchPaths(uint32_t no_of_paths, uint32_t *labels, unsigned char *paths, unsigned char *hashes, uint32_t path_size, uint32_t path_hash_size, uint32_t level, uint32_t D_level) {
+	uint8_t rt;
+	uint32_t done = 0;
+	#ifdef EXITLESS_MODE
+		//A request on the ring carries at most one upload
+		if(upload_pending && pending_paths > 1)
+			FlushPath();
+		while(done < no_of_paths) {
+			bool up = upload_pending;
+			if(!exitlessPathIO(storage_id, up ? pending_path_data : NULL, up ? pending_path_size : 0, up ? pending_leaf[0] : 0, up ? pending_hash_data : NULL,
+				up ? pending_hash_size : 0, up ? pending_level : 0, up ? pending_D_level : 0, paths + done * path_size, path_size, labels[done],
+				hashes + done * path_hash_size, path_hash_size, level, D_level))
+				break;
+			upload_pending = false;
+			done++;
+		}
+		if(done == no_of_paths)
+			return;
+	#endif
+
+	uint32_t up_paths = upload_pending ? pending_paths : 0;
+	uint32_t down_paths = no_of_paths - done;
+	if(up_paths == 0 && down_paths == 1)
+		downloadPath(&rt, storage_id, paths + done * path_size, path_size, labels[done], hashes + done * path_hash_size, path_hash_size, level, D_level);
+	else if(up_paths == 1 && down_paths == 1)
+		exchangePath(&rt, storage_id, pending_path_data, pending_path_size, pending_leaf[0], pending_hash_data, pending_hash_size, pending_level, pending_D_level,
+			paths + done * path_size, path_size, labels[done], hashes + done * path_hash_size, path_hash_size, level, D_level);
+	else
+		exchangePaths(&rt, storage_id, pending_path_data, up_paths * pending_path_size, pending_leaf, pending_hash_data, up_paths * pending_hash_size, up_paths,
+			pending_level, pending_D_level, paths + done * path_size, down_paths * path_size, labels + done, hashes + done * path_hash_size,
+			down_paths * path_hash_size, down_paths, level, D_level);
+	upload_pending = false;
+}
+
+/*
+BeginPathBatch() - Fetches the no_of_paths paths of level to labels (at most MAX_BATCH_PATHS) in one OCALL, with the
+paths being held, and verifies them all against the current root. ReadBucketsFromPath() then hands them out in that order,
+and WriteBackPath() holds the paths of the level written back meanwhile, until all no_of_paths of them are
+(EndPathBatch()).
+Every path handed out first gets the buckets, and the hashes of the nodes and siblings, written back since it was
+fetched (TakeBatchPath()), so it is what a fetch at that point would have returned.
+Returns false, with nothing fetched, for trees that are not read through OCALLs.
+*/
+bool ORAMTree::BeginPathBatch(uint32_t no_of_paths, uint32_t *labels, uint32_t level) {
+	uint32_t tdata_size, path_size, path_hash_size, D_temp;
+
+	if(batch_active)
+		EndPathBatch();
+	if(no_of_paths < 2 || no_of_paths > MAX_BATCH_PATHS)
+		return false;
+	#ifdef ENCLAVE_TREES
+		if(isEnclaveTree(level))
+			return false;
+	#endif
+	#ifdef DIRECT_TREES
+		if(directTreeOf(level) != NULL)
+			return false;
+	#endif
+
+	if((int32_t) level==-1){
+		tdata_size = data_size;
+		D_temp = D;
+	}
+	else {
+		if((int32_t) level==recursion_levels)
+			tdata_size = data_size;
+		else
+			tdata_size = recursion_data_size;
+		D_temp = D_level[level];
+	}
+	path_size = Z * (tdata_size+ADDITIONAL_METADATA_SIZE) * (D_temp+1);
+	path_hash_size = HASH_LENGTH * 2 * (D_temp+1);
+
+	FetchPaths(no_of_paths, labels, batch_fetched, batch_path_hash, path_size, path_hash_size, level, D_temp);
+	for(uint32_t i = 0; i < no_of_paths; i++) {
+		#ifdef SPARSE_TREES
+			fillInitialHashes(batch_path_hash + i * path_hash_size, D_temp, level);
+		#endif
+		#ifndef PASSIVE_ADVERSARY
+			verifyPath(batch_fetched + i * path_size, batch_path_hash + i * path_hash_size, labels[i], D_temp, tdata_size + ADDITIONAL_METADATA_SIZE, level, NULL);
+		#endif
+		batch_leaf[i] = labels[i];
+	}
+
+	batch_level = level;
+	batch_D_level = D_temp;
+	batch_paths = no_of_paths;
+	batch_next = 0;
+	batch_written = 0;
+	batch_path_size = path_size;
+	batch_hash_size = path_hash_size;
+	batch_active = true;
+	return true;
+}
+
+/*
+TakeBatchPath() - Copies the next path of the batch and its hashes out, after patching in the paths written back so far, in the
+order they were : where a node is on the written path its bucket and hash are replaced, and where its sibling is, the sibling's hash.
+New hashes (one per node, leaf to root) land in the <L,R> pair of the same depth, or in the root slot at the end of path_hash.
+*/
+void ORAMTree::TakeBatchPath(unsigned char *path, unsigned char *path_hash) {
+	uint32_t bucket_size = batch_path_size / (batch_D_level+1);
+	unsigned char *fetched = batch_fetched + batch_next * batch_path_size;
+	unsigned char *fetched_hash = batch_path_hash + batch_next * batch_hash_size;
+
+	for(uint32_t j = 0; j < batch_written; j++) {
+		uint32_t node = batch_leaf[batch_next];
+		uint32_t written = batch_written_leaf[j];
+		unsigned char *written_path = batch_written_paths + j * batch_path_size;
+		unsigned char *written_hash = batch_new_hash + j * batch_new_hash_size;
+		for(uint32_t d = 0; d < batch_D_level+1; d++) {
+			unsigned char *pair = fetched_hash + d * 2 * HASH_LENGTH;
+			if(node == written) {
+				memcpy(fetched + d * bucket_size, written_path + d * bucket_size, bucket_size);
+				if(batch_new_hash_size != 0)
+					memcpy(pair + ((node%2==0 || node==1) ? 0 : HASH_LENGTH), written_hash + d * HASH_LENGTH, HASH_LENGTH);
+			}
+			else if((node^1) == written && batch_new_hash_size != 0)
+				memcpy(pair + ((node%2==0) ? HASH_LENGTH : 0), written_hash + d * HASH_LENGTH, HASH_LENGTH);
+			node = node>>1;
+			written = written>>1;
+		}
+	}
+
+	memcpy(path, fetched, batch_path_size);
+	memcpy(path_hash, fetched_hash, batch_hash_size);
+	batch_next++;
+}
+
+/*
+EndPathBatch() - Closes the batch, the paths written back in it are held for the next fetch (EXCHANGE_PATHS),
+or uploaded right away.
+*/
+void ORAMTree::EndPathBatch() {
+	batch_active = false;
+	if(batch_written == 0)
+		return;
+
+	FlushPath();
+	pending_paths = batch_written;
+	memcpy(pending_leaf, batch_written_leaf, batch_written * sizeof(uint32_t));
+	pending_path_data = batch_written_paths;
+	pending_hash_data = batch_new_hash;
+	pending_level = batch_level;
+	pending_D_level = batch_D_level;
+	pending_path_size = batch_path_size;
+	pending_hash_size = batch_new_hash_size;
+	upload_pending = true;
+	batch_written = 0;
+
+	#ifndef EXCHANGE_PATHS
+		FlushPath();
+	#endif
+}
+
+/*
+CreateNewPathHash() - New hashes (one per node, leaf to root) of the path at path_ptr, from the sibling hashes in old_path_hash.
+If plain_path is not NULL, path_ptr is first filled in with it encrypted, a bucket at a time right before the bucket is hashed,
+so the path streams through the cache once instead of twice.
+*/
+void ORAMTree::CreateNewPathHash(unsigned char *path_ptr, unsigned char *old_path_hash, unsigned char *new_path_hash, uint32_t leaf, uint32_t block_size, uint32_t D_level, uint32_t level, unsigned char *plain_path){
     uint32_t leaf_temp = leaf;
     uint32_t leaf_temp_prev = leaf;
     unsigned char *new_path_hash_trail = new_path_hash;
 
         for(uint8_t i = 0;i < D_level+1;i++){
+            if(plain_path!=NULL) {
+                encryptPath(plain_path, path_ptr, Z, block_size - ADDITIONAL_METADATA_SIZE);
+                plain_path+=(block_size*Z);
+            }
 
             if(i==0){
                 sgx_sha256_msg(path_ptr, (block_size*Z), (sgx_sha256_hash_t*) new_path_hash);
@@ -650,6 +1585,9 @@ void ORAMTree::CreateNewPathHash(unsigned char *path_ptr, unsigned char *old_pat
                 sgx_sha256_get_hash(sha_handle, (sgx_sha256_hash_t*) new_path_hash);
                 new_path_hash_trail+=HASH_LENGTH;
                 if(i==D_level){
+                    if((int32_t) level==-1)
+                        memcpy(merkle_root_hash, new_path_hash, HASH_LENGTH);
+                    else
                         memcpy(merkle_root_hash_level[level], new_path_hash, HASH_LENGTH);
                 }
                 new_path_hash+=HASH_LENGTH;
@@ -1045,8 +1983,9 @@ uint32_t ORAMTree::access(uint32_t id, uint32_t position_in_id, char opType, uin
 return nextLeaf;
 }
 */
-void ORAMTree::SetParams(uint8_t pZ, uint32_t s_max_blocks, uint32_t s_data_size, uint32_t s_stash_size, uint32_t oblivious, uint32_t s_recursion_data_size, int8_t precursion_levels, uint64_t onchip_posmap_mem_limit){
+void ORAMTree::SetParams(uint8_t pZ, uint32_t s_max_blocks, uint32_t s_data_size, uint32_t s_stash_size, uint32_t oblivious, uint32_t s_recursion_data_size, int8_t precursion_levels, uint64_t onchip_posmap_mem_limit, uint32_t pstorage_id){
         max_blocks = s_max_blocks;
+        storage_id = pstorage_id;
         data_size = s_data_size;
         stash_size = s_stash_size;
         oblivious_flag = (oblivious==1);
@@ -1056,6 +1995,13 @@ void ORAMTree::SetParams(uint8_t pZ, uint32_t s_max_blocks, uint32_t s_data_size
 	printf("precursion_levels = %d", precursion_levels);
 	x = recursion_data_size/sizeof(uint32_t);
 	Z = pZ;
+	enclave_levels = 0;
+	enclave_tree_level = NULL;
+	upload_pending = false;
+	pending_paths = 0;
+	batch_active = false;
+	batch_written = 0;
+	direct_tree_level = NULL;
         
         if(recursion_levels!=-1) {
             uint64_t size_pmap0 = max_blocks * sizeof(uint32_t);
@@ -1098,6 +2044,7 @@ void ORAMTree::SetParams(uint8_t pZ, uint32_t s_max_blocks, uint32_t s_data_size
 
             gN = max_blocks_level[recursion_levels];
             merkle_root_hash_level = (sgx_sha256_hash_t*) malloc((recursion_levels +1) * sizeof(sgx_sha256_hash_t));
+            initial_hash_level = (unsigned char**) calloc(recursion_levels +1, sizeof(unsigned char*));
         }
         else{
             gN = max_blocks;
@@ -1130,109 +2077,18 @@ void ORAMTree::BuildTree(uint32_t max_blocks) {
     // Thus buckets of different types of blocks as well .
 	uint32_t hashsize = HASH_LENGTH;
 
-	unsigned char* hash_lchild = (unsigned char*) malloc(HASH_LENGTH);	
-	unsigned char* hash_rchild = (unsigned char*) malloc(HASH_LENGTH);
-	printf("Params - D = %d, N = %d, treeSize = %d\n",pD,pN,ptreeSize);
+	//The position map is the sequential placement of the build
+	for(uint32_t i = 0; i < max_blocks; i++)
+		posmap[i] = initialLeaf(i, max_blocks, pN);
 
-	uint32_t blocks_per_bucket_in_ll = max_blocks/pN;
-	#ifdef BUILDTREE_DEBUG
-	printf("blocks_per_bucket_in_ll = %d\n",blocks_per_bucket_in_ll);
+	#ifdef SPARSE_TREES
+		//Nothing is uploaded, only the Merkle root of the untouched tree is needed
+		initial_hash = (unsigned char*) malloc((pD+1) * HASH_LENGTH);
+		computeInitialHashes(initial_hash, pD, data_size + ADDITIONAL_METADATA_SIZE);
+		memcpy(merkle_root_hash, initial_hash, HASH_LENGTH);
+		printf("Params - D = %d, N = %d, treeSize = %d (sparse)\n",pD,pN,ptreeSize);
+	#else
+		printf("Params - D = %d, N = %d, treeSize = %d\n",pD,pN,ptreeSize);
+		StreamBuildTree(-1, pD, pN, data_size, merkle_root_hash);
 	#endif
-	uint32_t c = max_blocks - (blocks_per_bucket_in_ll * pN);
-	uint32_t cnt = 0;
-
-	//Build Last level
-	uint32_t label = 0;
-	for(uint32_t i = pN ; i <= treeSize; i++) {
-		#ifdef BUILD_DEBUG
-		    printf("Build , Object %d",i);
-		#endif
-		Bucket temp(Z);
-		temp.fill(data_size);
-		temp.reset_values(gN);
-
-		uint32_t blocks_in_this_bucket = blocks_per_bucket_in_ll;
-		if(cnt < c) {
-		    blocks_in_this_bucket+=1;
-		    cnt+=1;
-	}
-
-        for(uint8_t q=0;q<blocks_in_this_bucket;q++) {	
-		temp.blocks[q].id = label;
-		temp.blocks[q].treeLabel = i - pN;
-		#ifdef BUILDTREE_DEBUG
-			printf("%d,",temp.blocks[q].id);
-		#endif
-		posmap[temp.blocks[q].id] = temp.blocks[q].treeLabel;
-		label++;				
-        }
-        #ifdef BUILDTREE_DEBUG
-		printf("\n");
-        #endif
-        #ifdef ENCRYPTION_ON
-		temp.aes_encryptBlocks(data_size, aes_key);
-        #endif
-
-        unsigned char *serialized_bucket = temp.serialize(data_size);
-        uint8_t ret;
-
-        //Hash / Integrity Tree
-        sgx_sha256_msg(serialized_bucket, (data_size+ADDITIONAL_METADATA_SIZE) * Z, (sgx_sha256_hash_t*) &merkle_root_hash);
-
-        //Upload Bucket
-        uploadObject(&ret, serialized_bucket, Z*(data_size+ADDITIONAL_METADATA_SIZE) ,i, (unsigned char*) merkle_root_hash, HASH_LENGTH, (data_size+ADDITIONAL_METADATA_SIZE), -1);
-
-        free(serialized_bucket);	
-    }
-
-    //Build Upper Levels of Tree
-    for(uint32_t i = pN - 1; i>=1; i--){
-        //printf("i = %d",i);
-	Bucket temp(Z);
-	temp.initialize(data_size, gN);
-	temp.displayBlocks();		
-
-        #ifdef ENCRYPTION_ON
-            temp.aes_encryptBlocks(data_size, aes_key);
-        #endif
-
-        unsigned char *serialized_bucket = temp.serialize(data_size);
-        uint8_t ret;
-
-        //Hash 	
-        build_fetchChildHash(i*2, i*2 +1, hash_lchild, hash_rchild, HASH_LENGTH, -1);		
-        sgx_sha_state_handle_t p_sha_handle;
-        sgx_sha256_init(&p_sha_handle);
-        sgx_sha256_update(serialized_bucket, (data_size+ADDITIONAL_METADATA_SIZE) * Z, p_sha_handle);					
-        sgx_sha256_update(hash_lchild, SGX_SHA256_HASH_SIZE, p_sha_handle);
-        sgx_sha256_update(hash_rchild, SGX_SHA256_HASH_SIZE, p_sha_handle);
-        sgx_sha256_get_hash(p_sha_handle, (sgx_sha256_hash_t*) merkle_root_hash);
-        sgx_sha256_close(p_sha_handle);	
-
-        //Upload Bucket 
-        uploadObject(&ret, serialized_bucket, Z*(data_size+ADDITIONAL_METADATA_SIZE) ,i, (unsigned char*) merkle_root_hash, HASH_LENGTH, (data_size+ADDITIONAL_METADATA_SIZE), -1);
-
-        free(serialized_bucket);
-
-    }
-	/*
-        //Testing Module :
-        unsigned char *bucket_array = (unsigned char*) malloc(Z*data_size);
-        unsigned char *hash = (unsigned char*) malloc(HASH_LENGTH);
-        uint8_t rt;
-        downloadObject(&rt, bucket_array, Z*data_size, i, hash, HASH_LENGTH, data_size, -1);
-
-        Bucket temp2(bucket_array,g_block_size);
-        //printf("(%d,%d) \t",temp2.blocks[0].id,temp2.blocks[0].treeLabel);
-        //temp2.aes_decryptBlocks();
-        //temp.aes_decryptBlocks();
-        printf("%d :",i);					
-        printf("(%d,%d) - ",temp.blocks[0].id,temp.blocks[0].treeLabel);				
-        printf("(%d,%d) \n",temp2.blocks[0].id,temp2.blocks[0].treeLabel);
-        free(bucket_array);
-        free(hash);
-        */
-						
-    free(hash_lchild);
-    free(hash_rchild);
 }
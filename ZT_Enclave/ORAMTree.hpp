@@ -21,6 +21,26 @@
 	#include "Bucket.hpp"
 	#include "Stash.hpp"
 
+	//Checkpoint of an instance (see ORAMTree::SaveState)
+	#define ORAM_STATE_MAGIC "ZTSTATE2"
+
+	struct oram_state_header {
+		char magic[8];
+		uint32_t oram_type;
+		uint32_t Z;
+		uint32_t max_blocks;
+		uint32_t data_size;
+		uint32_t stash_size;
+		uint32_t oblivious_flag;
+		uint32_t recursion_data_size;
+		int32_t recursion_levels;
+		uint64_t mem_posmap_limit;
+		uint32_t posmap_entries;
+		uint32_t no_of_trees;
+		uint32_t enclave_levels;
+		uint32_t reserved;
+	};
+
 	class ORAMTree {
 		public:
 			//Basic Tree Params
@@ -35,6 +55,8 @@
 			bool oblivious_flag;
 			int8_t recursion_levels;
 			uint32_t recursion_data_size;
+			//Identifies this tree's storage in the untrusted App, passed on every OCALL
+			uint32_t storage_id;
 			//Oram_type might not be a param anymore in the OOP version
 			uint32_t oram_type;
 
@@ -66,6 +88,47 @@
 			uint32_t *D_level;
 			sgx_sha256_hash_t* merkle_root_hash_level;
 
+			//Hash of an untouched subtree rooted at each depth of the tree (SPARSE_TREES)
+			unsigned char *initial_hash;
+			unsigned char **initial_hash_level;
+
+			//ENCLAVE_TREES : Plaintext trees of levels 1..enclave_levels, held in the enclave (NULL for the other levels)
+			uint32_t enclave_levels;
+			unsigned char **enclave_tree_level;
+
+			//EXCHANGE_PATHS : pending_paths paths of level (in pending_path_data, with their hashes in pending_hash_data)
+			//wait to be uploaded to pending_leaf[] with the next fetch
+			bool upload_pending;
+			uint32_t pending_paths;
+			uint32_t pending_leaf[MAX_BATCH_PATHS];
+			unsigned char *pending_path_data;
+			unsigned char *pending_hash_data;
+			uint32_t pending_level;
+			uint32_t pending_D_level;
+			uint32_t pending_path_size;
+			uint32_t pending_hash_size;
+
+			//BATCH_PATHS : batch_paths paths of batch_level fetched by BeginPathBatch(), handed out by ReadBucketsFromPath() in order,
+			//and the batch_written ones written back since, uploaded together by EndPathBatch()
+			bool batch_active;
+			uint32_t batch_level;
+			uint32_t batch_D_level;
+			uint32_t batch_paths;
+			uint32_t batch_next;
+			uint32_t batch_written;
+			uint32_t batch_leaf[MAX_BATCH_PATHS];
+			uint32_t batch_written_leaf[MAX_BATCH_PATHS];
+			uint32_t batch_path_size;
+			uint32_t batch_hash_size;
+			uint32_t batch_new_hash_size;
+			unsigned char *batch_fetched;
+			unsigned char *batch_path_hash;
+			unsigned char *batch_written_paths;
+			unsigned char *batch_new_hash;
+
+			//DIRECT_TREES : App trees of each level (index 0 for the non-recursive tree) accessed in place, base NULL for the others
+			struct direct_tree *direct_tree_level;
+
 			//Key components		
 			unsigned char *aes_key;
 
@@ -82,22 +145,65 @@
 			//void BuildTree(uint32_t max_blocks);
 			void BuildTreeRecursive(int32_t level, uint32_t *prev_pmap);
 			void BuildTree(uint32_t max_blocks);
+			void StreamBuildTree(uint32_t level, uint32_t pD, uint64_t pN, uint32_t tdata_size, unsigned char *root_hash);
 			void Initialize();
-			void SetParams(uint8_t pZ, uint32_t pmax_blocks, uint32_t pdata_size, uint32_t pstash_size, uint32_t poblivious_flag, uint32_t precursion_data_size, int8_t precursion_levels, uint64_t onchip_posmap_mem_limit);
+			void SetParams(uint8_t pZ, uint32_t pmax_blocks, uint32_t pdata_size, uint32_t pstash_size, uint32_t poblivious_flag, uint32_t precursion_data_size, int8_t precursion_levels, uint64_t onchip_posmap_mem_limit, uint32_t pstorage_id);
 			void SampleKey();
+			void SetupRecursiveStashes();
+			void PerformMemoryAllocations();
+
+			//Checkpoint/Resume Functions
+			uint32_t posmapEntries();
+			Stash* stashOfTree(uint32_t tree, uint32_t *block_size);
+			unsigned char* rootOfTree(uint32_t tree);
+			uint64_t StateSize();
+			void SaveState(unsigned char *state, uint32_t poram_type);
+			bool RestoreState(unsigned char *state, uint64_t state_size, uint32_t pstorage_id);
+			void ReleaseState();
+
+			//Audit Functions
+			int64_t AuditTrees(uint32_t thread_no, uint32_t no_of_threads);
+			bool auditBucket(unsigned char *bucket, uint32_t bucket_size, unsigned char *hash, unsigned char *child_hashes, uint32_t depth, uint32_t tree_depth, int32_t level);
 
 			//Constructor & Destructor
 			ORAMTree();
 			~ORAMTree();			
 	
 			//Path Function
-			void verifyPath(unsigned char *path_array, unsigned char *path_hash, uint32_t leaf, uint32_t D, uint32_t block_size, uint32_t level);
+			void verifyPath(unsigned char *path_array, unsigned char *path_hash, uint32_t leaf, uint32_t D, uint32_t block_size, uint32_t level, unsigned char *decrypted_path_array);
 			void decryptPath(unsigned char* path_array, unsigned char *decrypted_path_array, uint32_t num_of_blocks_on_path, uint32_t data_size);
 			void encryptPath(unsigned char* path_array, unsigned char *encrypted_path_array, uint32_t num_of_blocks_on_path, uint32_t data_size);
 
+			//Sparse tree Functions
+			void computeInitialHashes(unsigned char *initial_hash, uint32_t D, uint32_t block_size);
+			void fillInitialHashes(unsigned char *path_hash, uint32_t D, uint32_t level);
+			void fillInitialBuckets(unsigned char *fetched_path, unsigned char *decrypted_path, uint32_t leaf, uint32_t D, uint32_t tdata_size, uint32_t level);
+			uint32_t initialLeaf(uint64_t id, uint64_t real_blocks, uint64_t pN);
+
+			//Enclave-resident tree Functions
+			void SetupEnclaveTrees();
+			bool isEnclaveTree(uint32_t level);
+			uint64_t enclaveTreeSize(uint32_t level);
+			void BuildEnclaveTree(uint32_t level);
+			void ReadEnclavePath(unsigned char *path, uint32_t leaf, uint32_t D_level, uint32_t level);
+			void WriteEnclavePath(unsigned char *path, uint32_t leaf, uint32_t D_level, uint32_t level);
+
+			//Direct tree Functions
+			bool AttachDirectTree(uint32_t level, struct direct_tree *tree);
+			struct direct_tree* directTreeOf(uint32_t level);
+			uint64_t directRecordOffset(struct direct_tree *tree, uint32_t bucket_no);
+			void ReadDirectPath(unsigned char *path, unsigned char *path_hash, uint32_t leaf, uint32_t D_level, struct direct_tree *tree);
+			void WriteDirectPath(unsigned char *path, unsigned char *path_hash, uint32_t leaf, uint32_t D_level, struct direct_tree *tree);
+
 			//Access Functions
 			unsigned char* ReadBucketsFromPath(uint32_t leaf, unsigned char *path_hash, uint32_t level);
-			void CreateNewPathHash(unsigned char *path_ptr, unsigned char *old_path_hash, unsigned char *new_path_hash, uint32_t leaf, uint32_t block_size, uint32_t D_level, uint32_t level);  
+			void WriteBackPath(unsigned char *path, uint32_t path_size, uint32_t leaf, unsigned char *path_hash, uint32_t path_hash_size, uint32_t level, uint32_t D_level);
+			void FlushPath();
+			void FetchPaths(uint32_t no_of_paths, uint32_t *labels, unsigned char *paths, unsigned char *hashes, uint32_t path_size, uint32_t path_hash_size, uint32_t level, uint32_t D_level);
+			bool BeginPathBatch(uint32_t no_of_paths, uint32_t *labels, uint32_t level);
+			void TakeBatchPath(unsigned char *path, unsigned char *path_hash);
+			void EndPathBatch();
+			void CreateNewPathHash(unsigned char *path_ptr, unsigned char *old_path_hash, unsigned char *new_path_hash, uint32_t leaf, uint32_t block_size, uint32_t D_level, uint32_t level, unsigned char *plain_path);  
 			void addToNewPathHash(unsigned char *path_iter, unsigned char* old_path_hash, unsigned char* new_path_hash_trail, unsigned char* new_path_hash, uint32_t level_in_path, uint32_t 							leaf_temp_prev, uint32_t block_size ,uint32_t D_level, uint32_t level);
 			void PushBlocksFromPathIntoStash(unsigned char* decrypted_path_ptr, uint32_t level, uint32_t data_size, uint32_t block_size, uint32_t D_level, uint32_t id, uint32_t position_in_id, 				uint32_t *nextLeaf, uint32_t newleaf, uint32_t sampledLeaf, int32_t newleaf_nextlevel);
 			uint32_t access_oram_level(char opType, uint32_t leaf, uint32_t id, uint32_t position_in_id, uint32_t level, uint32_t newleaf,uint32_t newleaf_nextleaf, unsigned char *data_in,  								unsigned char *data_out);		
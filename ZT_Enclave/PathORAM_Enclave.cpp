@@ -33,14 +33,18 @@ PathORAM::PathORAM(uint32_t s_max_blocks, uint32_t s_data_size, uint32_t s_stash
         mem_posmap_limit = onchip_posmap_mem_limit;  
 };
 
-void PathORAM::Initialize(uint8_t pZ, uint32_t pmax_blocks, uint32_t pdata_size, uint32_t pstash_size, uint32_t poblivious_flag, uint32_t precursion_data_size, int8_t precursion_levels, uint64_t onchip_posmap_mem_limit){
+void PathORAM::Initialize(uint8_t pZ, uint32_t pmax_blocks, uint32_t pdata_size, uint32_t pstash_size, uint32_t poblivious_flag, uint32_t precursion_data_size, int8_t precursion_levels, uint64_t onchip_posmap_mem_limit, uint32_t pstorage_id){
 	printf("In PathORAM::Initialize, Started Initialize\n");
 	ORAMTree::SampleKey();	
-	ORAMTree::SetParams(pZ, pmax_blocks, pdata_size, pstash_size, poblivious_flag, precursion_data_size, precursion_levels, onchip_posmap_mem_limit);
+	ORAMTree::SetParams(pZ, pmax_blocks, pdata_size, pstash_size, poblivious_flag, precursion_data_size, precursion_levels, onchip_posmap_mem_limit, pstorage_id);
 	ORAMTree::Initialize();
 	printf("Finished Initialize\n");
 }
 
+bool PathORAM::Restore(unsigned char *state, uint64_t state_size, uint32_t pstorage_id){
+	return ORAMTree::RestoreState(state, state_size, pstorage_id);
+}
+
 /*
 void PathORAM::Create(uint32_t max_blocks, uint32_t data_size, uint32_t stash_size, uint32_t oblivious_flag, uint32_t recursion_data_size, int8_t recursion_levels, uint64_t onchip_posmap_mem_limit){
 	BuildTreeRecursive((recursion_levels==-1)?0:recursion_levels, NULL);
@@ -50,9 +54,6 @@ void PathORAM::Create(uint32_t max_blocks, uint32_t data_size, uint32_t stash_si
 uint32_t PathORAM::access_oram_level(char opType, uint32_t leaf, uint32_t id, uint32_t position_in_id, uint32_t level, uint32_t newleaf,uint32_t newleaf_nextleaf, unsigned char *data_in,  unsigned char *data_out)
 {
 	uint32_t return_value=-1;
-	#ifdef EXITLESS_MODE			
-		path_hash = resp_struct->path_hash;
-	#endif
 
 	decrypted_path = ReadBucketsFromPath(leaf + N_level[level], path_hash, level);
 
@@ -294,7 +295,6 @@ level, uint32_t D_level, uint32_t nlevel, unsigned char* data_in, unsigned char
 	bool flag = false;
 	bool ad_flag = false;
 	unsigned char *decrypted_path_ptr = decrypted_path;
-	uint8_t rt;
 	unsigned char random_value[ID_SIZE_IN_BYTES];
 	sgx_read_rand((unsigned char*) random_value, sizeof(uint32_t));
 	if(level!=-1){
@@ -324,11 +324,6 @@ level, uint32_t D_level, uint32_t nlevel, unsigned char* data_in, unsigned char
 		uint32_t leaf_temp_prev = (leaf+nlevel)<<1;
 		uint32_t path_size = Z*tblock_size*(D_level+1);
 		uint32_t new_path_hash_size = ((D_level+1)*HASH_LENGTH);
-
-		#ifdef EXITLESS_MODE
-			serialized_path = resp_struct->new_path;
-			new_path_hash = resp_struct->new_path_hash;
-		#endif
 		unsigned char *new_path_hash_trail = new_path_hash;
 		unsigned char *new_path_hash_iter = new_path_hash;
 		unsigned char *old_path_hash_iter = path_hash;
@@ -396,14 +391,18 @@ level, uint32_t D_level, uint32_t nlevel, unsigned char* data_in, unsigned char
 					recursive_stash[level].displayStashContents(nlevel);
 			#endif
 
+			#ifdef ENCLAVE_TREES
+				if(isEnclaveTree(level)) {
+					WriteEnclavePath(decrypted_path, leaf + nlevel, D_level, level);
+					return nextLeaf;
+				}
+			#endif
+
 			//Encrypt and Upload Path :
 			#ifdef PATH_GRANULAR_IO
-				#ifdef EXITLESS_MODE
-					*(req_struct->block) = false;			
-				#else
-					#ifdef ENCRYPTION_ON
-						encryptPath(decrypted_path, encrypted_path, (Z*(D_level+1)), tdata_size);						
-					#endif	
+					#if defined(ENCRYPTION_ON) && defined(PASSIVE_ADVERSARY)
+						encryptPath(decrypted_path, encrypted_path, (Z*(D_level+1)), tdata_size);
+					#endif
 
 					#ifndef PASSIVE_ADVERSARY
 						unsigned char *path_ptr;
@@ -420,7 +419,12 @@ level, uint32_t D_level, uint32_t nlevel, unsigned char* data_in, unsigned char
             
             
                         uint32_t leaf_adj = leaf + nlevel;
-                        CreateNewPathHash(path_ptr, path_hash, new_path_hash, leaf_adj, data_size+ADDITIONAL_METADATA_SIZE, D_level, level);            
+                        //Encrypts decrypted_path into path_ptr as it goes
+                        #ifdef ENCRYPTION_ON
+                        	CreateNewPathHash(path_ptr, path_hash, new_path_hash, leaf_adj, tblock_size, D_level, level, decrypted_path);
+                        #else
+                        	CreateNewPathHash(path_ptr, path_hash, new_path_hash, leaf_adj, tblock_size, D_level, level, NULL);
+                        #endif
                     
                         /*
 						for(i=0;i < ( Z * (D_level+1) ); i++) {
@@ -436,8 +440,7 @@ level, uint32_t D_level, uint32_t nlevel, unsigned char* data_in, unsigned char
             
 					#endif
 		
-					uploadPath(&rt, encrypted_path, path_size, leaf + nlevel, new_path_hash, new_path_hash_size, level, D_level);
-				#endif
+					WriteBackPath(encrypted_path, path_size, leaf + nlevel, new_path_hash, new_path_hash_size, level, D_level);
 				
 				
 			#endif
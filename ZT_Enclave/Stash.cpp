@@ -230,6 +230,42 @@ uint32_t Stash::stashOccupancy() {
 		}
 		*/
 
+/*
+saveStash() - Copies the real blocks of the stash (serialized, stash_data_size + ADDITIONAL_METADATA_SIZE bytes each)
+back to back into stash_serialized, and returns how many there were. With stash_serialized NULL it only counts them.
+*/
+uint32_t Stash::saveStash(unsigned char *stash_serialized) {
+    uint32_t count = 0;
+    uint32_t block_size = stash_data_size + ADDITIONAL_METADATA_SIZE;
+    nodev2 *iter = getStart();
+    while(iter) {
+        if(!isBlockDummy(iter->serialized_block, gN)) {
+            if(stash_serialized!=NULL)
+                memcpy(stash_serialized + (count * block_size), iter->serialized_block, block_size);
+            count++;
+        }
+        iter = iter->next;
+    }
+    return count;
+}
+
+/*
+restoreStash() - Puts no_of_blocks blocks saved by saveStash back into a stash that was just set up (setup/setup_nonoblivious).
+*/
+void Stash::restoreStash(unsigned char *stash_serialized, uint32_t no_of_blocks, bool oblivious) {
+    uint32_t block_size = stash_data_size + ADDITIONAL_METADATA_SIZE;
+    for(uint32_t i = 0; i < no_of_blocks; i++) {
+        if(oblivious) {
+            pass_insert(stash_serialized + (i * block_size), false);
+        }
+        else {
+            unsigned char *serialized_block = (unsigned char*) malloc(block_size);
+            memcpy(serialized_block, stash_serialized + (i * block_size), block_size);
+            insert(serialized_block);
+        }
+    }
+}
+
 struct nodev2* Stash::getStart(){
 	return start;
 }
@@ -49,6 +49,8 @@
 			void pass_insert(unsigned char *serialized_block, bool is_dummy);
 			void insert(unsigned char *serialized_block);
 			uint32_t displayStashContents(uint32_t nlevel);
+			uint32_t saveStash(unsigned char *stash_serialized);
+			void restoreStash(unsigned char *stash_serialized, uint32_t no_of_blocks, bool oblivious);
 	};
 
 #endif
@@ -21,6 +21,7 @@
 #include "ORAMTree.hpp"
 #include "PathORAM_Enclave.hpp"
 #include "CircuitORAM_Enclave.hpp"
+#include <sgx_tseal.h>
 
 std::vector<PathORAM *> poram_instances;
 std::vector<CircuitORAM *> coram_instances;
@@ -28,7 +29,7 @@ std::vector<CircuitORAM *> coram_instances;
 uint32_t poram_instance_id=0;
 uint32_t coram_instance_id=0;
 
-uint32_t createNewORAMInstance(uint32_t max_blocks, uint32_t data_size, uint32_t stash_size, uint32_t oblivious_flag, uint32_t recursion_data_size, int8_t recursion_levels, uint64_t onchip_posmap_mem_limit, uint32_t oram_type, uint8_t pZ){
+uint32_t createNewORAMInstance(uint32_t max_blocks, uint32_t data_size, uint32_t stash_size, uint32_t oblivious_flag, uint32_t recursion_data_size, int8_t recursion_levels, uint64_t onchip_posmap_mem_limit, uint32_t oram_type, uint8_t pZ, uint32_t storage_id){
 
 	if(oram_type==0){
 		PathORAM *new_poram_instance = (PathORAM*) malloc(sizeof(PathORAM));
@@ -40,7 +41,7 @@ uint32_t createNewORAMInstance(uint32_t max_blocks, uint32_t data_size, uint32_t
 		
 		//TODO : INVOKING THE VIRTUAL FUNCTION SEG-FAULTS:		
 		//new_poram_instance->Create(pZ, max_blocks, data_size, stash_size, oblivious_flag, recursion_data_size, recursion_levels, onchip_posmap_mem_limit);
-		new_poram_instance->Initialize(pZ, max_blocks, data_size, stash_size, oblivious_flag, recursion_data_size, recursion_levels, onchip_posmap_mem_limit);
+		new_poram_instance->Initialize(pZ, max_blocks, data_size, stash_size, oblivious_flag, recursion_data_size, recursion_levels, onchip_posmap_mem_limit, storage_id);
 		#ifdef DEBUG_ZT_ENCLAVE
 			printf("In createNewORAMInstance, after Create\n");	
 		#endif			
@@ -53,7 +54,7 @@ uint32_t createNewORAMInstance(uint32_t max_blocks, uint32_t data_size, uint32_t
 		printf("Just before Create\n");
 		//new_coram_instance->Create();
 		//new_coram_instance->Create(pZ, max_blocks, data_size, stash_size, oblivious_flag, recursion_data_size, recursion_levels, onchip_posmap_mem_limit);
-		new_coram_instance->Initialize(pZ, max_blocks, data_size, stash_size, oblivious_flag, recursion_data_size, recursion_levels, onchip_posmap_mem_limit);	
+		new_coram_instance->Initialize(pZ, max_blocks, data_size, stash_size, oblivious_flag, recursion_data_size, recursion_levels, onchip_posmap_mem_limit, storage_id);	
 		return coram_instance_id++;
 	}
 }
@@ -102,6 +103,11 @@ void accessInterface(uint32_t instance_id, uint8_t oram_type, unsigned char *enc
 		coram_current_instance = coram_instances[instance_id];
 		coram_current_instance->Access_temp(id, opType, data_in, data_out);
 	}
+	//The last path written back is uploaded before leaving the enclave (EXCHANGE_PATHS)
+	if(oram_type==0)
+		poram_current_instance->FlushPath();
+	else
+		coram_current_instance->FlushPath();
 	//Encrypt Response
 	status = sgx_rijndael128GCM_encrypt((const sgx_aes_gcm_128bit_key_t *) SHARED_AES_KEY, data_out, response_size,
                                         (uint8_t *) encrypted_response, (const uint8_t *) HARDCODED_IV, IV_LENGTH, NULL, 0,
@@ -175,6 +181,10 @@ void accessBulkReadInterface(uint32_t instance_id, uint8_t oram_type, uint32_t n
 			coram_current_instance->Access_temp(id, opType, data_in, response_ptr);
 		response_ptr+=(tdata_size);
 	}
+	if(oram_type==0)
+		poram_current_instance->FlushPath();
+	else
+		coram_current_instance->FlushPath();
 
 	//Encrypt Response
 	status = sgx_rijndael128GCM_encrypt((const sgx_aes_gcm_128bit_key_t *) SHARED_AES_KEY, response, response_size,
@@ -197,4 +207,133 @@ void accessBulkReadInterface(uint32_t instance_id, uint8_t oram_type, uint32_t n
 	free(data_in);
 
 }
+/*
+Checkpoint/Resume : the state of an instance (ORAMTree::SaveState) is sealed to the enclave's signer with sgx_seal_data,
+so a later run of this enclave can take the instance up again on top of the trees its untrusted storage still holds,
+instead of building a new one. The App makes sure the instance is idle and its storage synced around these.
+*/
+static ORAMTree* lookupInstance(uint32_t instance_id, uint8_t oram_type) {
+	if(oram_type==0)
+		return (instance_id < poram_instances.size()) ? poram_instances[instance_id] : NULL;
+	return (instance_id < coram_instances.size()) ? coram_instances[instance_id] : NULL;
+}
+
+uint32_t getSealedStateSize(uint32_t instance_id, uint8_t oram_type) {
+	ORAMTree *instance = lookupInstance(instance_id, oram_type);
+	if(instance == NULL)
+		return 0;
+	uint64_t state_size = instance->StateSize();
+	if(state_size >= UINT32_MAX)
+		return 0;
+	uint32_t sealed_size = sgx_calc_sealed_data_size(0, (uint32_t) state_size);
+	return (sealed_size == UINT32_MAX) ? 0 : sealed_size;
+}
+
+int8_t sealORAMInstance(uint32_t instance_id, uint8_t oram_type, unsigned char *sealed_state, uint32_t sealed_size) {
+	ORAMTree *instance = lookupInstance(instance_id, oram_type);
+	if(instance == NULL)
+		return -1;
+	uint64_t state_size = instance->StateSize();
+	if(state_size >= UINT32_MAX || sgx_calc_sealed_data_size(0, (uint32_t) state_size) != sealed_size)
+		return -1;
+
+	unsigned char *state = (unsigned char*) malloc(state_size);
+	if(state == NULL)
+		return -1;
+	instance->SaveState(state, oram_type);
+	sgx_status_t status = sgx_seal_data(0, NULL, (uint32_t) state_size, state, sealed_size, (sgx_sealed_data_t*) sealed_state);
+	//The key and position map don't outlive the sealing in the clear
+	memset_s(state, state_size, 0, state_size);
+	free(state);
+	return (status == SGX_SUCCESS) ? 0 : -1;
+}
+
+uint32_t restoreORAMInstance(uint8_t oram_type, unsigned char *sealed_state, uint32_t sealed_size, uint32_t storage_id) {
+	if(sealed_size < sizeof(sgx_sealed_data_t))
+		return -1;
+	uint32_t state_size = sgx_get_encrypt_txt_len((const sgx_sealed_data_t*) sealed_state);
+	if(state_size == UINT32_MAX || sgx_calc_sealed_data_size(0, state_size) > sealed_size)
+		return -1;
+
+	unsigned char *state = (unsigned char*) malloc(state_size);
+	if(state == NULL)
+		return -1;
+	sgx_status_t status = sgx_unseal_data((const sgx_sealed_data_t*) sealed_state, NULL, NULL, state, &state_size);
+	struct oram_state_header *header = (struct oram_state_header*) state;
+	if(status != SGX_SUCCESS || state_size < sizeof(struct oram_state_header) || header->oram_type != oram_type) {
+		printf("Unable to unseal the checkpoint\n");
+		memset_s(state, state_size, 0, state_size);
+		free(state);
+		return -1;
+	}
+
+	//Zeroed, so that a failed Restore can tell what it allocated (ORAMTree::ReleaseState)
+	uint32_t instance_id = -1;
+	if(oram_type==0) {
+		PathORAM *new_poram_instance = (PathORAM*) calloc(1, sizeof(PathORAM));
+		if(new_poram_instance->Restore(state, state_size, storage_id)) {
+			poram_instances.push_back(new_poram_instance);
+			instance_id = poram_instance_id++;
+		}
+		else {
+			new_poram_instance->ReleaseState();
+			free(new_poram_instance);
+		}
+	}
+	else {
+		CircuitORAM *new_coram_instance = (CircuitORAM*) calloc(1, sizeof(CircuitORAM));
+		if(new_coram_instance->Restore(state, state_size, storage_id)) {
+			coram_instances.push_back(new_coram_instance);
+			instance_id = coram_instance_id++;
+		}
+		else {
+			new_coram_instance->ReleaseState();
+			free(new_coram_instance);
+		}
+	}
+	if(instance_id == (uint32_t) -1)
+		printf("The checkpoint doesn't match the trees in storage, they changed after it was taken\n");
+	memset_s(state, state_size, 0, state_size);
+	free(state);
+	return instance_id;
+}
+
+/*
+Audit : share thread_no of no_of_threads of the Merkle audit of an instance's trees (see ORAMTree::AuditTrees),
+the App runs one such ECALL per thread (ZT_Audit).
+*/
+int64_t auditORAMInstance(uint32_t instance_id, uint8_t oram_type, uint32_t thread_no, uint32_t no_of_threads) {
+	ORAMTree *instance = lookupInstance(instance_id, oram_type);
+	if(instance == NULL || no_of_threads == 0 || thread_no >= no_of_threads)
+		return -1;
+	return instance->AuditTrees(thread_no, no_of_threads);
+}
+
+/*
+setupExitless() - Takes up the ring the App serves path requests on in EXITLESS_MODE (see exitlessSetup), 0 on success.
+*/
+int8_t setupExitless(void *ring) {
+	#ifdef EXITLESS_MODE
+		return exitlessSetup(ring) ? 0 : -1;
+	#else
+		return -1;
+	#endif
+}
+
+/*
+attachDirectTree() - Hands an in-memory tree of the App to an instance (DIRECT_TREES, see ORAMTree::AttachDirectTree), 0 on success.
+*/
+int8_t attachDirectTree(uint32_t instance_id, uint8_t oram_type, uint32_t level, unsigned char *descriptor, uint32_t descriptor_size) {
+	#ifdef DIRECT_TREES
+		struct direct_tree tree;
+		ORAMTree *instance = lookupInstance(instance_id, oram_type);
+		if(instance == NULL || descriptor_size != sizeof(struct direct_tree))
+			return -1;
+		memcpy(&tree, descriptor, sizeof(struct direct_tree));
+		return instance->AttachDirectTree(level, &tree) ? 0 : -1;
+	#else
+		return -1;
+	#endif
+}
+
 //Clean up all instances of ORAM on terminate.
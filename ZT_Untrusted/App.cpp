@@ -32,13 +32,22 @@ Note : parameters surrounded by quotes should entered in as is without the quote
 #include <assert.h>
 #include <sys/time.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <pwd.h>
 #include <time.h> 
+#include <pthread.h>
+#include <vector>
+#include <map>
 #include "sgx_urts.h"
 #include "App.h"
 #include "Enclave_u.h"
 #include "LocalStorage.hpp"
+#include "TieredStorage.hpp"
+#include "RemoteStorage.hpp"
+#include "ObjectStorage.hpp"
+#include "../Globals.hpp"
 #include "RandomRequestSource.hpp"
+#include "ExitlessIO.hpp"
 
 #define MAX_PATH FILENAME_MAX
 #define CIRCUIT_ORAM
@@ -52,7 +61,11 @@ Note : parameters surrounded by quotes should entered in as is without the quote
 
 #define RECURSION_LEVELS_DEBUG 1
 //#define NO_CACHING_APP 1
+//EXITLESS_MODE : a pool of EXITLESS_THREADS serves the path requests the enclave posts to a ring in untrusted memory,
+//so accesses don't leave the enclave (EXITLESS_MODE in Globals_Enclave.hpp as well, see ExitlessIO.hpp)
 //#define EXITLESS_MODE 1
+//Hash buffers of the ring, enough for trees 63 levels deep
+#define EXITLESS_HASH_BUFFER_SIZE (2 * HASH_LENGTH * 64)
 //#define POSMAP_EXPERIMENT 1
 
 // Global Variables Declarations
@@ -62,6 +75,8 @@ uint64_t PATH_SIZE_LIMIT = 1 * 1024 * 1024;
 uint32_t aes_key_size = 16;
 uint32_t hash_size = 32;	
 #define ADDITIONAL_METADATA_SIZE 24
+//Enclave threads of a ZT_Audit (at most TCSNum in Enclave.config.xml, less the caller)
+#define AUDIT_THREADS 8
 uint32_t oram_id = 0;
 
 //Timing variables
@@ -72,13 +87,46 @@ double upload_time, download_time;
 double t, t1, t2, t3, ut,dt,tf,te;
 clock_t ct, ct1, ct2, ct3, cut, cdt;
 clock_t ct_pos, ct_fetch, ct_start, ct_end;
-LocalStorage ls;
+//Untrusted storage of each ORAM instance, indexed by the storage_id handed to the enclave in createNewORAMInstance
+std::vector<Storage*> ls_instances;
+//storage_id of every enclave instance, keyed by <oram_type, instance_id> (instance ids are only unique within an ORAM type)
+std::map<std::pair<uint32_t, uint32_t>, uint32_t> instance_storage;
+
+//Parameters each instance was created with, also indexed by storage_id, they head its checkpoints (see ZT_Checkpoint)
+struct instance_params {
+	uint32_t instance_id;
+	uint32_t oram_type;
+	//storage_id of the instance in the run that created its tree files, they are named after it
+	uint32_t file_id;
+	uint32_t max_blocks;
+	uint32_t data_size;
+	uint32_t stash_size;
+	uint32_t oblivious_flag;
+	uint32_t recursion_data_size;
+	//Checkpoints taken of the instance so far, the log of its trees rolls back to the last one (see LocalStorage::checkpointed)
+	uint32_t epoch;
+	uint8_t Z;
+	uint8_t backend_type;
+	uint8_t placement;
+	uint8_t reserved;
+	uint64_t cache_budget;
+};
+std::vector<struct instance_params> instance_params_l;
+
+#define CHECKPOINT_MAGIC "ZTCKPT01"
+
+//Checkpoint file : <checkpoint_header> followed by sealed_size bytes of sealed enclave state
+struct checkpoint_header {
+	char magic[8];
+	uint32_t sealed_size;
+	uint32_t reserved;
+	struct instance_params params;
+};
 uint32_t recursion_levels_e = 0;
 
 /* Global EID shared by multiple threads */
 sgx_enclave_id_t global_eid = 0;
 bool resume_experiment = false;
-bool inmem_flag =false;
 
 typedef struct _sgx_errlist_t {
     sgx_status_t err;
@@ -86,29 +134,10 @@ typedef struct _sgx_errlist_t {
     const char *sug; /* Suggestion */
 } sgx_errlist_t;
 
-struct oram_request{
-	uint32_t *id;
-	uint32_t *level;
-	uint32_t *d_lev;
-	bool *recursion;
-	bool *block;
-};
-
-struct oram_response{
-	unsigned char *path;
-	unsigned char *path_hash;
-	unsigned char *new_path;
-	unsigned char *new_path_hash;
-};
-
-struct thread_data{
-	struct oram_request *req;
-	struct oram_response *resp;
-};
-
-struct thread_data td;
-struct oram_request req_struct;
-struct oram_response resp_struct;	
+#ifdef EXITLESS_MODE
+	//Serves the path requests the enclave posts to its ring, set up in ZT_Initialize
+	ExitlessIO *exitless_io = NULL;
+#endif
 unsigned char *data_in;
 unsigned char *data_out;
 
@@ -285,42 +314,6 @@ void ocall_print_string(const char *str) {
     printf("%s", str);
 }
 
-void *HandleRequest(void *arg) {
-	//printf("In Handle Request thread\n");
-
-	struct thread_data *data;
-	data = (struct thread_data *) arg;
-	unsigned char *ptr = data->resp->path;
-	unsigned char *ptr_hash = data->resp->path_hash;
-	uint32_t* id = data->req->id;
-	uint32_t *level= data->req->level;
-	uint32_t *d_lev = data->req->d_lev;
-	bool *recursion = data->req->recursion;
-	
-
-	uint64_t path_hash_size = 2 * (*d_lev) * HASH_LENGTH; // 2 from siblings 		
-
-	uint64_t i = 0;
-
-	while(1) {
-		//*id==-1 || *level == -1 || 
-		while( *(data->req->block) ) {}
-		//printf("APP : Recieved Request\n");
-
-		ls.downloadPath(data->resp->path, *id, data->resp->path_hash, path_hash_size, *level , *d_lev);	
-		//printf("APP : Downloaded Path\n");	
-		*(data->req->block) = true;
-				
-		while(*(data->req->block)) {}
-		ls.uploadPath(data->resp->new_path, *id, data->resp->new_path_hash, *level, *d_lev);
-		//printf("APP : Uploaded Path\n");
-		*(data->req->block) = true;
-
-		//pthread_exit(NULL);
-	}
-		
-}
-
 uint64_t timediff(struct timeval *start, struct timeval *end) {
 	long seconds,useconds;
 	seconds  = end->tv_sec  - start->tv_sec;
@@ -358,11 +351,11 @@ void time_report(uint8_t point) {
 	}
 }
 
-uint8_t uploadPath(unsigned char* path_array, uint32_t pathSize, uint32_t leafLabel, unsigned char* path_hash, uint32_t path_hash_size, uint32_t level, uint32_t D_level) {
+uint8_t uploadPath(uint32_t storage_id, unsigned char* path_array, uint32_t pathSize, uint32_t leafLabel, unsigned char* path_hash, uint32_t path_hash_size, uint32_t level, uint32_t D_level) {
 	clock_t s,e;
 	s = clock();
 	clock_gettime(CLOCK_MONOTONIC, &upload_start_time);
-	ls.uploadPath(path_array,leafLabel,path_hash, level, D_level);
+	ls_instances[storage_id]->uploadPath(path_array,leafLabel,path_hash, level, D_level);
 	e = clock();
 	clock_gettime(CLOCK_MONOTONIC, &upload_end_time);
 	double mtime = timetaken(&upload_start_time, &upload_end_time);
@@ -378,9 +371,9 @@ uint8_t uploadPath(unsigned char* path_array, uint32_t pathSize, uint32_t leafLa
 	return 1;
 }
 
-uint8_t uploadObject(unsigned char* serialized_bucket, uint32_t bucket_size, uint32_t label, unsigned char* hash, uint32_t hashsize, uint32_t size_for_level, uint32_t recursion_level) {
+uint8_t uploadObject(uint32_t storage_id, unsigned char* serialized_bucket, uint32_t bucket_size, uint32_t label, unsigned char* hash, uint32_t hashsize, uint32_t size_for_level, uint32_t recursion_level) {
 	clock_gettime(CLOCK_MONOTONIC, &upload_start_time);
-	ls.uploadObject(serialized_bucket, label, hash, hashsize, size_for_level, recursion_level);
+	ls_instances[storage_id]->uploadObject(serialized_bucket, label, hash, hashsize, size_for_level, recursion_level);
 	clock_gettime(CLOCK_MONOTONIC, &upload_end_time);
 	double mtime = timetaken(&upload_start_time, &upload_end_time);
 	upload_time = mtime;
@@ -388,11 +381,25 @@ uint8_t uploadObject(unsigned char* serialized_bucket, uint32_t bucket_size, uin
 	return 1;
 }
 
-uint8_t downloadPath(unsigned char* path_array, uint32_t pathSize, uint32_t leafLabel, unsigned char *path_hash, uint32_t path_hash_size, uint32_t level, uint32_t D_level) {	
+/*
+uploadBuckets() - Uploads no_of_buckets buckets of a tree being built (back to back in serialized_buckets), with their hashes, in one OCALL.
+*/
+uint8_t uploadBuckets(uint32_t storage_id, unsigned char* serialized_buckets, uint32_t buckets_size, uint32_t *labels, unsigned char* hashes, uint32_t hashes_size, uint32_t no_of_buckets, uint32_t size_for_level, uint32_t recursion_level) {
+	uint32_t bucket_size = buckets_size / no_of_buckets;
+	uint32_t hash_size = hashes_size / no_of_buckets;
+	clock_gettime(CLOCK_MONOTONIC, &upload_start_time);
+	for(uint32_t i = 0; i < no_of_buckets; i++)
+		ls_instances[storage_id]->uploadObject(serialized_buckets + i * bucket_size, labels[i], hashes + i * hash_size, hash_size, size_for_level, recursion_level);
+	clock_gettime(CLOCK_MONOTONIC, &upload_end_time);
+	upload_time = timetaken(&upload_start_time, &upload_end_time);
+	return 1;
+}
+
+uint8_t downloadPath(uint32_t storage_id, unsigned char* path_array, uint32_t pathSize, uint32_t leafLabel, unsigned char *path_hash, uint32_t path_hash_size, uint32_t level, uint32_t D_level) {	
 	clock_t s,e;
 	s = clock();
 	clock_gettime(CLOCK_MONOTONIC, &download_start_time);
-	ls.downloadPath(path_array,leafLabel,path_hash, path_hash_size, level, D_level);
+	ls_instances[storage_id]->downloadPath(path_array,leafLabel,path_hash, path_hash_size, level, D_level);
 	e = clock();	
 	clock_gettime(CLOCK_MONOTONIC, &download_end_time);
 	double mtime = timetaken(&download_start_time, &download_end_time);
@@ -407,18 +414,79 @@ uint8_t downloadPath(unsigned char* path_array, uint32_t pathSize, uint32_t leaf
 	return 1;
 }
 
-uint8_t downloadObject(unsigned char* serialized_bucket, uint32_t bucket_size, uint32_t label, unsigned char* hash, uint32_t hashsize, uint32_t size_for_level, uint32_t recursion_level) {
+/*
+exchangePath() - Write-back of a path followed by the fetch of the next one, in one OCALL (EXCHANGE_PATHS in the enclave).
+The upload goes first, the fetched path may be on the same tree.
+*/
+uint8_t exchangePath(uint32_t storage_id, unsigned char* up_path, uint32_t up_path_size, uint32_t up_label, unsigned char* up_path_hash, uint32_t up_path_hash_size, uint32_t up_level, uint32_t up_D_level, unsigned char* path_array, uint32_t pathSize, uint32_t leafLabel, unsigned char *path_hash, uint32_t path_hash_size, uint32_t level, uint32_t D_level) {
+	uploadPath(storage_id, up_path, up_path_size, up_label, up_path_hash, up_path_hash_size, up_level, up_D_level);
+	return downloadPath(storage_id, path_array, pathSize, leafLabel, path_hash, path_hash_size, level, D_level);
+}
+
+/*
+exchangePaths() - Write-back of no_of_up_paths paths followed by the fetch of no_of_paths others, in one OCALL (BATCH_PATHS in the enclave).
+The paths of a side, and their hashes, are back to back and all of the same size. The uploads go first, in order.
+*/
+uint8_t exchangePaths(uint32_t storage_id, unsigned char* up_paths, uint32_t up_paths_size, uint32_t *up_labels, unsigned char* up_path_hashes, uint32_t up_path_hashes_size, uint32_t no_of_up_paths, uint32_t up_level, uint32_t up_D_level, unsigned char* paths, uint32_t paths_size, uint32_t *labels, unsigned char *path_hashes, uint32_t path_hashes_size, uint32_t no_of_paths, uint32_t level, uint32_t D_level) {
+	for(uint32_t i = 0; i < no_of_up_paths; i++) {
+		uint32_t up_path_size = up_paths_size / no_of_up_paths;
+		uint32_t up_path_hash_size = up_path_hashes_size / no_of_up_paths;
+		uploadPath(storage_id, up_paths + i * up_path_size, up_path_size, up_labels[i], up_path_hashes + i * up_path_hash_size, up_path_hash_size, up_level, up_D_level);
+	}
+	for(uint32_t i = 0; i < no_of_paths; i++) {
+		uint32_t path_size = paths_size / no_of_paths;
+		uint32_t path_hash_size = path_hashes_size / no_of_paths;
+		downloadPath(storage_id, paths + i * path_size, path_size, labels[i], path_hashes + i * path_hash_size, path_hash_size, level, D_level);
+	}
+	return 1;
+}
+
+uint8_t downloadObject(uint32_t storage_id, unsigned char* serialized_bucket, uint32_t bucket_size, uint32_t label, unsigned char* hash, uint32_t hashsize, uint32_t size_for_level, uint32_t recursion_level) {
 	clock_gettime(CLOCK_MONOTONIC, &download_start_time);
-	serialized_bucket = ls.downloadObject(serialized_bucket, label, hash, hashsize, size_for_level, recursion_level);
+	serialized_bucket = ls_instances[storage_id]->downloadObject(serialized_bucket, label, hash, hashsize, size_for_level, recursion_level);
 	clock_gettime(CLOCK_MONOTONIC, &download_end_time);
 	double mtime = timetaken(&download_start_time, &download_end_time);
 	download_time = mtime;
 	return 1;
 }
 
-void build_fetchChildHash(uint32_t left, uint32_t right, unsigned char* lchild, unsigned char* rchild, uint32_t hash_size, uint32_t recursion_level) {
-	ls.fetchHash(left,lchild,hash_size, recursion_level);
-	ls.fetchHash(right,rchild,hash_size, recursion_level);
+/*
+exitlessWake() - The enclave posted a path request to the ring while every ExitlessIO worker was parked.
+*/
+void exitlessWake() {
+	#ifdef EXITLESS_MODE
+		if(exitless_io != NULL)
+			exitless_io->wake();
+	#endif
+}
+
+void build_fetchChildHash(uint32_t storage_id, uint32_t left, uint32_t right, unsigned char* lchild, unsigned char* rchild, uint32_t hash_size, uint32_t recursion_level) {
+	ls_instances[storage_id]->fetchHash(left,lchild,hash_size, recursion_level);
+	ls_instances[storage_id]->fetchHash(right,rchild,hash_size, recursion_level);
+}
+
+//Storages without auditRange aren't thread-safe, the threads of an audit (ZT_Audit) take turns on them
+pthread_mutex_t audit_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+auditFetch() - count consecutive buckets from first_label with their hashes, and the hashes of their children
+unless child_hashes_size is 0 (leaves), for the audit of a tree (see ORAMTree::AuditTrees).
+*/
+uint8_t auditFetch(uint32_t storage_id, unsigned char* buckets, uint32_t buckets_size, uint32_t first_label, uint32_t count, unsigned char* hashes, uint32_t hashes_size, unsigned char* child_hashes, uint32_t child_hashes_size, uint32_t size_for_level, uint32_t level) {
+	if(ls_instances[storage_id]->auditRange(level, first_label, count, buckets, hashes, (child_hashes_size != 0) ? child_hashes : NULL, size_for_level))
+		return 1;
+	uint32_t bucket_size = buckets_size / count;
+	pthread_mutex_lock(&audit_lock);
+	for(uint32_t i = 0; i < count; i++) {
+		uint32_t label = first_label + i;
+		ls_instances[storage_id]->downloadObject(buckets + (uint64_t) i * bucket_size, label, hashes + i * HASH_LENGTH, HASH_LENGTH, size_for_level, level);
+		if(child_hashes_size != 0) {
+			ls_instances[storage_id]->fetchHash(2 * label, child_hashes + 2 * i * HASH_LENGTH, HASH_LENGTH, level);
+			ls_instances[storage_id]->fetchHash(2 * label + 1, child_hashes + (2 * i + 1) * HASH_LENGTH, HASH_LENGTH, level);
+		}
+	}
+	pthread_mutex_unlock(&audit_lock);
+	return 1;
 }
 
 int8_t computeRecursionLevels(uint32_t max_blocks, uint32_t recursion_data_size, uint64_t onchip_posmap_memory_limit){
@@ -466,14 +534,56 @@ int8_t ZT_Initialize(){
 	ecall_libc_functions();
 	ecall_libcxx_functions();
 	ecall_thread_functions();
+
+	#ifdef EXITLESS_MODE
+		int8_t ret = -1;
+		exitless_io = new ExitlessIO(EXITLESS_THREADS, PATH_SIZE_LIMIT, EXITLESS_HASH_BUFFER_SIZE, &ls_instances);
+		if(setupExitless(global_eid, &ret, (void*) exitless_io->ring()) != SGX_SUCCESS || ret != 0) {
+			printf("Unable to set up the exitless ring, paths go through OCALLs\n");
+			delete exitless_io;
+			exitless_io = NULL;
+		}
+	#endif
     return 0;
 }
 
 void ZT_Close(){
+	#ifdef EXITLESS_MODE
+		if(exitless_io != NULL) {
+			delete exitless_io;
+			exitless_io = NULL;
+		}
+	#endif
+        for(uint32_t i = 0; i < ls_instances.size(); i++) {
+                ls_instances[i]->closeStorage();
+                delete ls_instances[i];
+        }
+        ls_instances.clear();
+        instance_storage.clear();
         sgx_destroy_enclave(global_eid);
 }
 
-uint32_t ZT_New( uint32_t max_blocks, uint32_t data_size, uint32_t stash_size, uint32_t oblivious_flag, uint32_t recursion_data_size, uint32_t oram_type, uint8_t pZ){
+/*
+attachDirectTrees() - Offers the enclave every tree of an instance that its storage holds in memory (see Storage::directTree),
+with DIRECT_TREES the enclave reads and writes those in place, the others keep going through the path OCALLs.
+*/
+static void attachDirectTrees(uint32_t instance_id, uint8_t oram_type, uint32_t storage_id, int8_t recursion_levels) {
+	struct direct_tree tree;
+	uint32_t attached = 0;
+	uint32_t no_of_trees = (recursion_levels==-1) ? 1 : recursion_levels;
+	for(uint32_t i = 0; i < no_of_trees; i++) {
+		uint32_t level = (recursion_levels==-1) ? -1 : (i+1);
+		if(!ls_instances[storage_id]->directTree(level, &tree))
+			continue;
+		int8_t ret = -1;
+		if(attachDirectTree(global_eid, &ret, instance_id, oram_type, level, (unsigned char*) &tree, sizeof(tree)) == SGX_SUCCESS && ret == 0)
+			attached++;
+	}
+	if(attached > 0)
+		printf("%d trees of instance %d are accessed in place by the enclave\n", attached, instance_id);
+}
+
+uint32_t ZT_New( uint32_t max_blocks, uint32_t data_size, uint32_t stash_size, uint32_t oblivious_flag, uint32_t recursion_data_size, uint32_t oram_type, uint8_t pZ, uint8_t backend_type, uint64_t cache_budget, uint8_t placement){
 	sgx_status_t sgx_return = SGX_SUCCESS;
 	int8_t rt;
 	uint8_t urt;
@@ -484,42 +594,44 @@ uint32_t ZT_New( uint32_t max_blocks, uint32_t data_size, uint32_t stash_size, u
 	printf("APP.cpp : ComputedRecursionLevels = %d", recursion_levels);
     
 	uint32_t D = (uint32_t) ceil(log((double)max_blocks/4)/log((double)2));
-	ls.setParams(max_blocks,D,pZ,stash_size,data_size + ADDITIONAL_METADATA_SIZE,inmem_flag, recursion_data_size + ADDITIONAL_METADATA_SIZE, recursion_levels);
+	uint32_t storage_id = ls_instances.size();
+	Storage *ls;
+	if(backend_type == BACKEND_REMOTE)
+		ls = new RemoteStorage(storage_id);
+	else if(backend_type == BACKEND_OBJECT)
+		ls = new ObjectStorage(storage_id);
+	else if(placement == PLACEMENT_AUTO && (backend_type == BACKEND_HDD || backend_type == BACKEND_MMAP))
+		ls = new TieredStorage(storage_id);
+	else
+		ls = new LocalStorage(storage_id);
+	ls_instances.push_back(ls);
+	ls->setParams(max_blocks,D,pZ,stash_size,data_size + ADDITIONAL_METADATA_SIZE,backend_type, recursion_data_size + ADDITIONAL_METADATA_SIZE, recursion_levels, cache_budget);
     
-	#ifdef EXITLESS_MODE
-		int rc;
-		pthread_t thread_hreq;
-		req_struct.id = (uint32_t*) malloc (4);
-		req_struct.level = (uint32_t*) malloc(4);
-		req_struct.d_lev = (uint32_t*) malloc(4);
-		req_struct.recursion = (bool *) malloc(1);
-		req_struct.block = (bool *) malloc(1);
-
-		resp_struct.path = (unsigned char*) malloc(PATH_SIZE_LIMIT);
-		resp_struct.path_hash = (unsigned char*) malloc (PATH_SIZE_LIMIT);
-		resp_struct.new_path = (unsigned char*) malloc (PATH_SIZE_LIMIT);
-		resp_struct.new_path_hash = (unsigned char*) malloc (PATH_SIZE_LIMIT);
-		td.req = &req_struct;
-		td.resp = &resp_struct;
-
-		*(req_struct.block) = true;
-		*(req_struct.id) = 7;
-
-		rc = pthread_create(&thread_hreq, NULL, HandleRequest, (void *)&td);
-		if (rc){
-		    std::cout << "Error:unable to create thread," << rc << std::endl;
-		    exit(-1);
-		}
-		sgx_return = initialize_oram(global_eid, &urt, max_blocks, data_size,&req_struct, &resp_struct);		
-	#else
-		//Pass the On-chip Posmap Memory size limit as a parameter.    
-		sgx_return = createNewORAMInstance(global_eid, &instance_id, max_blocks, data_size, stash_size, oblivious_flag, recursion_data_size, recursion_levels, MEM_POSMAP_LIMIT, oram_type, pZ);
-		//sgx_return = createNewORAMInstance(global_eid, &instance_id, max_blocks, data_size, stash_size, oblivious_flag, recursion_data_size, recursion_levels, MEM_POSMAP_LIMIT, oram_type);
-		printf("INSTANCE_ID returned = %d\n", instance_id);
+	//Pass the On-chip Posmap Memory size limit as a parameter.    
+	sgx_return = createNewORAMInstance(global_eid, &instance_id, max_blocks, data_size, stash_size, oblivious_flag, recursion_data_size, recursion_levels, MEM_POSMAP_LIMIT, oram_type, pZ, storage_id);
+	//sgx_return = createNewORAMInstance(global_eid, &instance_id, max_blocks, data_size, stash_size, oblivious_flag, recursion_data_size, recursion_levels, MEM_POSMAP_LIMIT, oram_type);
+	printf("INSTANCE_ID returned = %d\n", instance_id);
+	attachDirectTrees(instance_id, oram_type, storage_id, recursion_levels);
 	
-		//(uint32_t max_blocks, uint32_t data_size, uint32_t stash_size, uint32_t oblivious_flag, uint32_t recursion_data_size, int8_t recursion_levels, uint64_t onchip_posmap_mem_limit, uint32_t oram_type)
-		//sgx_return = createNewORAMInstance(global_eid, &urt, max_blocks, data_size, stash_size, oblivious_flag, recursion_data_size, recursion_levels, MEM_POSMAP_LIMIT, oram_type);
-	#endif
+	//(uint32_t max_blocks, uint32_t data_size, uint32_t stash_size, uint32_t oblivious_flag, uint32_t recursion_data_size, int8_t recursion_levels, uint64_t onchip_posmap_mem_limit, uint32_t oram_type)
+	//sgx_return = createNewORAMInstance(global_eid, &urt, max_blocks, data_size, stash_size, oblivious_flag, recursion_data_size, recursion_levels, MEM_POSMAP_LIMIT, oram_type);
+
+	instance_storage[std::make_pair(oram_type, instance_id)] = storage_id;
+	struct instance_params params;
+	memset(&params, 0, sizeof(params));
+	params.instance_id = instance_id;
+	params.oram_type = oram_type;
+	params.file_id = storage_id;
+	params.max_blocks = max_blocks;
+	params.data_size = data_size;
+	params.stash_size = stash_size;
+	params.oblivious_flag = oblivious_flag;
+	params.recursion_data_size = recursion_data_size;
+	params.Z = pZ;
+	params.backend_type = backend_type;
+	params.placement = placement;
+	params.cache_budget = cache_budget;
+	instance_params_l.push_back(params);
 
     #ifdef DEBUG_PRINT
         printf("initialize_oram Successful\n");
@@ -528,57 +640,242 @@ uint32_t ZT_New( uint32_t max_blocks, uint32_t data_size, uint32_t stash_size, u
 }
 
 
+//storage_id of the enclave instance instance_id of oram_type, ls_instances.size() if there is none
+static uint32_t storageOf(uint32_t instance_id, uint8_t oram_type) {
+	std::map<std::pair<uint32_t, uint32_t>, uint32_t>::iterator it = instance_storage.find(std::make_pair((uint32_t) oram_type, instance_id));
+	if(it == instance_storage.end())
+		return ls_instances.size();
+	return it->second;
+}
+
 void ZT_Access(uint32_t instance_id, uint8_t oram_type, unsigned char *encrypted_request, unsigned char *encrypted_response, unsigned char *tag_in, unsigned char* tag_out, uint32_t request_size, uint32_t response_size, uint32_t tag_size){
     accessInterface(global_eid, instance_id, oram_type, encrypted_request, encrypted_response, tag_in, tag_out, request_size, response_size, tag_size);
+    uint32_t storage_id = storageOf(instance_id, oram_type);
+    if(storage_id < ls_instances.size())
+        ls_instances[storage_id]->endAccess();
 }
 
 void ZT_Bulk_Read(uint32_t instance_id, uint8_t oram_type, uint32_t no_of_requests, unsigned char *encrypted_request, unsigned char *encrypted_response, unsigned char *tag_in, unsigned char* tag_out, uint32_t request_size, uint32_t response_size, uint32_t tag_size){
     accessBulkReadInterface(global_eid, instance_id, oram_type, no_of_requests, encrypted_request, encrypted_response, tag_in, tag_out, request_size, response_size, tag_size);
+    uint32_t storage_id = storageOf(instance_id, oram_type);
+    if(storage_id < ls_instances.size())
+        ls_instances[storage_id]->endAccess();
 }
 
 /*
-	uint32_t posmap_size = 4 * max_blocks;
-	uint32_t stash_size =  (stashSize+1) * (dataSize_p+8);
+ZT_Snapshot() - Incremental snapshot of the untrusted trees of every instance kept in this process (see LocalStorage::writeSnapshot),
+one file per instance in snapshot_directory. Remote and object-store instances are skipped. Returns the number of buckets
+written, ZT_ERROR_NOT_PERSISTENT (nothing written) if an instance keeps levels in RAM, ZT_ERROR_IO if a snapshot failed.
+*/
+int64_t ZT_Snapshot(const char *snapshot_directory){
+	for(uint32_t i = 0; i < ls_instances.size(); i++) {
+		if(dynamic_cast<TieredStorage*>(ls_instances[i]) != NULL) {
+			printf("Instance %d keeps levels in RAM (PLACEMENT_AUTO), it can't be snapshotted\n", i);
+			return ZT_ERROR_NOT_PERSISTENT;
+		}
+	}
+	int64_t total = 0;
+	for(uint32_t i = 0; i < ls_instances.size(); i++) {
+		LocalStorage *ls = dynamic_cast<LocalStorage*>(ls_instances[i]);
+		if(ls == NULL)
+			continue;
+		int64_t written = ls->writeSnapshot(snapshot_directory);
+		if(written < 0)
+			return ZT_ERROR_IO;
+		total+= written;
+	}
+	return total;
+}
 
+/*
+ZT_Checkpoint() - Syncs the trees of instance instance_id and seals its enclave state (position map, stashes, Merkle roots
+and key, see ORAMTree::SaveState) into checkpoint_file, from which ZT_Resume takes the instance up in a later run without
+rebuilding it. Only for the hdd/mmap backends (with PLACEMENT_UNIFORM), whose trees outlive the process. The instance has to be idle. With the
+write-ahead log of the hdd backend (WAL_MODE) the checkpoint stays good until the next one, the trees are rolled back
+to it on resume, otherwise it stays good until the next access. Returns 0 on success, ZT_ERROR_NO_INSTANCE,
+ZT_ERROR_NOT_PERSISTENT for instances whose trees don't outlive the process, or ZT_ERROR_IO if sealing or writing failed.
 */
+int8_t ZT_Checkpoint(uint32_t instance_id, uint8_t oram_type, const char *checkpoint_file){
+	uint32_t storage_id = storageOf(instance_id, oram_type);
+	if(storage_id == ls_instances.size()) {
+		printf("No instance %d to checkpoint\n", instance_id);
+		return ZT_ERROR_NO_INSTANCE;
+	}
+	uint8_t backend_type = instance_params_l[storage_id].backend_type;
+	if(backend_type != BACKEND_HDD && backend_type != BACKEND_MMAP) {
+		printf("Only the hdd and mmap backends keep their trees across runs, instance %d can't be checkpointed\n", instance_id);
+		return ZT_ERROR_NOT_PERSISTENT;
+	}
+	if(instance_params_l[storage_id].placement != PLACEMENT_UNIFORM) {
+		printf("Instance %d keeps levels in RAM (PLACEMENT_AUTO), it can't be checkpointed\n", instance_id);
+		return ZT_ERROR_NOT_PERSISTENT;
+	}
+
+	//The trees have to be durable before the roots that authenticate them
+	ls_instances[storage_id]->syncStorage();
+
+	uint32_t sealed_size = 0;
+	int8_t rt = -1;
+	getSealedStateSize(global_eid, &sealed_size, instance_id, oram_type);
+	unsigned char *sealed_state = (sealed_size == 0) ? NULL : (unsigned char*) malloc(sealed_size);
+	if(sealed_state == NULL || sealORAMInstance(global_eid, &rt, instance_id, oram_type, sealed_state, sealed_size) != SGX_SUCCESS || rt != 0) {
+		printf("Unable to seal the state of instance %d\n", instance_id);
+		free(sealed_state);
+		return ZT_ERROR_IO;
+	}
+
+	struct checkpoint_header header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, CHECKPOINT_MAGIC, 8);
+	header.sealed_size = sealed_size;
+	header.params = instance_params_l[storage_id];
+	uint32_t epoch = header.params.epoch + 1;
+	header.params.epoch = epoch;
+
+	//Written aside and renamed over checkpoint_file, so that a crash never leaves a torn checkpoint behind
+	std::string temp_file = std::string(checkpoint_file) + ".tmp";
+	FILE *file = fopen(temp_file.c_str(), "wb");
+	bool ok = (file != NULL);
+	if(ok) {
+		ok = (fwrite(&header, sizeof(header), 1, file) == 1) && (fwrite(sealed_state, sealed_size, 1, file) == 1);
+		ok = (fflush(file) == 0) && (fsync(fileno(file)) == 0) && ok;
+		fclose(file);
+	}
+	free(sealed_state);
+	if(!ok || rename(temp_file.c_str(), checkpoint_file) != 0) {
+		printf("Unable to write the checkpoint %s\n", checkpoint_file);
+		unlink(temp_file.c_str());
+		return ZT_ERROR_IO;
+	}
+	//The rename itself has to be durable before the log of the previous checkpoint is dropped
+	std::string directory = std::string(checkpoint_file);
+	directory = (directory.rfind('/') == std::string::npos) ? "." : directory.substr(0, directory.rfind('/') + 1);
+	int dir_fd = open(directory.c_str(), O_RDONLY);
+	if(dir_fd == -1 || fsync(dir_fd) != 0) {
+		printf("Unable to sync the directory of the checkpoint %s\n", checkpoint_file);
+		if(dir_fd != -1)
+			close(dir_fd);
+		return ZT_ERROR_IO;
+	}
+	close(dir_fd);
+
+	instance_params_l[storage_id].epoch = epoch;
+	ls_instances[storage_id]->checkpointed(epoch);
+	return 0;
+}
 
 /*
-if(resume_experiment) {
-		
-		//Determine if experiment is recursive , and setup parameters accordingly
-		if(recursion_data_size!=0) {	
-			uint32_t *posmap = (uint32_t*) malloc (MEM_POSMAP_LIMIT*16*4);
-			unsigned char *merkle =(unsigned char*) malloc(hash_size + aes_key_size);
-			ls.restoreMerkle(merkle,hash_size + aes_key_size);				
-			ls.restorePosmap(posmap, MEM_POSMAP_LIMIT*16);
-			//Print and test Posmap HERE
-			
-			//TODO : Fix restoreMerkle and restorePosmap in Enclave :
-			//sgx_return = restoreEnclavePosmap(posmap,);			
-			for(uint8_t k = 1; k <=recursion_levels_e;k++){
-				uint32_t stash_size;
-				unsigned char* stash = (unsigned char*) malloc (stash_size);
-				//ls.restoreStash();	
-				//TODO: Fix restore Stash in Enclave				
-				//sgx_return = frestoreEnclaveStashLevel();
-				free(stash);						
-			}
-			
-			free(posmap);	
-			free(merkle);
-			
-		}
-		else {
-		uint32_t current_stashSize = 0;
-		uint32_t *posmap = (uint32_t*) malloc (posmap_size);
-		uint32_t *stash = (uint32_t*) malloc(4 * 2 * stashSize);
-		unsigned char *merkle =(unsigned char*) malloc(hash_size);
-		ls.restoreState(posmap, max_blocks, stash, &current_stashSize, merkle, hash_size+aes_key_size);		
-		//sgx_return = restore_enclave_state(global_eid, &rt32, max_blocks, dataSize_p, posmap, posmap_size, stash, current_stashSize * 8, merkle, hash_size+aes_key_size);
-		//printf("Restore done\n");
-		free(posmap);
-		free(stash);
-		free(merkle);
-		}
+ZT_Resume() - Takes up the instance checkpointed in checkpoint_file : its storage reattaches to the hdd/mmap tree files
+as they are (see LocalStorage::resumeFrom) and the enclave unseals its state, nothing is rebuilt.
+Resume instances before creating new ones with the same parameters, those would take over the same tree files.
+Returns the instance id (for the oram_type of the checkpoint), or -1 if the checkpoint can't be unsealed
+or the trees no longer match it.
+*/
+uint32_t ZT_Resume(const char *checkpoint_file){
+	struct checkpoint_header header;
+	unsigned char *sealed_state = NULL;
+	FILE *file = fopen(checkpoint_file, "rb");
+	if(file == NULL) {
+		printf("No checkpoint %s\n", checkpoint_file);
+		return -1;
+	}
+	bool ok = (fread(&header, sizeof(header), 1, file) == 1) && (memcmp(header.magic, CHECKPOINT_MAGIC, 8) == 0);
+	ok = ok && (header.params.backend_type == BACKEND_HDD || header.params.backend_type == BACKEND_MMAP);
+	if(ok) {
+		sealed_state = (unsigned char*) malloc(header.sealed_size);
+		ok = (sealed_state != NULL) && (fread(sealed_state, header.sealed_size, 1, file) == 1);
+	}
+	fclose(file);
+	if(!ok) {
+		printf("%s is not a checkpoint of an hdd/mmap instance\n", checkpoint_file);
+		free(sealed_state);
+		return -1;
+	}
+
+	struct instance_params params = header.params;
+	int8_t recursion_levels = computeRecursionLevels(params.max_blocks, params.recursion_data_size, MEM_POSMAP_LIMIT);
+	uint32_t D = (uint32_t) ceil(log((double)params.max_blocks/4)/log((double)2));
+	uint32_t storage_id = ls_instances.size();
+	LocalStorage *ls = new LocalStorage(storage_id);
+	ls->resumeFrom(params.file_id, params.epoch);
+	ls_instances.push_back(ls);
+	ls->setParams(params.max_blocks, D, params.Z, params.stash_size, params.data_size + ADDITIONAL_METADATA_SIZE, params.backend_type, params.recursion_data_size + ADDITIONAL_METADATA_SIZE, recursion_levels, params.cache_budget);
+
+	uint32_t instance_id = -1;
+	sgx_status_t sgx_return = restoreORAMInstance(global_eid, &instance_id, params.oram_type, sealed_state, header.sealed_size, storage_id);
+	free(sealed_state);
+	if(sgx_return != SGX_SUCCESS || instance_id == (uint32_t) -1) {
+		printf("Unable to resume from %s\n", checkpoint_file);
+		ls->closeStorage();
+		delete ls;
+		ls_instances.pop_back();
+		return -1;
 	}
+
+	attachDirectTrees(instance_id, params.oram_type, storage_id, recursion_levels);
+	params.instance_id = instance_id;
+	instance_storage[std::make_pair((uint32_t) params.oram_type, instance_id)] = storage_id;
+	instance_params_l.push_back(params);
+	printf("Resumed instance %d from %s\n", instance_id, checkpoint_file);
+	return instance_id;
+}
+
+struct audit_share {
+	uint32_t instance_id;
+	uint8_t oram_type;
+	uint32_t thread_no;
+	int64_t verified;
+};
+
+void *AuditShare(void *arg) {
+	struct audit_share *share = (struct audit_share*) arg;
+	sgx_status_t sgx_return = auditORAMInstance(global_eid, &(share->verified), share->instance_id, share->oram_type, share->thread_no, AUDIT_THREADS);
+	if(sgx_return != SGX_SUCCESS)
+		share->verified = -1;
+	return NULL;
+}
+
+/*
+ZT_Audit() - Checks every bucket of the untrusted trees of instance instance_id against the Merkle roots held by the enclave,
+with AUDIT_THREADS enclave threads streaming the trees bottom-up in chunks (see ORAMTree::AuditTrees).
+Meant for an idle instance, typically right after ZT_Resume and before serving requests.
+Returns the number of buckets verified, or -1 if any of them doesn't match.
 */
+int64_t ZT_Audit(uint32_t instance_id, uint8_t oram_type){
+	pthread_t threads[AUDIT_THREADS];
+	bool spawned[AUDIT_THREADS];
+	struct audit_share shares[AUDIT_THREADS];
+	struct timespec audit_start, audit_end;
+	int64_t verified = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &audit_start);
+	//auditRange reads the trees from their files, which have to hold every write-back first
+	uint32_t storage_id = storageOf(instance_id, oram_type);
+	if(storage_id < ls_instances.size())
+		ls_instances[storage_id]->syncStorage();
+	for(uint32_t t = 0; t < AUDIT_THREADS; t++) {
+		shares[t].instance_id = instance_id;
+		shares[t].oram_type = oram_type;
+		shares[t].thread_no = t;
+		shares[t].verified = -1;
+		spawned[t] = (pthread_create(&threads[t], NULL, AuditShare, (void*) &shares[t]) == 0);
+		//Without a thread, its share runs here
+		if(!spawned[t])
+			AuditShare((void*) &shares[t]);
+	}
+	for(uint32_t t = 0; t < AUDIT_THREADS; t++) {
+		if(spawned[t])
+			pthread_join(threads[t], NULL);
+		if(verified == -1 || shares[t].verified < 0)
+			verified = -1;
+		else
+			verified+= shares[t].verified;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &audit_end);
+
+	if(verified == -1)
+		printf("Audit of instance %d failed, its trees don't match the enclave's Merkle roots\n", instance_id);
+	else
+		printf("Audited instance %d : %ld buckets verified in %f seconds\n", instance_id, (long) verified, timetaken(&audit_start, &audit_end)/1000);
+	return verified;
+}
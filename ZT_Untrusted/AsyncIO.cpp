@@ -0,0 +1,303 @@
+/*
+*    ZeroTrace: Oblivious Memory Primitives from Intel SGX
+*    Copyright (C) 2018  Sajin (sshsshy)
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU General Public License as published by
+*    the Free Software Foundation, version 3 of the License.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU General Public License for more details.
+*
+*    You should have received a copy of the GNU General Public License
+*    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+AsyncIO.cpp
+*/
+
+#include "AsyncIO.hpp"
+#include "NUMA.hpp"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <vector>
+
+//Upper bound on queued write-backs, submitters block beyond this till the pool catches up
+#define ASYNC_IO_MAX_DIRTY 8192
+//#define DEBUG_ASYNC_IO 1
+
+static void *AsyncIOWorker(void *arg) {
+	return ((AsyncIO*) arg)->worker();
+}
+
+AsyncIO::AsyncIO(uint32_t p_no_of_threads, int32_t numa_node) {
+	no_of_threads = p_no_of_threads;
+	stop = false;
+	read_queue = NULL;
+	read_next = 0;
+	read_count = 0;
+	reads_pending = 0;
+	writes_pending = 0;
+	hold = false;
+
+	pthread_mutex_init(&lock, NULL);
+	pthread_cond_init(&work_available, NULL);
+	pthread_cond_init(&work_done, NULL);
+
+	threads = (pthread_t*) malloc(no_of_threads * sizeof(pthread_t));
+	for(uint32_t i = 0; i < no_of_threads; i++) {
+		int rc = pthread_create(&threads[i], NULL, AsyncIOWorker, (void*) this);
+		if(rc) {
+			printf("AsyncIO : Unable to create thread, %d\n", rc);
+			exit(-1);
+		}
+		numaPinThread(threads[i], numa_node);
+	}
+}
+
+AsyncIO::~AsyncIO() {
+	flush();
+	pthread_mutex_lock(&lock);
+	stop = true;
+	pthread_cond_broadcast(&work_available);
+	pthread_mutex_unlock(&lock);
+
+	for(uint32_t i = 0; i < no_of_threads; i++)
+		pthread_join(threads[i], NULL);
+	free(threads);
+
+	pthread_mutex_destroy(&lock);
+	pthread_cond_destroy(&work_available);
+	pthread_cond_destroy(&work_done);
+}
+
+void *AsyncIO::worker() {
+	pthread_mutex_lock(&lock);
+	while(1) {
+		while(!stop && read_next == read_count && write_queue.empty())
+			pthread_cond_wait(&work_available, &lock);
+
+		//Reads first, the enclave is blocked on them
+		if(read_next < read_count) {
+			struct io_request *request = &(read_queue[read_next]);
+			read_next++;
+			pthread_mutex_unlock(&lock);
+			serviceRead(request);
+			pthread_mutex_lock(&lock);
+			reads_pending--;
+			if(reads_pending == 0)
+				pthread_cond_broadcast(&work_done);
+		}
+		else if(!write_queue.empty()) {
+			dirty_key key = write_queue.front();
+			write_queue.pop_front();
+			serviceWrite(key);
+		}
+		else if(stop) {
+			break;
+		}
+	}
+	pthread_mutex_unlock(&lock);
+	return NULL;
+}
+
+void AsyncIO::serviceRead(struct io_request *request) {
+	uint64_t total = 0;
+	for(uint8_t i = 0; i < request->iovcnt; i++)
+		total+= request->iov[i].iov_len;
+
+	ssize_t rc = preadv(request->fd, request->iov, request->iovcnt, request->offset);
+	if(rc != (ssize_t) total)
+		printf("AsyncIO : Short read at offset %ld, %ld of %ld bytes\n", request->offset, (long) rc, total);
+}
+
+//Called with lock held, drops it around the actual write
+void AsyncIO::serviceWrite(dirty_key key) {
+	dirty_entry &entry = dirty_map[key];
+	uint64_t version = entry.version;
+	uint32_t size = entry.size;
+	//Aligned for files opened with O_DIRECT
+	unsigned char *buffer = NULL;
+	if(posix_memalign((void**) &buffer, ASYNC_IO_ALIGNMENT, size) != 0) {
+		printf("AsyncIO : Failed to allocate a write buffer of %d bytes\n", size);
+		exit(-1);
+	}
+	memcpy(buffer, entry.data, size);
+	pthread_mutex_unlock(&lock);
+
+	struct iovec iov;
+	iov.iov_base = buffer;
+	iov.iov_len = size;
+	ssize_t rc = pwritev(key.first, &iov, 1, key.second);
+	if(rc != (ssize_t) size)
+		printf("AsyncIO : Short write at offset %ld, %ld of %d bytes\n", key.second, (long) rc, size);
+	free(buffer);
+
+	pthread_mutex_lock(&lock);
+	std::map<dirty_key, dirty_entry>::iterator it = dirty_map.find(key);
+	if(it->second.version == version) {
+		free(it->second.data);
+		dirty_map.erase(it);
+		writes_pending--;
+		pthread_cond_broadcast(&work_done);
+	}
+	else {
+		//Overwritten while we were writing, write the newer contents out as well
+		write_queue.push_back(key);
+	}
+}
+
+/*
+AsyncIO::readBatch() - Services all requests and returns once every one of them is in its buffers.
+
+Segments that have a pending write-back are copied straight out of the dirty map.
+Since only the submitting thread queues writes, a segment that is clean at this point stays clean
+until readBatch returns, so the remaining segments can safely be read from the file.
+*/
+void AsyncIO::readBatch(struct io_request *requests, uint32_t no_of_requests) {
+	std::vector<struct io_request> to_read;
+	to_read.reserve(no_of_requests * ASYNC_IO_MAX_IOV);
+
+	pthread_mutex_lock(&lock);
+	for(uint32_t i = 0; i < no_of_requests; i++) {
+		struct io_request *request = &(requests[i]);
+		bool dirty[ASYNC_IO_MAX_IOV];
+		bool any_dirty = false;
+		uint64_t seg_offset = request->offset;
+
+		for(uint8_t j = 0; j < request->iovcnt; j++) {
+			std::map<dirty_key, dirty_entry>::iterator it = dirty_map.find(dirty_key(request->fd, seg_offset));
+			dirty[j] = (it != dirty_map.end() && it->second.size == request->iov[j].iov_len);
+			if(dirty[j]) {
+				memcpy(request->iov[j].iov_base, it->second.data, it->second.size);
+				any_dirty = true;
+			}
+			seg_offset+= request->iov[j].iov_len;
+		}
+
+		if(!any_dirty) {
+			to_read.push_back(*request);
+			continue;
+		}
+
+		seg_offset = request->offset;
+		for(uint8_t j = 0; j < request->iovcnt; j++) {
+			if(!dirty[j]) {
+				struct io_request segment;
+				segment.fd = request->fd;
+				segment.offset = seg_offset;
+				segment.iov[0] = request->iov[j];
+				segment.iovcnt = 1;
+				to_read.push_back(segment);
+			}
+			seg_offset+= request->iov[j].iov_len;
+		}
+	}
+
+	#ifdef DEBUG_ASYNC_IO
+		printf("AsyncIO : readBatch, %d requests, %ld issued to pool, %ld dirty objects\n", no_of_requests, to_read.size(), dirty_map.size());
+	#endif
+
+	if(to_read.size() > 0) {
+		read_queue = to_read.data();
+		read_next = 0;
+		read_count = to_read.size();
+		reads_pending = to_read.size();
+		pthread_cond_broadcast(&work_available);
+
+		while(reads_pending > 0)
+			pthread_cond_wait(&work_done, &lock);
+
+		read_queue = NULL;
+		read_next = 0;
+		read_count = 0;
+	}
+	pthread_mutex_unlock(&lock);
+}
+
+/*
+AsyncIO::writeBack() - Queues data to be written at offset in fd and returns immediately.
+
+data is copied, so the caller may reuse its buffer. Repeated writes to the same object
+before it reaches the file are coalesced into the existing dirty entry.
+*/
+void AsyncIO::writeBack(int fd, uint64_t offset, unsigned char *data, uint32_t size) {
+	dirty_key key(fd, offset);
+
+	pthread_mutex_lock(&lock);
+	std::map<dirty_key, dirty_entry>::iterator it = dirty_map.find(key);
+	//A queued write may not take up contents that are being held, it has to reach the file first
+	while(hold && it != dirty_map.end() && !it->second.held) {
+		pthread_cond_wait(&work_done, &lock);
+		it = dirty_map.find(key);
+	}
+	if(it != dirty_map.end()) {
+		if(it->second.size != size) {
+			it->second.data = (unsigned char*) realloc(it->second.data, size);
+			it->second.size = size;
+		}
+		memcpy(it->second.data, data, size);
+		it->second.version++;
+	}
+	else {
+		//Held writes don't count, they can only drain once released
+		while(writes_pending - held_queue.size() >= ASYNC_IO_MAX_DIRTY)
+			pthread_cond_wait(&work_done, &lock);
+
+		dirty_entry entry;
+		entry.data = (unsigned char*) malloc(size);
+		memcpy(entry.data, data, size);
+		entry.size = size;
+		entry.version = 0;
+		entry.held = hold;
+		dirty_map[key] = entry;
+		writes_pending++;
+		if(hold) {
+			held_queue.push_back(key);
+		}
+		else {
+			write_queue.push_back(key);
+			pthread_cond_signal(&work_available);
+		}
+	}
+	pthread_mutex_unlock(&lock);
+}
+
+//Blocks till every queued write-back has reached its file (held ones stay held)
+void AsyncIO::flush() {
+	pthread_mutex_lock(&lock);
+	while(writes_pending > held_queue.size())
+		pthread_cond_wait(&work_done, &lock);
+	pthread_mutex_unlock(&lock);
+}
+
+void AsyncIO::holdWrites(bool p_hold) {
+	pthread_mutex_lock(&lock);
+	hold = p_hold;
+	pthread_mutex_unlock(&lock);
+}
+
+//Queues every held write-back
+void AsyncIO::releaseWrites() {
+	pthread_mutex_lock(&lock);
+	while(!held_queue.empty()) {
+		dirty_key key = held_queue.front();
+		held_queue.pop_front();
+		dirty_map[key].held = false;
+		write_queue.push_back(key);
+	}
+	pthread_cond_broadcast(&work_available);
+	pthread_mutex_unlock(&lock);
+}
+
+uint32_t AsyncIO::heldWrites() {
+	pthread_mutex_lock(&lock);
+	uint32_t held = held_queue.size();
+	pthread_mutex_unlock(&lock);
+	return held;
+}
@@ -0,0 +1,103 @@
+/*
+*    ZeroTrace: Oblivious Memory Primitives from Intel SGX
+*    Copyright (C) 2018  Sajin (sshsshy)
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU General Public License as published by
+*    the Free Software Foundation, version 3 of the License.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU General Public License for more details.
+*
+*    You should have received a copy of the GNU General Public License
+*    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+AsyncIO.hpp
+
+Thread pool I/O engine for the disk backend of LocalStorage.
+Reads of a path are submitted as one batch and serviced in parallel by the pool (preadv),
+write-backs are queued and return immediately, and are later written out by the pool (pwritev).
+Until a queued write has reached the file, its bucket/hash is held in the dirty map,
+which is consulted by every read so that read-after-write stays consistent.
+
+While writes are held (holdWrites), write-backs are only queued once releaseWrites() is called :
+the undo log of LocalStorage (WAL_MODE) holds them till the before-images they overwrite are durable.
+
+AsyncIO assumes a single submitting thread (the ORAM controller), the pool threads only service requests.
+They are pinned to the NUMA node of the instance, if it has one, so the buffers they fill stay node-local.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/uio.h>
+#include <map>
+#include <deque>
+#include <utility>
+
+#define ASYNC_IO_THREADS 8
+//Root record of the inline-hash layout : <root hash | L | bucket | R>
+#define ASYNC_IO_MAX_IOV 4
+//Alignment of the buffers writes are issued from
+#define ASYNC_IO_ALIGNMENT 4096
+
+struct io_request {
+	int fd;
+	uint64_t offset;
+	struct iovec iov[ASYNC_IO_MAX_IOV];
+	uint8_t iovcnt;
+};
+
+//A pending write-back : data is the most recent contents of the object, version is bumped on every overwrite
+struct dirty_entry {
+	unsigned char *data;
+	uint32_t size;
+	uint64_t version;
+	bool held;
+};
+
+typedef std::pair<int, uint64_t> dirty_key;
+
+class AsyncIO
+{
+	public:
+		AsyncIO(uint32_t no_of_threads, int32_t numa_node);
+		~AsyncIO();
+
+		void readBatch(struct io_request *requests, uint32_t no_of_requests);
+		void writeBack(int fd, uint64_t offset, unsigned char *data, uint32_t size);
+		void flush();
+		void holdWrites(bool hold);
+		void releaseWrites();
+		uint32_t heldWrites();
+		void *worker();
+
+	private:
+		uint32_t no_of_threads;
+		pthread_t *threads;
+		pthread_mutex_t lock;
+		pthread_cond_t work_available;
+		pthread_cond_t work_done;
+		bool stop;
+
+		//Read tasks of the batch currently being serviced
+		struct io_request *read_queue;
+		uint32_t read_next, read_count, reads_pending;
+
+		//Write tasks are keys into dirty_map, there is at most one queued/in-flight task per key,
+		//so writes to the same bucket are never reordered
+		std::deque<dirty_key> write_queue;
+		std::map<dirty_key, dirty_entry> dirty_map;
+		uint32_t writes_pending;
+		//Write-backs held back from write_queue till releaseWrites()
+		bool hold;
+		std::deque<dirty_key> held_queue;
+
+		void serviceRead(struct io_request *request);
+		void serviceWrite(dirty_key key);
+};
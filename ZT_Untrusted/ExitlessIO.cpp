@@ -0,0 +1,156 @@
+/*
+*    ZeroTrace: Oblivious Memory Primitives from Intel SGX
+*    Copyright (C) 2018  Sajin (sshsshy)
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU General Public License as published by
+*    the Free Software Foundation, version 3 of the License.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU General Public License for more details.
+*
+*    You should have received a copy of the GNU General Public License
+*    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+ExitlessIO.cpp
+*/
+
+#include "ExitlessIO.hpp"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+
+static void *ExitlessIOWorker(void *arg) {
+	return ((ExitlessIO*) arg)->worker();
+}
+
+static inline void cpuRelax() {
+	#if defined(__x86_64__) || defined(__i386__)
+		__builtin_ia32_pause();
+	#endif
+}
+
+ExitlessIO::ExitlessIO(uint32_t p_no_of_threads, uint32_t path_buffer_size, uint32_t hash_buffer_size, std::vector<Storage*> *instances) {
+	no_of_threads = p_no_of_threads;
+	storage_instances = instances;
+
+	shared = (struct exitless_ring*) calloc(1, sizeof(struct exitless_ring));
+	shared->path_buffer_size = path_buffer_size;
+	shared->hash_buffer_size = hash_buffer_size;
+	for(uint32_t i = 0; i < EXITLESS_RING_SLOTS; i++) {
+		struct exitless_slot *slot = &(shared->slots[i]);
+		slot->state = EXITLESS_SLOT_FREE;
+		slot->buffers[EXITLESS_PATH] = (unsigned char*) malloc(path_buffer_size);
+		slot->buffers[EXITLESS_PATH_HASH] = (unsigned char*) malloc(hash_buffer_size);
+		slot->buffers[EXITLESS_UP_PATH] = (unsigned char*) malloc(path_buffer_size);
+		slot->buffers[EXITLESS_UP_PATH_HASH] = (unsigned char*) malloc(hash_buffer_size);
+	}
+	//Workers start out spinning
+	shared->awake = no_of_threads;
+
+	pthread_mutex_init(&park_lock, NULL);
+	pthread_cond_init(&park_cond, NULL);
+
+	threads = (pthread_t*) malloc(no_of_threads * sizeof(pthread_t));
+	for(uint32_t i = 0; i < no_of_threads; i++) {
+		int rc = pthread_create(&threads[i], NULL, ExitlessIOWorker, (void*) this);
+		if(rc) {
+			printf("ExitlessIO : Unable to create thread, %d\n", rc);
+			exit(-1);
+		}
+	}
+}
+
+ExitlessIO::~ExitlessIO() {
+	shared->stop = 1;
+	wake();
+	for(uint32_t i = 0; i < no_of_threads; i++)
+		pthread_join(threads[i], NULL);
+	free(threads);
+
+	for(uint32_t i = 0; i < EXITLESS_RING_SLOTS; i++) {
+		for(uint32_t j = 0; j < EXITLESS_BUFFERS; j++)
+			free(shared->slots[i].buffers[j]);
+	}
+	free(shared);
+	pthread_mutex_destroy(&park_lock);
+	pthread_cond_destroy(&park_cond);
+}
+
+struct exitless_ring* ExitlessIO::ring() {
+	return shared;
+}
+
+/*
+ExitlessIO::wake() - Gets the parked workers going again and yields to them (exitlessWake OCALL, shutdown).
+*/
+void ExitlessIO::wake() {
+	pthread_mutex_lock(&park_lock);
+	pthread_cond_broadcast(&park_cond);
+	pthread_mutex_unlock(&park_lock);
+	sched_yield();
+}
+
+bool ExitlessIO::posted() {
+	for(uint32_t i = 0; i < EXITLESS_RING_SLOTS; i++) {
+		if(shared->slots[i].state == EXITLESS_SLOT_POSTED)
+			return true;
+	}
+	return false;
+}
+
+void ExitlessIO::serve(struct exitless_slot *slot) {
+	if(slot->storage_id >= storage_instances->size()) {
+		printf("ExitlessIO : Request for unknown storage %d\n", slot->storage_id);
+		return;
+	}
+	Storage *storage = (*storage_instances)[slot->storage_id];
+	if(slot->up_path_size != 0)
+		storage->uploadPath(slot->buffers[EXITLESS_UP_PATH], slot->up_label, slot->buffers[EXITLESS_UP_PATH_HASH], slot->up_level, slot->up_D_level);
+	if(slot->path_size != 0)
+		storage->downloadPath(slot->buffers[EXITLESS_PATH], slot->label, slot->buffers[EXITLESS_PATH_HASH], slot->path_hash_size, slot->level, slot->D_level);
+}
+
+void *ExitlessIO::worker() {
+	uint32_t idle = 0;
+	while(!shared->stop) {
+		bool served = false;
+		for(uint32_t i = 0; i < EXITLESS_RING_SLOTS; i++) {
+			struct exitless_slot *slot = &(shared->slots[i]);
+			if(slot->state == EXITLESS_SLOT_POSTED && __sync_bool_compare_and_swap(&(slot->state), EXITLESS_SLOT_POSTED, EXITLESS_SLOT_TAKEN)) {
+				serve(slot);
+				__sync_synchronize();
+				slot->state = EXITLESS_SLOT_DONE;
+				served = true;
+			}
+		}
+		if(served) {
+			idle = 0;
+			continue;
+		}
+		if(++idle < EXITLESS_SPINS) {
+			//Let the enclave thread run if it shares our core
+			if(idle % EXITLESS_YIELD_SPINS == 0)
+				sched_yield();
+			else
+				cpuRelax();
+			continue;
+		}
+
+		//Park. The enclave posts before it looks at awake, and we drop awake before we look at the ring again,
+		//so either it sees no worker awake and wakes us up, or we see its request.
+		pthread_mutex_lock(&park_lock);
+		__sync_fetch_and_sub(&(shared->awake), 1);
+		if(!posted() && !shared->stop)
+			pthread_cond_wait(&park_cond, &park_lock);
+		__sync_fetch_and_add(&(shared->awake), 1);
+		pthread_mutex_unlock(&park_lock);
+		idle = 0;
+	}
+	return NULL;
+}
@@ -0,0 +1,63 @@
+/*
+*    ZeroTrace: Oblivious Memory Primitives from Intel SGX
+*    Copyright (C) 2018  Sajin (sshsshy)
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU General Public License as published by
+*    the Free Software Foundation, version 3 of the License.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU General Public License for more details.
+*
+*    You should have received a copy of the GNU General Public License
+*    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+ExitlessIO.hpp
+
+Untrusted end of EXITLESS_MODE : the ring of ExitlessRing.hpp, and a pool of workers that serve the path requests
+the enclave posts to it from the storage of their instance (ls_instances), so an access doesn't leave the enclave.
+
+A worker spins on the ring for EXITLESS_SPINS empty rounds, then parks on a condition variable. The enclave only
+leaves to wake the pool up (exitlessWake OCALL) when it posts a request while no worker is spinning.
+Requests of one instance are posted one at a time, so a storage only ever serves one worker at a time.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <pthread.h>
+#include <vector>
+#include "Storage.hpp"
+#include "../ExitlessRing.hpp"
+
+#define EXITLESS_THREADS 2
+//Empty rounds over the ring before a worker parks
+#define EXITLESS_SPINS 100000
+//Empty rounds between two sched_yield() of a spinning worker
+#define EXITLESS_YIELD_SPINS 64
+
+class ExitlessIO
+{
+	public:
+		ExitlessIO(uint32_t no_of_threads, uint32_t path_buffer_size, uint32_t hash_buffer_size, std::vector<Storage*> *instances);
+		~ExitlessIO();
+
+		struct exitless_ring* ring();
+		void wake();
+		void *worker();
+
+	private:
+		struct exitless_ring *shared;
+		std::vector<Storage*> *storage_instances;
+		uint32_t no_of_threads;
+		pthread_t *threads;
+		pthread_mutex_t park_lock;
+		pthread_cond_t park_cond;
+
+		bool posted();
+		void serve(struct exitless_slot *slot);
+};
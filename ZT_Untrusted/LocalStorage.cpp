@@ -19,56 +19,92 @@
 LocalStorage.cpp
 */
 
-#include "Enclave_u.h"
 #include "LocalStorage.hpp"
+#include "AsyncIO.hpp"
+#include "NUMA.hpp"
+#include "../Globals.hpp"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <string>
 #include <iostream>
 #include <fstream>
 #include <math.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <vector>
 
 #define HASH_LENGTH 32
 #define FILESTREAM_MODE 1
+//ASYNC_IO_MODE : disk backend serviced by the AsyncIO thread pool, batched path reads and queued write-backs
+#define ASYNC_IO_MODE 1
+//INLINE_HASH_LAYOUT : every node is stored as one record <hash(left child) | bucket | hash(right child)>,
+//the root's own hash sits in front of the root record at offset 0, and there is no separate hash tree (_i files).
+//The <L,R> pair the enclave needs for a node is held by its parent's record, so a path is D+1 contiguous reads.
+#define INLINE_HASH_LAYOUT 1
+//SUBTREE_PACKED_LAYOUT : records are packed subtree-wise into SUBTREE_UNIT_SIZE units instead of heap order
+//(4 KB pages, 2 MB for trees backed by huge pages). Only LocalStorage sees the layout, bucket labels are unchanged.
+//#define SUBTREE_PACKED_LAYOUT 1
+#define SUBTREE_UNIT_SIZE 4096
+//HUGEPAGE_TREES : in-memory trees (BACKEND_MEMORY) are backed by huge pages, see allocTree()
+#define HUGEPAGE_TREES 1
+//NUMA_POLICY : placement of the in-memory trees, the cache and the I/O threads of an instance on multi-socket hosts (see NUMA.hpp)
+#define NUMA_POLICY NUMA_BIND
+//#define NUMA_POLICY NUMA_INTERLEAVE
+//NUMA_PIN_CALLER : with NUMA_BIND, also pin the thread creating the instance to its node (the thread belongs to the application, so this is opt-in)
+//#define NUMA_PIN_CALLER 1
+//DIRECT_IO_MODE : the hdd backend opens its tree files with O_DIRECT and bypasses the page cache. Records are padded to the
+//logical block size of the storage device (DIRECT_IO_BLOCK_SIZE if it can't be found) and only ever transferred whole.
+//#define DIRECT_IO_MODE 1
+#define DIRECT_IO_BLOCK_SIZE 4096
+//Granularity at which writes to the cached top levels are tracked and flushed (see LocalStorage::setupCache)
+#define CACHE_PAGE_SIZE 4096
+//WAL_MODE : write-backs of the disk backend go through an undo log with group commit (see LocalStorage::walLogBefore),
+//one fdatasync covers WAL_GROUP_ACCESSES accesses, and a resumed instance is rolled back to its checkpoint (see LocalStorage::recoverWAL)
+#define WAL_MODE 1
+//Granularity of the before-images, raised to the logical block size with DIRECT_IO_MODE
+#define WAL_UNDO_UNIT 512
+#define WAL_GROUP_ACCESSES 32
+#define WAL_GROUP_BYTES (4 * 1024 * 1024)
+//Held write-backs that force a commit at the end of the access
+#define WAL_GROUP_HELD 2048
+//DIRTY_TRACKING : one bit per bucket records what was uploaded since the last snapshot, for incremental snapshots (see LocalStorage::writeSnapshot)
+#define DIRTY_TRACKING 1
 #define DEBUG_LS 1
 // #define DEBUG_INTEGRITY 1
 // Utilization Parameter is the number of blocks of a bucket that is filled at start state. ( 4 = MAX_OCCUPANCY )
 #define UTILIZATION_PARAMETER 4
 #define ADDITIONAL_METADATA_SIZE 24
 //#define NO_CACHING 1
-//#define CACHE_UPPER 1
 //#define PASSIVE_ADVERSARY 1
 //#define PRINT_BUCKETS 1
 
+#if defined(SUBTREE_PACKED_LAYOUT) && !defined(INLINE_HASH_LAYOUT)
+	#error "SUBTREE_PACKED_LAYOUT places INLINE_HASH_LAYOUT records"
+#endif
+#if defined(DIRECT_IO_MODE) && !defined(INLINE_HASH_LAYOUT)
+	#error "DIRECT_IO_MODE pads INLINE_HASH_LAYOUT records"
+#endif
+#if defined(INLINE_HASH_LAYOUT) && !defined(ASYNC_IO_MODE)
+	#error "INLINE_HASH_LAYOUT on the disk backend is only serviced through ASYNC_IO_MODE"
+#endif
+#if defined(WAL_MODE) && !defined(INLINE_HASH_LAYOUT)
+	#error "WAL_MODE logs the writes of INLINE_HASH_LAYOUT records, which all go through diskWrite"
+#endif
+
 //uint64_t MEM_POSMAP_LIMIT_LS = 1 * 1024;
 uint64_t MEM_POSMAP_LIMIT_LS =  1 * 1024;
 //uint32_t MEM_POSMAP_LIMIT_LS = 32 * (4);
-uint64_t RAM_LIMIT = (uint64_t)(60 * 1024) * (uint64_t)(1024 * 1024);
-
-uint32_t dataSize;
-uint32_t Z;
-uint32_t D;
 
 //Take this value as input parameter !
-std::string directoryFP = "/mnt/Storage/";
-std::string directoryFP_i = directoryFP;
-std::string file_name;
-std::string file_name_i;
-std::string temp;
-std::string state_folder = "state";
-bool inmem;
-unsigned char* inmem_tree;
-unsigned char* inmem_hash;
-unsigned char** inmem_tree_l;
-unsigned char** inmem_hash_l;
-uint64_t datatree_size;
-uint64_t hashtree_size;
-uint32_t bucket_size;
-uint32_t recursionBlockSize;
-int32_t recursion_levels=0;
-uint32_t levels_on_disk = 0;
-uint32_t objectkeylimit;
-uint64_t *maxBlocks_of_pmap_level;
+//Root directory for the disk-backed trees, every instance creates its own sub-directory in it
+std::string storage_directory = "/mnt/Storage/";
+//Directories (one per device) the tree files of the disk backend are striped across, level by level (see LocalStorage::stripeOf).
+//Set from ZT_STRIPE_DIRECTORIES="<dir1>:<dir2>:..." if it is given, empty keeps every tree in one file under storage_directory.
+std::vector<std::string> stripe_directories;
 
 /*
 Debug Module (Auxiliary Snippet) : For Block level debugging on Storage side
@@ -183,198 +219,788 @@ class Block {
 */
 
 LocalStorage::LocalStorage(){
+	storage_id = 0;
+	directoryFP = storage_directory;
+	directoryFP_i = storage_directory;
+	state_folder = "state";
+	recursion_levels = 0;
+	aio = NULL;
+	numa_node = -1;
+	io_block_size = 0;
+	direct_path = NULL;
+	direct_scratch = NULL;
+	cache_budget = 0;
+	cache_size_l = NULL;
+	cache_l = NULL;
+	cache_dirty_l = NULL;
+	no_of_stripes = 1;
+	stripe_fd_l = NULL;
+	dirty_bitmap_l = NULL;
+	snapshot_epoch = 0;
+	wal_fd = -1;
+	wal_armed = false;
+	wal_logged_l = NULL;
+	wal_buffer = NULL;
+	wal_buffer_size = 0;
+	wal_buffer_capacity = 0;
+	wal_scratch = NULL;
+	wal_scratch_size = 0;
+	resume = false;
+	wal_epoch = 0;
+	file_id = storage_id;
+	first_level = 0;
+	last_level = -1;
 }
 
-int8_t LocalStorage::restoreState(uint32_t *posmap, uint32_t posmap_size, uint32_t* stash, uint32_t *stash_size, unsigned char* merkle_root, uint32_t hash_and_key_size)
-{
-	//Check if posmap/stash exists
-	if(1){
-		std::string fpp = directoryFP + temp + "posmap";
-		std::string fps = directoryFP + temp + "stash";
-		std::string fpr = directoryFP + temp + "merkleroot";
-		printf("%s\n",fps.c_str());		
-		std::string line,sp1,sp2;
-		size_t pos;
+LocalStorage::LocalStorage(uint32_t p_storage_id){
+	storage_id = p_storage_id;
+	directoryFP = storage_directory;
+	directoryFP_i = storage_directory;
+	state_folder = "state";
+	recursion_levels = 0;
+	aio = NULL;
+	numa_node = -1;
+	io_block_size = 0;
+	direct_path = NULL;
+	direct_scratch = NULL;
+	cache_budget = 0;
+	cache_size_l = NULL;
+	cache_l = NULL;
+	cache_dirty_l = NULL;
+	no_of_stripes = 1;
+	stripe_fd_l = NULL;
+	dirty_bitmap_l = NULL;
+	snapshot_epoch = 0;
+	wal_fd = -1;
+	wal_armed = false;
+	wal_logged_l = NULL;
+	wal_buffer = NULL;
+	wal_buffer_size = 0;
+	wal_buffer_capacity = 0;
+	wal_scratch = NULL;
+	wal_scratch_size = 0;
+	resume = false;
+	wal_epoch = 0;
+	file_id = storage_id;
+	first_level = 0;
+	last_level = -1;
+}
 
-		try {
-		std::ifstream file(fpp.c_str());
-		uint32_t *posmap_iter = (uint32_t*) posmap;
-		uint32_t i = 0;
-		for(i=0;i<posmap_size;i++) {
-			getline(file,line);
-			uint32_t item = atoi(line.c_str());
-			*posmap_iter = item;
-			posmap_iter++;
-			}
-		//file.write((unsigned char*) posmap, dataSize * Z);
-		file.close();
+#ifdef DIRECT_IO_MODE
+//Logical block size of the device holding directory, from sysfs (the queue of a partition is in its parent disk)
+static uint32_t logicalBlockSize(std::string directory) {
+	uint32_t block_size = 0;
+	struct stat st;
+	if(stat(directory.c_str(), &st) == 0) {
+		std::string dev = "/sys/dev/block/" + std::to_string(major(st.st_dev)) + ":" + std::to_string(minor(st.st_dev));
+		std::ifstream queue((dev + "/queue/logical_block_size").c_str());
+		if(!(queue >> block_size)) {
+			std::ifstream parent_queue((dev + "/../queue/logical_block_size").c_str());
+			if(!(parent_queue >> block_size))
+				block_size = 0;
+		}
+	}
+	//Records are written back through CACHE_PAGE_SIZE pages of the cache as well
+	if(block_size == 0 || block_size > CACHE_PAGE_SIZE || (block_size & (block_size-1)) != 0)
+		block_size = DIRECT_IO_BLOCK_SIZE;
+	printf("LS : Direct I/O with %d byte blocks\n", block_size);
+	return block_size;
+}
+#endif
+
+//Tree files of the disk backend, with O_DIRECT if it is asked for and the file system supports it
+static int openTreeFile(std::string file_name_this, bool direct) {
+	int fd = -1;
+	if(direct) {
+		fd = open(file_name_this.c_str(), O_RDWR|O_CREAT|O_DIRECT, 0644);
+		if(fd == -1)
+			printf("LS : O_DIRECT not supported for %s, falling back to buffered I/O\n", file_name_this.c_str());
+	}
+	if(fd == -1)
+		fd = open(file_name_this.c_str(), O_RDWR|O_CREAT, 0644);
+	return fd;
+}
 
-		file.open(fps.c_str());
-		uint32_t *stash_iter = (uint32_t*) stash;
+void LocalStorage::openDiskFiles() {
+	uint32_t no_of_files = (recursion_levels==-1) ? 1 : (recursion_levels+1);
+	hdd_fd_l = (int*) calloc(no_of_files, sizeof(int));
+	hdd_fd_hash_l = (int*) calloc(no_of_files, sizeof(int));
 
-		*stash_size = 0;
-		while(getline(file,line)) {
-			pos = line.find("\t");
-			sp1 = line.substr(0,pos);
-			sp2 = line.substr(pos+1,std::string::npos);
-			*stash_iter=atoi(sp1.c_str());
-			stash_iter++;
-			*stash_iter=atoi(sp2.c_str());
-			stash_iter++;
-			(*stash_size)++;
+	if(recursion_levels==-1) {
+		hdd_fd_l[0] = openTreeFile(file_name, io_block_size != 0);
+		#ifndef INLINE_HASH_LAYOUT
+			hdd_fd_hash_l[0] = open(file_name_i.c_str(), O_RDWR|O_CREAT, 0644);
+		#endif
+		if(hdd_fd_l[0] == -1 || hdd_fd_hash_l[0] == -1) {
+			printf("LS : Failed to open %s\n", file_name.c_str());
+			exit(0);
 		}
-		file.close();
-
-		file.open(fpr.c_str());
-		file.read((char *)merkle_root,hash_and_key_size);
-		file.close();
+	}
+	else {
+		for(int32_t i = 1;i<= recursion_levels;i++) {
+			std::string file_name_this = file_name + "p" + std::to_string(i);
+			std::string file_name_this_i = file_name_this + "_i";
+			hdd_fd_l[i] = openTreeFile(file_name_this, io_block_size != 0);
+			#ifndef INLINE_HASH_LAYOUT
+				hdd_fd_hash_l[i] = open(file_name_this_i.c_str(), O_RDWR|O_CREAT, 0644);
+			#endif
+			if(hdd_fd_l[i] == -1 || hdd_fd_hash_l[i] == -1) {
+				printf("LS : Failed to open %s\n", file_name_this.c_str());
+				exit(0);
+			}
+		}
+	}
 
+	//Stripe 0 of every tree is the file opened above, the others are files of the same name in the other stripe directories.
+	//Every stripe file spans the whole tree (sparse), so records keep their offsets whichever stripe they are in.
+	stripe_fd_l = (int**) calloc(no_of_files, sizeof(int*));
+	for(uint32_t k = 1;k < no_of_stripes;k++) {
+		std::string system_inst = "mkdir -p " + stripe_directories[k] + temp + "\n";
+		system(system_inst.c_str());
 	}
-	catch (std::ifstream::failure e) {
-			std::cerr <<"Exception opening file";
+	for(uint32_t i = (recursion_levels==-1) ? 0 : 1;i < no_of_files;i++) {
+		stripe_fd_l[i] = (int*) malloc(no_of_stripes * sizeof(int));
+		stripe_fd_l[i][0] = hdd_fd_l[i];
+		std::string tree_file = temp + "/" + temp + ((recursion_levels==-1) ? "" : ("p" + std::to_string(i)));
+		for(uint32_t k = 1;k < no_of_stripes;k++) {
+			std::string stripe_file = stripe_directories[k] + tree_file;
+			stripe_fd_l[i][k] = openTreeFile(stripe_file, io_block_size != 0);
+			if(stripe_fd_l[i][k] == -1) {
+				printf("LS : Failed to open %s\n", stripe_file.c_str());
+				exit(0);
+			}
+			struct stat st;
+			if(fstat(stripe_fd_l[i][k], &st) == 0 && (uint64_t) st.st_size < layout_l[i].tree_size && ftruncate(stripe_fd_l[i][k], layout_l[i].tree_size) != 0)
+				printf("LS : Unable to extend %s\n", stripe_file.c_str());
+		}
 	}
-		return 1;
+	//At least one pool thread per stripe, so that the reads of a path keep every device busy
+	aio = new AsyncIO((no_of_stripes > ASYNC_IO_THREADS) ? no_of_stripes : ASYNC_IO_THREADS, numa_node);
+
+	if(io_block_size) {
+		uint64_t path_size = 0;
+		uint32_t max_stride = io_block_size;
+		for(uint32_t i = 0;i < no_of_files;i++) {
+			uint64_t path_size_this = io_block_size + (uint64_t)(layout_l[i].depth+1) * layout_l[i].record_stride;
+			if(path_size_this > path_size)
+				path_size = path_size_this;
+			if(layout_l[i].record_stride > max_stride)
+				max_stride = layout_l[i].record_stride;
+		}
+		if(posix_memalign((void**) &direct_path, CACHE_PAGE_SIZE, path_size) != 0 || posix_memalign((void**) &direct_scratch, CACHE_PAGE_SIZE, max_stride) != 0) {
+			printf("LS : FAILED MALLOC of the direct I/O buffers\n");
+			exit(0);
+		}
+		direct_path_level = -1;
 	}
-	else
-		return -1;
-	// Else return -1
 }
 
-void LocalStorage::restoreMerkle(unsigned char* merkle, uint32_t size) {
-	std::string fpr = directoryFP + "merkleroot";
-	try {
-		std::ifstream file;
-		file.open(fpr.c_str());
-		file.read((char *)merkle,size);
-		file.close();		
+/*
+cachePrefixSize() - Bytes at the start of tree index that hold its top cached_levels levels.
+
+Both layouts place the upper levels in front of the lower ones, so the top of a tree is always a prefix of its file :
+in heap order that is the root hash and the first 2^c-1 records, with SUBTREE_PACKED_LAYOUT it is whole layers.
+*/
+uint64_t LocalStorage::cachePrefixSize(uint32_t index, uint32_t cached_levels) {
+	struct tree_layout *layout = &(layout_l[index]);
+	if(cached_levels==0)
+		return 0;
+	if(cached_levels >= layout->depth+1)
+		return layout->tree_size;
+	#ifdef SUBTREE_PACKED_LAYOUT
+		return layout->layer_base[cached_levels / layout->subtree_height];
+	#else
+		return layout->header_size + (((uint64_t)1<<cached_levels)-1) * layout->record_stride;
+	#endif
+}
+
+/*
+setupCache() - Pins the top levels of the trees in RAM, within cache_budget bytes.
+
+Every access reads and rewrites one bucket of each level of a tree, so a cached level saves one I/O per access
+no matter which tree it belongs to; levels are therefore handed out greedily, cheapest first across all trees.
+BACKEND_HDD keeps a RAM copy of the prefix : writes to it only mark its pages dirty and are written back by syncStorage(),
+so the root and upper levels, which every access rewrites, reach the file once per checkpoint.
+BACKEND_MMAP locks the prefix of the mapping instead, BACKEND_MEMORY has nothing to cache.
+*/
+void LocalStorage::setupCache() {
+	uint32_t no_of_trees = (recursion_levels==-1) ? 1 : (recursion_levels+1);
+	uint32_t first_tree = (recursion_levels==-1) ? 0 : 1;
+	uint32_t *cached_levels = (uint32_t*) calloc(no_of_trees, sizeof(uint32_t));
+	cache_size_l = (uint64_t*) calloc(no_of_trees, sizeof(uint64_t));
+	cache_l = (unsigned char**) calloc(no_of_trees, sizeof(unsigned char*));
+	cache_dirty_l = (uint8_t**) calloc(no_of_trees, sizeof(uint8_t*));
+
+	#ifndef INLINE_HASH_LAYOUT
+		//The prefix addressing needs the record layout, without it the budget is ignored
+		cache_budget = 0;
+	#endif
+	if(backend == BACKEND_MEMORY)
+		cache_budget = 0;
+
+	uint64_t cache_used = 0;
+	while(1) {
+		uint32_t best_tree = no_of_trees;
+		uint32_t best_step = 0;
+		uint64_t best_cost = 0;
+		for(uint32_t i = first_tree;i < no_of_trees;i++) {
+			if(cached_levels[i] >= layout_l[i].depth+1 || !serves(i))
+				continue;
+			#ifdef SUBTREE_PACKED_LAYOUT
+				uint32_t step = layout_l[i].subtree_height;
+			#else
+				uint32_t step = 1;
+			#endif
+			uint64_t cost = cachePrefixSize(i, cached_levels[i]+step) - cache_size_l[i];
+			if(cache_used + cost <= cache_budget && (best_tree == no_of_trees || cost < best_cost)) {
+				best_tree = i;
+				best_step = step;
+				best_cost = cost;
+			}
+		}
+		if(best_tree == no_of_trees)
+			break;
+		cached_levels[best_tree]+= best_step;
+		cache_size_l[best_tree]+= best_cost;
+		cache_used+= best_cost;
+	}
+
+	for(uint32_t i = first_tree;i < no_of_trees;i++) {
+		if(cache_size_l[i]==0)
+			continue;
+		if(backend == BACKEND_HDD) {
+			//Aligned, since DIRECT_IO_MODE flushes straight out of it
+			cache_l[i] = (unsigned char*) numaAlloc(cache_size_l[i], CACHE_PAGE_SIZE, NUMA_POLICY, numa_node);
+			cache_dirty_l[i] = (uint8_t*) calloc((cache_size_l[i] + CACHE_PAGE_SIZE - 1) / CACHE_PAGE_SIZE, sizeof(uint8_t));
+			if(cache_l[i]==NULL || cache_dirty_l[i]==NULL) {
+				printf("LS : FAILED MALLOC of %f MB for the cache of tree %d\n", float(cache_size_l[i])/float(1024*1024), i);
+				exit(0);
+			}
+			stripedIO(i, 0, cache_l[i], cache_size_l[i], false);
+		}
+		else if(backend == BACKEND_MMAP) {
+			unsigned char *tree = (i==0 && recursion_levels==-1) ? inmem_tree : inmem_tree_l[i];
+			madvise(tree, cache_size_l[i], MADV_WILLNEED);
+			if(mlock(tree, cache_size_l[i]) != 0)
+				printf("LS : Unable to lock %f MB of tree %d in RAM, check RLIMIT_MEMLOCK\n", float(cache_size_l[i])/float(1024*1024), i);
+		}
+		#ifdef DEBUG_LS
+			printf("LS : Cached %d of %d levels of tree %d, %f MB\n", cached_levels[i], layout_l[i].depth+1, i, float(cache_size_l[i])/float(1024*1024));
+		#endif
 	}
-	catch (std::ifstream::failure e) {
-			std::cerr <<"Exception opening file";
+	free(cached_levels);
+}
+
+/*
+diskRead() - readBatch through the cache, segments inside the cached prefix are copied out of RAM
+and only the remaining ones are handed to AsyncIO.
+*/
+void LocalStorage::diskRead(uint32_t level, struct io_request *requests, uint32_t no_of_requests) {
+	uint32_t index = ((int32_t) level==-1) ? 0 : level;
+	uint64_t cache_size = cache_size_l[index];
+	if(cache_size==0) {
+		aio->readBatch(requests, no_of_requests);
+		return;
 	}
+
+	std::vector<struct io_request> to_read;
+	for(uint32_t i = 0;i < no_of_requests;i++) {
+		struct io_request *request = &(requests[i]);
+		uint64_t seg_offset = request->offset;
+		if(seg_offset >= cache_size) {
+			to_read.push_back(*request);
+			continue;
+		}
+		for(uint8_t j = 0;j < request->iovcnt;j++) {
+			if(seg_offset + request->iov[j].iov_len <= cache_size) {
+				memcpy(request->iov[j].iov_base, cache_l[index] + seg_offset, request->iov[j].iov_len);
+			}
+			else {
+				struct io_request segment;
+				segment.fd = request->fd;
+				segment.offset = seg_offset;
+				segment.iov[0] = request->iov[j];
+				segment.iovcnt = 1;
+				to_read.push_back(segment);
+			}
+			seg_offset+= request->iov[j].iov_len;
+		}
+	}
+	if(to_read.size() > 0)
+		aio->readBatch(to_read.data(), to_read.size());
 }
 
-void LocalStorage::restorePosmap(uint32_t* posmap, uint32_t size)
-{
-	std::string fpp = directoryFP + "posmap";
-	try {
-		std::ifstream file;
-		file.open(fpp.c_str());
-		
-		uint32_t *posmap_iter = (uint32_t*) posmap;
-		uint32_t i = 0;
-		char *label = (char*) malloc(5);
-		for(i=0;i<size/4;i++) {
-			//std::string tempstr = std::to_string(*posmap_iter) + "\n";
-			file.getline(label,5);
-			std::string tempstr = std::string(label,4);
-			*posmap_iter = std::stoi(tempstr,NULL);
-			posmap_iter++;
-		}		
+//Counterpart of diskRead(), writes to the cached prefix stay in RAM till the next syncStorage()
+void LocalStorage::diskWrite(uint32_t level, uint64_t offset, unsigned char *data, uint32_t size) {
+	uint32_t index = ((int32_t) level==-1) ? 0 : level;
+	if(offset + size <= cache_size_l[index]) {
+		memcpy(cache_l[index] + offset, data, size);
+		for(uint64_t page = offset / CACHE_PAGE_SIZE;page <= (offset + size - 1) / CACHE_PAGE_SIZE;page++)
+			cache_dirty_l[index][page] = 1;
 	}
-	catch (std::ifstream::failure e) {
-			std::cerr <<"Exception opening file";
+	else {
+		#ifdef WAL_MODE
+			if(wal_armed)
+				walLogBefore(index, offset, size);
+		#endif
+		aio->writeBack(stripeFd(level, offset), offset, data, size);
+		#ifdef WAL_MODE
+			//Bounds the group if accesses don't end for a while (the build, a long ZT_Bulk_Read)
+			if(wal_buffer_size >= WAL_GROUP_BYTES)
+				walCommit();
+		#endif
 	}
 }
 
-void LocalStorage::savePosmapMerkleRoot(unsigned char* posmap, uint32_t posmap_size, unsigned char* merkle_root_and_aes_key, uint32_t hash_and_key_size)
-{
-	std::string fpp = directoryFP + "posmap";
-	std::string fpr = directoryFP + "merkleroot";
-	try {
-		std::ofstream file;
-		file.open(fpr.c_str());
-		file.write((char *)merkle_root_and_aes_key,hash_and_key_size);
-		file.close();
-		
-		uint32_t *posmap_iter = (uint32_t*) posmap;
-		uint32_t i = 0;
-		file.open(fpp.c_str());
-		for(i=0;i<posmap_size/4;i++) {
-			std::string tempstr = std::to_string(*posmap_iter) + "\n";
-			file.write(tempstr.c_str(),tempstr.length());
-			posmap_iter++;
+//Writes the dirty pages of every cached prefix back to its file, runs of dirty pages go out as one pwrite
+void LocalStorage::flushCache() {
+	uint32_t no_of_trees = (recursion_levels==-1) ? 1 : (recursion_levels+1);
+	for(uint32_t i = 0;i < no_of_trees;i++) {
+		if(cache_l==NULL || cache_l[i]==NULL)
+			continue;
+		uint64_t no_of_pages = (cache_size_l[i] + CACHE_PAGE_SIZE - 1) / CACHE_PAGE_SIZE;
+		uint64_t page = 0;
+		while(page < no_of_pages) {
+			if(!cache_dirty_l[i][page]) {
+				page++;
+				continue;
+			}
+			uint64_t run_start = page;
+			while(page < no_of_pages && cache_dirty_l[i][page]) {
+				cache_dirty_l[i][page] = 0;
+				page++;
+			}
+			uint64_t offset = run_start * CACHE_PAGE_SIZE;
+			uint64_t end = page * CACHE_PAGE_SIZE;
+			if(end > cache_size_l[i])
+				end = cache_size_l[i];
+			if(!stripedIO(i, offset, cache_l[i] + offset, end - offset, true))
+				printf("LS : Short write while flushing the cache of tree %d at offset %ld\n", i, offset);
 		}
-		file.close();
-		
 	}
-	catch (std::ifstream::failure e) {
-			std::cerr <<"Exception opening file";
+}
+
+uint32_t LocalStorage::sizeForLevel(uint32_t level) {
+	if((int32_t) level==-1 || (int32_t) level==recursion_levels)
+		return dataSize;
+	return recursionBlockSize;
+}
+
+/* levelDepth() - Depth of the tree held for level, -1 if the instance has no tree at that level */
+int32_t LocalStorage::levelDepth(uint32_t level) {
+	if(recursion_levels==-1)
+		return ((int32_t) level==-1) ? layout_l[0].depth : -1;
+	if((int32_t) level < 1 || (int32_t) level > recursion_levels)
+		return -1;
+	return layout_l[level].depth;
+}
+
+unsigned char* LocalStorage::treeBase(uint32_t level) {
+	return ((int32_t) level==-1) ? inmem_tree : inmem_tree_l[level];
+}
+
+/*
+setupLayout() - Computes where the records of a tree of depth D_level are placed.
+
+Heap order puts the D+1 buckets of a path on D+1 different pages. With SUBTREE_PACKED_LAYOUT the tree is cut
+into layers of subtree_height levels, and every subtree of a layer is stored contiguously in a slot that never
+crosses a SUBTREE_UNIT_SIZE boundary, so a path touches about (D+1)/subtree_height units.
+Every slot starts with a HASH_LENGTH gap, which holds the root hash in the root's slot.
+With DIRECT_IO_MODE records are padded to record_stride, a multiple of io_block_size, and the gap is a whole block,
+so every record (and the root hash) can be read and written on its own with O_DIRECT.
+*/
+void LocalStorage::setupLayout(uint32_t index, uint32_t D_level, uint32_t size_for_level) {
+	struct tree_layout *layout = &(layout_l[index]);
+	layout->depth = D_level;
+	layout->record_size = Z*size_for_level + 2*HASH_LENGTH;
+	layout->record_stride = layout->record_size;
+	layout->header_size = HASH_LENGTH;
+	if(io_block_size) {
+		layout->record_stride = ((layout->record_size + io_block_size - 1) / io_block_size) * io_block_size;
+		layout->header_size = io_block_size;
 	}
+
+	#ifdef SUBTREE_PACKED_LAYOUT
+		uint32_t k = 1;
+		while(k < D_level+1 && layout->header_size + (uint64_t)((1<<(k+1))-1) * layout->record_stride <= SUBTREE_UNIT_SIZE)
+			k++;
+		layout->subtree_height = k;
+		layout->no_of_layers = (D_level + k) / k;
+		layout->layer_base = (uint64_t*) malloc(layout->no_of_layers * sizeof(uint64_t));
+		layout->layer_stride = (uint64_t*) malloc(layout->no_of_layers * sizeof(uint64_t));
+
+		uint64_t base = 0;
+		for(uint32_t l = 0;l < layout->no_of_layers;l++) {
+			uint32_t h = (D_level+1 - l*k < k) ? (D_level+1 - l*k) : k;
+			uint64_t slot = layout->header_size + (uint64_t)((1<<h)-1) * layout->record_stride;
+			uint64_t stride;
+			if(slot <= SUBTREE_UNIT_SIZE) {
+				//Power of two strides keep every slot inside one unit
+				stride = 1;
+				while(stride < slot)
+					stride = stride<<1;
+			}
+			else {
+				stride = ((slot + SUBTREE_UNIT_SIZE - 1) / SUBTREE_UNIT_SIZE) * SUBTREE_UNIT_SIZE;
+			}
+			layout->layer_base[l] = base;
+			layout->layer_stride[l] = stride;
+			base+= ((uint64_t)1<<(l*k)) * stride;
+		}
+		layout->tree_size = base;
+	#else
+		layout->subtree_height = D_level+1;
+		layout->no_of_layers = 1;
+		layout->tree_size = layout->header_size + (((uint64_t)1<<(D_level+1))-1) * layout->record_stride;
+	#endif
+
+	#ifdef DEBUG_LS
+		printf("LS : Layout %d, D = %d, record_size = %d, subtree_height = %d, tree_size = %f MB\n", index, D_level, layout->record_size, layout->subtree_height, float(layout->tree_size)/float(1024*1024));
+	#endif
+}
+
+/*
+INLINE_HASH_LAYOUT addressing, bucket_no is the 1-indexed node label (root = 1).
+hash(k) lives in the record of its parent, in the L slot for even k and the R slot for odd k.
+*/
+uint64_t LocalStorage::recordOffset(uint32_t bucket_no, uint32_t level) {
+	struct tree_layout *layout = &(layout_l[((int32_t) level==-1) ? 0 : level]);
+	#ifdef SUBTREE_PACKED_LAYOUT
+		uint32_t depth = 31 - __builtin_clz(bucket_no);
+		uint32_t layer = depth / layout->subtree_height;
+		uint32_t depth_in_subtree = depth - layer * layout->subtree_height;
+		uint32_t subtree_root = bucket_no >> depth_in_subtree;
+		uint32_t local_no = bucket_no - (subtree_root << depth_in_subtree) + (1 << depth_in_subtree);
+		uint64_t subtree_no = subtree_root - (1 << (layer * layout->subtree_height));
+		return layout->layer_base[layer] + subtree_no * layout->layer_stride[layer] + layout->header_size + (uint64_t)(local_no-1) * layout->record_stride;
+	#else
+		return layout->header_size + (uint64_t)(bucket_no-1) * layout->record_stride;
+	#endif
+}
+
+uint64_t LocalStorage::bucketOffset(uint32_t bucket_no, uint32_t level) {
+	return recordOffset(bucket_no, level) + HASH_LENGTH;
+}
+
+uint64_t LocalStorage::hashOffset(uint32_t bucket_no, uint32_t level) {
+	if(bucket_no==1)
+		return 0;
+	uint64_t parent_record = recordOffset(bucket_no>>1, level);
+	if(bucket_no%2==0)
+		return parent_record;
+	return parent_record + layout_l[((int32_t) level==-1) ? 0 : level].record_size - HASH_LENGTH;
 }
 
-void LocalStorage::saveStashLevel(unsigned char* stash, uint32_t stash_size, uint32_t level) 
+/*
+directTree() - Describes the tree of level for DIRECT_TREES : only trees this instance holds in memory (or maps) with
+INLINE_HASH_LAYOUT, and without DIRECT_IO_MODE padding, can be read and written in place by the enclave.
+Paths written that way skip uploadPath, so they are marked dirty by the enclave itself (dirty_bitmap).
+*/
+bool LocalStorage::directTree(uint32_t level, struct direct_tree *tree)
 {
-	std::string fps = directoryFP + temp + "stash" + std::to_string(level);
-		try {
-		std::ofstream file(fps.c_str());
-		file.write((const char*)stash,stash_size);
-		/*
-		uint32_t *stash_iter = (uint32_t*) stash;
-		for(uint32_t i=0;i<stash_size;i++) {
-			std::string temp = std::to_string(*(stash_iter++)) + "\t";
-			temp+= std::to_string(*(stash_iter++)) + "\n";
-			file.write(temp.c_str(),temp.length());
-		}*/
-		file.close();
+	#ifndef INLINE_HASH_LAYOUT
+		return false;
+	#endif
+	if(!inmem || io_block_size || !serves(level))
+		return false;
+	uint32_t index = ((int32_t) level==-1) ? 0 : level;
+	struct tree_layout *layout = &(layout_l[index]);
+	if(layout->no_of_layers > DIRECT_TREE_MAX_LAYERS)
+		return false;
+
+	memset(tree, 0, sizeof(struct direct_tree));
+	tree->base = treeBase(level);
+	tree->tree_size = layout->tree_size;
+	tree->depth = layout->depth;
+	tree->record_size = layout->record_size;
+	tree->record_stride = layout->record_stride;
+	tree->header_size = layout->header_size;
+	tree->subtree_height = layout->subtree_height;
+	tree->no_of_layers = layout->no_of_layers;
+	#ifdef SUBTREE_PACKED_LAYOUT
+		for(uint32_t l = 0;l < layout->no_of_layers;l++) {
+			tree->layer_base[l] = layout->layer_base[l];
+			tree->layer_stride[l] = layout->layer_stride[l];
+		}
+	#else
+		tree->layer_base[0] = 0;
+		tree->layer_stride[0] = layout->tree_size;
+	#endif
+	#ifdef DIRTY_TRACKING
+		tree->dirty_bitmap = dirty_bitmap_l[index];
+		tree->dirty_bitmap_size = (((uint64_t)2<<layout->depth) + 7) / 8;
+	#endif
+	return true;
+}
 
-		
+/*
+stripeOf() - Stripe of tree index that holds the byte at offset, and in *band_end where the run of it held by that stripe ends.
+
+Trees are striped level by level in heap order (layer by layer with SUBTREE_PACKED_LAYOUT, whose slots never span layers) :
+level l goes to stripe l % no_of_stripes, so the D+1 records of a path are spread evenly over all the stripes.
+The root hash in front of the root record goes with level 0.
+*/
+uint32_t LocalStorage::stripeOf(uint32_t index, uint64_t offset, uint64_t *band_end) {
+	struct tree_layout *layout = &(layout_l[index]);
+	uint32_t band;
+	#ifdef SUBTREE_PACKED_LAYOUT
+		band = 0;
+		while(band+1 < layout->no_of_layers && layout->layer_base[band+1] <= offset)
+			band++;
+		*band_end = (band+1 < layout->no_of_layers) ? layout->layer_base[band+1] : layout->tree_size;
+	#else
+		uint64_t record_no = (offset < layout->header_size) ? 1 : ((offset - layout->header_size) / layout->record_stride + 1);
+		band = 63 - __builtin_clzll(record_no);
+		*band_end = layout->header_size + (((uint64_t)2<<band)-1) * layout->record_stride;
+	#endif
+	if(offset >= layout->tree_size)
+		*band_end = offset + ((uint64_t)1<<62);
+	return band % no_of_stripes;
+}
+
+//File a request at offset of the tree of level is issued to
+int LocalStorage::stripeFd(uint32_t level, uint64_t offset) {
+	uint32_t index = ((int32_t) level==-1) ? 0 : level;
+	if(no_of_stripes == 1)
+		return hdd_fd_l[index];
+	uint64_t band_end;
+	return stripe_fd_l[index][stripeOf(index, offset, &band_end)];
+}
+
+//Synchronous pread/pwrite of a range that may span stripes (the cached prefix), holes past the end of a file read as zeros
+bool LocalStorage::stripedIO(uint32_t index, uint64_t offset, unsigned char *buffer, uint64_t size, bool write) {
+	bool ok = true;
+	while(size > 0) {
+		uint64_t band_end = offset + size;
+		int fd = hdd_fd_l[index];
+		if(no_of_stripes > 1)
+			fd = stripe_fd_l[index][stripeOf(index, offset, &band_end)];
+		uint64_t length = (band_end - offset < size) ? (band_end - offset) : size;
+		ssize_t rc = write ? pwrite(fd, buffer, length, offset) : pread(fd, buffer, length, offset);
+		if(rc < (ssize_t) length) {
+			if(write)
+				ok = false;
+			else
+				memset(buffer + ((rc > 0) ? rc : 0), 0, length - ((rc > 0) ? rc : 0));
+		}
+		offset+= length;
+		buffer+= length;
+		size-= length;
+	}
+	return ok;
+}
+
+//Same expression as the enclave, so that both sides agree on the depth of every tree
+static uint32_t treeDepth(uint64_t max_blocks, uint32_t Z) {
+	uint32_t pD_temp = ceil((double)max_blocks/(double)Z);
+	return (uint32_t) ceil(log((double)pD_temp)/log((double)2));
+}
+
+//Same sizing as ORAMTree::SetParams/BuildTreeRecursive in the enclave
+void treeDepths(uint32_t maxBlocks, uint32_t Z, uint32_t recursion_block_size, int8_t recursion_levels, uint32_t *depth_l) {
+	if(recursion_levels==-1) {
+		depth_l[0] = treeDepth(maxBlocks, Z);
+		return;
 	}
-	catch (std::ifstream::failure e) {
-			std::cerr <<"Exception opening file";
+	uint32_t x = (recursion_block_size - ADDITIONAL_METADATA_SIZE) / sizeof(uint32_t);
+	uint64_t level_blocks = maxBlocks;
+	for(int32_t i = recursion_levels;i > 1;i--)
+		level_blocks = (uint64_t) ceil((double)level_blocks/(double)x);
+	depth_l[0] = 0;
+	for(int32_t i = 1;i<= recursion_levels;i++) {
+		depth_l[i] = treeDepth(level_blocks, Z);
+		level_blocks = level_blocks * x;
 	}
 }
 
-void LocalStorage::saveState(unsigned char *posmap, uint32_t posmap_size, unsigned char *stash, uint32_t stash_size, unsigned char* merkle_root_and_aes_key,uint32_t hash_and_key_size)
-{
-	
-	std::string fpp = directoryFP + temp + "posmap";
-	std::string fps = directoryFP + temp + "stash";
-	std::string fpr = directoryFP + temp + "merkleroot";
+#ifdef HUGEPAGE_TREES
+//Default huge page size of the system (Hugepagesize in /proc/meminfo), 2 MB if it can't be read
+static uint64_t hugePageSize() {
+	uint64_t huge_page_size = 2 * 1024 * 1024;
+	std::ifstream meminfo("/proc/meminfo");
+	std::string line;
+	while(getline(meminfo, line)) {
+		if(line.compare(0, 13, "Hugepagesize:") == 0) {
+			huge_page_size = (uint64_t) atol(line.c_str() + 13) * 1024;
+			break;
+		}
+	}
+	return huge_page_size;
+}
 
-	try {
-		std::ofstream file(fpp.c_str());
-		uint32_t *posmap_iter = (uint32_t*) posmap;
-		uint32_t i = 0;
-		for(i=0;i<posmap_size;i++) {
-			std::string temp = std::to_string(*posmap_iter) + "\n";
-			file.write(temp.c_str(),temp.length());
-			posmap_iter++;
-		}
-		//file.write((unsigned char*) posmap, dataSize * Z);
-		file.close();
+//Transparent huge pages are only handed out for madvise'd regions if the kernel isn't set to "never"
+static bool thpAvailable() {
+	std::ifstream thp("/sys/kernel/mm/transparent_hugepage/enabled");
+	std::string mode;
+	if(!getline(thp, mode))
+		return false;
+	return (mode.find("[never]") == std::string::npos);
+}
+#endif
+
+/*
+allocTree() - Buffer of an in-memory tree (data tree, or hash tree without INLINE_HASH_LAYOUT).
 
-		file.open(fps.c_str());
-		uint32_t *stash_iter = (uint32_t*) stash;
-		for(i=0;i<stash_size;i++) {
-			std::string temp = std::to_string(*(stash_iter++)) + "\t";
-			temp+= std::to_string(*(stash_iter++)) + "\n";
-			file.write(temp.c_str(),temp.length());
+Every access walks a path to a random leaf, so with 4 KB pages nearly every bucket of a multi-GB tree is a TLB miss.
+With HUGEPAGE_TREES the buffer is taken from the MAP_HUGETLB pool, and if the pool can't hold it, from a huge page
+aligned mapping that is madvise'd for transparent huge pages. Either way the alignment also keeps
+SUBTREE_PACKED_LAYOUT units on one page each. The page size obtained is reported for every tree.
+Every tree is a mapping of its own, placed by NUMA_POLICY before anything touches it.
+
+Trees are never malloc'd : the enclave builds them sparse (SPARSE_TREES), so the buffer has to read back as zeros,
+and its pages should only be faulted in by the first path written through them.
+*/
+static unsigned char* allocTree(uint64_t tree_size, int32_t numa_node) {
+	#ifdef HUGEPAGE_TREES
+		uint64_t huge_page_size = hugePageSize();
+		uint64_t alloc_size = ((tree_size + huge_page_size - 1) / huge_page_size) * huge_page_size;
+
+		void *tree = mmap(NULL, alloc_size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB, -1, 0);
+		if(tree != MAP_FAILED) {
+			printf("LS : Tree of %f MB backed by %ld KB pages (MAP_HUGETLB)\n", float(tree_size)/float(1024*1024), huge_page_size/1024);
+			numaPlace(tree, alloc_size, NUMA_POLICY, numa_node);
+			return (unsigned char*) tree;
 		}
-		file.close();
 
-		file.open(fpr.c_str());
-		file.write((char *)merkle_root_and_aes_key,hash_and_key_size);
-		file.close();
+		tree = numaAlloc(alloc_size, huge_page_size, NUMA_POLICY, numa_node);
+		if(tree == NULL)
+			return NULL;
+		if(thpAvailable() && madvise(tree, alloc_size, MADV_HUGEPAGE) == 0)
+			printf("LS : Tree of %f MB backed by %ld KB pages (transparent huge pages, MAP_HUGETLB pool too small)\n", float(tree_size)/float(1024*1024), huge_page_size/1024);
+		else
+			printf("LS : Tree of %f MB backed by %ld KB pages, no huge pages available\n", float(tree_size)/float(1024*1024), sysconf(_SC_PAGESIZE)/1024);
+		return (unsigned char*) tree;
+	#elif SUBTREE_PACKED_LAYOUT
+		//SUBTREE_PACKED_LAYOUT units have to be aligned to actually fall on one page each
+		return (unsigned char*) numaAlloc(tree_size, SUBTREE_UNIT_SIZE, NUMA_POLICY, numa_node);
+	#else
+		return (unsigned char*) numaAlloc(tree_size, 0, NUMA_POLICY, numa_node);
+	#endif
+}
+
+/*
+mapTreeFile() - Opens (or creates) file_name_this, sizes it to map_size and maps it in once.
+All subsequent accesses to the tree are plain memcpys against the returned mapping,
+dirty pages are only flushed back to the file by syncStorage()
+The file is emptied first, unless the tree it holds is reattached (LocalStorage::resumeFrom).
+*/
+static unsigned char* mapTreeFile(std::string file_name_this, uint64_t map_size, int *fd, bool reattach) {
+	*fd = open(file_name_this.c_str(), reattach ? (O_RDWR|O_CREAT) : (O_RDWR|O_CREAT|O_TRUNC), 0644);
+	if(*fd == -1) {
+		printf("LS : Failed to open %s\n", file_name_this.c_str());
+		exit(0);
+	}
+	if(ftruncate(*fd, map_size) != 0) {
+		printf("LS : Failed to size %s to %f MB\n", file_name_this.c_str(), float(map_size)/float(1024*1024));
+		exit(0);
 	}
-	catch (std::ifstream::failure e) {
-			std::cerr <<"Exception opening file";
+
+	unsigned char *map = (unsigned char*) mmap(NULL, map_size, PROT_READ|PROT_WRITE, MAP_SHARED, *fd, 0);
+	if(map == MAP_FAILED) {
+		printf("LS : FAILED MMAP of %s (%f MB)\n", file_name_this.c_str(), float(map_size)/float(1024*1024));
+		exit(0);
 	}
+	//ORAM paths are uniformly random, readahead only pulls in buckets we won't touch
+	madvise(map, map_size, MADV_RANDOM);
+
+	#ifdef DEBUG_LS
+		printf("LS : Mapped %s, size = %f MB\n", file_name_this.c_str(), float(map_size)/float(1024*1024));
+	#endif
+	return map;
 }
-void LocalStorage::setParams(uint32_t maxBlocks,uint32_t set_D, uint32_t set_Z, uint32_t stashSize, uint32_t dataSize_p, bool inmem_p, uint32_t recursion_block_size, int8_t recursion_levels_p)
+
+void LocalStorage::setParams(uint32_t maxBlocks,uint32_t set_D, uint32_t set_Z, uint32_t stashSize, uint32_t dataSize_p, uint8_t backend_p, uint32_t recursion_block_size, int8_t recursion_levels_p, uint64_t cache_budget_p)
 {
 	//Test and set directory name
 	dataSize = dataSize_p;
 	D = set_D;
 	Z = set_Z;
-	inmem = inmem_p;	
+	backend = backend_p;
+	inmem = (backend != BACKEND_HDD);
+	cache_budget = cache_budget_p;
+
+	//The thread creating the instance is the one that issues its OCALLs later on,
+	//so with NUMA_BIND everything the OCALLs touch is allocated on its current node, and the I/O threads are pinned there
+	numa_node = -1;
+	if(NUMA_POLICY == NUMA_BIND && numaNoOfNodes() > 1) {
+		numa_node = numaNodeOfThread();
+		#ifdef NUMA_PIN_CALLER
+			numaPinThread(pthread_self(), numa_node);
+		#endif
+		printf("LS : Instance %d placed on NUMA node %d\n", storage_id, numa_node);
+	}
 
-	temp = std::to_string(maxBlocks) + "_" + std::to_string(dataSize) + "_" + std::to_string(stashSize);
+	temp = std::to_string(file_id) + "_" + std::to_string(maxBlocks) + "_" + std::to_string(dataSize) + "_" + std::to_string(stashSize);
 	recursionBlockSize = recursion_block_size;
 	recursion_levels = recursion_levels_p;
 
 	bucket_size = dataSize_p * Z;
 	datatree_size = (pow(2,D+1)-1) * (bucket_size);
 	hashtree_size = ((pow(2,D+1)-1) * (HASH_LENGTH));
+	#ifdef INLINE_HASH_LAYOUT
+		hashtree_size = 0;
+	#endif
+
+	//Stripes of the disk backend, the first stripe directory takes the place of storage_directory
+	no_of_stripes = 1;
+	char *stripe_list = getenv("ZT_STRIPE_DIRECTORIES");
+	if(stripe_list != NULL) {
+		stripe_directories.clear();
+		std::string list = stripe_list;
+		size_t start = 0;
+		while(start <= list.size()) {
+			size_t end = list.find(':', start);
+			if(end == std::string::npos)
+				end = list.size();
+			if(end > start)
+				stripe_directories.push_back(list.substr(start, end - start));
+			start = end + 1;
+		}
+	}
+	#ifdef INLINE_HASH_LAYOUT
+		if(backend == BACKEND_HDD && stripe_directories.size() > 0) {
+			for(uint32_t k = 0;k < stripe_directories.size();k++) {
+				if(stripe_directories[k][stripe_directories[k].size()-1] != '/')
+					stripe_directories[k].append("/");
+				std::string system_inst = "mkdir -p " + stripe_directories[k] + "\n";
+				system(system_inst.c_str());
+			}
+			no_of_stripes = stripe_directories.size();
+			directoryFP = stripe_directories[0];
+			printf("LS : Instance %d striped across %d directories\n", storage_id, no_of_stripes);
+		}
+	#endif
+
+	//DIRECT_IO_MODE pads the records of the disk backend to the logical block size of the device
+	io_block_size = 0;
+	#ifdef DIRECT_IO_MODE
+		//Records are padded to the largest block size among the stripes' devices
+		if(backend == BACKEND_HDD) {
+			io_block_size = logicalBlockSize(directoryFP);
+			for(uint32_t k = 1;k < no_of_stripes;k++) {
+				uint32_t stripe_block_size = logicalBlockSize(stripe_directories[k]);
+				if(stripe_block_size > io_block_size)
+					io_block_size = stripe_block_size;
+			}
+		}
+	#endif
+
+	//Record layout of every tree, with the tree depths the enclave builds (ORAMTree::SetParams/BuildTreeRecursive)
+	uint32_t no_of_trees = (recursion_levels==-1) ? 1 : (recursion_levels+1);
+	layout_l = (struct tree_layout*) calloc(no_of_trees, sizeof(struct tree_layout));
+	uint32_t *depth_l = (uint32_t*) malloc(no_of_trees * sizeof(uint32_t));
+	treeDepths(maxBlocks, Z, recursion_block_size, recursion_levels, depth_l);
+	if(recursion_levels==-1) {
+		setupLayout(0, depth_l[0], dataSize);
+	}
+	else {
+		for(int32_t i = 1;i<= recursion_levels;i++)
+			setupLayout(i, depth_l[i], (i==recursion_levels) ? dataSize : recursionBlockSize);
+	}
+	free(depth_l);
+	#ifdef INLINE_HASH_LAYOUT
+		datatree_size = layout_l[0].tree_size;
+	#endif
 
 	#ifdef DEBUG_LS
 		printf("\nIN LS : recursion_levels = %d, dataSize = %d, recursionBlockSize = %d\n\n",recursion_levels, dataSize, recursionBlockSize);
@@ -382,16 +1008,20 @@ void LocalStorage::setParams(uint32_t maxBlocks,uint32_t set_D, uint32_t set_Z,
 	#endif
 
 	if(inmem==false) {
-		#ifndef RESUME_EXPERIMENT
-			std::string system_inst = "mkdir "+ directoryFP+ temp + "\n";
-			system(system_inst.c_str());
-			//std::string system_inst2 = "mkdir " + directoryFP + temp +"_i\n";
-			//system(system_inst2.c_str());
-			file_name = directoryFP+temp+"/"+temp;
-			file_name_i = directoryFP+temp+"/"+temp+"_i";
-			//printf("MAXBLOCKS: %d\n",maxBlocks);
-
-			if(recursion_levels==0) {
+		std::string system_inst = "mkdir -p "+ directoryFP+ temp + "\n";
+		system(system_inst.c_str());
+		//std::string system_inst2 = "mkdir " + directoryFP + temp +"_i\n";
+		//system(system_inst2.c_str());
+		file_name = directoryFP+temp+"/"+temp;
+		file_name_i = directoryFP+temp+"/"+temp+"_i";
+		//printf("MAXBLOCKS: %d\n",maxBlocks);
+
+		//Resuming reattaches to the tree files as they are, only a new instance creates (and empties) them
+		if(resume) {
+			printf("LS : Reattaching instance %d to the trees in %s\n", storage_id, (directoryFP+temp).c_str());
+		}
+		else {
+			if(recursion_levels==-1) {
 				std::ofstream file(file_name,std::ios::binary);
 				std::ofstream file_i(file_name_i,std::ios::binary);
 				file.seekp(datatree_size);
@@ -409,7 +1039,7 @@ void LocalStorage::setParams(uint32_t maxBlocks,uint32_t set_D, uint32_t set_Z,
 				while(pmap0_blocks > MEM_POSMAP_LIMIT_LS/ UTILIZATION_PARAMETER){
 					pmap0_blocks = (uint32_t) ceil((double)pmap0_blocks/(double)x);
 				}
-				uint32_t lev = 2;
+				int32_t lev = 2;
 				maxBlocks_of_pmap_level[0] = pmap0_blocks;
 				maxBlocks_of_pmap_level[1] = pmap0_blocks;
 				while(lev <= recursion_levels){
@@ -418,182 +1048,740 @@ void LocalStorage::setParams(uint32_t maxBlocks,uint32_t set_D, uint32_t set_Z,
 					lev++;
 			}			
 				
-			#ifdef CACHE_UPPER
-				//Partition the last disk layer across DRAM and Storage Disk
-				uint64_t total_size= 0;
-				inmem_tree_l = (unsigned char**) malloc ((recursion_levels+1)*sizeof(unsigned char*));
-				inmem_hash_l = (unsigned char**) malloc ((recursion_levels+1)*sizeof(unsigned char*));
-
-				for(uint32_t i = 1;i<= recursion_levels;i++) {
+				for(int32_t i = 1;i<= recursion_levels;i++) {
 					std::string file_name_this = file_name + "p" + std::to_string(i);
 					std::string file_name_this_i = file_name + "p" + std::to_string(i) + "_i";
-												
+					std::ofstream file(file_name_this,std::ios::binary);
 					uint32_t pD_temp = ceil((double)maxBlocks_of_pmap_level[i]/(double) UTILIZATION_PARAMETER);
 					uint32_t pD = (uint32_t) ceil(log((double)pD_temp)/log((double)2));
 					uint32_t pN = (int) pow((double)2, (double) pD);
-					uint32_t ptreeSize = 2*pN-1;	
-					uint64_t file_size, remainder, mem_tree_size, next_layer_size, final_file_size = 0; 
-					uint64_t hashtree_size_this = (uint64_t)(ptreeSize) * (uint64_t)HASH_LENGTH;
-
-					inmem_hash_l[i] = (unsigned char*) malloc(hashtree_size_this);
-					printf("HASHTREE_SIZE for level %d = %f MB\n",i,float(hashtree_size_this)/float(1024*1024));					
-					total_size+=hashtree_size_this;
+					uint32_t ptreeSize = 2*pN-1;
 
+					uint64_t file_size; 
 					if(i==recursion_levels)	
 						file_size = (uint64_t) ptreeSize* (uint64_t) (Z*dataSize_p); 
 					else
 						file_size = (uint64_t) ptreeSize* (uint64_t) (Z*recursion_block_size);
-
-					if(i==recursion_levels){						
-						//Determine amount that has to be moved to Disk storage
-						//Do Math here to detemine number of levels that can be cached.
-						remainder = RAM_LIMIT - total_size;
-						levels_on_disk = 1;	
-						objectkeylimit = ptreeSize - pN;
-						mem_tree_size = ( (uint64_t)(pN) * (uint64_t)(Z*dataSize_p));
-						final_file_size += ((uint64_t)pN * (uint64_t)(Z*dataSize_p));
-			
-						printf("mem_tree_size = %f MB\n",(float) mem_tree_size/(float)(1024*1024));
-						//Note : Last layer of tree is ALWAYS moved to DISK
-						//If tree doesn't fit in memory more of the lower levels are moved to Disk
-						while(mem_tree_size > remainder) {				
-							next_layer_size = ((uint64_t)(pow(2,pD-(levels_on_disk))) * (uint64_t)Z*dataSize_p); 
-							mem_tree_size -= next_layer_size;
-							final_file_size += next_layer_size;				
-							objectkeylimit -= (pow(2,pD-(levels_on_disk)));
-							levels_on_disk++;
-							printf("mem_tree_size = %f MB\n",(float) mem_tree_size/(float)(1024*1024));
-						}						
-						printf("Level on Disk = %d\n", levels_on_disk);					
-
-						//Setup DataTree half Inmem and half in disk
-						//Setup Integrity tree Inmem
-						inmem_tree_l[i] = (unsigned char*) malloc(mem_tree_size);
-						if(!inmem_tree_l[i]) {
-							printf("FAILED MALLOC of %f MB\n", float(mem_tree_size)/(float(1024*1024)));
-							exit(0);
-						}
-						std::ofstream file(file_name_this,std::ios::binary);
-						file.seekp(final_file_size);
-						file.write("X",1);
-						file.close();
-					}
-					else{	
-						inmem_tree_l[i] = (unsigned char*) malloc(file_size);
-						total_size+=file_size;
-					}			
-				}		
-			
-				#else
-					for(uint32_t i = 1;i<= recursion_levels;i++) {
-						std::string file_name_this = file_name + "p" + std::to_string(i);
-						std::string file_name_this_i = file_name + "p" + std::to_string(i) + "_i";
-						std::ofstream file(file_name_this,std::ios::binary);
+					#ifdef INLINE_HASH_LAYOUT
+						file_size = layout_l[i].tree_size;
+					#endif
+					file.seekp(file_size);
+					printf("Level = %d, MaxBlocks = %ld, File_size = %ld or %f GB\n", i, maxBlocks_of_pmap_level[i], file_size, float(file_size)/float(1024*1024*1024));				
+					file.write("X",1);
+					file.close();
+				
+					#ifndef INLINE_HASH_LAYOUT
 						std::ofstream file_i(file_name_this_i,std::ios::binary);
-						uint32_t pD_temp = ceil((double)maxBlocks_of_pmap_level[i]/(double) UTILIZATION_PARAMETER);
-						uint32_t pD = (uint32_t) ceil(log((double)pD_temp)/log((double)2));
-						uint32_t pN = (int) pow((double)2, (double) pD);
-						uint32_t ptreeSize = 2*pN-1;
-	
-						uint64_t file_size; 
-						if(i==recursion_levels)	
-							file_size = (uint64_t) ptreeSize* (uint64_t) (Z*dataSize_p); 
-						else
-							file_size = (uint64_t) ptreeSize* (uint64_t) (Z*recursion_block_size);
-						file.seekp(file_size);
-						printf("Level = %d, MaxBlocks = %ld, File_size = %ld or %f GB\n", i, maxBlocks_of_pmap_level[i], file_size, float(file_size)/float(1024*1024*1024));				
-						file.write("X",1);
-						file.close();
-					
 						uint64_t hashtree_size_this = (uint64_t)(pow(2,pD+1)-1 ) * (uint64_t)HASH_LENGTH;
 						file_i.seekp(hashtree_size_this);
 						file_i.write("X",1);
-						file_i.close();				
-					}				
-				#endif			
+						file_i.close();
+					#endif
+				}				
 			}	
+		}
+		#ifdef ASYNC_IO_MODE
+			openDiskFiles();
+		#endif
+		#ifdef WAL_MODE
+			//Before the cache is loaded, since recovery rewrites the files
+			openWAL();
 		#endif
 	}
 	else {
+		if(backend == BACKEND_MMAP) {
+			std::string system_inst = "mkdir -p "+ directoryFP+ temp + "\n";
+			system(system_inst.c_str());
+			file_name = directoryFP+temp+"/"+temp;
+			file_name_i = directoryFP+temp+"/"+temp+"_i";
+			if(resume)
+				printf("LS : Reattaching instance %d to the trees in %s\n", storage_id, (directoryFP+temp).c_str());
+
+			uint32_t no_of_maps = (recursion_levels==-1) ? 1 : (recursion_levels+1);
+			mmap_fd_l = (int*) calloc(no_of_maps, sizeof(int));
+			mmap_fd_hash_l = (int*) calloc(no_of_maps, sizeof(int));
+			mmap_size_l = (uint64_t*) calloc(no_of_maps, sizeof(uint64_t));
+			mmap_hash_size_l = (uint64_t*) calloc(no_of_maps, sizeof(uint64_t));
+		}
+
 		if(recursion_levels==-1) {
 			#ifdef DEBUG_LS			
 				printf("DataTree_size = %ld, HashTree_size = %ld\n",datatree_size,hashtree_size);			
 			#endif			
-			inmem_tree = (unsigned char *) malloc(datatree_size);
-			inmem_hash = (unsigned char *) malloc(hashtree_size);
+			if(backend == BACKEND_MMAP) {
+				mmap_size_l[0] = datatree_size;
+				mmap_hash_size_l[0] = hashtree_size;
+				inmem_tree = mapTreeFile(file_name, datatree_size, &(mmap_fd_l[0]), resume);
+				#ifndef INLINE_HASH_LAYOUT
+					inmem_hash = mapTreeFile(file_name_i, hashtree_size, &(mmap_fd_hash_l[0]), resume);
+				#endif
+			}
+			else {
+				inmem_tree = allocTree(datatree_size, numa_node);
+				#ifndef INLINE_HASH_LAYOUT
+					inmem_hash = allocTree(hashtree_size, numa_node);
+				#endif
+			}
 		}	
 		else {	
-			#ifdef RESUME_EXPERIMENT
-				//Resuming mechanism for in-memory database
-			#else	
-			
-				uint32_t x = (recursion_block_size - 24) / 4;
+		
+			uint32_t x = (recursion_block_size - 24) / 4;
+			#ifdef DEBUG_LS
+				printf("X = %d\n",x);
+			#endif
+			uint64_t pmap0_blocks = maxBlocks; 				
+			uint64_t *maxBlocks_of_pmap_level = (uint64_t*) malloc((recursion_levels +1) * sizeof(uint64_t*));
+		
+			int32_t level = recursion_levels;
+			maxBlocks_of_pmap_level[recursion_levels] = pmap0_blocks;
+		
+	
+			while(level > 1) {
+				maxBlocks_of_pmap_level[level-1] = ceil((double)maxBlocks_of_pmap_level[level]/(double)x);
+				level--;
+			}
+			maxBlocks_of_pmap_level[0] = maxBlocks_of_pmap_level[1];
+			#ifdef DEBUG_LS
+				printf("LS:Level : %d, Blocks : %ld\n", 0, maxBlocks_of_pmap_level[0]);	
+			#endif	
+			level = 2;
+		
+			while(level <= recursion_levels) {
+				maxBlocks_of_pmap_level[level] = maxBlocks_of_pmap_level[level-1] * x;
 				#ifdef DEBUG_LS
-					printf("X = %d\n",x);
+					printf("LS:Level : %d, Blocks : %ld\n", level, maxBlocks_of_pmap_level[level]);
+				#endif				
+				level++;
+			}
+
+			inmem_tree_l = (unsigned char**) calloc ((recursion_levels+1), sizeof(unsigned char*));
+			inmem_hash_l = (unsigned char**) calloc ((recursion_levels+1), sizeof(unsigned char*));
+			for(int32_t i = 1;i<= recursion_levels;i++) {
+				if(!serves(i))
+					continue;
+				uint64_t level_size; 
+				if(i==recursion_levels)	
+					level_size = 2 * ceil((double)maxBlocks_of_pmap_level[i])*(Z*(dataSize_p+ADDITIONAL_METADATA_SIZE)); 
+				else
+					level_size = 2 * ceil((double) maxBlocks_of_pmap_level[i]) * (Z*(recursion_block_size+ADDITIONAL_METADATA_SIZE));
+				uint64_t hashtree_size_this = 2 * maxBlocks_of_pmap_level[i] * HASH_LENGTH;				
+				#ifdef INLINE_HASH_LAYOUT
+					level_size = layout_l[i].tree_size;
+					hashtree_size_this = 0;
 				#endif
-				uint64_t pmap0_blocks = maxBlocks; 				
-				uint64_t cur_pmap0_blocks = maxBlocks;
-				uint64_t *maxBlocks_of_pmap_level = (uint64_t*) malloc((recursion_levels +1) * sizeof(uint64_t*));
 			
-				uint32_t level = recursion_levels;
-				maxBlocks_of_pmap_level[recursion_levels] = pmap0_blocks;
-			
-		
-				while(level > 1) {
-					maxBlocks_of_pmap_level[level-1] = ceil((double)maxBlocks_of_pmap_level[level]/(double)x);
-					level--;
+				//Setup Memory locations for hashtree and recursion block	
+				if(backend == BACKEND_MMAP) {
+					std::string file_name_this = file_name + "p" + std::to_string(i);
+					std::string file_name_this_i = file_name_this + "_i";
+					mmap_size_l[i] = level_size;
+					mmap_hash_size_l[i] = hashtree_size_this;
+					inmem_tree_l[i] = mapTreeFile(file_name_this, level_size, &(mmap_fd_l[i]), resume);
+					#ifndef INLINE_HASH_LAYOUT
+						inmem_hash_l[i] = mapTreeFile(file_name_this_i, hashtree_size_this, &(mmap_fd_hash_l[i]), resume);
+					#endif
 				}
-				maxBlocks_of_pmap_level[0] = maxBlocks_of_pmap_level[1];
-				#ifdef DEBUG_LS
-					printf("LS:Level : %d, Blocks : %ld\n", 0, maxBlocks_of_pmap_level[0]);	
-				#endif	
-				level = 2;
-			
-				while(level <= recursion_levels) {
-					maxBlocks_of_pmap_level[level] = maxBlocks_of_pmap_level[level-1] * x;
-					#ifdef DEBUG_LS
-						printf("LS:Level : %d, Blocks : %ld\n", level, maxBlocks_of_pmap_level[level]);
-					#endif				
-					level++;
+				else {
+					inmem_tree_l[i] = allocTree(level_size, numa_node);
+					#ifndef INLINE_HASH_LAYOUT
+						inmem_hash_l[i] = allocTree(hashtree_size_this, numa_node);
+					#endif
 				}
+			}			
+		}
 	
-				inmem_tree_l = (unsigned char**) malloc ((recursion_levels+1)*sizeof(unsigned char*));
-				inmem_hash_l = (unsigned char**) malloc ((recursion_levels+1)*sizeof(unsigned char*));
-				for(uint32_t i = 1;i<= recursion_levels;i++) {
-					uint64_t level_size; 
-					if(i==recursion_levels)	
-						level_size = 2 * ceil((double)maxBlocks_of_pmap_level[i])*(Z*(dataSize_p+ADDITIONAL_METADATA_SIZE)); 
-					else
-						level_size = 2 * ceil((double) maxBlocks_of_pmap_level[i]) * (Z*(recursion_block_size+ADDITIONAL_METADATA_SIZE));
-					uint32_t pD_temp = ceil((double)maxBlocks_of_pmap_level[i]/(double) UTILIZATION_PARAMETER);
-					uint32_t pD = (uint32_t) ceil(log((double)pD_temp)/log((double)2));
-					uint64_t hashtree_size_this = 2 * maxBlocks_of_pmap_level[i] * HASH_LENGTH;				
-				
-					//Setup Memory locations for hashtree and recursion block	
-					inmem_tree_l[i] = (unsigned char*) malloc(level_size);
-					inmem_hash_l[i] = (unsigned char*) malloc(hashtree_size_this);
-				}			
+	}
+	setupCache();
+	#ifdef DIRTY_TRACKING
+		setupDirtyTracking();
+	#endif
+	directoryFP_i.append(temp + "_i/");
+	directoryFP.append(temp+"/");
+}
+
+LocalStorage::LocalStorage(LocalStorage&ls)
+{
+}
+
+void LocalStorage::connect()
+{
+	
+}
+
+/*
+resumeFrom() - Makes setParams reattach to the tree files (or mapped files) of instance checkpoint_storage_id,
+as they were left by the process that checkpointed it, instead of creating new ones. Call it before setParams.
+With WAL_MODE the trees are rolled back to the checkpoint of epoch first (see LocalStorage::recoverWAL).
+*/
+void LocalStorage::resumeFrom(uint32_t checkpoint_storage_id, uint32_t epoch)
+{
+	resume = true;
+	file_id = checkpoint_storage_id;
+	wal_epoch = epoch;
+}
+
+/*
+checkpointed() - Called once the checkpoint of epoch, whose enclave state was sealed after syncStorage(), is durable.
+The trees as they are now become what a crash rolls back to, so the log is emptied and logging is armed (WAL_MODE).
+*/
+void LocalStorage::checkpointed(uint32_t epoch)
+{
+	if(wal_fd == -1)
+		return;
+	wal_epoch = epoch;
+	walReset();
+	wal_armed = true;
+}
+
+/*
+serveLevels() - Restricts the instance to the trees of recursion levels first_level..last_level, the others are
+served by another storage. Their in-memory/mapped trees aren't set up and no cache is spent on them
+(disk files are still created, sparse and small, since only posmap levels are handed off). Call it before setParams.
+*/
+void LocalStorage::serveLevels(uint32_t p_first_level, uint32_t p_last_level)
+{
+	first_level = p_first_level;
+	last_level = p_last_level;
+}
+
+bool LocalStorage::serves(uint32_t level)
+{
+	uint32_t index = ((int32_t) level==-1) ? 0 : level;
+	return index >= first_level && index <= last_level;
+}
+
+/*
+LocalStorage::syncStorage() - Checkpoint for BACKEND_MMAP and BACKEND_HDD
+
+Flushes the dirty pages of every mapped data/hash file back to disk,
+for BACKEND_HDD the dirty pages of the cached top levels and all queued write-backs.
+Path accesses never msync by themselves, so this should be called whenever the ORAM state is saved.
+With WAL_MODE the dirty cache pages are logged like any other write before they go out, the log itself
+is only emptied once the enclave state is sealed as well (checkpointed).
+*/
+void LocalStorage::syncStorage()
+{
+	#ifdef ASYNC_IO_MODE
+		if(backend == BACKEND_HDD) {
+			if(wal_fd != -1) {
+				walLogCache();
+				walCommit();
+			}
+			flushCache();
+			aio->flush();
+			uint32_t no_of_files = (recursion_levels==-1) ? 1 : (recursion_levels+1);
+			for(uint32_t i = 0;i < no_of_files;i++) {
+				if(hdd_fd_l[i] > 0)
+					fdatasync(hdd_fd_l[i]);
+				for(uint32_t k = 1;stripe_fd_l[i] && k < no_of_stripes;k++)
+					fdatasync(stripe_fd_l[i][k]);
+				if(hdd_fd_hash_l[i] > 0)
+					fdatasync(hdd_fd_hash_l[i]);
+			}
+		}
+	#endif
+	if(backend != BACKEND_MMAP)
+		return;
+
+	if(recursion_levels==-1) {
+		msync(inmem_tree, mmap_size_l[0], MS_SYNC);
+		#ifndef INLINE_HASH_LAYOUT
+			msync(inmem_hash, mmap_hash_size_l[0], MS_SYNC);
+		#endif
+	}
+	else {
+		for(int32_t i = 1;i<= recursion_levels;i++) {
+			if(!serves(i))
+				continue;
+			msync(inmem_tree_l[i], mmap_size_l[i], MS_SYNC);
+			#ifndef INLINE_HASH_LAYOUT
+				msync(inmem_hash_l[i], mmap_hash_size_l[i], MS_SYNC);
 			#endif
 		}
-	
 	}
-	directoryFP_i.append(temp + "_i/");
-	directoryFP.append(temp+"/");
 }
 
-LocalStorage::LocalStorage(LocalStorage&ls)
-{
+void LocalStorage::closeStorage()
+{
+	#ifdef ASYNC_IO_MODE
+		if(backend == BACKEND_HDD) {
+			syncStorage();
+			delete aio;
+			uint32_t no_of_files = (recursion_levels==-1) ? 1 : (recursion_levels+1);
+			if(wal_fd != -1) {
+				close(wal_fd);
+				wal_fd = -1;
+				for(uint32_t i = 0;i < no_of_files;i++)
+					free(wal_logged_l[i]);
+				free(wal_logged_l);
+				free(wal_buffer);
+				free(wal_scratch);
+			}
+			for(uint32_t i = 0;i < no_of_files;i++) {
+				if(hdd_fd_l[i] > 0)
+					close(hdd_fd_l[i]);
+				for(uint32_t k = 1;stripe_fd_l[i] && k < no_of_stripes;k++)
+					close(stripe_fd_l[i][k]);
+				free(stripe_fd_l[i]);
+				if(hdd_fd_hash_l[i] > 0)
+					close(hdd_fd_hash_l[i]);
+				numaFree(cache_l[i], cache_size_l[i]);
+				free(cache_dirty_l[i]);
+			}
+		}
+	#endif
+	if(backend != BACKEND_MMAP)
+		return;
+
+	syncStorage();
+	if(recursion_levels==-1) {
+		munmap(inmem_tree, mmap_size_l[0]);
+		close(mmap_fd_l[0]);
+		#ifndef INLINE_HASH_LAYOUT
+			munmap(inmem_hash, mmap_hash_size_l[0]);
+			close(mmap_fd_hash_l[0]);
+		#endif
+	}
+	else {
+		for(int32_t i = 1;i<= recursion_levels;i++) {
+			if(!serves(i))
+				continue;
+			munmap(inmem_tree_l[i], mmap_size_l[i]);
+			close(mmap_fd_l[i]);
+			#ifndef INLINE_HASH_LAYOUT
+				munmap(inmem_hash_l[i], mmap_hash_size_l[i]);
+				close(mmap_fd_hash_l[i]);
+			#endif
+		}
+	}
+}
+
+/*
+Incremental snapshots (DIRTY_TRACKING).
+
+A snapshot holds, for every tree, its root hash (the Merkle root the enclave verifies against) and the buckets uploaded
+since the previous snapshot, each as <label | bucket | hash of the bucket>, i.e. exactly what uploadObject takes.
+Trees start out sparse (all zeros), so the chain of snapshots of an instance, from epoch 1 on, rebuilds it completely.
+
+File : <snapshot_header> then per tree <snapshot_tree> followed by its no_of_buckets entries.
+*/
+void LocalStorage::setupDirtyTracking() {
+	uint32_t no_of_trees = (recursion_levels==-1) ? 1 : (recursion_levels+1);
+	dirty_bitmap_l = (uint8_t**) calloc(no_of_trees, sizeof(uint8_t*));
+	for(uint32_t i = (recursion_levels==-1) ? 0 : 1;i < no_of_trees;i++) {
+		dirty_bitmap_l[i] = (uint8_t*) calloc((((uint64_t)2<<layout_l[i].depth) + 7) / 8, 1);
+		if(dirty_bitmap_l[i] == NULL) {
+			printf("LS : FAILED MALLOC of the dirty bitmap of tree %d\n", i);
+			exit(0);
+		}
+	}
+	snapshot_epoch = 0;
+}
+
+void LocalStorage::markDirty(uint32_t level, uint32_t bucket_no) {
+	uint8_t *bitmap = dirty_bitmap_l[((int32_t) level==-1) ? 0 : level];
+	bitmap[bucket_no>>3] |= (1<<(bucket_no&7));
+}
+
+/*
+writeSnapshot() - Writes the buckets uploaded since the last snapshot (and the root hashes) to
+<snapshot_directory>/<storage_id>_<epoch>.zts, and clears the dirty bits.
+Returns the number of buckets written, -1 if the file couldn't be written.
+The buckets are read back through downloadObject, so pending write-backs and cached levels are picked up as well.
+*/
+int64_t LocalStorage::writeSnapshot(std::string snapshot_directory) {
+	if(snapshot_directory[snapshot_directory.size()-1] != '/')
+		snapshot_directory.append("/");
+	std::string system_inst = "mkdir -p " + snapshot_directory + "\n";
+	system(system_inst.c_str());
+	std::string snapshot_file = snapshot_directory + std::to_string(storage_id) + "_" + std::to_string(snapshot_epoch+1) + ".zts";
+	FILE *file = fopen(snapshot_file.c_str(), "wb");
+	if(file == NULL) {
+		printf("LS : Unable to create snapshot %s\n", snapshot_file.c_str());
+		return -1;
+	}
+
+	uint32_t no_of_trees = (recursion_levels==-1) ? 1 : (recursion_levels+1);
+	uint32_t first_tree = (recursion_levels==-1) ? 0 : 1;
+	struct snapshot_header header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+	header.storage_id = storage_id;
+	header.epoch = ++snapshot_epoch;
+	header.no_of_trees = no_of_trees - first_tree;
+	bool ok = (fwrite(&header, sizeof(header), 1, file) == 1);
+
+	unsigned char *bucket = (unsigned char*) malloc(Z * ((dataSize > recursionBlockSize) ? dataSize : recursionBlockSize));
+	unsigned char hash[HASH_LENGTH];
+	int64_t written = 0;
+	for(uint32_t i = first_tree;i < no_of_trees && ok;i++) {
+		int32_t level = (recursion_levels==-1) ? -1 : i;
+		uint8_t *bitmap = dirty_bitmap_l[i];
+		uint64_t no_of_buckets = ((uint64_t)2<<layout_l[i].depth) - 1;
+
+		struct snapshot_tree tree;
+		memset(&tree, 0, sizeof(tree));
+		tree.level = level;
+		tree.bucket_size = Z * sizeForLevel(level);
+		for(uint64_t b = 1;b <= no_of_buckets;b++)
+			if(bitmap[b>>3] & (1<<(b&7)))
+				tree.no_of_buckets++;
+		fetchHash(1, tree.root_hash, HASH_LENGTH, level);
+		ok = (fwrite(&tree, sizeof(tree), 1, file) == 1);
+
+		for(uint64_t b = 1;b <= no_of_buckets && ok;b++) {
+			if(!(bitmap[b>>3] & (1<<(b&7))))
+				continue;
+			uint32_t label = b;
+			downloadObject(bucket, label, hash, HASH_LENGTH, sizeForLevel(level), level);
+			ok = (fwrite(&label, sizeof(label), 1, file) == 1) && (fwrite(bucket, tree.bucket_size, 1, file) == 1) && (fwrite(hash, HASH_LENGTH, 1, file) == 1);
+		}
+		written+= tree.no_of_buckets;
+	}
+	free(bucket);
+	ok = ok && (fflush(file) == 0) && (fsync(fileno(file)) == 0);
+	fclose(file);
+	if(!ok) {
+		//The dirty bits are kept, so the next snapshot still covers these buckets
+		snapshot_epoch--;
+		printf("LS : Failed to write snapshot %s\n", snapshot_file.c_str());
+		return -1;
+	}
+
+	for(uint32_t i = first_tree;i < no_of_trees;i++)
+		memset(dirty_bitmap_l[i], 0, (((uint64_t)2<<layout_l[i].depth) + 7) / 8);
+	#ifdef DEBUG_LS
+		printf("LS : Snapshot %d of instance %d, %ld buckets in %s\n", header.epoch, storage_id, written, snapshot_file.c_str());
+	#endif
+	return written;
+}
+
+/*
+applySnapshot() - Uploads the buckets of snapshot_file, to roll a copy of the instance forward (snapshots have to be applied in epoch order).
+Returns false if the snapshot doesn't match the geometry of the instance, isn't the next epoch, or if a root hash doesn't match the snapshot's afterwards.
+*/
+bool LocalStorage::applySnapshot(std::string snapshot_file) {
+	FILE *file = fopen(snapshot_file.c_str(), "rb");
+	if(file == NULL) {
+		printf("LS : Unable to open snapshot %s\n", snapshot_file.c_str());
+		return false;
+	}
+
+	uint32_t no_of_trees = (recursion_levels==-1) ? 1 : (recursion_levels+1);
+	uint32_t first_tree = (recursion_levels==-1) ? 0 : 1;
+	struct snapshot_header header;
+	bool ok = (fread(&header, sizeof(header), 1, file) == 1) && memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) == 0 && header.no_of_trees == no_of_trees - first_tree;
+	//The root is on every path, so its hash would match even with an epoch skipped : the chain has to be checked by epoch
+	ok = ok && header.epoch == snapshot_epoch+1;
+
+	unsigned char *bucket = (unsigned char*) malloc(Z * ((dataSize > recursionBlockSize) ? dataSize : recursionBlockSize));
+	unsigned char hash[HASH_LENGTH];
+	for(uint32_t i = first_tree;i < no_of_trees && ok;i++) {
+		int32_t level = (recursion_levels==-1) ? -1 : i;
+		struct snapshot_tree tree;
+		ok = (fread(&tree, sizeof(tree), 1, file) == 1) && tree.level == level && tree.bucket_size == Z * sizeForLevel(level);
+		for(uint64_t b = 0;b < tree.no_of_buckets && ok;b++) {
+			uint32_t label;
+			ok = (fread(&label, sizeof(label), 1, file) == 1) && (fread(bucket, tree.bucket_size, 1, file) == 1) && (fread(hash, HASH_LENGTH, 1, file) == 1);
+			ok = ok && label > 0 && label < ((uint64_t)2<<layout_l[i].depth);
+			if(ok)
+				uploadObject(bucket, label, hash, HASH_LENGTH, sizeForLevel(level), level);
+		}
+		if(ok) {
+			fetchHash(1, hash, HASH_LENGTH, level);
+			ok = (memcmp(hash, tree.root_hash, HASH_LENGTH) == 0);
+		}
+	}
+	free(bucket);
+	fclose(file);
+	if(!ok) {
+		printf("LS : Snapshot %s does not apply to instance %d\n", snapshot_file.c_str(), storage_id);
+		return false;
+	}
+	snapshot_epoch = header.epoch;
+	return true;
+}
+
+/*
+Undo log (WAL_MODE, BACKEND_HDD).
+
+The last checkpoint (checkpointed) is the recovery point. The first time a WAL_UNDO_UNIT of a tree file is about to be written after it,
+what the unit holds is appended to wal_buffer as a record <wal_record | before-image> (walLogBefore), and write-backs
+are held in AsyncIO (reads are served from its dirty map meanwhile) while there are buffered records. At the end of an
+access (endAccess), once WAL_GROUP_ACCESSES accesses (or WAL_GROUP_BYTES) have piled up, the group is committed :
+written to the log with a WAL_COMMIT record and one fdatasync, after which the write-backs are released to the files.
+So no tree file ever holds a write whose unit's before-image isn't durable, and writing the committed before-images
+back (recoverWAL) returns every tree to the recovery point, the consistent Merkle root the enclave sealed with it.
+Units already logged cost nothing more till the next recovery point, so the log is at most the size of the trees.
+*/
+static uint64_t walChecksum(uint64_t checksum, const unsigned char *data, uint64_t size) {
+	//FNV-1a
+	for(uint64_t i = 0;i < size;i++) {
+		checksum^= data[i];
+		checksum*= 1099511628211ULL;
+	}
+	return checksum;
+}
+
+void LocalStorage::openWAL() {
+	std::string wal_name = file_name + "_wal";
+	wal_fd = open(wal_name.c_str(), O_RDWR|O_CREAT, 0644);
+	if(wal_fd == -1) {
+		printf("LS : Unable to open the write-ahead log %s, running without it\n", wal_name.c_str());
+		return;
+	}
+	wal_unit = (io_block_size > WAL_UNDO_UNIT) ? io_block_size : WAL_UNDO_UNIT;
+	uint32_t no_of_trees = (recursion_levels==-1) ? 1 : (recursion_levels+1);
+	wal_logged_l = (uint8_t**) calloc(no_of_trees, sizeof(uint8_t*));
+	for(uint32_t i = (recursion_levels==-1) ? 0 : 1;i < no_of_trees;i++) {
+		uint64_t no_of_units = (layout_l[i].tree_size + wal_unit - 1) / wal_unit;
+		wal_logged_l[i] = (uint8_t*) calloc((no_of_units + 7) / 8, sizeof(uint8_t));
+		if(wal_logged_l[i] == NULL) {
+			printf("LS : FAILED MALLOC of the write-ahead log bitmap of tree %d\n", i);
+			exit(0);
+		}
+	}
+	wal_group = 0;
+	wal_group_accesses = 0;
+	wal_log_size = 0;
+	//A resumed instance first rolls its trees back to the checkpoint it is taken up from
+	if(resume) {
+		recoverWAL();
+	}
+	else {
+		//New trees, there is nothing to roll back to till the first checkpoint
+		walReset();
+	}
+}
+
+void LocalStorage::walAppend(uint32_t type, uint32_t index, uint64_t offset, unsigned char *data, uint32_t size) {
+	uint64_t record_size = sizeof(struct wal_record) + size;
+	if(wal_buffer_size + record_size > wal_buffer_capacity) {
+		wal_buffer_capacity = 2 * (wal_buffer_size + record_size);
+		wal_buffer = (unsigned char*) realloc(wal_buffer, wal_buffer_capacity);
+		if(wal_buffer == NULL) {
+			printf("LS : FAILED MALLOC of the write-ahead log buffer\n");
+			exit(0);
+		}
+	}
+
+	struct wal_record record;
+	memset(&record, 0, sizeof(record));
+	record.magic = WAL_MAGIC;
+	record.type = type;
+	record.index = index;
+	record.size = size;
+	record.offset = offset;
+	record.epoch = wal_epoch;
+	record.group = wal_group;
+	uint64_t checksum = walChecksum(14695981039346656037ULL, (unsigned char*) &record, sizeof(record));
+	record.checksum = walChecksum(checksum, data, size);
+
+	memcpy(wal_buffer + wal_buffer_size, &record, sizeof(record));
+	if(size)
+		memcpy(wal_buffer + wal_buffer_size + sizeof(record), data, size);
+	wal_buffer_size+= record_size;
+}
+
+/*
+walLogBefore() - Logs the before-image of every unit of tree index in [offset, offset+size) that wasn't logged since
+the recovery point, ahead of a write-back to that range. Nothing has been written to such a unit since, so the file still
+holds what it had at the recovery point. Write-backs are held from here till the records are committed (walCommit).
+*/
+void LocalStorage::walLogBefore(uint32_t index, uint64_t offset, uint64_t size) {
+	uint8_t *logged = wal_logged_l[index];
+	uint64_t last = (offset + size - 1) / wal_unit;
+	for(uint64_t unit = offset / wal_unit;unit <= last;unit++) {
+		if(logged[unit/8] & (1 << (unit%8)))
+			continue;
+		//A run of units that aren't logged yet goes in one record
+		uint64_t run_start = unit;
+		while(unit < last && !(logged[(unit+1)/8] & (1 << ((unit+1)%8))))
+			unit++;
+		uint64_t run_size = (unit - run_start + 1) * wal_unit;
+		if(run_size > wal_scratch_size) {
+			free(wal_scratch);
+			//Aligned, the tree files may be opened with O_DIRECT
+			if(posix_memalign((void**) &wal_scratch, CACHE_PAGE_SIZE, run_size) != 0) {
+				printf("LS : FAILED MALLOC of the write-ahead log scratch buffer\n");
+				exit(0);
+			}
+			wal_scratch_size = run_size;
+		}
+		stripedIO(index, run_start * wal_unit, wal_scratch, run_size, false);
+		walAppend(WAL_UNDO, index, run_start * wal_unit, wal_scratch, run_size);
+		for(uint64_t u = run_start;u <= unit;u++)
+			logged[u/8]|= (1 << (u%8));
+	}
+	if(wal_buffer_size > 0)
+		aio->holdWrites(true);
+}
+
+//The dirty pages of the cached prefixes are about to reach the files (flushCache), so their before-images are logged first
+void LocalStorage::walLogCache() {
+	if(!wal_armed || cache_l == NULL)
+		return;
+	uint32_t no_of_trees = (recursion_levels==-1) ? 1 : (recursion_levels+1);
+	for(uint32_t i = 0;i < no_of_trees;i++) {
+		if(cache_l[i]==NULL)
+			continue;
+		uint64_t no_of_pages = (cache_size_l[i] + CACHE_PAGE_SIZE - 1) / CACHE_PAGE_SIZE;
+		for(uint64_t page = 0;page < no_of_pages;page++) {
+			if(!cache_dirty_l[i][page])
+				continue;
+			uint64_t offset = page * CACHE_PAGE_SIZE;
+			uint64_t size = (offset + CACHE_PAGE_SIZE > cache_size_l[i]) ? (cache_size_l[i] - offset) : CACHE_PAGE_SIZE;
+			walLogBefore(i, offset, size);
+		}
+	}
+}
+
+//Makes the buffered records durable with one write and one fdatasync, and releases the held write-backs
+void LocalStorage::walCommit() {
+	if(wal_buffer_size > 0) {
+		walAppend(WAL_COMMIT, 0, 0, NULL, 0);
+		uint64_t done = 0;
+		while(done < wal_buffer_size) {
+			ssize_t rc = pwrite(wal_fd, wal_buffer + done, wal_buffer_size - done, wal_log_size + done);
+			if(rc <= 0)
+				break;
+			done+= rc;
+		}
+		if(done < wal_buffer_size || fdatasync(wal_fd) != 0) {
+			//The write-backs can't be released without their before-images, and the enclave can't roll back
+			printf("LS : Failed to commit the write-ahead log of instance %d\n", storage_id);
+			exit(0);
+		}
+		wal_log_size+= wal_buffer_size;
+		wal_buffer_size = 0;
+		wal_group++;
+	}
+	aio->releaseWrites();
+	aio->holdWrites(false);
+	wal_group_accesses = 0;
+}
+
+//Empties the log, once the trees it would roll back are durable and sealed in the checkpoint of wal_epoch
+void LocalStorage::walReset() {
+	if(ftruncate(wal_fd, 0) != 0 || fdatasync(wal_fd) != 0) {
+		//Appending past stale records would roll a later crash back to an older state than the enclave's
+		printf("LS : Unable to empty the write-ahead log of instance %d\n", storage_id);
+		exit(0);
+	}
+	wal_log_size = 0;
+	uint32_t no_of_trees = (recursion_levels==-1) ? 1 : (recursion_levels+1);
+	for(uint32_t i = (recursion_levels==-1) ? 0 : 1;i < no_of_trees;i++) {
+		uint64_t no_of_units = (layout_l[i].tree_size + wal_unit - 1) / wal_unit;
+		memset(wal_logged_l[i], 0, (no_of_units + 7) / 8);
+	}
+}
+
+/*
+endAccess() - Access boundary, where groups end once WAL_GROUP_ACCESSES accesses (or WAL_GROUP_BYTES, or WAL_GROUP_HELD
+held write-backs) have piled up. Signalled by the App once an access ECALL has returned.
+*/
+void LocalStorage::endAccess() {
+	if(wal_fd == -1 || wal_buffer_size == 0)
+		return;
+	if(++wal_group_accesses >= WAL_GROUP_ACCESSES || wal_buffer_size >= WAL_GROUP_BYTES || aio->heldWrites() >= WAL_GROUP_HELD)
+		walCommit();
 }
 
-void LocalStorage::connect()
-{
-	
+/*
+recoverWAL() - Rolls the trees back to the checkpoint of wal_epoch, the one the instance is taken up from : writes the
+before-images of every committed group back in place, last group first, then syncs the trees and empties the log.
+The log is read up to the first torn or uncommitted record, whose write-backs were still held and never reached the files.
+Records of an earlier checkpoint were left by a crash after the trees of this one were synced and sealed, but before its
+log was emptied : the trees already are those of the checkpoint, and the log is dropped. Records of a later checkpoint
+mean the one taken up is stale : the log is left as it is (the enclave refuses the roots anyway) and nothing is logged.
+Returns the number of groups rolled back.
+*/
+uint64_t LocalStorage::recoverWAL() {
+	struct stat st;
+	uint64_t log_size = (fstat(wal_fd, &st) == 0) ? st.st_size : 0;
+	unsigned char *log = (unsigned char*) malloc(log_size + 1);
+	uint64_t done = 0;
+	while(log != NULL && done < log_size) {
+		ssize_t rc = pread(wal_fd, log + done, log_size - done, done);
+		if(rc <= 0)
+			break;
+		done+= rc;
+	}
+	log_size = done;
+
+	uint32_t no_of_trees = (recursion_levels==-1) ? 1 : (recursion_levels+1);
+	std::vector<uint64_t> committed;
+	uint64_t groups = 0, group_start = 0, offset = 0;
+	uint32_t log_epoch = wal_epoch;
+	while(log != NULL && offset + sizeof(struct wal_record) <= log_size) {
+		struct wal_record record;
+		memcpy(&record, log + offset, sizeof(record));
+		uint64_t record_size = sizeof(record) + (uint64_t) record.size;
+		if(record.magic != WAL_MAGIC || offset + record_size > log_size || record.index >= no_of_trees || (record.type==WAL_UNDO && recursion_levels!=-1 && record.index==0))
+			break;
+		uint64_t checksum = record.checksum;
+		record.checksum = 0;
+		uint64_t expected = walChecksum(14695981039346656037ULL, (unsigned char*) &record, sizeof(record));
+		if(checksum != walChecksum(expected, log + offset + sizeof(record), record.size))
+			break;
+		if(offset == 0)
+			log_epoch = record.epoch;
+		else if(record.epoch != log_epoch)
+			break;
+		offset+= record_size;
+		if(record.type != WAL_COMMIT)
+			continue;
+		uint64_t iter = group_start;
+		while(iter < offset - record_size) {
+			committed.push_back(iter);
+			iter+= sizeof(struct wal_record) + (uint64_t) ((struct wal_record*) (log + iter))->size;
+		}
+		groups++;
+		group_start = offset;
+	}
+
+	if(log_epoch > wal_epoch) {
+		printf("LS : The write-ahead log of instance %d rolls back to checkpoint %d, not %d, left as it is\n", storage_id, log_epoch, wal_epoch);
+		free(log);
+		return 0;
+	}
+	if(log_epoch < wal_epoch) {
+		committed.clear();
+		groups = 0;
+	}
+
+	for(int64_t i = committed.size() - 1;i >= 0;i--) {
+		struct wal_record record;
+		memcpy(&record, log + committed[i], sizeof(record));
+		if(record.size > wal_scratch_size) {
+			free(wal_scratch);
+			if(posix_memalign((void**) &wal_scratch, CACHE_PAGE_SIZE, record.size) != 0) {
+				printf("LS : FAILED MALLOC of the write-ahead log scratch buffer\n");
+				exit(0);
+			}
+			wal_scratch_size = record.size;
+		}
+		memcpy(wal_scratch, log + committed[i] + sizeof(record), record.size);
+		if(!stripedIO(record.index, record.offset, wal_scratch, record.size, true)) {
+			printf("LS : Unable to roll tree %d of instance %d back at offset %ld\n", record.index, storage_id, record.offset);
+			exit(0);
+		}
+	}
+	free(log);
+
+	if(groups > 0) {
+		printf("LS : Rolled instance %d back to checkpoint %d, %ld groups (%ld before-images) of its write-ahead log\n", storage_id, wal_epoch, groups, committed.size());
+		syncStorage();
+	}
+	walReset();
+	wal_armed = true;
+	return groups;
 }
 
 void LocalStorage::fetchHash(uint32_t objectKey, unsigned char* hash, uint32_t hashsize, uint32_t recursion_level) {
 	
 	std::string file_name_this, file_name_this_i;
-	if(recursion_level!=-1)	{
+	if((int32_t) recursion_level!=-1)	{
 		file_name_this = file_name + "p" + std::to_string(recursion_level); 
 		file_name_this_i = file_name_this + "_i";	
 	}
@@ -601,10 +1789,40 @@ void LocalStorage::fetchHash(uint32_t objectKey, unsigned char* hash, uint32_t h
 		file_name_this = file_name;	
 		file_name_this_i = file_name_i;
 	}	
+
+	#ifdef INLINE_HASH_LAYOUT
+		uint64_t hash_pos = hashOffset(objectKey, recursion_level);
+		if(inmem) {
+			memcpy(hash, treeBase(recursion_level)+hash_pos, HASH_LENGTH);
+		}
+		else if(io_block_size) {
+			uint64_t block_pos;
+			uint32_t block_length;
+			hashBlock(objectKey, recursion_level, &block_pos, &block_length);
+			readBlock(recursion_level, block_pos, block_length, direct_scratch);
+			memcpy(hash, direct_scratch + (hash_pos - block_pos), HASH_LENGTH);
+		}
+		else {
+			struct io_request request;
+			request.fd = stripeFd(recursion_level, hash_pos);
+			request.offset = hash_pos;
+			request.iov[0].iov_base = hash;
+			request.iov[0].iov_len = HASH_LENGTH;
+			request.iovcnt = 1;
+			diskRead(recursion_level, &request, 1);
+		}
+		return;
+	#endif
 	
 	if(inmem==false) {	
-		#ifdef CACHE_UPPER
-			memcpy(hash,inmem_hash_l[recursion_level] +((uint64_t)(objectKey-1)*(uint64_t)HASH_LENGTH), HASH_LENGTH);
+		#ifdef ASYNC_IO_MODE
+			struct io_request request;
+			request.fd = hdd_fd_hash_l[((int32_t) recursion_level==-1) ? 0 : recursion_level];
+			request.offset = (uint64_t)(objectKey-1)*(uint64_t)hashsize;
+			request.iov[0].iov_base = hash;
+			request.iov[0].iov_len = hashsize;
+			request.iovcnt = 1;
+			aio->readBatch(&request, 1);
 		#else
 			//std::string fp_i = directoryFP_i + std::to_string(objectKey);	
 			try {
@@ -613,13 +1831,13 @@ void LocalStorage::fetchHash(uint32_t objectKey, unsigned char* hash, uint32_t h
 				file.read((char*) hash, hashsize);
 				file.close();
 			}
-			catch (std::ifstream::failure e) {
+			catch (std::ifstream::failure &e) {
 				std::cerr << "Exception opening file";
 			}
 		#endif
 	}
 	else {
-		if(recursion_level!=-1) {
+		if((int32_t) recursion_level!=-1) {
 			memcpy(hash,inmem_hash_l[recursion_level]+((objectKey-1)*HASH_LENGTH), HASH_LENGTH);		
 		}
 		else {
@@ -630,10 +1848,13 @@ void LocalStorage::fetchHash(uint32_t objectKey, unsigned char* hash, uint32_t h
 
 uint8_t LocalStorage::uploadObject(unsigned char *data, uint32_t objectKey,unsigned char *hash, uint32_t hashsize, uint32_t size_for_level, uint32_t recursion_level)
 {
+	#ifdef DIRTY_TRACKING
+		markDirty(recursion_level, objectKey);
+	#endif
 	uint64_t pos;
 	std::string file_name_this, file_name_this_i;
 	if(!inmem) {
-		if(recursion_level!=-1)	{
+		if((int32_t) recursion_level!=-1)	{
 			file_name_this = file_name + "p" + std::to_string(recursion_level); 
 			file_name_this_i = file_name_this + "_i";	
 		}
@@ -643,6 +1864,28 @@ uint8_t LocalStorage::uploadObject(unsigned char *data, uint32_t objectKey,unsig
 		}
 	}
 
+	#ifdef INLINE_HASH_LAYOUT
+		//Bucket goes into its own record, its hash into the L/R slot of the parent's record
+		uint64_t bucket_pos = bucketOffset(objectKey, recursion_level);
+		uint64_t hash_pos = hashOffset(objectKey, recursion_level);
+		if(inmem) {
+			memcpy(treeBase(recursion_level)+bucket_pos, data, (Z*size_for_level));
+			memcpy(treeBase(recursion_level)+hash_pos, hash, HASH_LENGTH);
+		}
+		else if(io_block_size) {
+			uint64_t block_pos;
+			uint32_t block_length;
+			patchBlock(recursion_level, recordOffset(objectKey, recursion_level), layout_l[((int32_t) recursion_level==-1) ? 0 : recursion_level].record_stride, bucket_pos, data, (Z*size_for_level));
+			hashBlock(objectKey, recursion_level, &block_pos, &block_length);
+			patchBlock(recursion_level, block_pos, block_length, hash_pos, hash, HASH_LENGTH);
+		}
+		else {
+			diskWrite(recursion_level, bucket_pos, data, (Z*size_for_level));
+			diskWrite(recursion_level, hash_pos, hash, HASH_LENGTH);
+		}
+		return 0;
+	#endif
+
 	if(inmem == false) {
 		try {
 			#ifdef DEBUG_LS			
@@ -662,82 +1905,46 @@ uint8_t LocalStorage::uploadObject(unsigned char *data, uint32_t objectKey,unsig
 			*/
 			
 			pos = (uint64_t)(objectKey-1)*(uint64_t)(Z*size_for_level);
-			int filedesc;
-	
-			#ifdef FILEOPEN_MODE
-				filedesc = open(file_name_this.c_str(), O_RDWR|O_DIRECT|O_DSYNC);
-				pwrite(filedesc,data,(size_for_level*Z),pos);
-				//posix_fadvise(filedesc,pos,(size_for_level*Z),POSIX_FADV_DONTNEED);
-				posix_fadvise(filedesc,0,datatree_size,POSIX_FADV_DONTNEED);
-				syncfs(filedesc);
-				close(filedesc);
-				
-				filedesc = open(file_name_this_i.c_str(), O_RDWR|O_DIRECT|O_DSYNC);
-				pwrite(filedesc,hash,hashsize,(objectKey-1)*hashsize);
-				posix_fadvise(filedesc,(objectKey-1)*hashsize,hashsize,POSIX_FADV_DONTNEED);
-				syncfs(filedesc);
-				close(filedesc);
-					
+			#ifdef ASYNC_IO_MODE
+				uint32_t fd_index = ((int32_t) recursion_level==-1) ? 0 : recursion_level;
+				aio->writeBack(hdd_fd_l[fd_index], pos, data, (size_for_level*Z));
+				aio->writeBack(hdd_fd_hash_l[fd_index], (uint64_t)(objectKey-1)*(uint64_t)hashsize, hash, hashsize);
 			#elif FILESTREAM_MODE
-				#ifdef CACHE_UPPER
-					//printf("%d,%d\n",objectKey,objectkeylimit);
-					if(recursion_level == recursion_levels){
-						if(objectKey <= objectkeylimit) {
-							memcpy(inmem_tree_l[recursion_level]+pos,data,(Z*size_for_level));
-							memcpy(inmem_hash_l[recursion_level]+((uint64_t)HASH_LENGTH*(uint64_t)(objectKey-1)),hash, hashsize);
-						}	
-						else{	
-							uint32_t adjusted_objectkey = objectKey - objectkeylimit - 1;
-							memcpy(inmem_hash_l[recursion_level]+((uint64_t) HASH_LENGTH * (uint64_t) (objectKey-1)),hash, hashsize);
-							pos = (uint64_t)(objectKey - 1 - objectkeylimit) * (uint64_t)(Z*size_for_level);
-							//std::cout<<"Pos = "<<pos<<"\n";							
-							std::ofstream file(file_name_this.c_str(),std::ios::binary|std::ios::in);
-							file.seekp(pos);
-							file.write((char*) data, (size_for_level*Z));
-							file.close();
-						}
-					}
-					else {
-						memcpy(inmem_tree_l[recursion_level]+((Z*size_for_level)*(objectKey-1)),data,(Z*size_for_level));
-						memcpy(inmem_hash_l[recursion_level]+(HASH_LENGTH*(objectKey-1)),hash, hashsize);
-					}
-				#else
-					std::ofstream file(file_name_this.c_str(),std::ios::binary|std::ios::in);
-					file.seekp(pos);
-					file.write((char*) data, (size_for_level*Z));
-					file.close();
-		
-					/*
-					//Debug Module :
-					unsigned char* data2 = (unsigned char*) malloc(Z*size_for_level);
-					std::ifstream file2(file_name_this.c_str(),std::ios::binary);
-					file2.seekg((objectKey-1)*(Z*size_for_level));
-					file2.read((char*) data2, (Z*size_for_level));
-					file2.close();			
-					printer = (uint32_t*) data2;
-					printf("AFTER WRITE : ");
-					for(uint8_t e = 0;e < Z ;e++) {
-						printer+=4;
-						printf("(%d,%d) , ", *printer, *(printer+1));
-						printer = (uint32_t*) (data2 + (e+1)*size_for_level);
-					}
-					printf("\n");
-					*/
+				std::ofstream file(file_name_this.c_str(),std::ios::binary|std::ios::in);
+				file.seekp(pos);
+				file.write((char*) data, (size_for_level*Z));
+				file.close();
+	
+				/*
+				//Debug Module :
+				unsigned char* data2 = (unsigned char*) malloc(Z*size_for_level);
+				std::ifstream file2(file_name_this.c_str(),std::ios::binary);
+				file2.seekg((objectKey-1)*(Z*size_for_level));
+				file2.read((char*) data2, (Z*size_for_level));
+				file2.close();			
+				printer = (uint32_t*) data2;
+				printf("AFTER WRITE : ");
+				for(uint8_t e = 0;e < Z ;e++) {
+					printer+=4;
+					printf("(%d,%d) , ", *printer, *(printer+1));
+					printer = (uint32_t*) (data2 + (e+1)*size_for_level);
+				}
+				printf("\n");
+				*/
 
-					file.open(file_name_this_i.c_str(),std::ios::binary|std::ios::in);
-					file.seekp((objectKey-1)*hashsize,std::ios_base::beg);
-					file.write((char*) hash, hashsize);
-					file.close();
-				#endif
+				file.open(file_name_this_i.c_str(),std::ios::binary|std::ios::in);
+				file.seekp((objectKey-1)*hashsize,std::ios_base::beg);
+				file.write((char*) hash, hashsize);
+				file.close();
 			#endif
 		}
-		catch (std::ifstream::failure e) {
+		catch (std::ifstream::failure &e) {
 			std::cerr << "Exception opening file";
 		}
 	}
 	else {
 
-		if(recursion_level == -1) {
+		if((int32_t) recursion_level==-1) {
 			memcpy(inmem_tree+((Z*size_for_level)*(objectKey-1)),data,(size_for_level*Z));
 			memcpy(inmem_hash+(HASH_LENGTH*(objectKey-1)),hash,HASH_LENGTH);
 		}
@@ -750,16 +1957,152 @@ uint8_t LocalStorage::uploadObject(unsigned char *data, uint32_t objectKey,unsig
 	return 0;
 }
 
+/*
+DIRECT_IO_MODE helpers. With O_DIRECT only whole blocks can be transferred, so single buckets and hashes
+are read and written as the padded record (or the header block, for the root hash) that holds them.
+*/
+
+//Block that holds hash(bucket_no) : the header block for the root, the record of its parent otherwise
+void LocalStorage::hashBlock(uint32_t bucket_no, uint32_t level, uint64_t *offset, uint32_t *length) {
+	if(bucket_no==1) {
+		*offset = 0;
+		*length = io_block_size;
+	}
+	else {
+		*offset = recordOffset(bucket_no>>1, level);
+		*length = layout_l[((int32_t) level==-1) ? 0 : level].record_stride;
+	}
+}
+
+void LocalStorage::readBlock(uint32_t level, uint64_t offset, uint32_t length, unsigned char *block) {
+	struct io_request request;
+	request.fd = stripeFd(level, offset);
+	request.offset = offset;
+	request.iov[0].iov_base = block;
+	request.iov[0].iov_len = length;
+	request.iovcnt = 1;
+	diskRead(level, &request, 1);
+}
+
+//Read-modify-write of size bytes at file offset at, within the block [offset, offset+length)
+void LocalStorage::patchBlock(uint32_t level, uint64_t offset, uint32_t length, uint64_t at, unsigned char *data, uint32_t size) {
+	readBlock(level, offset, length, direct_scratch);
+	memcpy(direct_scratch + (at - offset), data, size);
+	diskWrite(level, offset, direct_scratch, length);
+	//The block may be part of the path held in direct_path
+	direct_path_level = -1;
+}
+
+//Reads the D_lev+1 records of the path (leaf to root) and the header block into direct_path
+void LocalStorage::readPathRecords(uint32_t leafLabel, uint32_t level, uint32_t D_lev) {
+	uint32_t stride = layout_l[((int32_t) level==-1) ? 0 : level].record_stride;
+	uint32_t temp = leafLabel;
+	for(uint8_t i = 0;i<D_lev+1;i++) {
+		struct io_request *request = &(path_requests[i]);
+		request->offset = recordOffset(temp, level);
+		request->fd = stripeFd(level, request->offset);
+		request->iov[0].iov_base = direct_path + io_block_size + (uint64_t)i * stride;
+		request->iov[0].iov_len = stride;
+		request->iovcnt = 1;
+		temp = temp>>1;
+	}
+	struct io_request *request = &(path_requests[D_lev+1]);
+	request->fd = stripeFd(level, 0);
+	request->offset = 0;
+	request->iov[0].iov_base = direct_path;
+	request->iov[0].iov_len = io_block_size;
+	request->iovcnt = 1;
+	diskRead(level, path_requests, D_lev+2);
+
+	direct_path_leaf = leafLabel;
+	direct_path_level = level;
+}
+
+/*
+LocalStorage::uploadPathRecords() - uploadPath for INLINE_HASH_LAYOUT
+
+path_hash holds the new hash of every node on the path (leaf to root, one per node).
+The bucket of each node goes into its record and its hash into the L/R slot of the parent's record,
+which is adjacent to the parent bucket written at the next step, so each record is updated in one region.
+*/
+uint8_t LocalStorage::uploadPathRecords(unsigned char *path, uint32_t leafLabel, unsigned char *path_hash, uint32_t level, uint32_t D_level, uint32_t size_for_level)
+{
+	uint32_t temp = leafLabel;
+	uint32_t bucket_bytes = Z*size_for_level;
+	unsigned char* path_iter = path;
+	unsigned char* path_hash_iter = path_hash;
+
+	if(inmem) {
+		unsigned char *tree = treeBase(level);
+		for(uint8_t i = 0;i<D_level+1;i++) {
+			memcpy(tree+bucketOffset(temp, level), path_iter, bucket_bytes);
+			#ifndef PASSIVE_ADVERSARY
+				memcpy(tree+hashOffset(temp, level), path_hash_iter, HASH_LENGTH);
+			#endif
+			path_iter+=bucket_bytes;
+			path_hash_iter+=HASH_LENGTH;
+			temp = temp>>1;
+		}
+		return 0;
+	}
+
+	if(io_block_size) {
+		//Patch the records of the path in direct_path (read again only if another path was fetched since),
+		//the hash of every node goes into the record of its parent, which is the next one on the path
+		if(direct_path_leaf != leafLabel || direct_path_level != level)
+			readPathRecords(leafLabel, level, D_level);
+		struct tree_layout *layout = &(layout_l[((int32_t) level==-1) ? 0 : level]);
+		unsigned char *record = direct_path + io_block_size;
+		for(uint8_t i = 0;i<D_level+1;i++) {
+			memcpy(record+HASH_LENGTH, path_iter, bucket_bytes);
+			#ifndef PASSIVE_ADVERSARY
+				if(temp==1)
+					memcpy(direct_path, path_hash_iter, HASH_LENGTH);
+				else
+					memcpy(record + layout->record_stride + ((temp%2==0) ? 0 : (layout->record_size-HASH_LENGTH)), path_hash_iter, HASH_LENGTH);
+			#endif
+			record+=layout->record_stride;
+			path_iter+=bucket_bytes;
+			path_hash_iter+=HASH_LENGTH;
+			temp = temp>>1;
+		}
+
+		temp = leafLabel;
+		record = direct_path + io_block_size;
+		for(uint8_t i = 0;i<D_level+1;i++) {
+			diskWrite(level, recordOffset(temp, level), record, layout->record_stride);
+			record+=layout->record_stride;
+			temp = temp>>1;
+		}
+		diskWrite(level, 0, direct_path, io_block_size);
+		return 0;
+	}
+
+	//Bucket and hash are queued as separate segments, readBatch matches dirty segments exactly
+	for(uint8_t i = 0;i<D_level+1;i++) {
+		diskWrite(level, bucketOffset(temp, level), path_iter, bucket_bytes);
+		diskWrite(level, hashOffset(temp, level), path_hash_iter, HASH_LENGTH);
+		path_iter+=bucket_bytes;
+		path_hash_iter+=HASH_LENGTH;
+		temp = temp>>1;
+	}
+	return 0;
+}
+
 uint8_t LocalStorage::uploadPath(unsigned char *path, uint32_t leafLabel,unsigned char *path_hash, uint32_t level, uint32_t D_level)
 {
+	#ifdef DIRTY_TRACKING
+		for(uint32_t node = leafLabel;node > 0;node = node>>1)
+			markDirty(level, node);
+	#endif
 	std::string file_name_this, file_name_this_i;
 	uint32_t size_for_level = dataSize;
 	uint64_t pos;
 	if(!inmem){
-		if(level!=-1)	{
+		if((int32_t) level!=-1)	{
 			file_name_this = file_name + "p" + std::to_string(level); 
 			file_name_this_i = file_name_this + "_i";	
-			if(level==recursion_levels)
+			if((int32_t) level==recursion_levels)
 				size_for_level = dataSize;
 			else
 				size_for_level = recursionBlockSize;
@@ -770,23 +2113,39 @@ uint8_t LocalStorage::uploadPath(unsigned char *path, uint32_t leafLabel,unsigne
 		}	
 	}
 	else{
-		if(level==recursion_levels)
+		if((int32_t) level==recursion_levels)
 			size_for_level = dataSize;
 		else
 			size_for_level = recursionBlockSize;
 	}
 
+	#ifdef INLINE_HASH_LAYOUT
+		return uploadPathRecords(path, leafLabel, path_hash, level, D_level, size_for_level);
+	#endif
+
 	uint32_t temp = leafLabel;
 	unsigned char* path_iter = path;
 	unsigned char* path_hash_iter = path_hash;
 
 	if(inmem == false) {
+		#ifdef ASYNC_IO_MODE
+			//Queue the write-backs and return, AsyncIO's dirty map serves them to reads till they hit the disk
+			uint32_t fd_index = ((int32_t) level==-1) ? 0 : level;
+			for(uint8_t i = 0;i<D_level+1;i++) {
+				pos = (uint64_t)(temp-1)*(uint64_t)(size_for_level*Z);
+				aio->writeBack(hdd_fd_l[fd_index], pos, path_iter, (size_for_level*Z));
+				aio->writeBack(hdd_fd_hash_l[fd_index], (uint64_t)(temp-1)*HASH_LENGTH, path_hash_iter, HASH_LENGTH);
+				path_iter+=(size_for_level*Z);
+				path_hash_iter+=HASH_LENGTH;
+				temp = temp>>1;
+			}
+			return 0;
+		#endif
+
 		#ifdef FILESTREAM_MODE
 			FILE *file1, *file2;
-			#ifndef CACHE_UPPER
-				file1 = fopen(file_name_this.c_str(),"r+b");
-				file2 = fopen(file_name_this_i.c_str(), "r+b");
-			#endif
+			file1 = fopen(file_name_this.c_str(),"r+b");
+			file2 = fopen(file_name_this_i.c_str(), "r+b");
 		#endif
 				
 		for(uint8_t i = 0;i<D_level+1;i++) {
@@ -808,73 +2167,18 @@ uint8_t LocalStorage::uploadPath(unsigned char *path, uint32_t leafLabel,unsigne
 			#endif
 
 			try {
-				#ifdef FILEOPEN_MODE
-					system("echo 3 > /proc/sys/vm/drop_caches");
-					int filedesc;
-					//printf("DP : FILE_DESC_MODE\n");
-					//printf("USING SYSCALL OPEN");
-					filedesc = open(file_name_this.c_str(), O_RDWR|O_DIRECT|O_DSYNC);
-					pos = (temp-1)*(size_for_level*Z);
-					pwrite(filedesc,path_iter,(size_for_level*Z),pos);
+				#ifdef FILESTREAM_MODE
+					//Confirm that mode doesn't wipe existing file
+					pos = (uint64_t)(temp-1)*(uint64_t)(size_for_level*Z);
+					//printf("Seeked pos : %ld\n",pos);
+					fseek(file1, pos, SEEK_SET);
+					fwrite(path_iter,1,(size_for_level*Z), file1);
 					path_iter+=(size_for_level*Z);
-					posix_fadvise(filedesc,pos,(size_for_level*Z),POSIX_FADV_DONTNEED);
-					syncfs(filedesc);
-					close(filedesc);
-
-					//printf("DP : FILE_DESC_BASE DONE\n");					
-				
-					filedesc = open(file_name_this_i.c_str(), O_RDWR|O_DIRECT|O_DSYNC);
-					pwrite(filedesc,path_hash_iter,HASH_LENGTH,(temp-1)*HASH_LENGTH);
-					path_hash_iter+=(HASH_LENGTH);
-					syncfs(filedesc);
-					close(filedesc);					
-
-				#elif FILESTREAM_MODE
-					#ifdef CACHE_UPPER
-						if(level==recursion_levels){
-							if(temp > objectkeylimit){
-								FILE *file1t;
-								file1t = fopen(file_name_this.c_str(),"r+b");
-								uint32_t adjusted_temp = temp - objectkeylimit -1;
-								//File Access
-								pos = (uint64_t)(adjusted_temp)*(uint64_t)(size_for_level*Z);
-								fseek(file1t, pos, SEEK_SET);
-								fwrite(path_iter, 1, (size_for_level*Z), file1t);
-								path_iter += (Z*size_for_level);
-								fclose(file1t);								
 								
-							}	
-							else{
-								memcpy(inmem_tree_l[level]+((uint64_t)(Z*size_for_level)*(uint64_t)(temp-1)),path_iter,(Z*size_for_level));
-								path_iter += (Z*size_for_level);
-							}
-
-							//Common integrity tree part
-							memcpy(inmem_hash_l[level]+(uint64_t)(HASH_LENGTH*(temp-1)),path_hash_iter,HASH_LENGTH);
-							path_hash_iter +=(HASH_LENGTH);
-							
-						}	
-						else{
-							uint64_t postemp = (Z*size_for_level)*(temp-1);
-							//printf("LS-FS-CU: temp = %d, pos = %ld\n",temp,postemp);
-							memcpy(inmem_tree_l[level]+((Z*size_for_level)*(temp-1)),path_iter,(Z*size_for_level));
-							memcpy( inmem_hash_l[level]+(HASH_LENGTH*(temp-1)),path_hash_iter,HASH_LENGTH);
-							path_iter += (Z*size_for_level);
-							path_hash_iter+=HASH_LENGTH;	
-						}
-					#else
-						//Confirm that mode doesn't wipe existing file
-						pos = (uint64_t)(temp-1)*(uint64_t)(size_for_level*Z);
-						//printf("Seeked pos : %ld\n",pos);
-						fseek(file1, pos, SEEK_SET);
-						fwrite(path_iter,1,(size_for_level*Z), file1);
-						path_iter+=(size_for_level*Z);
-									
-						pos = (temp-1)*HASH_LENGTH;					
-						fseek(file2, pos, SEEK_SET);
-						fwrite(path_hash_iter,1, HASH_LENGTH, file2);
-						path_hash_iter+=HASH_LENGTH;
-					#endif
+					pos = (temp-1)*HASH_LENGTH;					
+					fseek(file2, pos, SEEK_SET);
+					fwrite(path_hash_iter,1, HASH_LENGTH, file2);
+					path_hash_iter+=HASH_LENGTH;
 				#else
 					std::ofstream file(file_name_this.c_str(),std::ios::binary|std::ios::in);
 					pos = (temp-1)*(size_for_level*Z);				
@@ -891,17 +2195,15 @@ uint8_t LocalStorage::uploadPath(unsigned char *path, uint32_t leafLabel,unsigne
 				#endif
 				
 			}
-			catch (std::ifstream::failure e) {
+			catch (std::ifstream::failure &e) {
 					std::cerr <<"Exception opening file";
 			}
 			//if(temp > 0) {temp = ((temp+1)>>1)-1;}
 			temp = temp>>1;
 		}
 		#ifdef FILESTREAM_MODE	
-			#ifndef CACHE_UPPER
-				fclose(file1);							
-				fclose(file2);
-			#endif
+			fclose(file1);							
+			fclose(file2);
 		#endif
 		/*
 		#ifdef FILE_DESC_MODE
@@ -918,7 +2220,7 @@ uint8_t LocalStorage::uploadPath(unsigned char *path, uint32_t leafLabel,unsigne
 
 	}
 	else {
-		if(level == -1) {
+		if((int32_t) level==-1) {
 			for(uint8_t i = 0;i<D_level+1;i++) {
 				memcpy(inmem_tree+(bucket_size*(temp-1)),path_iter,bucket_size);
 				memcpy(inmem_hash+(HASH_LENGTH*(temp-1)),path_hash_iter,HASH_LENGTH);
@@ -972,7 +2274,7 @@ uint8_t LocalStorage::uploadPath(unsigned char *path, uint32_t leafLabel,unsigne
 	/*
 	#ifdef FILESTREAM_MODE
 		#ifdef NO_CACHING
-			if(level == recursion_levels && inmem==false) {
+			if((int32_t) level==recursion_levels && inmem==false) {
 				system("sudo sync");
 			}
 		#endif
@@ -990,7 +2292,7 @@ unsigned char* LocalStorage::downloadObject(unsigned char* data,uint32_t objectK
 	std::string file_name_this, file_name_this_i;
 
 	if(!inmem) {
-		if(recursion_level!=-1)	{
+		if((int32_t) recursion_level!=-1)	{
 			file_name_this = file_name + "p" + std::to_string(recursion_level); 
 			file_name_this_i = file_name_this + "_i";
 		}
@@ -1000,6 +2302,69 @@ unsigned char* LocalStorage::downloadObject(unsigned char* data,uint32_t objectK
 		}	
 	}
 
+	#ifdef INLINE_HASH_LAYOUT
+		uint64_t bucket_pos = bucketOffset(objectKey, recursion_level);
+		uint64_t hash_pos = hashOffset(objectKey, recursion_level);
+		if(inmem) {
+			memcpy(data, treeBase(recursion_level)+bucket_pos, (Z*size_for_level));
+			memcpy(hash, treeBase(recursion_level)+hash_pos, HASH_LENGTH);
+		}
+		else if(io_block_size) {
+			uint64_t block_pos = recordOffset(objectKey, recursion_level);
+			uint32_t block_length = layout_l[((int32_t) recursion_level==-1) ? 0 : recursion_level].record_stride;
+			readBlock(recursion_level, block_pos, block_length, direct_scratch);
+			memcpy(data, direct_scratch + (bucket_pos - block_pos), (Z*size_for_level));
+			hashBlock(objectKey, recursion_level, &block_pos, &block_length);
+			readBlock(recursion_level, block_pos, block_length, direct_scratch);
+			memcpy(hash, direct_scratch + (hash_pos - block_pos), HASH_LENGTH);
+		}
+		else {
+			struct io_request requests[2];
+			for(uint8_t r = 0;r < 2;r++)
+				requests[r].iovcnt = 1;
+			requests[0].fd = stripeFd(recursion_level, bucket_pos);
+			requests[0].offset = bucket_pos;
+			requests[0].iov[0].iov_base = data;
+			requests[0].iov[0].iov_len = (Z*size_for_level);
+			requests[1].fd = stripeFd(recursion_level, hash_pos);
+			requests[1].offset = hash_pos;
+			requests[1].iov[0].iov_base = hash;
+			requests[1].iov[0].iov_len = HASH_LENGTH;
+			diskRead(recursion_level, requests, 2);
+		}
+		return data;
+	#endif
+
+	if(inmem) {
+		uint64_t pos = ((uint64_t)(Z*size_for_level))*((uint64_t)(objectKey-1));
+		if((int32_t) recursion_level==-1) {
+			memcpy(data,inmem_tree+pos,(Z*size_for_level));
+			memcpy(hash,inmem_hash+(HASH_LENGTH*(objectKey-1)),HASH_LENGTH);
+		}
+		else {
+			memcpy(data,inmem_tree_l[recursion_level]+pos,(Z*size_for_level));
+			memcpy(hash,inmem_hash_l[recursion_level]+(HASH_LENGTH*(objectKey-1)),HASH_LENGTH);
+		}
+		return data;
+	}
+
+	#ifdef ASYNC_IO_MODE
+		uint32_t fd_index = ((int32_t) recursion_level==-1) ? 0 : recursion_level;
+		struct io_request requests[2];
+		requests[0].fd = hdd_fd_l[fd_index];
+		requests[0].offset = (uint64_t)(objectKey-1)*(uint64_t)(Z*size_for_level);
+		requests[0].iov[0].iov_base = data;
+		requests[0].iov[0].iov_len = (Z*size_for_level);
+		requests[0].iovcnt = 1;
+		requests[1].fd = hdd_fd_hash_l[fd_index];
+		requests[1].offset = (uint64_t)(objectKey-1)*(uint64_t)hashsize;
+		requests[1].iov[0].iov_base = hash;
+		requests[1].iov[0].iov_len = hashsize;
+		requests[1].iovcnt = 1;
+		aio->readBatch(requests, 2);
+		return data;
+	#endif
+
 	try {
 		//printf("Name: %s, Pos : %d\n", file_name_this.c_str(),(objectKey-1)*Z*size_for_level);
 		std::ifstream file(file_name_this.c_str(),std::ios::binary);
@@ -1024,13 +2389,191 @@ unsigned char* LocalStorage::downloadObject(unsigned char* data,uint32_t objectK
 		file.read((char*) hash, hashsize);
 		file.close();
 	}
-	catch (std::ifstream::failure e) {
+	catch (std::ifstream::failure &e) {
 		std::cerr <<"Exception opening file";
 	}
 
 	return data;
 
 }
+/*
+readRecords() - Copies the records of the count consecutive nodes from first_label of the tree of level (one row of it)
+into records, one record_stride apart. Runs of records that are adjacent in the tree go out as a single read.
+Only memcpy and pread, so concurrent calls are safe as long as the instance is idle and synced (see auditRange).
+*/
+void LocalStorage::readRecords(uint32_t level, uint32_t first_label, uint32_t count, unsigned char *records) {
+	uint32_t index = ((int32_t) level==-1) ? 0 : level;
+	uint32_t stride = layout_l[index].record_stride;
+	uint32_t run_start = 0;
+	while(run_start < count) {
+		uint64_t offset = recordOffset(first_label + run_start, level);
+		uint32_t run_end = run_start + 1;
+		while(run_end < count && recordOffset(first_label + run_end, level) == offset + (uint64_t)(run_end - run_start) * stride)
+			run_end++;
+		unsigned char *buffer = records + (uint64_t) run_start * stride;
+		uint64_t size = (uint64_t)(run_end - run_start) * stride;
+		if(inmem) {
+			memcpy(buffer, treeBase(level) + offset, size);
+		}
+		else {
+			//The cached prefix is in RAM, the rest comes straight from the files
+			uint64_t cache_size = (cache_size_l != NULL) ? cache_size_l[index] : 0;
+			if(offset < cache_size) {
+				uint64_t cached = (offset + size <= cache_size) ? size : (cache_size - offset);
+				memcpy(buffer, cache_l[index] + offset, cached);
+				offset+= cached;
+				buffer+= cached;
+				size-= cached;
+			}
+			if(size > 0)
+				stripedIO(index, offset, buffer, size, false);
+		}
+		run_start = run_end;
+	}
+}
+
+/*
+auditRange() - The buckets first_label..first_label+count-1 of one row of the tree of level, with their hashes and
+(if child_hashes isn't NULL) those of their children, for ZT_Audit. With INLINE_HASH_LAYOUT a record holds
+<L hash | bucket | R hash>, so the row is read once for buckets and child hashes, and the row of the parents once
+for the hashes of the nodes. Needs an idle instance that was synced (syncStorage) since its last access.
+Returns false without INLINE_HASH_LAYOUT, the caller then falls back to downloadObject/fetchHash.
+*/
+bool LocalStorage::auditRange(uint32_t level, uint32_t first_label, uint32_t count, unsigned char *buckets, unsigned char *hashes, unsigned char *child_hashes, uint32_t size_for_level)
+{
+	#ifdef INLINE_HASH_LAYOUT
+		uint32_t index = ((int32_t) level==-1) ? 0 : level;
+		struct tree_layout *layout = &(layout_l[index]);
+		uint32_t stride = layout->record_stride;
+		uint32_t bucket_bytes = Z*size_for_level;
+		uint32_t first_parent = first_label>>1;
+		uint32_t no_of_parents = (first_label==1) ? 0 : (((first_label + count - 1)>>1) - first_parent + 1);
+		uint64_t records_size = (uint64_t)(count + no_of_parents) * stride;
+		//O_DIRECT reads land in aligned memory, and the root hash takes up a whole header block
+		if(first_label==1)
+			records_size+= layout->header_size;
+		unsigned char *records;
+		if(posix_memalign((void**) &records, CACHE_PAGE_SIZE, records_size) != 0) {
+			printf("LS : FAILED MALLOC of the audit buffer\n");
+			return false;
+		}
+		unsigned char *parents = records + (uint64_t) count * stride;
+
+		readRecords(level, first_label, count, records);
+		for(uint32_t i = 0;i < count;i++) {
+			unsigned char *record = records + (uint64_t) i * stride;
+			memcpy(buckets + (uint64_t) i * bucket_bytes, record + HASH_LENGTH, bucket_bytes);
+			if(child_hashes != NULL) {
+				memcpy(child_hashes + 2 * i * HASH_LENGTH, record, HASH_LENGTH);
+				memcpy(child_hashes + (2 * i + 1) * HASH_LENGTH, record + layout->record_size - HASH_LENGTH, HASH_LENGTH);
+			}
+		}
+
+		if(first_label==1) {
+			//The root hash sits in front of the root record
+			if(inmem)
+				memcpy(parents, treeBase(level), HASH_LENGTH);
+			else if(cache_size_l != NULL && cache_size_l[index] >= layout->header_size)
+				memcpy(parents, cache_l[index], HASH_LENGTH);
+			else
+				stripedIO(index, 0, parents, layout->header_size, false);
+			memcpy(hashes, parents, HASH_LENGTH);
+		}
+		else {
+			readRecords(level, first_parent, no_of_parents, parents);
+			for(uint32_t i = 0;i < count;i++) {
+				uint32_t label = first_label + i;
+				unsigned char *parent = parents + (uint64_t)((label>>1) - first_parent) * stride;
+				memcpy(hashes + i * HASH_LENGTH, (label%2==0) ? parent : (parent + layout->record_size - HASH_LENGTH), HASH_LENGTH);
+			}
+		}
+		free(records);
+		return true;
+	#else
+		return false;
+	#endif
+}
+
+/*
+LocalStorage::downloadPathRecords() - downloadPath for INLINE_HASH_LAYOUT
+
+The record of the node at index i of the path carries the <L,R> pair of index i-1, so every node is one contiguous read :
+the leaf reads just its bucket, inner nodes read <L | bucket | R>, and the root additionally picks up its own hash
+from offset 0, right in front of its record.
+*/
+unsigned char* LocalStorage::downloadPathRecords(unsigned char* path, uint32_t leafLabel, unsigned char *path_hash, uint32_t level, uint32_t D_lev, uint32_t size_for_level)
+{
+	uint32_t temp = leafLabel;
+	uint32_t bucket_bytes = Z*size_for_level;
+	unsigned char* path_iter = path;
+	//<L,R> pair of the previous (child) index
+	unsigned char* pair_iter = path_hash;
+	//Child hashes of the root of a single node tree have no slot in path_hash
+	unsigned char unused_pair[2*HASH_LENGTH];
+
+	if(inmem || io_block_size) {
+		//DIRECT_IO_MODE reads the whole records into direct_path first, and picks them apart just like an in-memory tree
+		unsigned char *tree = NULL;
+		uint32_t stride = layout_l[((int32_t) level==-1) ? 0 : level].record_stride;
+		if(inmem)
+			tree = treeBase(level);
+		else
+			readPathRecords(leafLabel, level, D_lev);
+		for(uint8_t i = 0;i<D_lev+1;i++) {
+			unsigned char *record = inmem ? (tree+recordOffset(temp, level)) : (direct_path + io_block_size + (uint64_t)i * stride);
+			memcpy(path_iter, record+HASH_LENGTH, bucket_bytes);
+			#ifndef PASSIVE_ADVERSARY
+				if(i!=0) {
+					memcpy(pair_iter, record, HASH_LENGTH);
+					memcpy(pair_iter+HASH_LENGTH, record+HASH_LENGTH+bucket_bytes, HASH_LENGTH);
+					pair_iter+=(2*HASH_LENGTH);
+				}
+				if(temp==1)
+					memcpy(pair_iter, inmem ? tree : direct_path, HASH_LENGTH);
+			#endif
+			path_iter+=bucket_bytes;
+			temp = temp>>1;
+		}
+		return path;
+	}
+
+	for(uint8_t i = 0;i<D_lev+1;i++) {
+		struct io_request *request = &(path_requests[i]);
+		uint64_t record = recordOffset(temp, level);
+		bool with_pair = (i!=0 || temp==1);
+		unsigned char *pair = (i!=0) ? pair_iter : unused_pair;
+		uint8_t iovcnt = 0;
+
+		if(temp==1) {
+			request->offset = 0;
+			request->iov[iovcnt].iov_base = (i!=0) ? (pair_iter + 2*HASH_LENGTH) : pair_iter;
+			request->iov[iovcnt++].iov_len = HASH_LENGTH;
+		}
+		else {
+			request->offset = with_pair ? record : (record + HASH_LENGTH);
+		}
+		if(with_pair) {
+			request->iov[iovcnt].iov_base = pair;
+			request->iov[iovcnt++].iov_len = HASH_LENGTH;
+		}
+		request->iov[iovcnt].iov_base = path_iter;
+		request->iov[iovcnt++].iov_len = bucket_bytes;
+		if(with_pair) {
+			request->iov[iovcnt].iov_base = pair + HASH_LENGTH;
+			request->iov[iovcnt++].iov_len = HASH_LENGTH;
+		}
+		request->iovcnt = iovcnt;
+		request->fd = stripeFd(level, request->offset);
+
+		if(i!=0)
+			pair_iter+=(2*HASH_LENGTH);
+		path_iter+=bucket_bytes;
+		temp = temp>>1;
+	}
+	diskRead(level, path_requests, D_lev+1);
+	return path;
+}
+
 /*
 LocalStorage::downloadPath() - returns requested path in *path
 
@@ -1046,10 +2589,10 @@ unsigned char* LocalStorage::downloadPath(unsigned char* path, uint32_t leafLabe
 	uint32_t size_for_level = dataSize;
 
 	if(!inmem) {
-		if(level!=-1)	{
+		if((int32_t) level!=-1)	{
 			file_name_this = file_name + "p" + std::to_string(level); 
 			file_name_this_i = file_name_this + "_i";	
-			if(level==recursion_levels)
+			if((int32_t) level==recursion_levels)
 				size_for_level = dataSize;
 			else
 				size_for_level = recursionBlockSize;
@@ -1060,17 +2603,21 @@ unsigned char* LocalStorage::downloadPath(unsigned char* path, uint32_t leafLabe
 		}	
 	}
 	else{
-		if(level==-1) {
+		if((int32_t) level==-1) {
 			size_for_level = dataSize;
 		}
 		else{
-			if(level==recursion_levels)
+			if((int32_t) level==recursion_levels)
 				size_for_level = dataSize;
 			else
 				size_for_level = recursionBlockSize;
 		}
 	}
 
+	#ifdef INLINE_HASH_LAYOUT
+		return downloadPathRecords(path, leafLabel, path_hash, level, D_lev, size_for_level);
+	#endif
+
 	uint32_t temp = leafLabel;
 	unsigned char* path_iter = path;
 	unsigned char* path_hash_iter = path_hash;	
@@ -1080,60 +2627,52 @@ unsigned char* LocalStorage::downloadPath(unsigned char* path, uint32_t leafLabe
 		#ifdef PRINT_BUCKETS
 			printf("IN LS : Buckets Accessed : \n");
 		#endif
+
+		#ifdef ASYNC_IO_MODE
+			//Submit every bucket and sibling-hash read of the path as one batch
+			uint32_t fd_index = ((int32_t) level==-1) ? 0 : level;
+			uint32_t no_of_requests = 0;
+			for(uint8_t i =0;i<D_lev+1;i++) {
+				struct io_request *request = &(path_requests[no_of_requests++]);
+				request->fd = hdd_fd_l[fd_index];
+				request->offset = (uint64_t)(temp-1)*(uint64_t)(Z*size_for_level);
+				request->iov[0].iov_base = path_iter;
+				request->iov[0].iov_len = (Z*size_for_level);
+				request->iovcnt = 1;
+				path_iter+=(Z*size_for_level);
+
+				request = &(path_requests[no_of_requests++]);
+				request->fd = hdd_fd_hash_l[fd_index];
+				if(temp==1) {
+					request->offset = 0;
+					request->iov[0].iov_base = path_hash_iter;
+					request->iov[0].iov_len = HASH_LENGTH;
+					request->iovcnt = 1;
+					path_hash_iter+=HASH_LENGTH;
+				}
+				else {
+					//<L,R> pair, L is always the even node
+					uint32_t left = (temp%2==0) ? temp : temp-1;
+					request->offset = (uint64_t)(left-1)*HASH_LENGTH;
+					request->iov[0].iov_base = path_hash_iter;
+					request->iov[0].iov_len = HASH_LENGTH;
+					request->iov[1].iov_base = path_hash_iter + HASH_LENGTH;
+					request->iov[1].iov_len = HASH_LENGTH;
+					request->iovcnt = 2;
+					path_hash_iter+=(2*HASH_LENGTH);
+				}
+				temp = temp>>1;
+			}
+			aio->readBatch(path_requests, no_of_requests);
+			return path;
+		#endif
+
 		for(uint8_t i =0;i<D_lev+1;i++) {
 	
 			try {
 
-				uint32_t temp_sib;
-				#ifdef SYSOPEN_MODE
-					system("echo 1 > /proc/sys/vm/drop_caches");
-					system("echo 2 > /proc/sys/vm/drop_caches");
-					system("echo 3 > /proc/sys/vm/drop_caches");
-					int filedesc;
-					//printf("DP : FILE_DESC_MODE\n");
-					//printf("USING SYSCALL OPEN");
-					filedesc = open(file_name_this.c_str(), O_RDONLY|O_DIRECT);
-					pos = (temp-1)*(size_for_level*Z);
-					pread(filedesc,path_iter,(size_for_level*Z),pos);
-				
-					//Print contents to TEST
-					uint32_t *labelptr = (uint32_t*) (path_iter+16);
-					printf("(%d,%d) \n",*labelptr,*(labelptr+4));
-	
-					path_iter+=(size_for_level*Z);
-					//posix_fadvise(filedesc,pos,(size_for_level*Z),POSIX_FADV_DONTNEED);
-					posix_fadvise(filedesc,0,datatree_size,POSIX_FADV_DONTNEED);
-					syncfs(filedesc);
-					close(filedesc);
-
-					//printf("DP : FILE_DESC_BASE DONE\n");					
-					
-					if(temp==1) {
-						filedesc = open(file_name_this_i.c_str(), O_RDONLY|O_DIRECT);
-						pread(filedesc,path_hash_iter,HASH_LENGTH,(temp-1)*HASH_LENGTH);
-						path_hash_iter+=(HASH_LENGTH);
-						close(filedesc);					
-					}
-					else {
-						if(temp%2 ==0)
-							temp_sib = temp+1;
-						else	{
-							temp_sib = temp;
-							temp = temp - 1;			
-						}
-
-						filedesc = open(file_name_this_i.c_str(), O_RDONLY|O_DIRECT);
-						pread(filedesc,path_hash_iter,HASH_LENGTH,(temp-1)*HASH_LENGTH);
-						path_hash_iter+=(HASH_LENGTH);
-					
-						pread(filedesc,path_hash_iter,HASH_LENGTH,(temp_sib-1)*HASH_LENGTH);
-						path_hash_iter+=(HASH_LENGTH);
-						posix_fadvise(filedesc,(temp-1)*HASH_LENGTH,HASH_LENGTH*2,POSIX_FADV_DONTNEED);
-						close(filedesc);
-
-					}
-
-				#elif FILE_DESC_MODE
+				#ifdef FILE_DESC_MODE
+					uint32_t temp_sib;
 						FILE *file;
 						file = fopen(file_name_this.c_str(),"rb");
 						pos = (temp-1)*(size_for_level*Z);
@@ -1182,135 +2721,78 @@ unsigned char* LocalStorage::downloadPath(unsigned char* path, uint32_t leafLabe
 				#else
 
 										
-					#ifdef CACHE_UPPER
-						if(level==recursion_levels){
-							if(temp > objectkeylimit){			
-								uint32_t adjusted_temp = temp - objectkeylimit - 1;
-								FILE *file;
-								file = fopen(file_name_this.c_str(),"rb");
-								pos = (uint64_t)(adjusted_temp)*(uint64_t)(size_for_level*Z);
-								fseek(file, pos, SEEK_SET);
-								fread(path_iter, 1, (size_for_level*Z), file);
-								path_iter+=(Z*size_for_level);
-								fclose(file);								
-								
-							}	
-							else{
-								pos = (uint64_t)(temp-1)*(uint64_t)(size_for_level*Z);
-								memcpy(path_iter,(inmem_tree_l[level])+pos,(Z*size_for_level));
-								path_iter+=(Z*size_for_level);								
-							}
-
-							#ifdef PRINT_BUCKETS
-								std::cout<<temp<<","<<pos<<"\n";
-								//printf("%d,%ld\n",temp,pos);
-							#endif
-							//Common integrity tree part
-							if(temp==1){
-								memcpy(path_hash_iter, inmem_hash_l[level]+(HASH_LENGTH*(temp-1)),HASH_LENGTH);
-								path_hash_iter +=(HASH_LENGTH);
-							}
-							else{
-								if(temp%2 ==0)
-									temp_sib = temp+1;
-								else	{
-									temp_sib = temp;
-									temp = temp - 1;			
-								}
-								memcpy(path_hash_iter, inmem_hash_l[level]+(HASH_LENGTH*(temp-1)),HASH_LENGTH);
-								path_hash_iter +=(HASH_LENGTH);
-								memcpy(path_hash_iter, inmem_hash_l[level]+(HASH_LENGTH*(temp_sib-1)),HASH_LENGTH);
-								path_hash_iter +=(HASH_LENGTH);
-							}
-						}	
-						else{
-							uint64_t post = (Z*size_for_level)*(temp-1);
-							#ifdef PRINT_BUCKETS
-								std::cout<<temp<<","<<post<<"\n";
-								//printf("%d,%ld",temp,post);
-							#endif
-							memcpy(path_iter,inmem_tree_l[level]+((Z*size_for_level)*(temp-1)),(Z*size_for_level));
-							memcpy(path_hash_iter, inmem_hash_l[level]+(HASH_LENGTH*(temp-1)),HASH_LENGTH);
-							path_iter += (Z*size_for_level);
-							path_hash_iter+=HASH_LENGTH;	
-						}
-					#else
-						pos = (uint64_t)(temp-1)*(uint64_t)(Z*size_for_level);
-						#ifdef PRINT_BUCKETS
-							//printf("(%d,%ld)\n",temp,pos);
-							std::cout<<"("<<temp<<","<<pos<<")\n";
-						#endif
-						//printf("Level : %d, %s, Pos : %ld, bucket_label = %d\n",level, file_name_this.c_str(),pos, temp-1);
-						//std::string fp = directoryFP + std::to_string(temp);
-						std::ifstream file(file_name_this.c_str(),std::ios::binary);
-						file.seekg(pos);
-						file.read((char*) path_iter, (Z*size_for_level));
-						path_iter +=(Z*size_for_level);
-						file.close();
-				
-						/*
-						//Print Path for Debugging :
-						if(level!=recursion_levels) {
-							uint32_t *print_iter = (uint32_t*) (path_iter - (Z*size_for_level));
-							for(uint8_t q = 0 ;q < Z ;q++) {
-								print_iter+=4;
-								printf("(%d,%d) : ",*print_iter,*(print_iter+1));
-								print_iter+=2;
-								for(uint8_t p = 0;p<16;p++) {
-									printf(" %d, ", *print_iter);
-									print_iter+=1;
-								}
-						
-								printf("\n");				
+					pos = (uint64_t)(temp-1)*(uint64_t)(Z*size_for_level);
+					#ifdef PRINT_BUCKETS
+						//printf("(%d,%ld)\n",temp,pos);
+						std::cout<<"("<<temp<<","<<pos<<")\n";
+					#endif
+					//printf("Level : %d, %s, Pos : %ld, bucket_label = %d\n",level, file_name_this.c_str(),pos, temp-1);
+					//std::string fp = directoryFP + std::to_string(temp);
+					std::ifstream file(file_name_this.c_str(),std::ios::binary);
+					file.seekg(pos);
+					file.read((char*) path_iter, (Z*size_for_level));
+					path_iter +=(Z*size_for_level);
+					file.close();
+			
+					/*
+					//Print Path for Debugging :
+					if(level!=recursion_levels) {
+						uint32_t *print_iter = (uint32_t*) (path_iter - (Z*size_for_level));
+						for(uint8_t q = 0 ;q < Z ;q++) {
+							print_iter+=4;
+							printf("(%d,%d) : ",*print_iter,*(print_iter+1));
+							print_iter+=2;
+							for(uint8_t p = 0;p<16;p++) {
+								printf(" %d, ", *print_iter);
+								print_iter+=1;
 							}
-						}		
-				
-						unsigned char *path_debug = path_iter-(Z*size_for_level);
-						uint32_t *printer = (uint32_t*) path_debug;
-						printer+=4;
-						for(uint8_t e = 0 ;e < Z;e++) {
-							printf("(%d,%d) , ", *printer,*(printer+1));				
-						}
-						printf("\n");	
-						*/	
-	
-						if(temp==1) {
-							//std::string fp_i1 = directoryFP_i + std::to_string(temp);
-							//printf("%s\n",fp_i1.c_str());
-							file.open(file_name_this_i.c_str(),std::ios::binary);
-							file.seekg((temp-1)*HASH_LENGTH);
-							file.read((char*) path_hash_iter, HASH_LENGTH);
-							path_hash_iter +=(HASH_LENGTH);
-							file.close();					
+					
+							printf("\n");				
 						}
-						else {
-							if(temp%2 ==0)
-								temp_sib = temp+1;
-							else	{
-								temp_sib = temp;
-								temp = temp - 1;			
-							}
-
-							//std::string fp_i1 = directoryFP_i + std::to_string(temp);
-							//printf("%s\n",fp_i1.c_str());
-							file.open(file_name_this_i.c_str(),std::ios::binary);
-							file.seekg((temp-1)*HASH_LENGTH);					
-							file.read((char*) path_hash_iter, HASH_LENGTH);
-							path_hash_iter +=(HASH_LENGTH);
-							//file.close();
+					}		
+			
+					unsigned char *path_debug = path_iter-(Z*size_for_level);
+					uint32_t *printer = (uint32_t*) path_debug;
+					printer+=4;
+					for(uint8_t e = 0 ;e < Z;e++) {
+						printf("(%d,%d) , ", *printer,*(printer+1));				
+					}
+					printf("\n");	
+					*/	
 
-							//std::string fp_i2 = directoryFP_i + std::to_string(temp_sib);
-							//printf("%s\n",fp_i2.c_str());
-							//file.open(file_name_this_i.c_str(),std::ios::binary);
-							//file.seekg((temp_sib-1)*HASH_LENGTH);
-							file.read((char*) path_hash_iter, HASH_LENGTH);
-							path_hash_iter +=(HASH_LENGTH);
-							file.close();
-						}
-					#endif
+					if(temp==1) {
+						//std::string fp_i1 = directoryFP_i + std::to_string(temp);
+						//printf("%s\n",fp_i1.c_str());
+						file.open(file_name_this_i.c_str(),std::ios::binary);
+						file.seekg((temp-1)*HASH_LENGTH);
+						file.read((char*) path_hash_iter, HASH_LENGTH);
+						path_hash_iter +=(HASH_LENGTH);
+						file.close();					
+					}
+					else {
+						//The sibling hash is read sequentially after this one
+						if(temp%2 !=0)
+							temp = temp - 1;
+
+						//std::string fp_i1 = directoryFP_i + std::to_string(temp);
+						//printf("%s\n",fp_i1.c_str());
+						file.open(file_name_this_i.c_str(),std::ios::binary);
+						file.seekg((temp-1)*HASH_LENGTH);					
+						file.read((char*) path_hash_iter, HASH_LENGTH);
+						path_hash_iter +=(HASH_LENGTH);
+						//file.close();
+
+						//std::string fp_i2 = directoryFP_i + std::to_string(temp_sib);
+						//printf("%s\n",fp_i2.c_str());
+						//file.open(file_name_this_i.c_str(),std::ios::binary);
+						//file.seekg((temp_sib-1)*HASH_LENGTH);
+						file.read((char*) path_hash_iter, HASH_LENGTH);
+						path_hash_iter +=(HASH_LENGTH);
+						file.close();
+					}
 				#endif
 			}
-			catch (std::ifstream::failure e) {
+			catch (std::ifstream::failure &e) {
 					std::cerr <<"Exception opening file";
 			}
 	
@@ -1322,12 +2804,20 @@ unsigned char* LocalStorage::downloadPath(unsigned char* path, uint32_t leafLabe
 		#endif
 	}
 	else {
-		if(level == -1) {
+		if((int32_t) level==-1) {
 			for(uint8_t i = 0;i<D+1;i++) {
 				memcpy(path_iter,inmem_tree+((Z*size_for_level)*(temp-1)),(Z*size_for_level));
 				#ifndef PASSIVE_ADVERSARY
-					memcpy(path_hash_iter, inmem_hash+(HASH_LENGTH*(temp-1)),HASH_LENGTH);
-					path_hash_iter+=HASH_LENGTH;				
+					if(i!=D) {
+						//<L-hash, R-hash> pair of this node and its sibling, as for the recursive trees
+						uint32_t left = temp - (temp%2);
+						memcpy(path_hash_iter, inmem_hash+(HASH_LENGTH*(left-1)),2*HASH_LENGTH);
+						path_hash_iter+=(2*HASH_LENGTH);
+					}
+					else {
+						memcpy(path_hash_iter, inmem_hash+(HASH_LENGTH*(temp-1)),HASH_LENGTH);
+						path_hash_iter+=HASH_LENGTH;
+					}
 				#endif
 				path_iter += (Z*size_for_level);
 				temp = temp>>1;		
@@ -21,25 +21,219 @@ LocalStorage.hpp
 
 #pragma once
 
-class LocalStorage
+#include <stdint.h>
+#include <string>
+#include "AsyncIO.hpp"
+#include "Storage.hpp"
+
+#define ASYNC_IO_PATH_REQUESTS 128
+#define SNAPSHOT_MAGIC "ZTSNAP01"
+
+//Undo log records (see LocalStorage::walLogBefore), a WAL_UNDO record is followed by the size bytes it restores
+#define WAL_MAGIC 0x4c41575a
+#define WAL_UNDO 1
+#define WAL_COMMIT 2
+
+struct wal_record {
+	uint32_t magic;
+	uint32_t type;
+	//Tree (index 0 for the non-recursive tree) and range of its file the before-image covers
+	uint32_t index;
+	uint32_t size;
+	uint64_t offset;
+	//Checkpoint the record rolls back to (see LocalStorage::checkpointed), and group it was committed in
+	uint32_t epoch;
+	uint32_t group;
+	uint64_t checksum;
+};
+
+//Incremental snapshot file (see LocalStorage::writeSnapshot)
+struct snapshot_header {
+	char magic[8];
+	uint32_t storage_id;
+	uint32_t epoch;
+	uint32_t no_of_trees;
+	uint32_t reserved;
+};
+
+struct snapshot_tree {
+	int32_t level;
+	uint32_t bucket_size;
+	uint64_t no_of_buckets;
+	unsigned char root_hash[32];
+};
+
+//Placement of the records of one tree (see LocalStorage::setupLayout)
+struct tree_layout {
+	uint32_t depth;
+	uint32_t record_size;
+	//Space a record takes up in the tree, and the gap in front of the root record / every subtree slot
+	uint32_t record_stride;
+	uint32_t header_size;
+	uint32_t subtree_height;
+	uint32_t no_of_layers;
+	uint64_t *layer_base;
+	uint64_t *layer_stride;
+	uint64_t tree_size;
+};
+
+/*
+Untrusted storage of a single ORAM instance (all its recursion levels), held in this process.
+Implements the Storage interface for BACKEND_MEMORY, BACKEND_HDD and BACKEND_MMAP.
+*/
+class LocalStorage : public Storage
 {
+private:
+	uint32_t storage_id;
+	uint32_t dataSize;
+	uint32_t Z;
+	uint32_t D;
+
+	std::string directoryFP;
+	std::string directoryFP_i;
+	std::string file_name;
+	std::string file_name_i;
+	std::string temp;
+	std::string state_folder;
+	//Set by resumeFrom : setParams reattaches to the trees left behind by instance file_id instead of creating them
+	bool resume;
+	uint32_t file_id;
+	//Set by serveLevels : the trees of the other levels are held by another storage (see TieredStorage)
+	uint32_t first_level;
+	uint32_t last_level;
+	bool serves(uint32_t level);
+	uint8_t backend;
+	//NUMA node the arrays and I/O threads of this instance are bound to, -1 if they aren't
+	int32_t numa_node;
+	//inmem is set for every backend that serves paths out of inmem_tree/inmem_hash (BACKEND_MEMORY and BACKEND_MMAP)
+	bool inmem;
+	unsigned char* inmem_tree;
+	unsigned char* inmem_hash;
+	unsigned char** inmem_tree_l;
+	unsigned char** inmem_hash_l;
+	uint64_t datatree_size;
+	uint64_t hashtree_size;
+	uint32_t bucket_size;
+	uint32_t recursionBlockSize;
+	int32_t recursion_levels;
+	uint64_t *maxBlocks_of_pmap_level;
+
+	//BACKEND_MMAP : File descriptors and sizes of the mapped data/hash files of each level
+	//(Index 0 holds the non-recursive tree, since level 0 is the enclave-resident posmap)
+	int *mmap_fd_l;
+	int *mmap_fd_hash_l;
+	uint64_t *mmap_size_l;
+	uint64_t *mmap_hash_size_l;
+
+	//ASYNC_IO_MODE : Tree/hash files of each level are opened once, index 0 again for the non-recursive tree
+	AsyncIO *aio;
+	int *hdd_fd_l;
+	int *hdd_fd_hash_l;
+	struct io_request path_requests[ASYNC_IO_PATH_REQUESTS];
+	//Files of every stripe of each tree (stripe_directories), stripe 0 being hdd_fd_l
+	uint32_t no_of_stripes;
+	int **stripe_fd_l;
+
+	void openDiskFiles();
+	uint32_t stripeOf(uint32_t index, uint64_t offset, uint64_t *band_end);
+	int stripeFd(uint32_t level, uint64_t offset);
+	bool stripedIO(uint32_t index, uint64_t offset, unsigned char *buffer, uint64_t size, bool write);
+
+	//Cache of the top levels of every tree, sized from the byte budget given to setParams (see LocalStorage::setupCache)
+	//cache_size_l is the pinned prefix of each tree file, index 0 again for the non-recursive tree
+	uint64_t cache_budget;
+	uint64_t *cache_size_l;
+	//BACKEND_HDD : RAM copy of each prefix, and one dirty flag per CACHE_PAGE_SIZE page of it
+	unsigned char **cache_l;
+	uint8_t **cache_dirty_l;
+
+	void setupCache();
+	uint64_t cachePrefixSize(uint32_t index, uint32_t cached_levels);
+	void diskRead(uint32_t level, struct io_request *requests, uint32_t no_of_requests);
+	void diskWrite(uint32_t level, uint64_t offset, unsigned char *data, uint32_t size);
+	void flushCache();
+
+	//DIRECT_IO_MODE : Logical block size the records are padded to (0 without direct I/O).
+	//The records of the last downloaded path are kept in the aligned direct_path buffer,
+	//so that uploadPath can patch them and write them back whole without reading them again.
+	uint32_t io_block_size;
+	unsigned char *direct_path;
+	uint32_t direct_path_leaf;
+	uint32_t direct_path_level;
+	unsigned char *direct_scratch;
+
+	//DIRTY_TRACKING : One bit per bucket label of each tree, set by uploads since the last snapshot
+	uint8_t **dirty_bitmap_l;
+	uint32_t snapshot_epoch;
+
+	void setupDirtyTracking();
+	void markDirty(uint32_t level, uint32_t bucket_no);
+
+	//WAL_MODE : Undo log of the disk backend, records of the current group are buffered in wal_buffer.
+	//wal_logged_l has one bit per wal_unit bytes of each tree file, set once the unit's before-image is in the log,
+	//and logging is armed once there is a checkpoint to roll back to (wal_epoch)
+	int wal_fd;
+	bool wal_armed;
+	uint32_t wal_unit;
+	uint8_t **wal_logged_l;
+	unsigned char *wal_buffer;
+	uint64_t wal_buffer_size;
+	uint64_t wal_buffer_capacity;
+	unsigned char *wal_scratch;
+	uint64_t wal_scratch_size;
+	uint32_t wal_epoch;
+	uint32_t wal_group;
+	uint32_t wal_group_accesses;
+	uint64_t wal_log_size;
+
+	void openWAL();
+	void walAppend(uint32_t type, uint32_t index, uint64_t offset, unsigned char *data, uint32_t size);
+	void walLogBefore(uint32_t index, uint64_t offset, uint64_t size);
+	void walLogCache();
+	void walCommit();
+	void walReset();
+	uint64_t recoverWAL();
+
+	void readPathRecords(uint32_t leafLabel, uint32_t level, uint32_t D_lev);
+	void hashBlock(uint32_t bucket_no, uint32_t level, uint64_t *offset, uint32_t *length);
+	void readBlock(uint32_t level, uint64_t offset, uint32_t length, unsigned char *block);
+	void patchBlock(uint32_t level, uint64_t offset, uint32_t length, uint64_t at, unsigned char *data, uint32_t size);
+
+	//INLINE_HASH_LAYOUT : Node addressing within the record tree of a level
+	struct tree_layout *layout_l;
+	uint32_t sizeForLevel(uint32_t level);
+	unsigned char* treeBase(uint32_t level);
+	void setupLayout(uint32_t index, uint32_t D_level, uint32_t size_for_level);
+	uint64_t recordOffset(uint32_t bucket_no, uint32_t level);
+	uint64_t bucketOffset(uint32_t bucket_no, uint32_t level);
+	uint64_t hashOffset(uint32_t bucket_no, uint32_t level);
+	uint8_t uploadPathRecords(unsigned char *path, uint32_t leafLabel, unsigned char *path_hash, uint32_t level, uint32_t D_level, uint32_t size_for_level);
+	unsigned char* downloadPathRecords(unsigned char* path, uint32_t leafLabel, unsigned char *path_hash, uint32_t level, uint32_t D_lev, uint32_t size_for_level);
+	void readRecords(uint32_t level, uint32_t first_label, uint32_t count, unsigned char *records);
+
 public:
 	LocalStorage();
+	LocalStorage(uint32_t storage_id);
 	LocalStorage(LocalStorage &ls);
 
 	void connect();
 	void fetchHash(uint32_t objectKey, unsigned char* hash_buffer, uint32_t hashsize, uint32_t recursion_level);
 	uint8_t uploadObject(unsigned char *serialized_bucket, uint32_t objectKey, unsigned char* hash, uint32_t hashsize, uint32_t size_for_level, uint32_t recursion_level);
-	unsigned char* downloadObject(unsigned char* data, uint32_t objectKey, unsigned char *hash, uint32_t hashsize,uint32_t level, uint32_t D_lev);
+	unsigned char* downloadObject(unsigned char* data, uint32_t objectKey, unsigned char *hash, uint32_t hashsize, uint32_t size_for_level, uint32_t recursion_level);
 	uint8_t uploadPath(unsigned char *serialized_path, uint32_t leafLabel, unsigned char *path_hash,uint32_t level, uint32_t D_level);
 	unsigned char* downloadPath(unsigned char* data, uint32_t leafLabel, unsigned char *path_hash, uint32_t path_hash_size, uint32_t level, uint32_t D);
-	void setParams(uint32_t maxBlocks, uint32_t D, uint32_t Z, uint32_t stashSize, uint32_t dataSize, bool inmem, uint32_t recursion_block_size, int8_t recursion_levels);
-	void saveState(unsigned char *posmap, uint32_t posmap_size, unsigned char *stash, uint32_t stashSize, unsigned char* merkle_root, uint32_t hash_and_key_size);
-	void savePosmapMerkleRoot(unsigned char* posmap_serialized, uint32_t posmap_size, unsigned char* merkle_root_and_aes_key, uint32_t hash_and_key_size);
-	void saveStashLevel(unsigned char *stash, uint32_t stash_size, uint32_t level);	
-	int8_t restoreState(uint32_t *posmap, uint32_t posmap_size, uint32_t *stash, uint32_t *stashSize, unsigned char* merkle_root, uint32_t hash_and_key_size);
-	void restorePosmap(uint32_t* posmap, uint32_t size);
-	void restoreMerkle(unsigned char* merkle, uint32_t size);
+	void setParams(uint32_t maxBlocks, uint32_t D, uint32_t Z, uint32_t stashSize, uint32_t dataSize, uint8_t backend, uint32_t recursion_block_size, int8_t recursion_levels, uint64_t cache_budget);
+	int32_t levelDepth(uint32_t level);
+	void resumeFrom(uint32_t checkpoint_storage_id, uint32_t epoch);
+	void checkpointed(uint32_t epoch);
+	void serveLevels(uint32_t first_level, uint32_t last_level);
+	void syncStorage();
+	void endAccess();
+	void closeStorage();
+	bool auditRange(uint32_t level, uint32_t first_label, uint32_t count, unsigned char *buckets, unsigned char *hashes, unsigned char *child_hashes, uint32_t size_for_level);
+	bool directTree(uint32_t level, struct direct_tree *tree);
+	int64_t writeSnapshot(std::string snapshot_directory);
+	bool applySnapshot(std::string snapshot_file);
 
 	void deleteObject();
 	void copyObject();
@@ -0,0 +1,161 @@
+/*
+*    ZeroTrace: Oblivious Memory Primitives from Intel SGX
+*    Copyright (C) 2018  Sajin (sshsshy)
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU General Public License as published by
+*    the Free Software Foundation, version 3 of the License.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU General Public License for more details.
+*
+*    You should have received a copy of the GNU General Public License
+*    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+NUMA.cpp
+*/
+
+#include "NUMA.hpp"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <linux/mempolicy.h>
+#include <string>
+#include <fstream>
+
+#define NUMA_MAX_NODES 64
+//#define DEBUG_NUMA 1
+
+//Highest node in a sysfs list such as "0-1" or "0,2-3"
+static int32_t lastInList(std::string list) {
+	size_t pos = list.find_last_of(",-");
+	if(pos != std::string::npos)
+		list = list.substr(pos+1);
+	return atoi(list.c_str());
+}
+
+uint32_t numaNoOfNodes() {
+	std::ifstream online("/sys/devices/system/node/online");
+	std::string list;
+	if(!getline(online, list))
+		return 1;
+	uint32_t no_of_nodes = lastInList(list) + 1;
+	return (no_of_nodes > NUMA_MAX_NODES) ? NUMA_MAX_NODES : no_of_nodes;
+}
+
+int32_t numaNodeOfThread() {
+	unsigned int cpu, node;
+	if(syscall(SYS_getcpu, &cpu, &node, NULL) != 0)
+		return 0;
+	return (int32_t) node;
+}
+
+static uint64_t roundToPages(uint64_t size) {
+	uint64_t page_size = sysconf(_SC_PAGESIZE);
+	return ((size + page_size - 1) / page_size) * page_size;
+}
+
+/*
+numaPlace() - Sets the memory policy of buffer, pages already faulted in are migrated.
+
+Meant to be called right after the buffer is mapped, before the first touch, so that the pages
+are allocated on the right node to begin with. buffer has to be page aligned and the pages it spans
+(size rounded up to whole pages) must belong to it alone, i.e. a mapping of its own such as numaAlloc() returns,
+since the policy applies to whole pages and would otherwise move neighbouring allocations along.
+*/
+void numaPlace(void *buffer, uint64_t size, uint8_t policy, int32_t node) {
+	uint32_t no_of_nodes = numaNoOfNodes();
+	if(policy == NUMA_NONE || no_of_nodes <= 1 || buffer == NULL || size == 0)
+		return;
+	if((uint64_t) buffer % sysconf(_SC_PAGESIZE) != 0) {
+		printf("NUMA : %f MB buffer is not page aligned, left unplaced\n", float(size)/float(1024*1024));
+		return;
+	}
+
+	unsigned long nodemask = 0;
+	int mode;
+	if(policy == NUMA_BIND) {
+		nodemask = 1UL << node;
+		mode = MPOL_PREFERRED;
+	}
+	else {
+		for(uint32_t i = 0;i < no_of_nodes;i++)
+			nodemask|= 1UL << i;
+		mode = MPOL_INTERLEAVE;
+	}
+
+	if(syscall(SYS_mbind, buffer, roundToPages(size), mode, &nodemask, (unsigned long) NUMA_MAX_NODES + 1, MPOL_MF_MOVE) != 0)
+		printf("NUMA : mbind of %f MB failed\n", float(size)/float(1024*1024));
+
+	#ifdef DEBUG_NUMA
+		printf("NUMA : %f MB %s node %d\n", float(size)/float(1024*1024), (policy == NUMA_BIND) ? "preferring" : "interleaved, from", node);
+	#endif
+}
+
+/*
+numaAlloc() - A zero filled anonymous mapping of its own for size bytes, aligned to alignment (rounded up to the page size),
+placed by policy before anything touches it. Returns NULL if it can't be mapped, release it with numaFree().
+It is mapped MAP_NORESERVE, so pages only cost memory once they are written (see SPARSE_TREES).
+*/
+void* numaAlloc(uint64_t size, uint64_t alignment, uint8_t policy, int32_t node) {
+	uint64_t page_size = sysconf(_SC_PAGESIZE);
+	alignment = (alignment < page_size) ? page_size : ((alignment + page_size - 1) / page_size) * page_size;
+	size = roundToPages(size);
+
+	//Map alignment bytes more than needed, and trim the mapping down to the aligned part
+	unsigned char *map = (unsigned char*) mmap(NULL, size + alignment, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE, -1, 0);
+	if(map == MAP_FAILED)
+		return NULL;
+	unsigned char *buffer = (unsigned char*) ((((uint64_t) map + alignment - 1) / alignment) * alignment);
+	if(buffer > map)
+		munmap(map, buffer - map);
+	if(map + alignment > buffer)
+		munmap(buffer + size, (map + alignment) - buffer);
+
+	numaPlace(buffer, size, policy, node);
+	return buffer;
+}
+
+void numaFree(void *buffer, uint64_t size) {
+	if(buffer != NULL && size > 0)
+		munmap(buffer, roundToPages(size));
+}
+
+//Restricts thread to the CPUs of node
+void numaPinThread(pthread_t thread, int32_t node) {
+	if(node < 0 || numaNoOfNodes() <= 1)
+		return;
+
+	std::ifstream cpulist(("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist").c_str());
+	std::string list;
+	if(!getline(cpulist, list))
+		return;
+
+	//cpulist is a comma separated list of CPUs and CPU ranges
+	cpu_set_t cpus;
+	CPU_ZERO(&cpus);
+	size_t pos = 0;
+	while(pos < list.size()) {
+		size_t next = list.find(',', pos);
+		if(next == std::string::npos)
+			next = list.size();
+		std::string range = list.substr(pos, next - pos);
+		size_t dash = range.find('-');
+		int first = atoi(range.c_str());
+		int last = (dash == std::string::npos) ? first : atoi(range.c_str() + dash + 1);
+		for(int cpu = first;cpu <= last;cpu++)
+			CPU_SET(cpu, &cpus);
+		pos = next + 1;
+	}
+
+	if(pthread_setaffinity_np(thread, sizeof(cpu_set_t), &cpus) != 0)
+		printf("NUMA : Unable to pin thread to node %d\n", node);
+}
@@ -0,0 +1,44 @@
+/*
+*    ZeroTrace: Oblivious Memory Primitives from Intel SGX
+*    Copyright (C) 2018  Sajin (sshsshy)
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU General Public License as published by
+*    the Free Software Foundation, version 3 of the License.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU General Public License for more details.
+*
+*    You should have received a copy of the GNU General Public License
+*    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+NUMA.hpp
+
+Placement of the untrusted storage arrays and I/O threads on NUMA nodes.
+Uses the mbind/getcpu syscalls and sysfs directly, so that no libnuma is needed on the build hosts.
+On a single node system every function is a no-op.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <pthread.h>
+
+//Placement policies for the arrays of an ORAM instance
+#define NUMA_NONE 0
+//Prefer the node of the thread that created the instance (it serves the OCALLs of the instance).
+//This is MPOL_PREFERRED, not MPOL_BIND : once that node runs out of memory, pages come from the other nodes instead of failing.
+#define NUMA_BIND 1
+//Spread the pages round-robin over all nodes
+#define NUMA_INTERLEAVE 2
+
+uint32_t numaNoOfNodes();
+int32_t numaNodeOfThread();
+void numaPlace(void *buffer, uint64_t size, uint8_t policy, int32_t node);
+void* numaAlloc(uint64_t size, uint64_t alignment, uint8_t policy, int32_t node);
+void numaFree(void *buffer, uint64_t size);
+void numaPinThread(pthread_t thread, int32_t node);
@@ -0,0 +1,440 @@
+/*
+*    ZeroTrace: Oblivious Memory Primitives from Intel SGX
+*    Copyright (C) 2018  Sajin (sshsshy)
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU General Public License as published by
+*    the Free Software Foundation, version 3 of the License.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU General Public License for more details.
+*
+*    You should have received a copy of the GNU General Public License
+*    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+ObjectStorage.cpp
+*/
+
+#include "ObjectStorage.hpp"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define HASH_LENGTH 32
+//#define DEBUG_OS 1
+
+std::string object_store = "dir:/mnt/Storage/objects/";
+
+//Depth of a node in its tree, the root being at depth 0
+static inline uint32_t nodeDepth(uint32_t bucket_no) {
+	return 31 - __builtin_clz(bucket_no);
+}
+
+static void *objectWorker(void *arg) {
+	return ((ObjectStorage*) arg)->worker();
+}
+
+ObjectStorage::ObjectStorage(uint32_t p_storage_id) {
+	storage_id = p_storage_id;
+	Z = 0;
+	dataSize = 0;
+	recursionBlockSize = 0;
+	recursion_levels = -1;
+	depth_l = NULL;
+	store = NULL;
+	for(uint32_t i = 0;i < OBJECT_HELD_PATHS;i++) {
+		held_paths[i].objects = NULL;
+		held_paths[i].valid = false;
+	}
+	held_next = 0;
+	threads = NULL;
+	stop = false;
+	batch = NULL;
+	batch_next = batch_count = batch_pending = 0;
+	pthread_mutex_init(&lock, NULL);
+	pthread_cond_init(&work_available, NULL);
+	pthread_cond_init(&work_done, NULL);
+}
+
+uint32_t ObjectStorage::treeIndex(uint32_t level) {
+	return ((int32_t) level==-1) ? 0 : level;
+}
+
+uint32_t ObjectStorage::sizeForLevel(uint32_t level) {
+	if((int32_t) level==-1 || (int32_t) level==recursion_levels)
+		return dataSize;
+	return recursionBlockSize;
+}
+
+uint32_t ObjectStorage::recordSize(uint32_t level) {
+	return 2*HASH_LENGTH + Z*sizeForLevel(level);
+}
+
+uint32_t ObjectStorage::subtreeRoot(uint32_t bucket_no, uint32_t level) {
+	uint32_t d = nodeDepth(bucket_no);
+	return bucket_no >> (d % OBJECT_SUBTREE_HEIGHT);
+}
+
+std::string ObjectStorage::objectKey(uint32_t root, uint32_t level) {
+	return std::to_string(treeIndex(level)) + "_" + std::to_string(root);
+}
+
+//The last layer of a tree is cut short when D+1 is not a multiple of OBJECT_SUBTREE_HEIGHT
+uint64_t ObjectStorage::objectSize(uint32_t root, uint32_t level) {
+	uint32_t d0 = nodeDepth(root);
+	uint32_t height = depth_l[treeIndex(level)] + 1 - d0;
+	if(height > OBJECT_SUBTREE_HEIGHT)
+		height = OBJECT_SUBTREE_HEIGHT;
+	return ((root==1) ? HASH_LENGTH : 0) + (uint64_t)((1<<height) - 1) * recordSize(level);
+}
+
+//Offset of the record of bucket_no within the object of its subtree
+uint64_t ObjectStorage::recordOffset(uint32_t bucket_no, uint32_t level) {
+	uint32_t root = subtreeRoot(bucket_no, level);
+	uint32_t local_depth = nodeDepth(bucket_no) - nodeDepth(root);
+	uint32_t local_index = (1<<local_depth) + (bucket_no - (root<<local_depth));
+	return ((root==1) ? HASH_LENGTH : 0) + (uint64_t)(local_index - 1) * recordSize(level);
+}
+
+/*
+ObjectStorage::cachedObject() - the object of subtree root, out of object_cache (fetched on a miss)
+
+Once OBJECT_CACHE_LIMIT objects are held, they are all written back (the dirty ones) and dropped first,
+so a pointer returned earlier is only good up to the next call.
+*/
+unsigned char* ObjectStorage::cachedObject(uint32_t root, uint32_t level, bool modify) {
+	std::string key = objectKey(root, level);
+	uint64_t size = objectSize(root, level);
+	std::map<std::string, unsigned char*>::iterator it = object_cache.find(key);
+	unsigned char *object;
+	if(it != object_cache.end()) {
+		object = it->second;
+	}
+	else {
+		if(object_cache.size() >= OBJECT_CACHE_LIMIT)
+			flushObjects();
+		object = (unsigned char*) malloc(size);
+		store->get(key, object, size);
+		object_cache[key] = object;
+	}
+	if(modify)
+		object_dirty[key] = size;
+	return object;
+}
+
+/*
+ObjectStorage::hashSlot() - where the hash of bucket_no is kept
+
+In front of the records of the root object for the root, else the L or R slot of the parent's record.
+objects holds the objects of a path (one per layer) or is NULL to go through object_cache.
+*/
+unsigned char* ObjectStorage::hashSlot(uint32_t bucket_no, uint32_t level, unsigned char **objects, bool modify) {
+	if(bucket_no==1)
+		return objects ? objects[0] : cachedObject(1, level, modify);
+	uint32_t parent = bucket_no>>1;
+	unsigned char *object = objects ? objects[nodeDepth(parent)/OBJECT_SUBTREE_HEIGHT] : cachedObject(subtreeRoot(parent, level), level, modify);
+	return object + recordOffset(parent, level) + ((bucket_no%2==0) ? 0 : (HASH_LENGTH + Z*sizeForLevel(level)));
+}
+
+void ObjectStorage::flushObjects() {
+	uint32_t no_of_requests = object_dirty.size();
+	struct object_request *requests = new struct object_request[no_of_requests];
+	uint32_t i = 0;
+	for(std::map<std::string, uint64_t>::iterator it = object_dirty.begin(); it != object_dirty.end(); it++, i++) {
+		requests[i].key = it->first;
+		requests[i].data = object_cache[it->first];
+		requests[i].size = it->second;
+		requests[i].put = true;
+	}
+	runBatch(requests, no_of_requests);
+	delete[] requests;
+
+	for(std::map<std::string, unsigned char*>::iterator it = object_cache.begin(); it != object_cache.end(); it++)
+		free(it->second);
+	object_cache.clear();
+	object_dirty.clear();
+}
+
+void *ObjectStorage::worker() {
+	pthread_mutex_lock(&lock);
+	while(1) {
+		while(!stop && batch_next == batch_count)
+			pthread_cond_wait(&work_available, &lock);
+		if(stop)
+			break;
+		struct object_request *request = &(batch[batch_next++]);
+		pthread_mutex_unlock(&lock);
+
+		if(request->put)
+			store->put(request->key, request->data, request->size);
+		else
+			store->get(request->key, request->data, request->size);
+
+		pthread_mutex_lock(&lock);
+		if(--batch_pending == 0)
+			pthread_cond_signal(&work_done);
+	}
+	pthread_mutex_unlock(&lock);
+	return NULL;
+}
+
+//Issues all requests in parallel over the pool and waits for them, a single request is issued right away
+void ObjectStorage::runBatch(struct object_request *requests, uint32_t no_of_requests) {
+	if(no_of_requests == 0)
+		return;
+	if(no_of_requests == 1) {
+		if(requests[0].put)
+			store->put(requests[0].key, requests[0].data, requests[0].size);
+		else
+			store->get(requests[0].key, requests[0].data, requests[0].size);
+		return;
+	}
+
+	pthread_mutex_lock(&lock);
+	batch = requests;
+	batch_next = 0;
+	batch_count = no_of_requests;
+	batch_pending = no_of_requests;
+	pthread_cond_broadcast(&work_available);
+	while(batch_pending)
+		pthread_cond_wait(&work_done, &lock);
+	batch = NULL;
+	batch_next = batch_count = 0;
+	pthread_mutex_unlock(&lock);
+}
+
+//Held path of leafLabel of level, OBJECT_HELD_PATHS if its objects aren't held
+uint32_t ObjectStorage::heldPath(uint32_t leafLabel, uint32_t level) {
+	for(uint32_t i = 0;i < OBJECT_HELD_PATHS;i++) {
+		if(held_paths[i].valid && held_paths[i].leaf == leafLabel && held_paths[i].level == level)
+			return i;
+	}
+	return OBJECT_HELD_PATHS;
+}
+
+//Single-bucket operations go through object_cache, so the objects of the held paths may no longer be those of the store
+void ObjectStorage::dropPaths() {
+	for(uint32_t i = 0;i < OBJECT_HELD_PATHS;i++)
+		held_paths[i].valid = false;
+}
+
+//GETs the objects of every layer the path to leafLabel passes through into a held path (the oldest one), returns which
+uint32_t ObjectStorage::fetchPath(uint32_t leafLabel, uint32_t level, uint32_t D_level) {
+	//Objects held back by single-bucket operations have to reach the store before the path is read
+	if(!object_cache.empty())
+		flushObjects();
+
+	uint32_t held = heldPath(leafLabel, level);
+	if(held == OBJECT_HELD_PATHS) {
+		held = held_next;
+		held_next = (held_next + 1) % OBJECT_HELD_PATHS;
+	}
+	uint32_t no_of_layers = (D_level / OBJECT_SUBTREE_HEIGHT) + 1;
+	struct object_request *requests = new struct object_request[no_of_layers];
+	for(uint32_t k = 0;k < no_of_layers;k++) {
+		uint32_t root = leafLabel >> (D_level - k*OBJECT_SUBTREE_HEIGHT);
+		requests[k].key = objectKey(root, level);
+		requests[k].data = held_paths[held].objects[k];
+		requests[k].size = objectSize(root, level);
+		requests[k].put = false;
+	}
+	runBatch(requests, no_of_layers);
+	delete[] requests;
+
+	held_paths[held].leaf = leafLabel;
+	held_paths[held].level = level;
+	held_paths[held].D_level = D_level;
+	held_paths[held].valid = true;
+	return held;
+}
+
+void ObjectStorage::setParams(uint32_t maxBlocks, uint32_t set_D, uint32_t set_Z, uint32_t stashSize, uint32_t dataSize_p, uint8_t backend_p, uint32_t recursion_block_size, int8_t recursion_levels_p, uint64_t cache_budget) {
+	Z = set_Z;
+	dataSize = dataSize_p;
+	recursionBlockSize = recursion_block_size;
+	recursion_levels = recursion_levels_p;
+
+	uint32_t no_of_trees = (recursion_levels==-1) ? 1 : (recursion_levels+1);
+	depth_l = (uint32_t*) malloc(no_of_trees * sizeof(uint32_t));
+	treeDepths(maxBlocks, Z, recursion_block_size, recursion_levels, depth_l);
+
+	char *address = getenv("ZT_OBJECT_STORE");
+	if(address != NULL)
+		object_store = address;
+	if(object_store[object_store.size()-1] != '/')
+		object_store.append("/");
+	std::string instance = std::to_string(storage_id) + "_" + std::to_string(maxBlocks) + "_" + std::to_string(dataSize) + "_" + std::to_string(stashSize);
+	store = openObjectStore(object_store + instance);
+	if(store == NULL)
+		exit(0);
+	//Object-store trees aren't checkpointed (ZT_Checkpoint), every instance starts from an empty store
+	store->clear();
+
+	//One object per layer of the deepest tree, the largest records are those of the data level
+	uint32_t max_D = 0;
+	for(uint32_t i = 0;i < no_of_trees;i++)
+		if(depth_l[i] > max_D)
+			max_D = depth_l[i];
+	uint32_t max_record = 2*HASH_LENGTH + Z*((dataSize > recursionBlockSize) ? dataSize : recursionBlockSize);
+	uint32_t no_of_layers = (max_D / OBJECT_SUBTREE_HEIGHT) + 1;
+	for(uint32_t i = 0;i < OBJECT_HELD_PATHS;i++) {
+		held_paths[i].objects = (unsigned char**) malloc(no_of_layers * sizeof(unsigned char*));
+		for(uint32_t k = 0;k < no_of_layers;k++)
+			held_paths[i].objects[k] = (unsigned char*) malloc(HASH_LENGTH + (uint64_t)((1<<OBJECT_SUBTREE_HEIGHT) - 1) * max_record);
+		held_paths[i].valid = false;
+	}
+	held_next = 0;
+
+	threads = (pthread_t*) malloc(OBJECT_IO_THREADS * sizeof(pthread_t));
+	for(uint32_t i = 0;i < OBJECT_IO_THREADS;i++)
+		pthread_create(&(threads[i]), NULL, objectWorker, this);
+
+	printf("OS : Instance %d kept in object store %s, %d levels per object\n", storage_id, (object_store + instance).c_str(), OBJECT_SUBTREE_HEIGHT);
+}
+
+void ObjectStorage::fetchHash(uint32_t objectKey, unsigned char* hash, uint32_t hashsize, uint32_t recursion_level) {
+	dropPaths();
+	memcpy(hash, hashSlot(objectKey, recursion_level, NULL, false), HASH_LENGTH);
+}
+
+uint8_t ObjectStorage::uploadObject(unsigned char *data, uint32_t objectKey, unsigned char *hash, uint32_t hashsize, uint32_t size_for_level, uint32_t recursion_level) {
+	dropPaths();
+	unsigned char *object = cachedObject(subtreeRoot(objectKey, recursion_level), recursion_level, true);
+	memcpy(object + recordOffset(objectKey, recursion_level) + HASH_LENGTH, data, Z*size_for_level);
+	memcpy(hashSlot(objectKey, recursion_level, NULL, true), hash, HASH_LENGTH);
+	return 1;
+}
+
+unsigned char* ObjectStorage::downloadObject(unsigned char* data, uint32_t objectKey, unsigned char *hash, uint32_t hashsize, uint32_t size_for_level, uint32_t recursion_level) {
+	dropPaths();
+	unsigned char *object = cachedObject(subtreeRoot(objectKey, recursion_level), recursion_level, false);
+	memcpy(data, object + recordOffset(objectKey, recursion_level) + HASH_LENGTH, Z*size_for_level);
+	memcpy(hash, hashSlot(objectKey, recursion_level, NULL, false), HASH_LENGTH);
+	return data;
+}
+
+/*
+ObjectStorage::uploadPath() - writes back a path downloaded earlier
+
+The buckets and hashes are patched into the objects held since downloadPath (fetched again only if OBJECT_HELD_PATHS
+other paths or an object were accessed since), and every object is PUT whole, all layers in parallel.
+The held paths that share an object with this one get its new contents.
+*/
+uint8_t ObjectStorage::uploadPath(unsigned char *path, uint32_t leafLabel, unsigned char *path_hash, uint32_t level, uint32_t D_level) {
+	uint32_t bucket_bytes = Z*sizeForLevel(level);
+	uint32_t held = heldPath(leafLabel, level);
+	if(held == OBJECT_HELD_PATHS)
+		held = fetchPath(leafLabel, level, D_level);
+	unsigned char **objects = held_paths[held].objects;
+
+	uint32_t temp = leafLabel;
+	unsigned char *path_iter = path;
+	unsigned char *path_hash_iter = path_hash;
+	for(uint32_t i = 0;i < D_level+1;i++) {
+		unsigned char *object = objects[nodeDepth(temp)/OBJECT_SUBTREE_HEIGHT];
+		memcpy(object + recordOffset(temp, level) + HASH_LENGTH, path_iter, bucket_bytes);
+		#ifndef PASSIVE_ADVERSARY
+			memcpy(hashSlot(temp, level, objects, false), path_hash_iter, HASH_LENGTH);
+		#endif
+		path_iter+=bucket_bytes;
+		path_hash_iter+=HASH_LENGTH;
+		temp = temp>>1;
+	}
+
+	uint32_t no_of_layers = (D_level / OBJECT_SUBTREE_HEIGHT) + 1;
+	struct object_request *requests = new struct object_request[no_of_layers];
+	for(uint32_t k = 0;k < no_of_layers;k++) {
+		uint32_t root = leafLabel >> (D_level - k*OBJECT_SUBTREE_HEIGHT);
+		requests[k].key = objectKey(root, level);
+		requests[k].data = objects[k];
+		requests[k].size = objectSize(root, level);
+		requests[k].put = true;
+	}
+	runBatch(requests, no_of_layers);
+	delete[] requests;
+
+	for(uint32_t i = 0;i < OBJECT_HELD_PATHS;i++) {
+		if(i == held || !held_paths[i].valid || held_paths[i].level != level)
+			continue;
+		for(uint32_t k = 0;k < no_of_layers;k++) {
+			uint32_t root = leafLabel >> (D_level - k*OBJECT_SUBTREE_HEIGHT);
+			if((held_paths[i].leaf >> (D_level - k*OBJECT_SUBTREE_HEIGHT)) != root)
+				break;
+			memcpy(held_paths[i].objects[k], objects[k], objectSize(root, level));
+		}
+	}
+	return 1;
+}
+
+/*
+ObjectStorage::downloadPath() - returns requested path in *path
+
+Requested path is returned leaf to root, path_hash gets the <L,R> pair of every node below the root
+(out of the record of its parent) and then the root hash, as LocalStorage::downloadPath returns them.
+*/
+unsigned char* ObjectStorage::downloadPath(unsigned char* path, uint32_t leafLabel, unsigned char *path_hash, uint32_t path_hash_size, uint32_t level, uint32_t D_lev) {
+	uint32_t bucket_bytes = Z*sizeForLevel(level);
+	unsigned char **objects = held_paths[fetchPath(leafLabel, level, D_lev)].objects;
+
+	uint32_t temp = leafLabel;
+	unsigned char *path_iter = path;
+	unsigned char *pair_iter = path_hash;
+	for(uint32_t i = 0;i < D_lev+1;i++) {
+		unsigned char *record = objects[nodeDepth(temp)/OBJECT_SUBTREE_HEIGHT] + recordOffset(temp, level);
+		memcpy(path_iter, record + HASH_LENGTH, bucket_bytes);
+		#ifndef PASSIVE_ADVERSARY
+			if(i!=0) {
+				memcpy(pair_iter, record, HASH_LENGTH);
+				memcpy(pair_iter + HASH_LENGTH, record + HASH_LENGTH + bucket_bytes, HASH_LENGTH);
+				pair_iter+=(2*HASH_LENGTH);
+			}
+			if(temp==1)
+				memcpy(pair_iter, objects[0], HASH_LENGTH);
+		#endif
+		path_iter+=bucket_bytes;
+		temp = temp>>1;
+	}
+
+	#ifdef DEBUG_OS
+		printf("OS : downloadPath leaf = %d, level = %d, %d objects\n", leafLabel, level, (D_lev / OBJECT_SUBTREE_HEIGHT) + 1);
+	#endif
+	return path;
+}
+
+void ObjectStorage::syncStorage() {
+	if(!object_cache.empty())
+		flushObjects();
+}
+
+void ObjectStorage::closeStorage() {
+	syncStorage();
+
+	pthread_mutex_lock(&lock);
+	stop = true;
+	pthread_cond_broadcast(&work_available);
+	pthread_mutex_unlock(&lock);
+	for(uint32_t i = 0;i < OBJECT_IO_THREADS;i++)
+		pthread_join(threads[i], NULL);
+	free(threads);
+	threads = NULL;
+
+	uint32_t max_D = 0;
+	uint32_t no_of_trees = (recursion_levels==-1) ? 1 : (recursion_levels+1);
+	for(uint32_t i = 0;i < no_of_trees;i++)
+		if(depth_l[i] > max_D)
+			max_D = depth_l[i];
+	for(uint32_t i = 0;i < OBJECT_HELD_PATHS;i++) {
+		for(uint32_t k = 0;k < (max_D / OBJECT_SUBTREE_HEIGHT) + 1;k++)
+			free(held_paths[i].objects[k]);
+		free(held_paths[i].objects);
+		held_paths[i].objects = NULL;
+		held_paths[i].valid = false;
+	}
+	free(depth_l);
+	delete store;
+	store = NULL;
+}
@@ -0,0 +1,123 @@
+/*
+*    ZeroTrace: Oblivious Memory Primitives from Intel SGX
+*    Copyright (C) 2018  Sajin (sshsshy)
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU General Public License as published by
+*    the Free Software Foundation, version 3 of the License.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU General Public License for more details.
+*
+*    You should have received a copy of the GNU General Public License
+*    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+ObjectStorage.hpp
+
+BACKEND_OBJECT : the trees of an instance are kept in an object store (see ObjectStore.hpp),
+named by object_store ("dir:<directory>", overridden by the ZT_OBJECT_STORE environment variable).
+
+Every tree is cut into layers of OBJECT_SUBTREE_HEIGHT levels, and every subtree of a layer is one object,
+so a path touches ceil((D+1)/OBJECT_SUBTREE_HEIGHT) objects, which are all fetched (and written back) in parallel.
+Within an object the nodes are records <hash(left child) | bucket | hash(right child)> in heap order, like the
+INLINE_HASH_LAYOUT of LocalStorage : the <L,R> pair of a path node is held by its parent, which is on the path too.
+The object of the root has the root hash in front of its records. Objects that were never written read as zeros
+(trees start sparse). Keys are "<tree>_<label of the subtree root>", in a store of the instance of its own.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <map>
+#include <pthread.h>
+#include "Storage.hpp"
+#include "ObjectStore.hpp"
+
+#define OBJECT_SUBTREE_HEIGHT 4
+#define OBJECT_IO_THREADS 8
+//Objects touched by single-bucket operations (the build) are held back and written in parallel batches of this many
+#define OBJECT_CACHE_LIMIT 256
+//Paths whose objects are kept after their download, BATCH_PATHS (Globals_Enclave.hpp) fetches the three paths of a
+//CircuitORAM level before it writes any of them back
+#define OBJECT_HELD_PATHS 3
+
+struct object_request {
+	std::string key;
+	unsigned char *data;
+	uint64_t size;
+	bool put;
+};
+
+struct held_path {
+	//One object per layer
+	unsigned char **objects;
+	uint32_t leaf;
+	uint32_t level;
+	uint32_t D_level;
+	bool valid;
+};
+
+extern std::string object_store;
+
+class ObjectStorage : public Storage
+{
+private:
+	uint32_t storage_id;
+	uint32_t Z;
+	uint32_t dataSize;
+	uint32_t recursionBlockSize;
+	int32_t recursion_levels;
+	uint32_t *depth_l;
+	ObjectStore *store;
+
+	//Objects of the last OBJECT_HELD_PATHS downloaded paths, so that their write-backs need no GETs. They are kept
+	//equal to the store : a write-back copies the objects it PUTs into the other held paths that share them
+	struct held_path held_paths[OBJECT_HELD_PATHS];
+	uint32_t held_next;
+
+	//Objects read/modified by uploadObject/downloadObject/fetchHash, keyed by object key
+	std::map<std::string, unsigned char*> object_cache;
+	std::map<std::string, uint64_t> object_dirty;
+
+	//Pool issuing the GETs/PUTs of a batch in parallel
+	pthread_t *threads;
+	pthread_mutex_t lock;
+	pthread_cond_t work_available;
+	pthread_cond_t work_done;
+	bool stop;
+	struct object_request *batch;
+	uint32_t batch_next, batch_count, batch_pending;
+
+	uint32_t treeIndex(uint32_t level);
+	uint32_t sizeForLevel(uint32_t level);
+	uint32_t recordSize(uint32_t level);
+	uint32_t subtreeRoot(uint32_t bucket_no, uint32_t level);
+	std::string objectKey(uint32_t root, uint32_t level);
+	uint64_t objectSize(uint32_t root, uint32_t level);
+	uint64_t recordOffset(uint32_t bucket_no, uint32_t level);
+	unsigned char* cachedObject(uint32_t root, uint32_t level, bool modify);
+	unsigned char* hashSlot(uint32_t bucket_no, uint32_t level, unsigned char **objects, bool modify);
+	void flushObjects();
+	void runBatch(struct object_request *requests, uint32_t no_of_requests);
+	uint32_t heldPath(uint32_t leafLabel, uint32_t level);
+	void dropPaths();
+	uint32_t fetchPath(uint32_t leafLabel, uint32_t level, uint32_t D_level);
+
+public:
+	ObjectStorage(uint32_t storage_id);
+	void *worker();
+
+	void setParams(uint32_t maxBlocks, uint32_t D, uint32_t Z, uint32_t stashSize, uint32_t dataSize, uint8_t backend, uint32_t recursion_block_size, int8_t recursion_levels, uint64_t cache_budget);
+	void fetchHash(uint32_t objectKey, unsigned char* hash_buffer, uint32_t hashsize, uint32_t recursion_level);
+	uint8_t uploadObject(unsigned char *serialized_bucket, uint32_t objectKey, unsigned char* hash, uint32_t hashsize, uint32_t size_for_level, uint32_t recursion_level);
+	unsigned char* downloadObject(unsigned char* data, uint32_t objectKey, unsigned char *hash, uint32_t hashsize, uint32_t size_for_level, uint32_t recursion_level);
+	uint8_t uploadPath(unsigned char *serialized_path, uint32_t leafLabel, unsigned char *path_hash, uint32_t level, uint32_t D_level);
+	unsigned char* downloadPath(unsigned char* data, uint32_t leafLabel, unsigned char *path_hash, uint32_t path_hash_size, uint32_t level, uint32_t D);
+	void syncStorage();
+	void closeStorage();
+};
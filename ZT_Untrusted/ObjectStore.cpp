@@ -0,0 +1,122 @@
+/*
+*    ZeroTrace: Oblivious Memory Primitives from Intel SGX
+*    Copyright (C) 2018  Sajin (sshsshy)
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU General Public License as published by
+*    the Free Software Foundation, version 3 of the License.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU General Public License for more details.
+*
+*    You should have received a copy of the GNU General Public License
+*    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+ObjectStore.cpp
+*/
+
+#include "ObjectStore.hpp"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+//Objects are kept in files named <key>.object, PUTs go through <key>.object.put
+#define OBJECT_SUFFIX ".object"
+#define PUT_SUFFIX ".object.put"
+
+//Creates directory and any missing parents
+static bool makeDirectories(std::string directory) {
+	for(size_t slash = directory.find('/', 1); slash != std::string::npos; slash = directory.find('/', slash+1)) {
+		if(mkdir(directory.substr(0, slash).c_str(), 0755) != 0 && errno != EEXIST)
+			return false;
+	}
+	return true;
+}
+
+static bool endsWith(std::string name, const char *suffix) {
+	size_t length = strlen(suffix);
+	return name.size() > length && name.compare(name.size() - length, length, suffix) == 0;
+}
+
+DirectoryObjectStore::DirectoryObjectStore(std::string p_directory) {
+	directory = p_directory;
+	if(directory[directory.size()-1] != '/')
+		directory.append("/");
+	if(!makeDirectories(directory))
+		printf("OS : Failed to create object directory %s\n", directory.c_str());
+}
+
+bool DirectoryObjectStore::get(std::string key, unsigned char *data, uint64_t size) {
+	int fd = open((directory + key + OBJECT_SUFFIX).c_str(), O_RDONLY);
+	if(fd == -1) {
+		memset(data, 0, size);
+		return false;
+	}
+
+	uint64_t done = 0;
+	while(done < size) {
+		ssize_t got = pread(fd, data + done, size - done, done);
+		if(got <= 0)
+			break;
+		done+= got;
+	}
+	if(done < size)
+		memset(data + done, 0, size - done);
+	close(fd);
+	return true;
+}
+
+bool DirectoryObjectStore::put(std::string key, unsigned char *data, uint64_t size) {
+	std::string object_name = directory + key + OBJECT_SUFFIX;
+	std::string temp_name = directory + key + PUT_SUFFIX;
+	int fd = open(temp_name.c_str(), O_WRONLY|O_CREAT|O_TRUNC, 0644);
+	if(fd == -1) {
+		printf("OS : Failed to create object %s\n", object_name.c_str());
+		return false;
+	}
+
+	uint64_t done = 0;
+	while(done < size) {
+		ssize_t put = pwrite(fd, data + done, size - done, done);
+		if(put <= 0)
+			break;
+		done+= put;
+	}
+	close(fd);
+	if(done < size || rename(temp_name.c_str(), object_name.c_str()) != 0) {
+		printf("OS : Failed to write object %s\n", object_name.c_str());
+		unlink(temp_name.c_str());
+		return false;
+	}
+	return true;
+}
+
+//Only the object files of the store are removed, anything else in its directory is left alone
+void DirectoryObjectStore::clear() {
+	DIR *dir = opendir(directory.c_str());
+	if(dir == NULL)
+		return;
+	struct dirent *entry;
+	while((entry = readdir(dir)) != NULL) {
+		std::string name = entry->d_name;
+		if(endsWith(name, OBJECT_SUFFIX) || endsWith(name, PUT_SUFFIX))
+			unlink((directory + name).c_str());
+	}
+	closedir(dir);
+}
+
+ObjectStore* openObjectStore(std::string address) {
+	if(address.compare(0, 4, "dir:") == 0)
+		return new DirectoryObjectStore(address.substr(4));
+	printf("OS : Unsupported object store %s\n", address.c_str());
+	return NULL;
+}
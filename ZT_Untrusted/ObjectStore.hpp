@@ -0,0 +1,59 @@
+/*
+*    ZeroTrace: Oblivious Memory Primitives from Intel SGX
+*    Copyright (C) 2018  Sajin (sshsshy)
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU General Public License as published by
+*    the Free Software Foundation, version 3 of the License.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU General Public License for more details.
+*
+*    You should have received a copy of the GNU General Public License
+*    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+ObjectStore.hpp
+
+Whole-object GET/PUT against an object store, the transport underneath ObjectStorage.
+Implementations have to allow concurrent calls on different keys, ObjectStorage issues the objects of a path in parallel.
+
+DirectoryObjectStore - local stand-in that keeps every object in a file of its own (<key>.object) under a directory,
+                       a PUT is atomic (written to a temporary and renamed over the object).
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <string>
+
+class ObjectStore
+{
+public:
+	virtual ~ObjectStore() {}
+
+	//Reads object key into data (size bytes), a missing object (or the missing tail of a short one) reads as zeros.
+	//Returns false if the object does not exist.
+	virtual bool get(std::string key, unsigned char *data, uint64_t size) = 0;
+	virtual bool put(std::string key, unsigned char *data, uint64_t size) = 0;
+	//Deletes every object, a new instance starts out with an empty store
+	virtual void clear() = 0;
+};
+
+class DirectoryObjectStore : public ObjectStore
+{
+private:
+	std::string directory;
+
+public:
+	DirectoryObjectStore(std::string directory);
+	bool get(std::string key, unsigned char *data, uint64_t size);
+	bool put(std::string key, unsigned char *data, uint64_t size);
+	void clear();
+};
+
+//Object store named by address, "dir:<directory>" is the only scheme so far
+ObjectStore* openObjectStore(std::string address);
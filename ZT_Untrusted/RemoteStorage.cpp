@@ -0,0 +1,348 @@
+/*
+*    ZeroTrace: Oblivious Memory Primitives from Intel SGX
+*    Copyright (C) 2018  Sajin (sshsshy)
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU General Public License as published by
+*    the Free Software Foundation, version 3 of the License.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU General Public License for more details.
+*
+*    You should have received a copy of the GNU General Public License
+*    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+RemoteStorage.cpp
+*/
+
+#include "RemoteStorage.hpp"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#define HASH_LENGTH 32
+//#define DEBUG_REMOTE 1
+
+std::string storage_server = "unix:/tmp/zt_storage.sock";
+
+//Splits "tcp:<host>:<port>" into host and port, host defaults to localhost
+static void tcpAddress(std::string address, std::string &host, std::string &port) {
+	std::string rest = address.substr(4);
+	size_t colon = rest.rfind(':');
+	if(colon == std::string::npos) {
+		host = "localhost";
+		port = rest;
+	}
+	else {
+		host = rest.substr(0, colon);
+		port = rest.substr(colon+1);
+	}
+	if(host.empty())
+		host = "localhost";
+}
+
+int remoteConnect(std::string address) {
+	int fd = -1;
+	if(address.compare(0, 5, "unix:") == 0) {
+		struct sockaddr_un addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sun_family = AF_UNIX;
+		strncpy(addr.sun_path, address.c_str() + 5, sizeof(addr.sun_path) - 1);
+		fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if(fd != -1 && connect(fd, (struct sockaddr*) &addr, sizeof(addr)) != 0) {
+			close(fd);
+			fd = -1;
+		}
+	}
+	else if(address.compare(0, 4, "tcp:") == 0) {
+		std::string host, port;
+		tcpAddress(address, host, port);
+		struct addrinfo hints, *result, *iter;
+		memset(&hints, 0, sizeof(hints));
+		hints.ai_family = AF_UNSPEC;
+		hints.ai_socktype = SOCK_STREAM;
+		if(getaddrinfo(host.c_str(), port.c_str(), &hints, &result) != 0)
+			return -1;
+		for(iter = result; iter != NULL; iter = iter->ai_next) {
+			fd = socket(iter->ai_family, iter->ai_socktype, iter->ai_protocol);
+			if(fd == -1)
+				continue;
+			if(connect(fd, iter->ai_addr, iter->ai_addrlen) == 0)
+				break;
+			close(fd);
+			fd = -1;
+		}
+		freeaddrinfo(result);
+		//Requests are small and latency bound, don't let Nagle hold them back
+		int one = 1;
+		if(fd != -1)
+			setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	}
+	return fd;
+}
+
+int remoteListen(std::string address) {
+	int fd = -1;
+	if(address.compare(0, 5, "unix:") == 0) {
+		struct sockaddr_un addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sun_family = AF_UNIX;
+		strncpy(addr.sun_path, address.c_str() + 5, sizeof(addr.sun_path) - 1);
+		unlink(addr.sun_path);
+		fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if(fd != -1 && bind(fd, (struct sockaddr*) &addr, sizeof(addr)) != 0) {
+			close(fd);
+			fd = -1;
+		}
+	}
+	else if(address.compare(0, 4, "tcp:") == 0) {
+		std::string host, port;
+		tcpAddress(address, host, port);
+		struct sockaddr_in addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sin_family = AF_INET;
+		addr.sin_addr.s_addr = htonl(INADDR_ANY);
+		addr.sin_port = htons(atoi(port.c_str()));
+		fd = socket(AF_INET, SOCK_STREAM, 0);
+		int one = 1;
+		if(fd != -1)
+			setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+		if(fd != -1 && bind(fd, (struct sockaddr*) &addr, sizeof(addr)) != 0) {
+			close(fd);
+			fd = -1;
+		}
+	}
+	if(fd != -1 && listen(fd, 64) != 0) {
+		close(fd);
+		fd = -1;
+	}
+	return fd;
+}
+
+static bool sendAll(int fd, struct iovec *iov, uint32_t iovcnt) {
+	struct iovec *iter = iov;
+	while(iovcnt) {
+		struct msghdr msg;
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = iter;
+		msg.msg_iovlen = iovcnt;
+		ssize_t sent = sendmsg(fd, &msg, MSG_NOSIGNAL);
+		if(sent <= 0)
+			return false;
+		while(iovcnt && (size_t) sent >= iter->iov_len) {
+			sent-= iter->iov_len;
+			iter++;
+			iovcnt--;
+		}
+		if(iovcnt) {
+			iter->iov_base = (unsigned char*) iter->iov_base + sent;
+			iter->iov_len-= sent;
+		}
+	}
+	return true;
+}
+
+//Writes the header (if any) and both payloads (either can be NULL) with a single sendmsg where possible
+bool remoteSend(int fd, struct remote_request *request, unsigned char *payload, uint32_t payload_size, unsigned char *payload2, uint32_t payload2_size) {
+	struct iovec iov[3];
+	uint32_t iovcnt = 0;
+	if(request != NULL) {
+		iov[iovcnt].iov_base = request;
+		iov[iovcnt++].iov_len = sizeof(struct remote_request);
+	}
+	if(payload != NULL && payload_size) {
+		iov[iovcnt].iov_base = payload;
+		iov[iovcnt++].iov_len = payload_size;
+	}
+	if(payload2 != NULL && payload2_size) {
+		iov[iovcnt].iov_base = payload2;
+		iov[iovcnt++].iov_len = payload2_size;
+	}
+	return sendAll(fd, iov, iovcnt);
+}
+
+bool remoteRead(int fd, void *buffer, uint64_t size) {
+	unsigned char *ptr = (unsigned char*) buffer;
+	while(size) {
+		ssize_t got = read(fd, ptr, size);
+		if(got <= 0)
+			return false;
+		ptr+= got;
+		size-= got;
+	}
+	return true;
+}
+
+RemoteStorage::RemoteStorage(uint32_t p_storage_id) {
+	storage_id = p_storage_id;
+	fd = -1;
+	Z = 0;
+	dataSize = 0;
+	recursionBlockSize = 0;
+	recursion_levels = -1;
+}
+
+uint32_t RemoteStorage::sizeForLevel(uint32_t level) {
+	if((int32_t) level==-1 || (int32_t) level==recursion_levels)
+		return dataSize;
+	return recursionBlockSize;
+}
+
+//The enclave has no way to recover from lost storage, so a broken connection ends the process, like a failed open does in LocalStorage
+void RemoteStorage::request(struct remote_request *request, unsigned char *payload, uint32_t payload_size, unsigned char *payload2, uint32_t payload2_size) {
+	if(!remoteSend(fd, request, payload, payload_size, payload2, payload2_size)) {
+		printf("RS : Lost connection to storage server %s (storage_id = %d)\n", storage_server.c_str(), storage_id);
+		exit(0);
+	}
+}
+
+void RemoteStorage::response(void *buffer, uint64_t size) {
+	if(!remoteRead(fd, buffer, size)) {
+		printf("RS : Lost connection to storage server %s (storage_id = %d)\n", storage_server.c_str(), storage_id);
+		exit(0);
+	}
+}
+
+void RemoteStorage::setParams(uint32_t maxBlocks, uint32_t set_D, uint32_t set_Z, uint32_t stashSize, uint32_t dataSize_p, uint8_t backend_p, uint32_t recursion_block_size, int8_t recursion_levels_p, uint64_t cache_budget) {
+	Z = set_Z;
+	dataSize = dataSize_p;
+	recursionBlockSize = recursion_block_size;
+	recursion_levels = recursion_levels_p;
+
+	char *address = getenv("ZT_STORAGE_SERVER");
+	if(address != NULL)
+		storage_server = address;
+	fd = remoteConnect(storage_server);
+	if(fd == -1) {
+		printf("RS : Unable to connect to storage server %s\n", storage_server.c_str());
+		exit(0);
+	}
+
+	//The backend the trees are kept in is the server's choice, the budget for its cache is passed on
+	struct remote_params params;
+	params.maxBlocks = maxBlocks;
+	params.D = set_D;
+	params.Z = set_Z;
+	params.stashSize = stashSize;
+	params.dataSize = dataSize_p;
+	params.recursion_block_size = recursion_block_size;
+	params.recursion_levels = recursion_levels_p;
+	params.cache_budget = cache_budget;
+
+	struct remote_request req;
+	memset(&req, 0, sizeof(req));
+	req.op = REMOTE_OP_SET_PARAMS;
+	req.size = sizeof(params);
+	request(&req, (unsigned char*) &params, sizeof(params), NULL, 0);
+
+	uint8_t ack;
+	response(&ack, 1);
+	printf("RS : Instance %d served by %s\n", storage_id, storage_server.c_str());
+}
+
+void RemoteStorage::fetchHash(uint32_t objectKey, unsigned char* hash, uint32_t hashsize, uint32_t recursion_level) {
+	struct remote_request req;
+	memset(&req, 0, sizeof(req));
+	req.op = REMOTE_OP_FETCH_HASH;
+	req.key = objectKey;
+	req.level = recursion_level;
+	req.hash_size = hashsize;
+	request(&req, NULL, 0, NULL, 0);
+	response(hash, hashsize);
+}
+
+uint8_t RemoteStorage::uploadObject(unsigned char *data, uint32_t objectKey, unsigned char *hash, uint32_t hashsize, uint32_t size_for_level, uint32_t recursion_level) {
+	struct remote_request req;
+	memset(&req, 0, sizeof(req));
+	req.op = REMOTE_OP_UPLOAD_OBJECT;
+	req.key = objectKey;
+	req.level = recursion_level;
+	req.d_level = size_for_level;
+	req.size = Z * size_for_level;
+	req.hash_size = hashsize;
+	request(&req, data, req.size, hash, hashsize);
+	return 1;
+}
+
+unsigned char* RemoteStorage::downloadObject(unsigned char* data, uint32_t objectKey, unsigned char *hash, uint32_t hashsize, uint32_t size_for_level, uint32_t recursion_level) {
+	struct remote_request req;
+	memset(&req, 0, sizeof(req));
+	req.op = REMOTE_OP_DOWNLOAD_OBJECT;
+	req.key = objectKey;
+	req.level = recursion_level;
+	req.d_level = size_for_level;
+	req.size = Z * size_for_level;
+	req.hash_size = hashsize;
+	request(&req, NULL, 0, NULL, 0);
+	response(data, req.size);
+	response(hash, hashsize);
+	return data;
+}
+
+uint8_t RemoteStorage::uploadPath(unsigned char *path, uint32_t leafLabel, unsigned char *path_hash, uint32_t level, uint32_t D_level) {
+	struct remote_request req;
+	memset(&req, 0, sizeof(req));
+	req.op = REMOTE_OP_UPLOAD_PATH;
+	req.key = leafLabel;
+	req.level = level;
+	req.d_level = D_level;
+	req.size = (D_level+1) * Z * sizeForLevel(level);
+	req.hash_size = (D_level+1) * HASH_LENGTH;
+	request(&req, path, req.size, path_hash, req.hash_size);
+	return 1;
+}
+
+unsigned char* RemoteStorage::downloadPath(unsigned char* path, uint32_t leafLabel, unsigned char *path_hash, uint32_t path_hash_size, uint32_t level, uint32_t D_lev) {
+	struct remote_request req;
+	memset(&req, 0, sizeof(req));
+	req.op = REMOTE_OP_DOWNLOAD_PATH;
+	req.key = leafLabel;
+	req.level = level;
+	req.d_level = D_lev;
+	req.size = (D_lev+1) * Z * sizeForLevel(level);
+	//<L,R> pairs of the non-root levels and the root hash, what LocalStorage::downloadPath() fills in
+	req.hash_size = (2*D_lev+1) * HASH_LENGTH;
+	request(&req, NULL, 0, NULL, 0);
+	response(path, req.size);
+	response(path_hash, req.hash_size);
+
+	#ifdef DEBUG_REMOTE
+		printf("RS : Path of leaf %d (level %d) received, %d bytes\n", leafLabel, level, req.size + req.hash_size);
+	#endif
+	return path;
+}
+
+void RemoteStorage::syncStorage() {
+	if(fd == -1)
+		return;
+	struct remote_request req;
+	memset(&req, 0, sizeof(req));
+	req.op = REMOTE_OP_SYNC;
+	request(&req, NULL, 0, NULL, 0);
+	uint8_t ack;
+	response(&ack, 1);
+}
+
+void RemoteStorage::closeStorage() {
+	if(fd == -1)
+		return;
+	struct remote_request req;
+	memset(&req, 0, sizeof(req));
+	req.op = REMOTE_OP_CLOSE;
+	request(&req, NULL, 0, NULL, 0);
+	uint8_t ack;
+	response(&ack, 1);
+	close(fd);
+	fd = -1;
+}
@@ -0,0 +1,103 @@
+/*
+*    ZeroTrace: Oblivious Memory Primitives from Intel SGX
+*    Copyright (C) 2018  Sajin (sshsshy)
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU General Public License as published by
+*    the Free Software Foundation, version 3 of the License.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU General Public License for more details.
+*
+*    You should have received a copy of the GNU General Public License
+*    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+RemoteStorage.hpp
+
+BACKEND_REMOTE : the trees of an instance are held by a storage server process (zt_storage_server, StorageServer.cpp),
+which serves them out of a LocalStorage of its own. Every RemoteStorage has its own connection to the server,
+given by storage_server ("unix:<socket path>" or "tcp:<host>:<port>", overridden by the ZT_STORAGE_SERVER environment variable).
+
+Protocol : every request is a remote_request header followed by its payload, requests of a connection are served in order.
+A path moves in a single request/response, never bucket by bucket, so a fetch costs one round trip whatever the depth.
+Uploads have no response at all : they are pipelined behind the requests that follow them (the write-back of
+a path overlaps the fetch of the next one), and ordering on the connection keeps read-after-write consistent.
+Only setParams, syncStorage and closeStorage wait for an acknowledgement.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include "Storage.hpp"
+
+#define REMOTE_OP_SET_PARAMS 1
+#define REMOTE_OP_FETCH_HASH 2
+#define REMOTE_OP_UPLOAD_OBJECT 3
+#define REMOTE_OP_DOWNLOAD_OBJECT 4
+#define REMOTE_OP_UPLOAD_PATH 5
+#define REMOTE_OP_DOWNLOAD_PATH 6
+#define REMOTE_OP_SYNC 7
+#define REMOTE_OP_CLOSE 8
+
+#define REMOTE_ACK 1
+
+//key is the bucket or leaf label, size the bytes of bucket/path data in the payload or the response,
+//and hash_size the bytes of hash(es) following them
+struct remote_request {
+	uint8_t op;
+	uint32_t key;
+	uint32_t level;
+	uint32_t d_level;
+	uint32_t size;
+	uint32_t hash_size;
+} __attribute__((packed));
+
+struct remote_params {
+	uint32_t maxBlocks;
+	uint32_t D;
+	uint32_t Z;
+	uint32_t stashSize;
+	uint32_t dataSize;
+	uint32_t recursion_block_size;
+	int8_t recursion_levels;
+	uint64_t cache_budget;
+} __attribute__((packed));
+
+extern std::string storage_server;
+
+int remoteConnect(std::string address);
+int remoteListen(std::string address);
+bool remoteSend(int fd, struct remote_request *request, unsigned char *payload, uint32_t payload_size, unsigned char *payload2, uint32_t payload2_size);
+bool remoteRead(int fd, void *buffer, uint64_t size);
+
+class RemoteStorage : public Storage
+{
+private:
+	uint32_t storage_id;
+	int fd;
+	uint32_t Z;
+	uint32_t dataSize;
+	uint32_t recursionBlockSize;
+	int32_t recursion_levels;
+
+	uint32_t sizeForLevel(uint32_t level);
+	void request(struct remote_request *request, unsigned char *payload, uint32_t payload_size, unsigned char *payload2, uint32_t payload2_size);
+	void response(void *buffer, uint64_t size);
+
+public:
+	RemoteStorage(uint32_t storage_id);
+
+	void setParams(uint32_t maxBlocks, uint32_t D, uint32_t Z, uint32_t stashSize, uint32_t dataSize, uint8_t backend, uint32_t recursion_block_size, int8_t recursion_levels, uint64_t cache_budget);
+	void fetchHash(uint32_t objectKey, unsigned char* hash_buffer, uint32_t hashsize, uint32_t recursion_level);
+	uint8_t uploadObject(unsigned char *serialized_bucket, uint32_t objectKey, unsigned char* hash, uint32_t hashsize, uint32_t size_for_level, uint32_t recursion_level);
+	unsigned char* downloadObject(unsigned char* data, uint32_t objectKey, unsigned char *hash, uint32_t hashsize, uint32_t size_for_level, uint32_t recursion_level);
+	uint8_t uploadPath(unsigned char *serialized_path, uint32_t leafLabel, unsigned char *path_hash, uint32_t level, uint32_t D_level);
+	unsigned char* downloadPath(unsigned char* data, uint32_t leafLabel, unsigned char *path_hash, uint32_t path_hash_size, uint32_t level, uint32_t D);
+	void syncStorage();
+	void closeStorage();
+};
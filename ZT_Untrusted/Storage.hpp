@@ -0,0 +1,60 @@
+/*
+*    ZeroTrace: Oblivious Memory Primitives from Intel SGX
+*    Copyright (C) 2018  Sajin (sshsshy)
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU General Public License as published by
+*    the Free Software Foundation, version 3 of the License.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU General Public License for more details.
+*
+*    You should have received a copy of the GNU General Public License
+*    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+Storage.hpp
+
+Interface between the OCALLs of App.cpp and the untrusted storage of one ORAM instance (all its recursion levels).
+Buckets are addressed by their label in the tree of a level, level -1 being the non-recursive tree.
+
+Implementations :
+LocalStorage  - BACKEND_MEMORY, BACKEND_HDD, BACKEND_MMAP, trees held by this process
+RemoteStorage - BACKEND_REMOTE, trees held by a storage server process (zt_storage_server) reached over a socket
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include "../DirectTree.hpp"
+
+class Storage
+{
+public:
+	virtual ~Storage() {}
+
+	virtual void setParams(uint32_t maxBlocks, uint32_t D, uint32_t Z, uint32_t stashSize, uint32_t dataSize, uint8_t backend, uint32_t recursion_block_size, int8_t recursion_levels, uint64_t cache_budget) = 0;
+	virtual void fetchHash(uint32_t objectKey, unsigned char* hash_buffer, uint32_t hashsize, uint32_t recursion_level) = 0;
+	virtual uint8_t uploadObject(unsigned char *serialized_bucket, uint32_t objectKey, unsigned char* hash, uint32_t hashsize, uint32_t size_for_level, uint32_t recursion_level) = 0;
+	virtual unsigned char* downloadObject(unsigned char* data, uint32_t objectKey, unsigned char *hash, uint32_t hashsize, uint32_t size_for_level, uint32_t recursion_level) = 0;
+	virtual uint8_t uploadPath(unsigned char *serialized_path, uint32_t leafLabel, unsigned char *path_hash, uint32_t level, uint32_t D_level) = 0;
+	virtual unsigned char* downloadPath(unsigned char* data, uint32_t leafLabel, unsigned char *path_hash, uint32_t path_hash_size, uint32_t level, uint32_t D) = 0;
+	//Checkpoint : everything uploaded so far is durable once this returns
+	virtual void syncStorage() = 0;
+	//Called once an access ECALL has returned, so that the storage can act on access boundaries (see LocalStorage::endAccess)
+	virtual void endAccess() {}
+	//Called once a checkpoint (epoch) sealing the state of the enclave after syncStorage() is durable
+	virtual void checkpointed(uint32_t epoch) {}
+	virtual void closeStorage() = 0;
+	//ZT_Audit : reads a row of count buckets of level at once, with their hashes and those of their children (child_hashes
+	//unless NULL), and may be called from several threads. Returns false if the storage can't, see App.cpp auditFetch
+	virtual bool auditRange(uint32_t level, uint32_t first_label, uint32_t count, unsigned char *buckets, unsigned char *hashes, unsigned char *child_hashes, uint32_t size_for_level) { return false; }
+	//DIRECT_TREES : describes the tree of level in *tree if the enclave can read and write it in place (see DirectTree.hpp)
+	virtual bool directTree(uint32_t level, struct direct_tree *tree) { return false; }
+};
+
+//Depth of every tree of an instance, as the enclave builds them (index 0 for the non-recursive tree, else 1..recursion_levels)
+void treeDepths(uint32_t maxBlocks, uint32_t Z, uint32_t recursion_block_size, int8_t recursion_levels, uint32_t *depth_l);
@@ -0,0 +1,243 @@
+/*
+*    ZeroTrace: Oblivious Memory Primitives from Intel SGX
+*    Copyright (C) 2018  Sajin (sshsshy)
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU General Public License as published by
+*    the Free Software Foundation, version 3 of the License.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU General Public License for more details.
+*
+*    You should have received a copy of the GNU General Public License
+*    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+StorageServer.cpp
+
+Storage server for BACKEND_REMOTE (see RemoteStorage.hpp). Needs no SGX : it only holds the encrypted trees.
+Usage :
+./zt_storage_server <"unix:<socket path>"/"tcp:<port>"> <"memory"/"hdd"/"mmap"> [<Storage_directory>]
+
+Every connection is one ORAM instance, served by a thread of its own out of a LocalStorage with the given backend.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <string>
+#include "LocalStorage.hpp"
+#include "RemoteStorage.hpp"
+#include "../Globals.hpp"
+
+#define HASH_LENGTH 32
+
+extern std::string storage_directory;
+
+uint8_t server_backend = BACKEND_MEMORY;
+uint32_t next_storage_id = 0;
+pthread_mutex_t storage_id_lock = PTHREAD_MUTEX_INITIALIZER;
+
+struct connection {
+	int fd;
+	uint32_t storage_id;
+};
+
+//Grows buffer to hold size bytes
+static unsigned char* reserve(unsigned char *buffer, uint64_t *capacity, uint64_t size) {
+	if(size <= *capacity)
+		return buffer;
+	free(buffer);
+	*capacity = size;
+	return (unsigned char*) calloc(size, 1);
+}
+
+/*
+validRequest() - Checks a request against the parameters the instance was set up with : the level must have a tree,
+the label must be a bucket (a leaf for paths) of that tree, and size/hash_size must be exactly those of a bucket or a path
+at that level. Anything else would index out of the trees or the buffers, so the connection is dropped instead.
+*/
+static bool validRequest(LocalStorage *ls, struct remote_params *params, struct remote_request *req) {
+	if(req->op < REMOTE_OP_FETCH_HASH || req->op > REMOTE_OP_DOWNLOAD_PATH)
+		return true;
+	int32_t depth = ls->levelDepth(req->level);
+	if(depth == -1)
+		return false;
+	uint32_t size_for_level = ((int32_t) req->level==-1 || (int32_t) req->level==params->recursion_levels) ? params->dataSize : params->recursion_block_size;
+	uint32_t no_of_buckets = ((uint32_t)2 << depth) - 1;
+	uint32_t first_leaf = (uint32_t)1 << depth;
+
+	if(req->op == REMOTE_OP_FETCH_HASH)
+		return req->key >= 1 && req->key <= no_of_buckets && req->size == 0 && req->hash_size == HASH_LENGTH;
+	if(req->op == REMOTE_OP_UPLOAD_OBJECT || req->op == REMOTE_OP_DOWNLOAD_OBJECT)
+		return req->key >= 1 && req->key <= no_of_buckets && req->d_level == size_for_level
+			&& req->size == (uint64_t) params->Z * size_for_level && req->hash_size == HASH_LENGTH;
+	if(req->op == REMOTE_OP_UPLOAD_PATH || req->op == REMOTE_OP_DOWNLOAD_PATH) {
+		uint32_t hash_size = ((req->op == REMOTE_OP_UPLOAD_PATH) ? (depth+1) : (2*depth+1)) * HASH_LENGTH;
+		return req->key >= first_leaf && req->key <= no_of_buckets && req->d_level == (uint32_t) depth
+			&& req->size == (uint64_t) (depth+1) * params->Z * size_for_level && req->hash_size == hash_size;
+	}
+	return false;
+}
+
+//recursion_levels is -1 (non-recursive) or the number of trees, and the trees have to be addressable by a 32 bit label
+static bool validParams(struct remote_params *params) {
+	return (params->recursion_levels == -1 || params->recursion_levels >= 1) && params->Z >= 1 && params->D < 31
+		&& params->dataSize >= 1 && (params->recursion_levels == -1 || params->recursion_block_size >= 1);
+}
+
+void *serveConnection(void *arg) {
+	struct connection *conn = (struct connection*) arg;
+	int fd = conn->fd;
+	LocalStorage *ls = new LocalStorage(conn->storage_id);
+	bool ready = false;
+
+	unsigned char *data = NULL, *hash = NULL;
+	uint64_t data_capacity = 0, hash_capacity = 0;
+	uint8_t ack = REMOTE_ACK;
+	struct remote_request req;
+	struct remote_params params;
+
+	while(remoteRead(fd, &req, sizeof(req))) {
+		if(req.op != REMOTE_OP_SET_PARAMS && !ready) {
+			printf("SS : Instance %d sent a request before its parameters\n", conn->storage_id);
+			break;
+		}
+		if(req.op == REMOTE_OP_SET_PARAMS && ready) {
+			printf("SS : Instance %d sent its parameters twice\n", conn->storage_id);
+			break;
+		}
+		if(req.op != REMOTE_OP_SET_PARAMS && !validRequest(ls, &params, &req)) {
+			printf("SS : Instance %d sent an invalid request %d (level = %d, key = %d, size = %d, hash_size = %d)\n", conn->storage_id, req.op, req.level, req.key, req.size, req.hash_size);
+			break;
+		}
+
+		bool ok = true;
+		if(req.op == REMOTE_OP_SET_PARAMS) {
+			ok = (req.size == sizeof(params)) && remoteRead(fd, &params, sizeof(params)) && validParams(&params);
+			if(ok) {
+				ls->setParams(params.maxBlocks, params.D, params.Z, params.stashSize, params.dataSize, server_backend, params.recursion_block_size, params.recursion_levels, params.cache_budget);
+				ready = true;
+				printf("SS : Instance %d : maxBlocks = %d, Z = %d, recursion_levels = %d\n", conn->storage_id, params.maxBlocks, params.Z, params.recursion_levels);
+				ok = remoteSend(fd, NULL, &ack, 1, NULL, 0);
+			}
+		}
+		else if(req.op == REMOTE_OP_FETCH_HASH) {
+			hash = reserve(hash, &hash_capacity, req.hash_size);
+			ls->fetchHash(req.key, hash, req.hash_size, req.level);
+			ok = remoteSend(fd, NULL, hash, req.hash_size, NULL, 0);
+		}
+		else if(req.op == REMOTE_OP_UPLOAD_OBJECT) {
+			data = reserve(data, &data_capacity, req.size);
+			hash = reserve(hash, &hash_capacity, req.hash_size);
+			ok = remoteRead(fd, data, req.size) && remoteRead(fd, hash, req.hash_size);
+			if(ok)
+				ls->uploadObject(data, req.key, hash, req.hash_size, req.d_level, req.level);
+		}
+		else if(req.op == REMOTE_OP_DOWNLOAD_OBJECT) {
+			data = reserve(data, &data_capacity, req.size);
+			hash = reserve(hash, &hash_capacity, req.hash_size);
+			ls->downloadObject(data, req.key, hash, req.hash_size, req.d_level, req.level);
+			ok = remoteSend(fd, NULL, data, req.size, hash, req.hash_size);
+		}
+		else if(req.op == REMOTE_OP_UPLOAD_PATH) {
+			data = reserve(data, &data_capacity, req.size);
+			hash = reserve(hash, &hash_capacity, req.hash_size);
+			ok = remoteRead(fd, data, req.size) && remoteRead(fd, hash, req.hash_size);
+			if(ok)
+				ls->uploadPath(data, req.key, hash, req.level, req.d_level);
+		}
+		else if(req.op == REMOTE_OP_DOWNLOAD_PATH) {
+			data = reserve(data, &data_capacity, req.size);
+			hash = reserve(hash, &hash_capacity, req.hash_size);
+			ls->downloadPath(data, req.key, hash, req.hash_size, req.level, req.d_level);
+			ok = remoteSend(fd, NULL, data, req.size, hash, req.hash_size);
+		}
+		else if(req.op == REMOTE_OP_SYNC) {
+			ls->syncStorage();
+			ok = remoteSend(fd, NULL, &ack, 1, NULL, 0);
+		}
+		else if(req.op == REMOTE_OP_CLOSE) {
+			ls->closeStorage();
+			ready = false;
+			remoteSend(fd, NULL, &ack, 1, NULL, 0);
+			break;
+		}
+		else {
+			printf("SS : Instance %d sent unknown request %d\n", conn->storage_id, req.op);
+			ok = false;
+		}
+		if(!ok)
+			break;
+	}
+
+	//A client that went away without closing still gets its storage synced
+	if(ready)
+		ls->closeStorage();
+	delete ls;
+	free(data);
+	free(hash);
+	close(fd);
+	printf("SS : Instance %d closed\n", conn->storage_id);
+	free(conn);
+	return NULL;
+}
+
+int main(int argc, char *argv[]) {
+	if(argc < 3) {
+		printf("Usage : %s <\"unix:<socket path>\"/\"tcp:<port>\"> <\"memory\"/\"hdd\"/\"mmap\"> [<Storage_directory>]\n", argv[0]);
+		return 1;
+	}
+	std::string address = argv[1];
+	std::string backend = argv[2];
+	if(backend == "memory")
+		server_backend = BACKEND_MEMORY;
+	else if(backend == "hdd")
+		server_backend = BACKEND_HDD;
+	else if(backend == "mmap")
+		server_backend = BACKEND_MMAP;
+	else {
+		printf("SS : Unknown backend %s\n", backend.c_str());
+		return 1;
+	}
+	if(argc > 3) {
+		storage_directory = argv[3];
+		if(storage_directory[storage_directory.size()-1] != '/')
+			storage_directory.append("/");
+	}
+
+	int listen_fd = remoteListen(address);
+	if(listen_fd == -1) {
+		printf("SS : Unable to listen on %s\n", address.c_str());
+		return 1;
+	}
+	printf("SS : Serving %s trees on %s\n", backend.c_str(), address.c_str());
+
+	while(1) {
+		int fd = accept(listen_fd, NULL, NULL);
+		if(fd == -1)
+			continue;
+
+		struct connection *conn = (struct connection*) malloc(sizeof(struct connection));
+		conn->fd = fd;
+		pthread_mutex_lock(&storage_id_lock);
+		conn->storage_id = next_storage_id++;
+		pthread_mutex_unlock(&storage_id_lock);
+
+		pthread_t thread;
+		if(pthread_create(&thread, NULL, serveConnection, conn) != 0) {
+			printf("SS : Unable to create a thread for instance %d\n", conn->storage_id);
+			close(fd);
+			free(conn);
+			continue;
+		}
+		pthread_detach(thread);
+	}
+	return 0;
+}
@@ -0,0 +1,126 @@
+/*
+*    ZeroTrace: Oblivious Memory Primitives from Intel SGX
+*    Copyright (C) 2018  Sajin (sshsshy)
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU General Public License as published by
+*    the Free Software Foundation, version 3 of the License.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU General Public License for more details.
+*
+*    You should have received a copy of the GNU General Public License
+*    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+TieredStorage.cpp
+*/
+
+#include "TieredStorage.hpp"
+#include "../Globals.hpp"
+#include <stdio.h>
+#include <stdlib.h>
+
+#define HASH_LENGTH 32
+
+TieredStorage::TieredStorage(uint32_t p_storage_id) {
+	storage_id = p_storage_id;
+	recursion_levels = -1;
+	ram_levels = 0;
+	ram_tier = NULL;
+	file_tier = NULL;
+}
+
+LocalStorage* TieredStorage::tierOf(uint32_t level) {
+	if(level != (uint32_t) -1 && level <= ram_levels)
+		return ram_tier;
+	return file_tier;
+}
+
+/*
+setParams() - Places the levels : going up from level 1, each level joins the RAM tier as long as the levels so far
+(buckets and hashes) fit in cache_budget. The data level always stays on backend, which is what it was picked for.
+*/
+void TieredStorage::setParams(uint32_t maxBlocks, uint32_t D, uint32_t Z, uint32_t stashSize, uint32_t dataSize, uint8_t backend, uint32_t recursion_block_size, int8_t recursion_levels_p, uint64_t cache_budget) {
+	recursion_levels = recursion_levels_p;
+	ram_levels = 0;
+	uint64_t ram_size = 0;
+
+	if(recursion_levels > 1 && (backend == BACKEND_HDD || backend == BACKEND_MMAP)) {
+		uint32_t *depth_l = (uint32_t*) malloc((recursion_levels+1) * sizeof(uint32_t));
+		treeDepths(maxBlocks, Z, recursion_block_size, recursion_levels, depth_l);
+		for(int32_t i = 1;i < recursion_levels;i++) {
+			uint64_t level_size = (((uint64_t)2 << depth_l[i]) - 1) * (uint64_t)(Z*recursion_block_size + HASH_LENGTH);
+			if(ram_size + level_size > cache_budget)
+				break;
+			ram_size+= level_size;
+			ram_levels = i;
+		}
+		free(depth_l);
+	}
+
+	if(ram_levels > 0) {
+		ram_tier = new LocalStorage(storage_id);
+		ram_tier->serveLevels(1, ram_levels);
+		ram_tier->setParams(maxBlocks, D, Z, stashSize, dataSize, BACKEND_MEMORY, recursion_block_size, recursion_levels, 0);
+		printf("LS : Instance %d keeps levels 1-%d in RAM (%f MB), levels %d-%d on the %s backend\n", storage_id, ram_levels,
+			float(ram_size)/float(1024*1024), ram_levels+1, recursion_levels, (backend == BACKEND_HDD) ? "hdd" : "mmap");
+	}
+	file_tier = new LocalStorage(storage_id);
+	if(ram_levels > 0)
+		file_tier->serveLevels(ram_levels+1, recursion_levels);
+	file_tier->setParams(maxBlocks, D, Z, stashSize, dataSize, backend, recursion_block_size, recursion_levels, cache_budget - ram_size);
+}
+
+void TieredStorage::fetchHash(uint32_t objectKey, unsigned char* hash_buffer, uint32_t hashsize, uint32_t recursion_level) {
+	tierOf(recursion_level)->fetchHash(objectKey, hash_buffer, hashsize, recursion_level);
+}
+
+uint8_t TieredStorage::uploadObject(unsigned char *serialized_bucket, uint32_t objectKey, unsigned char* hash, uint32_t hashsize, uint32_t size_for_level, uint32_t recursion_level) {
+	return tierOf(recursion_level)->uploadObject(serialized_bucket, objectKey, hash, hashsize, size_for_level, recursion_level);
+}
+
+unsigned char* TieredStorage::downloadObject(unsigned char* data, uint32_t objectKey, unsigned char *hash, uint32_t hashsize, uint32_t size_for_level, uint32_t recursion_level) {
+	return tierOf(recursion_level)->downloadObject(data, objectKey, hash, hashsize, size_for_level, recursion_level);
+}
+
+uint8_t TieredStorage::uploadPath(unsigned char *serialized_path, uint32_t leafLabel, unsigned char *path_hash, uint32_t level, uint32_t D_level) {
+	return tierOf(level)->uploadPath(serialized_path, leafLabel, path_hash, level, D_level);
+}
+
+unsigned char* TieredStorage::downloadPath(unsigned char* data, uint32_t leafLabel, unsigned char *path_hash, uint32_t path_hash_size, uint32_t level, uint32_t D) {
+	return tierOf(level)->downloadPath(data, leafLabel, path_hash, path_hash_size, level, D);
+}
+
+bool TieredStorage::auditRange(uint32_t level, uint32_t first_label, uint32_t count, unsigned char *buckets, unsigned char *hashes, unsigned char *child_hashes, uint32_t size_for_level) {
+	return tierOf(level)->auditRange(level, first_label, count, buckets, hashes, child_hashes, size_for_level);
+}
+
+bool TieredStorage::directTree(uint32_t level, struct direct_tree *tree) {
+	return tierOf(level)->directTree(level, tree);
+}
+
+void TieredStorage::syncStorage() {
+	if(ram_tier != NULL)
+		ram_tier->syncStorage();
+	file_tier->syncStorage();
+}
+
+//Only the file tier has a write-ahead log, and it may not see any path of an access (PLACEMENT_AUTO)
+void TieredStorage::endAccess() {
+	file_tier->endAccess();
+}
+
+void TieredStorage::closeStorage() {
+	if(ram_tier != NULL) {
+		ram_tier->closeStorage();
+		delete ram_tier;
+		ram_tier = NULL;
+	}
+	file_tier->closeStorage();
+	delete file_tier;
+	file_tier = NULL;
+}
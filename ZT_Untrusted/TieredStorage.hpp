@@ -0,0 +1,62 @@
+/*
+*    ZeroTrace: Oblivious Memory Primitives from Intel SGX
+*    Copyright (C) 2018  Sajin (sshsshy)
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU General Public License as published by
+*    the Free Software Foundation, version 3 of the License.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU General Public License for more details.
+*
+*    You should have received a copy of the GNU General Public License
+*    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+TieredStorage.hpp
+
+PLACEMENT_AUTO : the recursion levels of an hdd/mmap instance are split across two LocalStorages.
+Every access walks one path of every level, and the posmap trees of levels 1..L-1 are small next to the data tree,
+so the smallest levels (1..ram_levels) that fit in the memory budget are kept in RAM (BACKEND_MEMORY),
+and the remaining ones, at least the data level, on the backend the instance was created with.
+What the RAM levels leave of the budget goes to the cache of the file-backed levels (see LocalStorage::setupCache).
+
+The RAM levels don't outlive the process, so such instances can't be checkpointed or snapshotted.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include "Storage.hpp"
+#include "LocalStorage.hpp"
+
+class TieredStorage : public Storage
+{
+private:
+	uint32_t storage_id;
+	int32_t recursion_levels;
+	//Levels 1..ram_levels are held by ram_tier (NULL if none fit), the others by file_tier
+	uint32_t ram_levels;
+	LocalStorage *ram_tier;
+	LocalStorage *file_tier;
+
+	LocalStorage* tierOf(uint32_t level);
+
+public:
+	TieredStorage(uint32_t storage_id);
+
+	void setParams(uint32_t maxBlocks, uint32_t D, uint32_t Z, uint32_t stashSize, uint32_t dataSize, uint8_t backend, uint32_t recursion_block_size, int8_t recursion_levels, uint64_t cache_budget);
+	void fetchHash(uint32_t objectKey, unsigned char* hash_buffer, uint32_t hashsize, uint32_t recursion_level);
+	uint8_t uploadObject(unsigned char *serialized_bucket, uint32_t objectKey, unsigned char* hash, uint32_t hashsize, uint32_t size_for_level, uint32_t recursion_level);
+	unsigned char* downloadObject(unsigned char* data, uint32_t objectKey, unsigned char *hash, uint32_t hashsize, uint32_t size_for_level, uint32_t recursion_level);
+	uint8_t uploadPath(unsigned char *serialized_path, uint32_t leafLabel, unsigned char *path_hash, uint32_t level, uint32_t D_level);
+	unsigned char* downloadPath(unsigned char* data, uint32_t leafLabel, unsigned char *path_hash, uint32_t path_hash_size, uint32_t level, uint32_t D);
+	void syncStorage();
+	void endAccess();
+	bool auditRange(uint32_t level, uint32_t first_label, uint32_t count, unsigned char *buckets, unsigned char *hashes, unsigned char *child_hashes, uint32_t size_for_level);
+	void closeStorage();
+	bool directTree(uint32_t level, struct direct_tree *tree);
+};
@@ -28,9 +28,15 @@ stash_size=10
 #block_size
 block_size=1024
 #new/resume
-#New/Resume flag, Previously ZT had a State Store/Resume mechanism which is currently broken. So hence always use new till this is fixed
+#New/Resume flag, resume takes up the hdd/mmap instance the previous run checkpointed to ZT_<N>_<block_size>.ckpt (its enclave state is sealed with sgx_seal_data), instead of building a new one
 new="new"
-#memory/hdd, ZT supports any underlying backend storage mechanism. Currently support for HDD is broken. But it's trivially fixable by tailoring parameters in LocalStorage.cpp if you wish to do that.
+#memory/hdd/mmap/remote/object, the storage backend that holds the ORAM trees outside the enclave. memory keeps them in untrusted RAM, hdd in files that are read and written on every access.
+#mmap keeps the ORAM trees in files that are mapped in once at ZT_New, and are only synced to disk at checkpoints and ZT_Close.
+#The hdd and mmap tree files are created under storage_directory (/mnt/Storage/ by default, set in LocalStorage.cpp), one directory per ORAM instance, which must exist.
+#remote keeps the trees in a separate storage server process, start it first with : ./zt_storage_server unix:/tmp/zt_storage.sock memory
+#(or tcp:<port>, and memory/hdd/mmap for how the server stores them). Point ZT at it with ZT_STORAGE_SERVER=unix:<path> or tcp:<host>:<port>.
+#hdd can stripe the trees over several devices, level by level, with ZT_STRIPE_DIRECTORIES=<dir1>:<dir2>:... (one directory per device).
+#object keeps the trees in an object store, one object per 4-level subtree, set with ZT_OBJECT_STORE=dir:<directory> (a directory stand-in for S3-style stores).
 backend=memory
 #oblivious_flag, ZeroTrace is a Doubly-oblivious ORAM i.e. the ORAM controller logic is itself oblivious to provide side-channel security against an adversary that observer the memory trace of this controller. Setting this to 0 improves performance, at the cost of introducing side-channel vulnerabilities.
 oblivious_flag=1
@@ -42,8 +48,12 @@ oram_type="circuit"
 Z=4
 #ZT supports a bulk_read_interface (designed for an application we are working on). Setting bulk_request_size to 0, will perform each request in the no_of_req individually, setting any larger value will cause the untrusted components of ZT to chunk the requests into bulk chunks of that size, the enclave will then perform all the requests in the chunk before it returns the response back to the untrusted part of the program.
 bulk_request_size=0
+#cache_budget_mb is the RAM (in MB) used to keep the top levels of the hdd/mmap trees resident, the levels that every access touches. Writes to them are only flushed to the files at checkpoints and ZT_Close. Ignored by the memory backend.
+cache_budget_mb=0
+#placement uniform/auto, auto keeps the smallest posmap levels of recursive hdd/mmap instances in RAM, as many as fit in cache_budget_mb (the rest of it goes to caching the file-backed levels), the data level stays in the files. Such instances are not checkpointed.
+placement="uniform"
 
-exec_command="Sample_App/sampleapp "$N" "$no_of_req" "$stash_size" "$block_size" "$new" "$backend" "$oblivious_flag" "$recursion_data_size" "$oram_type" "$Z" "$bulk_request_size
+exec_command="Sample_App/sampleapp "$N" "$no_of_req" "$stash_size" "$block_size" "$new" "$backend" "$oblivious_flag" "$recursion_data_size" "$oram_type" "$Z" "$bulk_request_size" "$cache_budget_mb" "$placement
 echo $exec_command
 $exec_command
 #Sample_App/sampleapp 10000 10 100 4096 new memory 1 64 path 4 0